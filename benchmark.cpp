@@ -0,0 +1,2093 @@
+/*
+    Yojimbo Benchmarks.
+
+    Copyright © 2016 - 2017, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shared.h"
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif // #if defined(__linux__)
+
+// Connection level benchmarks. Packets are passed directly between two connections, so these measure
+// the cost of the message and channel layer without any sockets, encryption or packet fragmentation.
+
+const int BenchmarkPacketSize = 1200;
+
+struct BenchmarkStats
+{
+    int numPackets;
+    uint64_t packetBytes;
+    double generateTime;
+    double processTime;
+    double ackTime;
+
+    BenchmarkStats()
+    {
+        numPackets = 0;
+        packetBytes = 0;
+        generateTime = 0.0;
+        processTime = 0.0;
+        ackTime = 0.0;
+    }
+};
+
+static void PumpConnections( const ConnectionConfig & connectionConfig,
+                             double & time,
+                             Connection & sender,
+                             Connection & receiver,
+                             uint16_t & packetSequence,
+                             int packetLossPercent,
+                             BenchmarkStats & stats )
+{
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    int packetBytes = 0;
+
+    const double generateStartTime = yojimbo_time();
+
+    const bool generated = sender.GeneratePacket( NULL, packetSequence, packetData, connectionConfig.maxPacketSize, packetBytes );
+
+    const double processStartTime = yojimbo_time();
+
+    stats.generateTime += processStartTime - generateStartTime;
+
+    if ( generated )
+    {
+        stats.numPackets++;
+        stats.packetBytes += packetBytes;
+
+        if ( random_int( 0, 99 ) >= packetLossPercent )
+        {
+            receiver.ProcessPacket( NULL, packetSequence, packetData, packetBytes );
+
+            const double ackStartTime = yojimbo_time();
+
+            sender.ProcessAcks( &packetSequence, 1 );
+
+            stats.ackTime += yojimbo_time() - ackStartTime;
+        }
+    }
+
+    stats.processTime += yojimbo_time() - processStartTime;
+
+    time += 0.01;
+
+    sender.AdvanceTime( time );
+    receiver.AdvanceTime( time );
+
+    packetSequence++;
+}
+
+static int DrainMessages( Connection & connection, int channelIndex )
+{
+    int numMessages = 0;
+    while ( true )
+    {
+        Message * message = connection.ReceiveMessage( channelIndex );
+        if ( !message )
+            break;
+        connection.ReleaseMessage( message );
+        numMessages++;
+    }
+    return numMessages;
+}
+
+static void FillSendQueue( MessageFactory & messageFactory, Connection & connection, int channelIndex, uint16_t & sequence )
+{
+    while ( connection.CanSendMessage( channelIndex ) )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        if ( !message )
+            break;
+        message->sequence = sequence++;
+        connection.SendMessage( channelIndex, message );
+    }
+}
+
+static void PrintStats( const char * name, const ConnectionConfig & connectionConfig, const BenchmarkStats & stats )
+{
+    printf( "    %-24s %8.2f us generate %8.2f us process %6.1f%% packet fill\n",
+        name,
+        stats.generateTime / stats.numPackets * 1000000.0,
+        stats.processTime / stats.numPackets * 1000000.0,
+        100.0 * double( stats.packetBytes ) / ( double( stats.numPackets ) * connectionConfig.maxPacketSize ) );
+}
+
+static void benchmark_channel_scheduling()
+{
+    printf( "\nchannel scheduling (4 saturated reliable-ordered channels)\n\n" );
+
+    const int NumChannels = 4;
+    const int NumPackets = 10000;
+
+    struct Setup
+    {
+        const char * name;
+        int priority[NumChannels];
+        int weight[NumChannels];
+    };
+
+    const Setup setups[] =
+    {
+        { "equal weights", { 0, 0, 0, 0 }, { 1, 1, 1, 1 } },
+        { "weights 4:2:1:1", { 0, 0, 0, 0 }, { 4, 2, 1, 1 } },
+        { "channel 0 priority", { 1, 0, 0, 0 }, { 1, 1, 1, 1 } },
+    };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( setups ) / sizeof( setups[0] ) ); ++setupIndex )
+    {
+        const Setup & setup = setups[setupIndex];
+
+        TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+        ConnectionConfig connectionConfig;
+        connectionConfig.maxPacketSize = BenchmarkPacketSize;
+        connectionConfig.numChannels = NumChannels;
+        for ( int i = 0; i < NumChannels; ++i )
+        {
+            connectionConfig.channel[i].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+            connectionConfig.channel[i].priority = setup.priority[i];
+            connectionConfig.channel[i].weight = setup.weight[i];
+        }
+
+        double time = 0.0;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        uint16_t messageSequence[NumChannels];
+        int numMessagesReceived[NumChannels];
+        memset( messageSequence, 0, sizeof( messageSequence ) );
+        memset( numMessagesReceived, 0, sizeof( numMessagesReceived ) );
+
+        BenchmarkStats stats;
+        uint16_t packetSequence = 0;
+
+        for ( int i = 0; i < NumPackets; ++i )
+        {
+            for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+                FillSendQueue( messageFactory, sender, channelIndex, messageSequence[channelIndex] );
+
+            PumpConnections( connectionConfig, time, sender, receiver, packetSequence, 0, stats );
+
+            for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+                numMessagesReceived[channelIndex] += DrainMessages( receiver, channelIndex );
+        }
+
+        PrintStats( setup.name, connectionConfig, stats );
+
+        int totalMessagesReceived = 0;
+        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+            totalMessagesReceived += numMessagesReceived[channelIndex];
+
+        printf( "    %-24s", "" );
+        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+            printf( " channel %d: %5.1f%%", channelIndex, 100.0 * numMessagesReceived[channelIndex] / double( totalMessagesReceived ) );
+        printf( "\n" );
+    }
+}
+
+static void benchmark_message_expiry()
+{
+    printf( "\nmessage expiry (reliable-ordered channel, congested, 10%% packet loss)\n\n" );
+
+    const int NumPackets = 10000;
+    const int MessagesPerPacket = 32;
+
+    const double timeToLive[] = { 0.0, 0.25 };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( timeToLive ) / sizeof( timeToLive[0] ) ); ++setupIndex )
+    {
+        TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+        // packets are too small to carry every message sent, so the send queue backs up
+
+        ConnectionConfig connectionConfig;
+        connectionConfig.maxPacketSize = 256;
+        connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+        connectionConfig.channel[0].messageSendQueueSize = 4096;
+        connectionConfig.channel[0].messageReceiveQueueSize = 4096;
+
+        double time = 0.0;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        BenchmarkStats stats;
+        uint16_t packetSequence = 0;
+
+        uint64_t numMessagesSent = 0;
+        uint64_t numMessagesReceived = 0;
+        double totalLatency = 0.0;
+
+        for ( int i = 0; i < NumPackets; ++i )
+        {
+            for ( int j = 0; j < MessagesPerPacket && sender.CanSendMessage( 0 ); ++j )
+            {
+                TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+                if ( !message )
+                    break;
+                message->sequence = uint16_t( i );
+                sender.SendMessage( 0, message, timeToLive[setupIndex], 0 );
+                numMessagesSent++;
+            }
+
+            PumpConnections( connectionConfig, time, sender, receiver, packetSequence, 10, stats );
+
+            while ( true )
+            {
+                TestMessage * message = (TestMessage*) receiver.ReceiveMessage( 0 );
+                if ( !message )
+                    break;
+                totalLatency += uint16_t( i - message->sequence ) * 0.01;
+                numMessagesReceived++;
+                receiver.ReleaseMessage( message );
+            }
+        }
+
+        char name[64];
+        snprintf( name, sizeof( name ), timeToLive[setupIndex] > 0.0 ? "time to live %.2fs" : "no time to live", timeToLive[setupIndex] );
+
+        PrintStats( name, connectionConfig, stats );
+
+        printf( "    %-24s %8.1f ms average latency %6.1f%% delivered\n",
+            "",
+            numMessagesReceived ? totalLatency / numMessagesReceived * 1000.0 : 0.0,
+            100.0 * double( numMessagesReceived ) / double( numMessagesSent ) );
+    }
+}
+
+static void benchmark_batch_messages()
+{
+    printf( "\nbatch send and receive (per-message cost)\n\n" );
+
+    const int NumRounds = 200;
+    const int MessagesPerRound = 1024;
+
+    const ChannelType channelTypes[] = { CHANNEL_TYPE_RELIABLE_ORDERED, CHANNEL_TYPE_UNRELIABLE_UNORDERED };
+    const char * channelNames[] = { "reliable-ordered", "unreliable-unordered" };
+    const int batchSizes[] = { 1, 16, 256 };
+
+    for ( int channelTypeIndex = 0; channelTypeIndex < int( sizeof( channelTypes ) / sizeof( channelTypes[0] ) ); ++channelTypeIndex )
+    {
+        for ( int batchSizeIndex = 0; batchSizeIndex < int( sizeof( batchSizes ) / sizeof( batchSizes[0] ) ); ++batchSizeIndex )
+        {
+            const int batchSize = batchSizes[batchSizeIndex];
+
+            TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+            ConnectionConfig connectionConfig;
+            connectionConfig.channel[0].type = channelTypes[channelTypeIndex];
+            connectionConfig.channel[0].messageSendQueueSize = MessagesPerRound;
+            connectionConfig.channel[0].messageReceiveQueueSize = MessagesPerRound;
+            connectionConfig.channel[0].maxMessagesPerPacket = MessagesPerRound;
+
+            double time = 0.0;
+
+            Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+            Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+            Message ** messages = (Message**) alloca( sizeof( Message* ) * MessagesPerRound );
+
+            BenchmarkStats stats;
+            uint16_t packetSequence = 0;
+            uint64_t numMessages = 0;
+            double sendTime = 0.0;
+            double receiveTime = 0.0;
+
+            for ( int round = 0; round < NumRounds; ++round )
+            {
+                for ( int i = 0; i < MessagesPerRound; ++i )
+                {
+                    messages[i] = messageFactory.CreateMessage( TEST_MESSAGE );
+                    yojimbo_assert( messages[i] );
+                }
+
+                const double sendStartTime = yojimbo_time();
+
+                if ( batchSize == 1 )
+                {
+                    for ( int i = 0; i < MessagesPerRound; ++i )
+                        sender.SendMessage( 0, messages[i] );
+                }
+                else
+                {
+                    for ( int i = 0; i < MessagesPerRound; i += batchSize )
+                        sender.SendMessages( 0, messages + i, yojimbo_min( batchSize, MessagesPerRound - i ) );
+                }
+
+                sendTime += yojimbo_time() - sendStartTime;
+
+                int numMessagesReceived = 0;
+
+                while ( numMessagesReceived < MessagesPerRound )
+                {
+                    PumpConnections( connectionConfig, time, sender, receiver, packetSequence, 0, stats );
+
+                    const double receiveStartTime = yojimbo_time();
+
+                    int numReceived = 0;
+
+                    if ( batchSize == 1 )
+                    {
+                        while ( true )
+                        {
+                            Message * message = receiver.ReceiveMessage( 0 );
+                            if ( !message )
+                                break;
+                            messages[numReceived++] = message;
+                        }
+                    }
+                    else
+                    {
+                        while ( true )
+                        {
+                            const int count = receiver.ReceiveMessages( 0, messages + numReceived, batchSize );
+                            numReceived += count;
+                            if ( count < batchSize )
+                                break;
+                        }
+                    }
+
+                    receiveTime += yojimbo_time() - receiveStartTime;
+
+                    for ( int i = 0; i < numReceived; ++i )
+                        receiver.ReleaseMessage( messages[i] );
+
+                    numMessagesReceived += numReceived;
+                }
+
+                numMessages += numMessagesReceived;
+            }
+
+            char name[64];
+            snprintf( name, sizeof( name ), "%s, batch %d", channelNames[channelTypeIndex], batchSize );
+
+            printf( "    %-32s %8.1f ns send %8.1f ns receive\n",
+                name,
+                sendTime / numMessages * 1000000000.0,
+                receiveTime / numMessages * 1000000000.0 );
+        }
+    }
+}
+
+static void benchmark_process_acks()
+{
+    printf( "\nprocess acks (%d channels, one unreliable and the rest reliable)\n\n", MaxChannels );
+
+    // measures the per-ack cost when only a few of the configured channels are sending. acks only need to reach the
+    // reliable channels that included data in the acked packet, so idle channels should cost nothing.
+
+    const int NumPackets = 10000;
+    const int MessagesPerPacket = 8;
+    const int numReliableChannels[] = { 0, 1, 8 };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( numReliableChannels ) / sizeof( numReliableChannels[0] ) ); ++setupIndex )
+    {
+        TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+        ConnectionConfig connectionConfig;
+        connectionConfig.maxPacketSize = BenchmarkPacketSize;
+        connectionConfig.numChannels = MaxChannels;
+        for ( int i = 0; i < MaxChannels; ++i )
+        {
+            connectionConfig.channel[i].type = ( i == 0 ) ? CHANNEL_TYPE_UNRELIABLE_UNORDERED : CHANNEL_TYPE_RELIABLE_ORDERED;
+            connectionConfig.channel[i].disableBlocks = true;
+            connectionConfig.channel[i].sentPacketBufferSize = 256;
+            connectionConfig.channel[i].messageSendQueueSize = 256;
+            connectionConfig.channel[i].messageReceiveQueueSize = 256;
+            connectionConfig.channel[i].maxMessagesPerPacket = MessagesPerPacket;
+        }
+
+        double time = 0.0;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        BenchmarkStats stats;
+        uint16_t packetSequence = 0;
+
+        for ( int i = 0; i < NumPackets; ++i )
+        {
+            for ( int channelIndex = 0; channelIndex <= numReliableChannels[setupIndex]; ++channelIndex )
+            {
+                for ( int j = 0; j < MessagesPerPacket && sender.CanSendMessage( channelIndex ); ++j )
+                {
+                    Message * message = messageFactory.CreateMessage( TEST_MESSAGE );
+                    if ( !message )
+                        break;
+                    sender.SendMessage( channelIndex, message );
+                }
+            }
+
+            PumpConnections( connectionConfig, time, sender, receiver, packetSequence, 0, stats );
+
+            for ( int channelIndex = 0; channelIndex <= numReliableChannels[setupIndex]; ++channelIndex )
+                DrainMessages( receiver, channelIndex );
+        }
+
+        char name[64];
+        snprintf( name, sizeof( name ), "%d reliable sending", numReliableChannels[setupIndex] );
+
+        printf( "    %-24s %8.1f ns per ack\n", name, stats.ackTime / stats.numPackets * 1000000000.0 );
+    }
+}
+
+static void benchmark_ack_bursts()
+{
+    printf( "\nack bursts (reliable-ordered channel, 1024 deep send queue)\n\n" );
+
+    // fill the send queue, send it all in one burst of packets and lose the first packet. acks for the rest of the burst
+    // leave a hole at the front of the send queue, then the ack for the resent first packet clears the whole queue at once.
+
+    const int NumRounds = 1000;
+    const int QueueSize = 1024;
+    const int MessagesPerPacket = 64;
+    const int PacketsPerRound = QueueSize / MessagesPerPacket;
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[0].messageSendQueueSize = QueueSize;
+    connectionConfig.channel[0].messageReceiveQueueSize = QueueSize;
+    connectionConfig.channel[0].maxMessagesPerPacket = MessagesPerPacket;
+
+    double time = 0.0;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    uint16_t messageSequence = 0;
+    uint16_t packetSequence = 0;
+    uint64_t numMessagesAcked = 0;
+    double ackTime = 0.0;
+    double finalAckTime = 0.0;
+
+    for ( int round = 0; round < NumRounds; ++round )
+    {
+        FillSendQueue( messageFactory, sender, 0, messageSequence );
+
+        const uint16_t firstPacketSequence = packetSequence;
+
+        for ( int i = 0; i < PacketsPerRound; ++i )
+        {
+            int packetBytes = 0;
+            sender.GeneratePacket( NULL, packetSequence, packetData, connectionConfig.maxPacketSize, packetBytes );
+            if ( i > 0 )
+                receiver.ProcessPacket( NULL, packetSequence, packetData, packetBytes );
+            packetSequence++;
+        }
+
+        const double startTime = yojimbo_time();
+
+        for ( uint16_t sequence = firstPacketSequence + 1; sequence != packetSequence; ++sequence )
+            sender.ProcessAcks( &sequence, 1 );
+
+        ackTime += yojimbo_time() - startTime;
+
+        // resend the first packet once its messages are due
+
+        time += 1.0;
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
+
+        int packetBytes = 0;
+        sender.GeneratePacket( NULL, packetSequence, packetData, connectionConfig.maxPacketSize, packetBytes );
+        receiver.ProcessPacket( NULL, packetSequence, packetData, packetBytes );
+
+        const double finalAckStartTime = yojimbo_time();
+
+        sender.ProcessAcks( &packetSequence, 1 );
+
+        finalAckTime += yojimbo_time() - finalAckStartTime;
+
+        packetSequence++;
+
+        DrainMessages( receiver, 0 );
+
+        numMessagesAcked += QueueSize;
+    }
+
+    printf( "    %-24s %8.1f ns per message acked\n", "burst acks", ( ackTime + finalAckTime ) / numMessagesAcked * 1000000000.0 );
+    printf( "    %-24s %8.1f ns per ack\n", "ack filling the hole", finalAckTime / NumRounds * 1000000000.0 );
+}
+
+static void benchmark_block_fragments()
+{
+    printf( "\nblock fragments (reliable-ordered channel, 4MB blocks in 1024 byte fragments, 10%% packet loss)\n\n" );
+
+    // packets are topped up with as many fragments as fit, and the sender picks each one out of 4096
+
+    const int NumBlocks = 4;
+    const int BlockSize = 4 * 1024 * 1024;
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[0].maxBlockSize = BlockSize;
+    connectionConfig.channel[0].blockFragmentSize = 1024;
+
+    double time = 0.0;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    for ( int i = 0; i < NumBlocks; ++i )
+    {
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        if ( !message )
+            break;
+        message->sequence = uint16_t( i );
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+        memset( blockData, i, BlockSize );
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+        sender.SendMessage( 0, message );
+    }
+
+    BenchmarkStats stats;
+
+    uint16_t packetSequence = 0;
+
+    int numBlocksReceived = 0;
+
+    while ( numBlocksReceived < NumBlocks )
+    {
+        PumpConnections( connectionConfig, time, sender, receiver, packetSequence, 10, stats );
+
+        numBlocksReceived += DrainMessages( receiver, 0 );
+    }
+
+    printf( "    %-24s %8.2f us generate %8d packets\n", "fragment selection", stats.generateTime / stats.numPackets * 1000000.0, stats.numPackets );
+}
+
+static void benchmark_message_aggregation()
+{
+    printf( "\nmessage aggregation (saturated channel, shared.h test message mix)\n\n" );
+
+    const int NumPackets = 10000;
+
+    const ChannelType channelTypes[] = { CHANNEL_TYPE_RELIABLE_ORDERED, CHANNEL_TYPE_UNRELIABLE_UNORDERED };
+    const char * channelNames[] = { "reliable-ordered", "unreliable-unordered" };
+
+    for ( int typeIndex = 0; typeIndex < 2; ++typeIndex )
+    {
+        for ( int aggregate = 0; aggregate <= 1; ++aggregate )
+        {
+            TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+            ConnectionConfig connectionConfig;
+            connectionConfig.maxPacketSize = BenchmarkPacketSize;
+            connectionConfig.numChannels = 1;
+            connectionConfig.channel[0].type = channelTypes[typeIndex];
+            connectionConfig.channel[0].aggregateMessages = aggregate != 0;
+
+            double time = 0.0;
+
+            Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+            Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+            BenchmarkStats stats;
+            uint16_t messageSequence = 0;
+            uint16_t packetSequence = 0;
+            uint64_t numMessagesReceived = 0;
+
+            for ( int i = 0; i < NumPackets; ++i )
+            {
+                FillSendQueue( messageFactory, sender, 0, messageSequence );
+
+                PumpConnections( connectionConfig, time, sender, receiver, packetSequence, 0, stats );
+
+                numMessagesReceived += DrainMessages( receiver, 0 );
+            }
+
+            char name[64];
+            snprintf( name, sizeof( name ), "%s%s", channelNames[typeIndex], aggregate ? " (aggregate)" : "" );
+
+            printf( "    %-32s %8.2f bits per message %8.1f messages per packet %8.2f ns generate per message\n",
+                name,
+                double( stats.packetBytes ) * 8.0 / double( numMessagesReceived ),
+                double( numMessagesReceived ) / double( stats.numPackets ),
+                stats.generateTime / double( numMessagesReceived ) * 1000000000.0 );
+        }
+    }
+}
+
+static void benchmark_block_parity()
+{
+    printf( "\nblock parity (16KB blocks in 1024 byte fragments, 60 packets per-second, 100ms round trip)\n\n" );
+
+    // packets and acks both go through the network simulator, so lost fragments cost a real round trip plus the fragment resend time.
+    // the next block is sent as soon as the previous one is received, so the latency is the time to deliver each block.
+
+    const int NumBlocks = 100;
+    const int BlockSize = 16 * 1024;
+    const int NumSimulatorPackets = 256;
+    const double DeltaTime = 1.0 / 60.0;
+
+    const float packetLoss[] = { 1.0f, 5.0f, 10.0f };
+    const int parityGroupSize[] = { 0, 8, 4 };
+
+    for ( int lossIndex = 0; lossIndex < int( sizeof( packetLoss ) / sizeof( packetLoss[0] ) ); ++lossIndex )
+    {
+        for ( int parityIndex = 0; parityIndex < int( sizeof( parityGroupSize ) / sizeof( parityGroupSize[0] ) ); ++parityIndex )
+        {
+            TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+            ConnectionConfig connectionConfig;
+            connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+            connectionConfig.channel[0].blockFragmentSize = 1024;
+            connectionConfig.channel[0].blockParityGroupSize = parityGroupSize[parityIndex];
+
+            double time = 0.0;
+
+            Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+            Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+            NetworkSimulator networkSimulator( GetDefaultAllocator(), NumSimulatorPackets, time );
+            networkSimulator.SetLatency( 50.0f );
+            networkSimulator.SetPacketLoss( packetLoss[lossIndex] );
+
+            uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize + 2 );
+
+            uint16_t packetSequence = 0;
+            uint64_t bytesSent = 0;
+            int numBlocksSent = 0;
+            int numBlocksReceived = 0;
+            double blockSendTime = 0.0;
+            double totalLatency = 0.0;
+            double maxLatency = 0.0;
+
+            while ( numBlocksReceived < NumBlocks )
+            {
+                if ( numBlocksSent == numBlocksReceived )
+                {
+                    TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+                    if ( !message )
+                        break;
+                    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+                    memset( blockData, numBlocksSent, BlockSize );
+                    message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+                    sender.SendMessage( 0, message );
+                    blockSendTime = time;
+                    numBlocksSent++;
+                }
+
+                // sender to receiver: packet sequence followed by the connection packet
+
+                int packetBytes = 0;
+                if ( sender.GeneratePacket( NULL, packetSequence, packetData + 2, connectionConfig.maxPacketSize, packetBytes ) )
+                {
+                    packetData[0] = uint8_t( packetSequence & 0xFF );
+                    packetData[1] = uint8_t( packetSequence >> 8 );
+                    networkSimulator.SendPacket( 1, packetData, packetBytes + 2 );
+                    bytesSent += packetBytes;
+                }
+                packetSequence++;
+
+                time += DeltaTime;
+                sender.AdvanceTime( time );
+                receiver.AdvanceTime( time );
+                networkSimulator.AdvanceTime( time );
+
+                // receiver gets packets and sends back acks, sender gets acks
+
+                uint8_t * receivedPacketData[NumSimulatorPackets];
+                int receivedPacketBytes[NumSimulatorPackets];
+                int to[NumSimulatorPackets];
+
+                const int numPackets = networkSimulator.ReceivePackets( NumSimulatorPackets, receivedPacketData, receivedPacketBytes, to );
+
+                for ( int i = 0; i < numPackets; ++i )
+                {
+                    const uint16_t sequence = uint16_t( receivedPacketData[i][0] ) | uint16_t( receivedPacketData[i][1] << 8 );
+
+                    if ( to[i] == 1 )
+                    {
+                        receiver.ProcessPacket( NULL, sequence, receivedPacketData[i] + 2, receivedPacketBytes[i] - 2 );
+                        networkSimulator.SendPacket( 0, receivedPacketData[i], 2 );
+                    }
+                    else
+                    {
+                        sender.ProcessAcks( &sequence, 1 );
+                    }
+
+                    YOJIMBO_FREE( networkSimulator.GetAllocator(), receivedPacketData[i] );
+                }
+
+                const int numReceived = DrainMessages( receiver, 0 );
+
+                if ( numReceived > 0 )
+                {
+                    const double latency = time - blockSendTime;
+                    totalLatency += latency;
+                    maxLatency = yojimbo_max( maxLatency, latency );
+                    numBlocksReceived += numReceived;
+                }
+            }
+
+            char name[64];
+            if ( parityGroupSize[parityIndex] > 0 )
+                snprintf( name, sizeof( name ), "%.0f%% loss, parity 1/%d", packetLoss[lossIndex], parityGroupSize[parityIndex] );
+            else
+                snprintf( name, sizeof( name ), "%.0f%% loss, no parity", packetLoss[lossIndex] );
+
+            printf( "    %-28s %7.1f ms average latency %7.1f ms max latency %7.1f KB/sec goodput %5.1f%% overhead\n",
+                name,
+                totalLatency / numBlocksReceived * 1000.0,
+                maxLatency * 1000.0,
+                double( numBlocksReceived ) * BlockSize / time / 1024.0,
+                100.0 * ( double( bytesSent ) / ( double( numBlocksReceived ) * BlockSize ) - 1.0 ) );
+        }
+    }
+}
+
+static void benchmark_packet_parity()
+{
+    printf( "\npacket parity (one 256 byte message per-packet on an unreliable channel, 60 packets per-second, 50ms one way)\n\n" );
+
+    // unreliable messages are never resent, so without parity every lost packet is a lost message. with parity the
+    // receiver rebuilds a single lost packet per-group from the parity packet, which arrives after the last packet in the group.
+
+    const int NumTicks = 6000;
+    const int BlockSize = 256;
+    const int NumSimulatorPackets = 256;
+    const double DeltaTime = 1.0 / 60.0;
+
+    const float packetLoss[] = { 1.0f, 5.0f, 10.0f };
+    const int parityGroupSize[] = { 0, 8, 4 };
+
+    double * sendTime = (double*) YOJIMBO_ALLOCATE( GetDefaultAllocator(), sizeof( double ) * NumTicks );
+
+    for ( int lossIndex = 0; lossIndex < int( sizeof( packetLoss ) / sizeof( packetLoss[0] ) ); ++lossIndex )
+    {
+        for ( int parityIndex = 0; parityIndex < int( sizeof( parityGroupSize ) / sizeof( parityGroupSize[0] ) ); ++parityIndex )
+        {
+            TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+            ConnectionConfig connectionConfig;
+            connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+            connectionConfig.channel[0].maxBlockSize = BlockSize;
+            connectionConfig.channel[0].packetParityGroupSize = parityGroupSize[parityIndex];
+
+            double time = 0.0;
+
+            Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+            Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+            NetworkSimulator networkSimulator( GetDefaultAllocator(), NumSimulatorPackets, time );
+            networkSimulator.SetLatency( 50.0f );
+            networkSimulator.SetPacketLoss( packetLoss[lossIndex] );
+
+            uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize + 2 );
+
+            uint16_t packetSequence = 0;
+            uint64_t bytesSent = 0;
+            int numMessagesReceived = 0;
+            double totalLatency = 0.0;
+            double maxLatency = 0.0;
+
+            // run on for a second after the last message so parity for the final group has time to arrive
+
+            for ( int i = 0; i < NumTicks + 60; ++i )
+            {
+                if ( i < NumTicks )
+                {
+                    TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+                    if ( !message )
+                        break;
+                    message->sequence = uint16_t( i );
+                    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+                    memset( blockData, i, BlockSize );
+                    message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+                    sender.SendMessage( 0, message );
+                    sendTime[i] = time;
+                }
+
+                int packetBytes = 0;
+                if ( sender.GeneratePacket( NULL, packetSequence, packetData + 2, connectionConfig.maxPacketSize, packetBytes ) )
+                {
+                    packetData[0] = uint8_t( packetSequence & 0xFF );
+                    packetData[1] = uint8_t( packetSequence >> 8 );
+                    networkSimulator.SendPacket( 1, packetData, packetBytes + 2 );
+                    bytesSent += packetBytes;
+                }
+                packetSequence++;
+
+                time += DeltaTime;
+                sender.AdvanceTime( time );
+                receiver.AdvanceTime( time );
+                networkSimulator.AdvanceTime( time );
+
+                uint8_t * receivedPacketData[NumSimulatorPackets];
+                int receivedPacketBytes[NumSimulatorPackets];
+                int to[NumSimulatorPackets];
+
+                const int numPackets = networkSimulator.ReceivePackets( NumSimulatorPackets, receivedPacketData, receivedPacketBytes, to );
+
+                for ( int j = 0; j < numPackets; ++j )
+                {
+                    const uint16_t sequence = uint16_t( receivedPacketData[j][0] ) | uint16_t( receivedPacketData[j][1] << 8 );
+                    receiver.ProcessPacket( NULL, sequence, receivedPacketData[j] + 2, receivedPacketBytes[j] - 2 );
+                    YOJIMBO_FREE( networkSimulator.GetAllocator(), receivedPacketData[j] );
+                }
+
+                while ( true )
+                {
+                    TestBlockMessage * message = (TestBlockMessage*) receiver.ReceiveMessage( 0 );
+                    if ( !message )
+                        break;
+                    yojimbo_assert( message->GetBlockSize() == BlockSize );
+                    const double latency = time - sendTime[message->sequence];
+                    totalLatency += latency;
+                    maxLatency = yojimbo_max( maxLatency, latency );
+                    numMessagesReceived++;
+                    receiver.ReleaseMessage( message );
+                }
+            }
+
+            char name[64];
+            if ( parityGroupSize[parityIndex] > 0 )
+                snprintf( name, sizeof( name ), "%.0f%% loss, parity 1/%d", packetLoss[lossIndex], parityGroupSize[parityIndex] );
+            else
+                snprintf( name, sizeof( name ), "%.0f%% loss, no parity", packetLoss[lossIndex] );
+
+            printf( "    %-28s %6.2f%% delivered %7.1f ms average latency %7.1f ms max latency %7.1f bytes per-message\n",
+                name,
+                100.0 * numMessagesReceived / NumTicks,
+                totalLatency / yojimbo_max( numMessagesReceived, 1 ) * 1000.0,
+                maxLatency * 1000.0,
+                double( bytesSent ) / NumTicks );
+        }
+    }
+
+    YOJIMBO_FREE( GetDefaultAllocator(), sendTime );
+}
+
+static void benchmark_sent_packet_message_ids()
+{
+    printf( "\nsent packet message ids (default reliable channel config)\n\n" );
+
+    // the channel remembers which message ids went into each sent packet until it is acked. this used to reserve
+    // maxMessagesPerPacket ids for every sent packet entry. ids are now stored as runs in a shared ring buffer.
+
+    const int NumPackets = 20000;
+    const int messagesPerPacket[] = { 1, 8, 64 };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( messagesPerPacket ) / sizeof( messagesPerPacket[0] ) ); ++setupIndex )
+    {
+        TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+        ConnectionConfig connectionConfig;
+        connectionConfig.maxPacketSize = BenchmarkPacketSize;
+
+        double time = 0.0;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        BenchmarkStats stats;
+        uint16_t packetSequence = 0;
+
+        for ( int i = 0; i < NumPackets; ++i )
+        {
+            for ( int j = 0; j < messagesPerPacket[setupIndex] && sender.CanSendMessage( 0 ); ++j )
+            {
+                Message * message = messageFactory.CreateMessage( TEST_MESSAGE );
+                if ( !message )
+                    break;
+                sender.SendMessage( 0, message );
+            }
+
+            PumpConnections( connectionConfig, time, sender, receiver, packetSequence, 10, stats );
+
+            DrainMessages( receiver, 0 );
+        }
+
+        char name[64];
+        snprintf( name, sizeof( name ), "%d messages per packet", messagesPerPacket[setupIndex] );
+
+        printf( "    %-24s %8.1f ns per ack\n", name, stats.ackTime / stats.numPackets * 1000000000.0 );
+    }
+
+    const ChannelConfig & channelConfig = ConnectionConfig().channel[0];
+
+    printf( "\n    message id storage       %8d bytes per channel (was %d)\n", 
+        int( channelConfig.sentPacketMessageIdBufferSize * sizeof( uint16_t ) ),
+        int( channelConfig.sentPacketBufferSize * channelConfig.maxMessagesPerPacket * sizeof( uint16_t ) ) );
+}
+
+static void benchmark_packet_fill()
+{
+    printf( "\npacket fill (soak workload: reliable-ordered messages and blocks up to 64KB in 16KB packets)\n\n" );
+
+    // same channels and traffic as soak.cpp: each tick queues up to 64 messages, one in 25 of them a block message.
+    // fill is the average packet size as a fraction of maxPacketSize over every packet sent until all messages arrive.
+
+    const int NumTicks = 2000;
+    const int MaxBlockSize = 64 * 1024;
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.maxPacketSize = 16 * 1024;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[0].maxBlockSize = 8 * 1024;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[1].maxBlockSize = MaxBlockSize;
+    connectionConfig.channel[1].blockFragmentSize = 1024;
+
+    double time = 0.0;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    BenchmarkStats stats;
+    uint16_t packetSequence = 0;
+
+    int numMessagesSent = 0;
+    int numMessagesReceived = 0;
+
+    for ( int i = 0; i < NumTicks || numMessagesReceived < numMessagesSent; ++i )
+    {
+        const int messagesToSend = ( i < NumTicks ) ? random_int( 0, 64 ) : 0;
+
+        for ( int j = 0; j < messagesToSend && sender.CanSendMessage( 1 ); ++j )
+        {
+            if ( rand() % 25 )
+            {
+                TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+                if ( !message )
+                    break;
+                message->sequence = uint16_t( numMessagesSent );
+                sender.SendMessage( 1, message );
+            }
+            else
+            {
+                TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+                if ( !message )
+                    break;
+                message->sequence = uint16_t( numMessagesSent );
+                const int blockSize = 1 + ( numMessagesSent * 33 ) % MaxBlockSize;
+                uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+                memset( blockData, numMessagesSent, blockSize );
+                message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+                sender.SendMessage( 1, message );
+            }
+            numMessagesSent++;
+        }
+
+        PumpConnections( connectionConfig, time, sender, receiver, packetSequence, 0, stats );
+
+        numMessagesReceived += DrainMessages( receiver, 1 );
+    }
+
+    PrintStats( "soak workload", connectionConfig, stats );
+
+    printf( "    %-24s %8d packets %8d messages\n", "delivered", stats.numPackets, numMessagesReceived );
+
+    // a saturated message channel in small packets shows the per-packet header cost on its own
+
+    const int NumPackets = 10000;
+
+    ConnectionConfig messageConfig;
+    messageConfig.maxPacketSize = BenchmarkPacketSize;
+
+    Connection messageSender( GetDefaultAllocator(), messageFactory, messageConfig, time );
+    Connection messageReceiver( GetDefaultAllocator(), messageFactory, messageConfig, time );
+
+    BenchmarkStats messageStats;
+    uint16_t messageSequence = 0;
+
+    for ( int i = 0; i < NumPackets; ++i )
+    {
+        FillSendQueue( messageFactory, messageSender, 0, messageSequence );
+
+        PumpConnections( messageConfig, time, messageSender, messageReceiver, packetSequence, 0, messageStats );
+
+        DrainMessages( messageReceiver, 0 );
+    }
+
+    PrintStats( "saturated messages", messageConfig, messageStats );
+}
+
+static double RunServerTicks( EchoServer & server, double & time, int numTicks )
+{
+    // each tick queues one reliable message per connected client, outside the timed part. the tick itself is
+    // ReceivePackets, AdvanceTime and SendPackets. packets are echoed back to the slot that sent them.
+
+    double tickTime = 0.0;
+
+    for ( int i = 0; i < numTicks; ++i )
+    {
+        for ( int j = 0; j < server.GetMaxClients(); ++j )
+        {
+            if ( !server.IsClientConnected( j ) )
+                continue;
+
+            while ( Message * message = server.ReceiveMessage( j, 0 ) )
+                server.ReleaseMessage( j, message );
+
+            if ( !server.CanSendMessage( j, 0 ) )
+                continue;
+
+            Message * message = server.CreateMessage( j, TEST_MESSAGE );
+            if ( message )
+                server.SendMessage( j, 0, message );
+        }
+
+        const double startTime = yojimbo_time();
+
+        server.ReceivePackets();
+
+        server.AdvanceTime( time );
+
+        server.SendPackets();
+
+        tickTime += yojimbo_time() - startTime;
+
+        time += 0.01;
+    }
+
+    return tickTime / numTicks;
+}
+
+static void benchmark_server_tick()
+{
+    printf( "\nserver tick (one reliable message per connected client per tick, echoed back to the server)\n\n" );
+
+    // slot tables are sized at Server::Start, so capacity is no longer capped at MaxClients. "1/8 connected" runs
+    // the same capacity with only one slot in eight in use. per-tick loops only visit connected slots, so that case
+    // should cost about an eighth as much.
+
+    const int NumTicks = 100;
+    const int maxClients[] = { 64, 128, 256, 512, 1024, 2048 };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( maxClients ) / sizeof( maxClients[0] ) ); ++setupIndex )
+    {
+        const int numClients = maxClients[setupIndex];
+
+        double tickTime[2] = { 0.0, 0.0 };
+
+        for ( int pass = 0; pass < 2; ++pass )
+        {
+            ClientServerConfig config;
+            config.networkSimulator = false;
+            config.serverPerClientMemory = 512 * 1024;
+
+            double time = 0.0;
+
+            EchoServer server( GetDefaultAllocator(), config, adapter, time );
+
+            server.Start( numClients );
+
+            const int numConnectedClients = ( pass == 0 ) ? numClients : numClients / 8;
+
+            for ( int j = 0; j < numConnectedClients; ++j )
+                server.ConnectClient( j );
+
+            tickTime[pass] = RunServerTicks( server, time, NumTicks );
+
+            server.Stop();
+        }
+
+        char name[64];
+        snprintf( name, sizeof( name ), "%d clients", numClients );
+
+        printf( "    %-24s %8.1f us per tick %8.1f us per tick 1/8 connected\n", name, tickTime[0] * 1000000.0, tickTime[1] * 1000000.0 );
+    }
+}
+
+static void benchmark_server_worker_threads()
+{
+    printf( "\nserver worker threads (1024 clients, same workload as server tick)\n\n" );
+
+    // ClientServerConfig::serverWorkerThreads splits per-client packet generation and processing across threads.
+    // socket I/O stays on the calling thread, and packets go out in the same order whatever the thread count,
+    // so the packet hash must match the single threaded run.
+
+    const int NumClients = 1024;
+    const int NumTicks = 100;
+    const int numThreads[] = { 1, 2, 4, 8, 16 };
+
+    double baseTickTime = 0.0;
+    uint64_t basePacketHash = 0;
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( numThreads ) / sizeof( numThreads[0] ) ); ++setupIndex )
+    {
+        ClientServerConfig config;
+        config.networkSimulator = false;
+        config.serverPerClientMemory = 512 * 1024;
+        config.serverWorkerThreads = numThreads[setupIndex];
+
+        double time = 0.0;
+
+        EchoServer server( GetDefaultAllocator(), config, adapter, time );
+
+        server.Start( NumClients );
+
+        for ( int j = 0; j < NumClients; ++j )
+            server.ConnectClient( j );
+
+        const double tickTime = RunServerTicks( server, time, NumTicks );
+
+        if ( setupIndex == 0 )
+        {
+            baseTickTime = tickTime;
+            basePacketHash = server.GetPacketHash();
+        }
+
+        char name[64];
+        snprintf( name, sizeof( name ), "%d threads", numThreads[setupIndex] );
+
+        printf( "    %-24s %8.1f us per tick %6.2fx %s\n", name, tickTime * 1000000.0, baseTickTime / tickTime, 
+            server.GetPacketHash() == basePacketHash ? "same packets" : "DIFFERENT PACKETS" );
+
+        server.Stop();
+    }
+}
+
+static void benchmark_network_thread_latency()
+{
+    printf( "\nnetwork thread receive latency (16 clients, one message per client per frame)\n\n" );
+
+    // the game thread polls for messages all through each frame, but without the network thread packets are only
+    // sent and received at the end of the frame, so latency grows with frame time. with ClientServerConfig::networkThread
+    // the server ticks at networkTickRate on its own, so messages show up at the same latency at any frame rate.
+
+    const int NumClients = 16;
+    const int NetworkTickRate = 1000;
+    const double RunTime = 0.5;
+    const int frameRates[] = { 10, 30, 60, 120 };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( frameRates ) / sizeof( frameRates[0] ) ); ++setupIndex )
+    {
+        const int frameRate = frameRates[setupIndex];
+        const double frameTime = 1.0 / frameRate;
+
+        double latency[2];
+
+        for ( int threaded = 0; threaded < 2; ++threaded )
+        {
+            ClientServerConfig config;
+            config.networkSimulator = false;
+            config.serverPerClientMemory = 512 * 1024;
+            config.networkThread = threaded != 0;
+            config.networkTickRate = NetworkTickRate;
+
+            double time = 0.0;
+
+            EchoServer server( GetDefaultAllocator(), config, adapter, time );
+
+            server.Start( NumClients );
+
+            for ( int i = 0; i < NumClients; ++i )
+                server.ConnectClient( i );
+
+            server.StartNetworkThread();
+
+            double sendTime[NumClients][256];
+            uint16_t numMessagesSent[NumClients];
+            memset( numMessagesSent, 0, sizeof( numMessagesSent ) );
+
+            double totalLatency = 0.0;
+            int numMessagesReceived = 0;
+
+            const double startTime = yojimbo_time();
+
+            while ( yojimbo_time() - startTime < RunTime )
+            {
+                const double frameStart = yojimbo_time();
+
+                for ( int i = 0; i < NumClients; ++i )
+                {
+                    if ( !server.CanSendMessage( i, 0 ) )
+                        continue;
+                    TestMessage * message = (TestMessage*) server.CreateMessage( i, TEST_MESSAGE );
+                    message->sequence = numMessagesSent[i];
+                    sendTime[i][numMessagesSent[i] % 256] = yojimbo_time();
+                    numMessagesSent[i]++;
+                    server.SendMessage( i, 0, message );
+                }
+
+                do
+                {
+                    for ( int i = 0; i < NumClients; ++i )
+                    {
+                        while ( Message * message = server.ReceiveMessage( i, 0 ) )
+                        {
+                            totalLatency += yojimbo_time() - sendTime[i][( (TestMessage*) message )->sequence % 256];
+                            numMessagesReceived++;
+                            server.ReleaseMessage( i, message );
+                        }
+                    }
+                    yojimbo_sleep( 0.0005 );
+                }
+                while ( yojimbo_time() - frameStart < frameTime );
+
+                time += frameTime;
+
+                server.ReceivePackets();
+
+                server.AdvanceTime( time );
+
+                server.SendPackets();
+            }
+
+            latency[threaded] = numMessagesReceived > 0 ? totalLatency / numMessagesReceived : 0.0;
+
+            server.Stop();
+        }
+
+        printf( "    %3d fps: %6.1f ms game thread, %6.1f ms network thread\n", frameRate, latency[0] * 1000.0, latency[1] * 1000.0 );
+    }
+}
+
+static void benchmark_memory_transport()
+{
+    printf( "\nmemory transport (real client and server, packets exchanged in memory instead of over sockets)\n\n" );
+
+    // each tick both sides top up the send queue on every connection and drain what arrived. the whole client and
+    // server tick is timed, so this is the cost of the library per message without socket or encryption overhead.
+
+    const int NumTicks = 100;
+    const int numClients[] = { 1, 16, 64 };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( numClients ) / sizeof( numClients[0] ) ); ++setupIndex )
+    {
+        const int NumClients = numClients[setupIndex];
+
+        ClientServerConfig config;
+        config.networkSimulator = false;
+        config.serverPerClientMemory = 512 * 1024;
+
+        double time = 0.0;
+
+        MemoryServerTransport serverTransport( GetDefaultAllocator(), Address( "127.0.0.1", ServerPort ) );
+
+        Server server( GetDefaultAllocator(), serverTransport, config, adapter, time );
+
+        server.Start( NumClients );
+
+        MemoryClientTransport ** clientTransport = (MemoryClientTransport**) alloca( sizeof( MemoryClientTransport* ) * NumClients );
+        Client ** clients = (Client**) alloca( sizeof( Client* ) * NumClients );
+
+        uint8_t connectToken[ConnectTokenBytes];
+        memset( connectToken, 0, sizeof( connectToken ) );
+
+        for ( int i = 0; i < NumClients; ++i )
+        {
+            clientTransport[i] = YOJIMBO_NEW( GetDefaultAllocator(), MemoryClientTransport, serverTransport );
+            clients[i] = YOJIMBO_NEW( GetDefaultAllocator(), Client, GetDefaultAllocator(), *clientTransport[i], config, adapter, time );
+            clients[i]->Connect( i + 1, connectToken );
+        }
+
+        for ( int i = 0; i < 10 && server.GetNumConnectedClients() < NumClients; ++i )
+        {
+            time += 0.01;
+            for ( int j = 0; j < NumClients; ++j )
+                clients[j]->AdvanceTime( time );
+            server.AdvanceTime( time );
+        }
+
+        uint64_t numMessagesReceived = 0;
+
+        const double startTime = yojimbo_time();
+
+        for ( int i = 0; i < NumTicks; ++i )
+        {
+            for ( int j = 0; j < NumClients; ++j )
+            {
+                const int clientIndex = clients[j]->GetClientIndex();
+
+                while ( clients[j]->CanSendMessage( 0 ) )
+                    clients[j]->SendMessage( 0, clients[j]->CreateMessage( TEST_MESSAGE ) );
+
+                while ( server.CanSendMessage( clientIndex, 0 ) )
+                    server.SendMessage( clientIndex, 0, server.CreateMessage( clientIndex, TEST_MESSAGE ) );
+
+                while ( Message * message = clients[j]->ReceiveMessage( 0 ) )
+                {
+                    clients[j]->ReleaseMessage( message );
+                    numMessagesReceived++;
+                }
+
+                while ( Message * message = server.ReceiveMessage( clientIndex, 0 ) )
+                {
+                    server.ReleaseMessage( clientIndex, message );
+                    numMessagesReceived++;
+                }
+            }
+
+            for ( int j = 0; j < NumClients; ++j )
+                clients[j]->SendPackets();
+
+            server.SendPackets();
+
+            for ( int j = 0; j < NumClients; ++j )
+                clients[j]->ReceivePackets();
+
+            server.ReceivePackets();
+
+            time += 0.01;
+
+            for ( int j = 0; j < NumClients; ++j )
+                clients[j]->AdvanceTime( time );
+
+            server.AdvanceTime( time );
+        }
+
+        const double elapsed = yojimbo_time() - startTime;
+
+        for ( int i = 0; i < NumClients; ++i )
+        {
+            clients[i]->Disconnect();
+            YOJIMBO_DELETE( GetDefaultAllocator(), Client, clients[i] );
+            YOJIMBO_DELETE( GetDefaultAllocator(), MemoryClientTransport, clientTransport[i] );
+        }
+
+        server.Stop();
+
+        char name[64];
+        snprintf( name, sizeof( name ), "%d clients", NumClients );
+
+        printf( "    %-24s %8.1f us per tick %10.0f messages per second\n", name, elapsed / NumTicks * 1000000.0, numMessagesReceived / elapsed );
+    }
+}
+
+class CountingServerTransport : public ServerTransport
+{
+public:
+
+    // counts packets and calls at the transport boundary.
+
+    explicit CountingServerTransport( ServerTransport & transport ) : m_transport( &transport ) { ResetCounters(); }
+
+    void ResetCounters()
+    {
+        numSendCalls = 0;
+        numPacketsSent = 0;
+        numReceiveCalls = 0;
+        numPacketsReceived = 0;
+    }
+
+    bool Start( Allocator & allocator, int maxClients, ConnectDisconnectFunction function, void * context, double time ) { return m_transport->Start( allocator, maxClients, function, context, time ); }
+
+    void Stop() { m_transport->Stop(); }
+
+    void Update( double time ) { m_transport->Update( time ); }
+
+    void DisconnectClient( int clientIndex ) { m_transport->DisconnectClient( clientIndex ); }
+
+    void DisconnectAllClients() { m_transport->DisconnectAllClients(); }
+
+    bool IsClientConnected( int clientIndex ) const { return m_transport->IsClientConnected( clientIndex ); }
+
+    uint64_t GetClientId( int clientIndex ) const { return m_transport->GetClientId( clientIndex ); }
+
+    int GetNumConnectedClients() const { return m_transport->GetNumConnectedClients(); }
+
+    void SendPackets( const int * clientIndex, uint8_t * const * packetData, const int * packetBytes, int numPackets )
+    {
+        numSendCalls++;
+        numPacketsSent += numPackets;
+        m_transport->SendPackets( clientIndex, packetData, packetBytes, numPackets );
+    }
+
+    int ReceivePackets( int clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets )
+    {
+        const int numPackets = m_transport->ReceivePackets( clientIndex, packetData, packetBytes, maxPackets );
+        numReceiveCalls++;
+        numPacketsReceived += numPackets;
+        return numPackets;
+    }
+
+    int ReceiveAllPackets( int * clientCapacity, int * clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets )
+    {
+        const int numPackets = m_transport->ReceiveAllPackets( clientCapacity, clientIndex, packetData, packetBytes, maxPackets );
+        numReceiveCalls++;
+        numPacketsReceived += numPackets;
+        return numPackets;
+    }
+
+    void FreePackets( uint8_t ** packetData, int numPackets ) { m_transport->FreePackets( packetData, numPackets ); }
+
+    const Address & GetAddress() const { return m_transport->GetAddress(); }
+
+    uint64_t numSendCalls;
+    uint64_t numPacketsSent;
+    uint64_t numReceiveCalls;
+    uint64_t numPacketsReceived;
+
+private:
+
+    ServerTransport * m_transport;
+};
+
+static void benchmark_transport_packet_rate()
+{
+    printf( "\ntransport packet rate (server tick only, one thread, one message per client per tick each way)\n\n" );
+
+    // packets per second is what one core moves through the server tick over the memory transport. packets per call
+    // is the batch size crossing the transport interface. this measures the interface only, not socket syscalls.
+
+    const int NumTicks = 200;
+    const int numClients[] = { 16, 64 };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( numClients ) / sizeof( numClients[0] ) ); ++setupIndex )
+    {
+        const int NumClients = numClients[setupIndex];
+
+        ClientServerConfig config;
+        config.networkSimulator = false;
+        config.serverPerClientMemory = 512 * 1024;
+
+        double time = 0.0;
+
+        MemoryServerTransport memoryTransport( GetDefaultAllocator(), Address( "127.0.0.1", ServerPort ) );
+
+        CountingServerTransport serverTransport( memoryTransport );
+
+        Server server( GetDefaultAllocator(), serverTransport, config, adapter, time );
+
+        server.Start( NumClients );
+
+        MemoryClientTransport ** clientTransport = (MemoryClientTransport**) alloca( sizeof( MemoryClientTransport* ) * NumClients );
+        Client ** clients = (Client**) alloca( sizeof( Client* ) * NumClients );
+
+        uint8_t connectToken[ConnectTokenBytes];
+        memset( connectToken, 0, sizeof( connectToken ) );
+
+        for ( int i = 0; i < NumClients; ++i )
+        {
+            clientTransport[i] = YOJIMBO_NEW( GetDefaultAllocator(), MemoryClientTransport, memoryTransport );
+            clients[i] = YOJIMBO_NEW( GetDefaultAllocator(), Client, GetDefaultAllocator(), *clientTransport[i], config, adapter, time );
+            clients[i]->Connect( i + 1, connectToken );
+        }
+
+        for ( int i = 0; i < 10 && server.GetNumConnectedClients() < NumClients; ++i )
+        {
+            time += 0.01;
+            for ( int j = 0; j < NumClients; ++j )
+                clients[j]->AdvanceTime( time );
+            server.AdvanceTime( time );
+        }
+
+        serverTransport.ResetCounters();
+
+        double serverTime = 0.0;
+
+        for ( int i = 0; i < NumTicks; ++i )
+        {
+            for ( int j = 0; j < NumClients; ++j )
+            {
+                const int clientIndex = clients[j]->GetClientIndex();
+
+                if ( clients[j]->CanSendMessage( 0 ) )
+                    clients[j]->SendMessage( 0, clients[j]->CreateMessage( TEST_MESSAGE ) );
+
+                if ( server.CanSendMessage( clientIndex, 0 ) )
+                    server.SendMessage( clientIndex, 0, server.CreateMessage( clientIndex, TEST_MESSAGE ) );
+
+                while ( Message * message = clients[j]->ReceiveMessage( 0 ) )
+                    clients[j]->ReleaseMessage( message );
+
+                while ( Message * message = server.ReceiveMessage( clientIndex, 0 ) )
+                    server.ReleaseMessage( clientIndex, message );
+            }
+
+            for ( int j = 0; j < NumClients; ++j )
+                clients[j]->SendPackets();
+
+            time += 0.01;
+
+            const double startTime = yojimbo_time();
+
+            server.ReceivePackets();
+
+            server.AdvanceTime( time );
+
+            server.SendPackets();
+
+            serverTime += yojimbo_time() - startTime;
+
+            for ( int j = 0; j < NumClients; ++j )
+            {
+                clients[j]->ReceivePackets();
+                clients[j]->AdvanceTime( time );
+            }
+        }
+
+        for ( int i = 0; i < NumClients; ++i )
+        {
+            clients[i]->Disconnect();
+            YOJIMBO_DELETE( GetDefaultAllocator(), Client, clients[i] );
+            YOJIMBO_DELETE( GetDefaultAllocator(), MemoryClientTransport, clientTransport[i] );
+        }
+
+        server.Stop();
+
+        const uint64_t numPackets = serverTransport.numPacketsSent + serverTransport.numPacketsReceived;
+
+        char name[64];
+        snprintf( name, sizeof( name ), "%d clients", NumClients );
+
+        printf( "    %-24s %10.0f packets per second %6.2f packets per send call %6.2f packets per receive call\n", 
+            name, 
+            numPackets / serverTime, 
+            serverTransport.numSendCalls ? serverTransport.numPacketsSent / double( serverTransport.numSendCalls ) : 0.0,
+            serverTransport.numReceiveCalls ? serverTransport.numPacketsReceived / double( serverTransport.numReceiveCalls ) : 0.0 );
+    }
+}
+
+#if defined(__linux__)
+
+static void UdpConnectDisconnectFunction( void * context, int clientIndex, int connected )
+{
+    (void) context;
+    (void) clientIndex;
+    (void) connected;
+}
+
+static void benchmark_udp_transport_packet_rate()
+{
+    printf( "\nudp transport packet rate (loopback, 4 packets of 200 bytes per client per tick, echoed back)\n\n" );
+
+    // packets per second is what one core moves through UdpServerTransport::ReceiveAllPackets and SendPackets.
+    // a batch size of one makes a system call per packet, which is what netcode.io does inside its socket layer.
+
+    const int NumTicks = 500;
+    const int PacketsPerTick = 4;
+    const int PacketBytes = 200;
+    const int numClients[] = { 16, 64 };
+    const int batchSize[] = { 1, 16, 64 };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( numClients ) / sizeof( numClients[0] ) ); ++setupIndex )
+    {
+        for ( int batchIndex = 0; batchIndex < int( sizeof( batchSize ) / sizeof( batchSize[0] ) ); ++batchIndex )
+        {
+            const int NumClients = numClients[setupIndex];
+
+            UdpServerTransport transport( GetDefaultAllocator(), Address( "127.0.0.1", 0 ), batchSize[batchIndex] );
+
+            double time = 0.0;
+
+            if ( !transport.Start( GetDefaultAllocator(), NumClients, UdpConnectDisconnectFunction, NULL, time ) )
+            {
+                printf( "    error: failed to start udp transport\n" );
+                return;
+            }
+
+            sockaddr_in serverAddress;
+            memset( &serverAddress, 0, sizeof( serverAddress ) );
+            serverAddress.sin_family = AF_INET;
+            serverAddress.sin_port = htons( transport.GetAddress().GetPort() );
+            serverAddress.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+            int * clientSocket = (int*) alloca( sizeof( int ) * NumClients );
+            for ( int i = 0; i < NumClients; ++i )
+            {
+                clientSocket[i] = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+                int bufferSize = 1024 * 1024;
+                setsockopt( clientSocket[i], SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof( bufferSize ) );
+            }
+
+            int clientCapacity[MaxClients];
+            int clientIndex[MaxReceivePackets];
+            uint8_t * packetData[MaxReceivePackets];
+            int packetBytes[MaxReceivePackets];
+
+            uint8_t packet[PacketBytes];
+            memset( packet, 0, sizeof( packet ) );
+
+            uint64_t numPacketsSent = 0;
+            uint64_t numPacketsEchoed = 0;
+            uint64_t numPacketsMoved = 0;
+            double serverTime = 0.0;
+
+            for ( int i = 0; i <= NumTicks; ++i )
+            {
+                for ( int j = 0; j < NumClients; ++j )
+                {
+                    for ( int k = 0; k < PacketsPerTick; ++k )
+                        sendto( clientSocket[j], packet, sizeof( packet ), 0, (sockaddr*) &serverAddress, sizeof( serverAddress ) );
+                }
+
+                const double startTime = yojimbo_time();
+
+                while ( true )
+                {
+                    for ( int j = 0; j < NumClients; ++j )
+                        clientCapacity[j] = MaxReceivePackets;
+
+                    const int numPackets = transport.ReceiveAllPackets( clientCapacity, clientIndex, packetData, packetBytes, MaxReceivePackets );
+
+                    transport.SendPackets( clientIndex, packetData, packetBytes, numPackets );
+
+                    transport.FreePackets( packetData, numPackets );
+
+                    numPacketsMoved += numPackets * 2;
+
+                    if ( numPackets < MaxReceivePackets )
+                        break;
+                }
+
+                // the first tick only connects the clients
+
+                if ( i > 0 )
+                    serverTime += yojimbo_time() - startTime;
+                else
+                    numPacketsMoved = 0;
+
+                time += 0.01;
+
+                transport.Update( time );
+
+                numPacketsSent += NumClients * PacketsPerTick;
+
+                for ( int j = 0; j < NumClients; ++j )
+                {
+                    while ( recv( clientSocket[j], packet, sizeof( packet ), MSG_DONTWAIT ) > 0 )
+                        numPacketsEchoed++;
+                }
+            }
+
+            for ( int i = 0; i < NumClients; ++i )
+                close( clientSocket[i] );
+
+            transport.Stop();
+
+            char name[64];
+            snprintf( name, sizeof( name ), "%d clients, batch %d", NumClients, batchSize[batchIndex] );
+
+            printf( "    %-24s %10.0f packets per second %6.2f%% echoed\n", 
+                name, 
+                numPacketsMoved / serverTime,
+                100.0 * numPacketsEchoed / double( numPacketsSent ) );
+        }
+    }
+}
+
+#endif // #if defined(__linux__)
+
+class NetcodeKeepAliveServerTransport : public CountingServerTransport
+{
+public:
+
+    // also counts the keep-alive packets netcode.io would add on the wire. netcode.io sends a keep-alive to each client
+    // that has not been sent a packet for 1 / PacketSendRate seconds when the server updates, and each client does the
+    // same towards the server. the memory transport sends neither, so they are modelled here.
+
+    enum { PacketSendRate = 10 };
+
+    explicit NetcodeKeepAliveServerTransport( ServerTransport & transport ) : CountingServerTransport( transport )
+    {
+        m_allocator = NULL;
+        m_maxClients = 0;
+        m_lastPacketSendTime = NULL;
+        m_lastPacketReceiveTime = NULL;
+        m_time = 0.0;
+        ResetKeepAliveCounters();
+    }
+
+    void ResetKeepAliveCounters()
+    {
+        numKeepAlivesSent = 0;
+        numKeepAlivesReceived = 0;
+    }
+
+    bool Start( Allocator & allocator, int maxClients, ConnectDisconnectFunction function, void * context, double time )
+    {
+        m_allocator = &allocator;
+        m_maxClients = maxClients;
+        m_lastPacketSendTime = (double*) YOJIMBO_ALLOCATE( allocator, sizeof( double ) * maxClients );
+        m_lastPacketReceiveTime = (double*) YOJIMBO_ALLOCATE( allocator, sizeof( double ) * maxClients );
+        for ( int i = 0; i < maxClients; ++i )
+        {
+            m_lastPacketSendTime[i] = -1.0;
+            m_lastPacketReceiveTime[i] = -1.0;
+        }
+        m_time = time;
+        return CountingServerTransport::Start( allocator, maxClients, function, context, time );
+    }
+
+    void Stop()
+    {
+        CountingServerTransport::Stop();
+        YOJIMBO_FREE( *m_allocator, m_lastPacketSendTime );
+        YOJIMBO_FREE( *m_allocator, m_lastPacketReceiveTime );
+        m_maxClients = 0;
+    }
+
+    void Update( double time )
+    {
+        CountingServerTransport::Update( time );
+        m_time = time;
+        const double keepAliveInterval = 1.0 / PacketSendRate;
+        for ( int i = 0; i < m_maxClients; ++i )
+        {
+            if ( !IsClientConnected( i ) )
+            {
+                m_lastPacketSendTime[i] = -1.0;
+                m_lastPacketReceiveTime[i] = -1.0;
+                continue;
+            }
+            if ( m_lastPacketSendTime[i] < 0.0 )
+                m_lastPacketSendTime[i] = time;
+            if ( m_lastPacketReceiveTime[i] < 0.0 )
+                m_lastPacketReceiveTime[i] = time;
+            if ( m_lastPacketSendTime[i] + keepAliveInterval <= time )
+            {
+                numKeepAlivesSent++;
+                m_lastPacketSendTime[i] = time;
+            }
+            if ( m_lastPacketReceiveTime[i] + keepAliveInterval <= time )
+            {
+                numKeepAlivesReceived++;
+                m_lastPacketReceiveTime[i] = time;
+            }
+        }
+    }
+
+    void SendPackets( const int * clientIndex, uint8_t * const * packetData, const int * packetBytes, int numPackets )
+    {
+        for ( int i = 0; i < numPackets; ++i )
+            m_lastPacketSendTime[clientIndex[i]] = m_time;
+        CountingServerTransport::SendPackets( clientIndex, packetData, packetBytes, numPackets );
+    }
+
+    int ReceivePackets( int clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets )
+    {
+        const int numPackets = CountingServerTransport::ReceivePackets( clientIndex, packetData, packetBytes, maxPackets );
+        if ( numPackets > 0 )
+            m_lastPacketReceiveTime[clientIndex] = m_time;
+        return numPackets;
+    }
+
+    int ReceiveAllPackets( int * clientCapacity, int * clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets )
+    {
+        const int numPackets = CountingServerTransport::ReceiveAllPackets( clientCapacity, clientIndex, packetData, packetBytes, maxPackets );
+        for ( int i = 0; i < numPackets; ++i )
+            m_lastPacketReceiveTime[clientIndex[i]] = m_time;
+        return numPackets;
+    }
+
+    uint64_t numKeepAlivesSent;
+    uint64_t numKeepAlivesReceived;
+
+private:
+
+    Allocator * m_allocator;
+    int m_maxClients;
+    double * m_lastPacketSendTime;
+    double * m_lastPacketReceiveTime;
+    double m_time;
+};
+
+static void benchmark_idle_keep_alive()
+{
+    printf( "\nidle keep-alive (64 connected clients, no messages, 60 ticks per second)\n\n" );
+
+    // an idle server still sends one packet per client per tick unless empty packets are skipped. with a keep-alive
+    // interval set, idle connections only send when acks are due or the keep-alive interval has passed. wire counts
+    // add the 10 keep-alives per second netcode.io sends each way on a connection that is otherwise quiet, so the
+    // wire rate bottoms out near 10 packets per second per client, and intervals near 0.1 seconds double up with them.
+
+    const int NumClients = 64;
+    const int NumTicks = 600;
+    const double DeltaTime = 1.0 / 60.0;
+    const float keepAliveInterval[] = { 0.0f, 0.1f, 0.2f, 1.0f };
+
+    double everyTickWirePacketsSent = 0.0;
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( keepAliveInterval ) / sizeof( keepAliveInterval[0] ) ); ++setupIndex )
+    {
+        ClientServerConfig config;
+        config.networkSimulator = false;
+        config.keepAliveInterval = keepAliveInterval[setupIndex];
+        config.ackDelay = 0.05f;
+
+        double time = 0.0;
+
+        MemoryServerTransport memoryTransport( GetDefaultAllocator(), Address( "127.0.0.1", ServerPort ) );
+
+        NetcodeKeepAliveServerTransport serverTransport( memoryTransport );
+
+        Server server( GetDefaultAllocator(), serverTransport, config, adapter, time );
+
+        server.Start( NumClients );
+
+        MemoryClientTransport ** clientTransport = (MemoryClientTransport**) alloca( sizeof( MemoryClientTransport* ) * NumClients );
+        Client ** clients = (Client**) alloca( sizeof( Client* ) * NumClients );
+
+        uint8_t connectToken[ConnectTokenBytes];
+        memset( connectToken, 0, sizeof( connectToken ) );
+
+        for ( int i = 0; i < NumClients; ++i )
+        {
+            clientTransport[i] = YOJIMBO_NEW( GetDefaultAllocator(), MemoryClientTransport, memoryTransport );
+            clients[i] = YOJIMBO_NEW( GetDefaultAllocator(), Client, GetDefaultAllocator(), *clientTransport[i], config, adapter, time );
+            clients[i]->Connect( i + 1, connectToken );
+        }
+
+        for ( int i = 0; i < 10 && server.GetNumConnectedClients() < NumClients; ++i )
+        {
+            time += DeltaTime;
+            for ( int j = 0; j < NumClients; ++j )
+                clients[j]->AdvanceTime( time );
+            server.AdvanceTime( time );
+        }
+
+        serverTransport.ResetCounters();
+        serverTransport.ResetKeepAliveCounters();
+
+        for ( int i = 0; i < NumTicks; ++i )
+        {
+            for ( int j = 0; j < NumClients; ++j )
+                clients[j]->SendPackets();
+
+            time += DeltaTime;
+
+            server.ReceivePackets();
+            server.AdvanceTime( time );
+            server.SendPackets();
+
+            for ( int j = 0; j < NumClients; ++j )
+            {
+                clients[j]->ReceivePackets();
+                clients[j]->AdvanceTime( time );
+            }
+        }
+
+        const double elapsed = NumTicks * DeltaTime;
+
+        for ( int i = 0; i < NumClients; ++i )
+        {
+            clients[i]->Disconnect();
+            YOJIMBO_DELETE( GetDefaultAllocator(), Client, clients[i] );
+            YOJIMBO_DELETE( GetDefaultAllocator(), MemoryClientTransport, clientTransport[i] );
+        }
+
+        server.Stop();
+
+        char name[64];
+        if ( keepAliveInterval[setupIndex] > 0.0f )
+            snprintf( name, sizeof( name ), "keep-alive %.1fs", keepAliveInterval[setupIndex] );
+        else
+            snprintf( name, sizeof( name ), "send every tick" );
+
+        const double wirePacketsSent = ( serverTransport.numPacketsSent + serverTransport.numKeepAlivesSent ) / elapsed;
+        const double wirePacketsReceived = ( serverTransport.numPacketsReceived + serverTransport.numKeepAlivesReceived ) / elapsed;
+
+        if ( setupIndex == 0 )
+            everyTickWirePacketsSent = wirePacketsSent;
+
+        printf( "    %-24s %6.0f packets sent per second %6.0f on the wire (%3.0f%% saved) %6.0f received on the wire\n", 
+            name, 
+            serverTransport.numPacketsSent / elapsed, 
+            wirePacketsSent,
+            100.0 * ( 1.0 - wirePacketsSent / everyTickWirePacketsSent ),
+            wirePacketsReceived );
+    }
+}
+
+static void benchmark_broadcast_message()
+{
+    printf( "\nbroadcast message (one reliable message to every client, send calls only)\n\n" );
+
+    // per client creates and measures the message once for each client. broadcast creates and measures it once and
+    // queues a small reference to it on each client connection.
+
+    const int NumTicks = 100;
+    const int numClients[] = { 16, 64, 256 };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( numClients ) / sizeof( numClients[0] ) ); ++setupIndex )
+    {
+        const int NumClients = numClients[setupIndex];
+
+        ClientServerConfig config;
+        config.networkSimulator = false;
+        config.serverPerClientMemory = 256 * 1024;
+        config.serverBroadcastMemory = 64 * 1024;
+
+        double time = 0.0;
+
+        MemoryServerTransport serverTransport( GetDefaultAllocator(), Address( "127.0.0.1", ServerPort ) );
+
+        Server server( GetDefaultAllocator(), serverTransport, config, adapter, time );
+
+        server.Start( NumClients );
+
+        MemoryClientTransport ** clientTransport = (MemoryClientTransport**) alloca( sizeof( MemoryClientTransport* ) * NumClients );
+        Client ** clients = (Client**) alloca( sizeof( Client* ) * NumClients );
+
+        uint8_t connectToken[ConnectTokenBytes];
+        memset( connectToken, 0, sizeof( connectToken ) );
+
+        for ( int i = 0; i < NumClients; ++i )
+        {
+            clientTransport[i] = YOJIMBO_NEW( GetDefaultAllocator(), MemoryClientTransport, serverTransport );
+            clients[i] = YOJIMBO_NEW( GetDefaultAllocator(), Client, GetDefaultAllocator(), *clientTransport[i], config, adapter, time );
+            clients[i]->Connect( i + 1, connectToken );
+        }
+
+        for ( int i = 0; i < 10 && server.GetNumConnectedClients() < NumClients; ++i )
+        {
+            time += 0.01;
+            for ( int j = 0; j < NumClients; ++j )
+                clients[j]->AdvanceTime( time );
+            server.AdvanceTime( time );
+        }
+
+        double sendTime[2] = { 0.0, 0.0 };
+
+        for ( int i = 0; i < NumTicks * 2; ++i )
+        {
+            const int broadcast = i % 2;
+
+            const uint16_t sequence = uint16_t( i );
+
+            const double startTime = yojimbo_time();
+
+            if ( broadcast )
+            {
+                TestMessage * message = (TestMessage*) server.CreateBroadcastMessage( TEST_MESSAGE );
+                message->sequence = sequence;
+                server.BroadcastMessage( 0, message, NULL );
+            }
+            else
+            {
+                for ( int j = 0; j < NumClients; ++j )
+                {
+                    const int clientIndex = clients[j]->GetClientIndex();
+                    TestMessage * message = (TestMessage*) server.CreateMessage( clientIndex, TEST_MESSAGE );
+                    message->sequence = sequence;
+                    server.SendMessage( clientIndex, 0, message );
+                }
+            }
+
+            sendTime[broadcast] += yojimbo_time() - startTime;
+
+            time += 0.01;
+
+            server.AdvanceTime( time );
+            server.SendPackets();
+
+            for ( int j = 0; j < NumClients; ++j )
+            {
+                clients[j]->ReceivePackets();
+                clients[j]->AdvanceTime( time );
+                while ( Message * message = clients[j]->ReceiveMessage( 0 ) )
+                    clients[j]->ReleaseMessage( message );
+                clients[j]->SendPackets();
+            }
+
+            server.ReceivePackets();
+        }
+
+        for ( int i = 0; i < NumClients; ++i )
+        {
+            clients[i]->Disconnect();
+            YOJIMBO_DELETE( GetDefaultAllocator(), Client, clients[i] );
+            YOJIMBO_DELETE( GetDefaultAllocator(), MemoryClientTransport, clientTransport[i] );
+        }
+
+        server.Stop();
+
+        char name[64];
+        snprintf( name, sizeof( name ), "%d clients", NumClients );
+
+        printf( "    %-24s %8.2f us one client at a time %8.2f us broadcast (%.1fx faster)\n", 
+            name, 
+            sendTime[0] / NumTicks * 1000000.0, 
+            sendTime[1] / NumTicks * 1000000.0, 
+            sendTime[0] / sendTime[1] );
+    }
+}
+
+int main()
+{
+    printf( "\nbenchmark\n" );
+
+    if ( !InitializeYojimbo() )
+    {
+        printf( "error: failed to initialize Yojimbo!\n" );
+        return 1;
+    }
+
+    yojimbo_log_level( YOJIMBO_LOG_LEVEL_NONE );
+
+    srand( (unsigned int) time( NULL ) );
+
+    benchmark_channel_scheduling();
+
+    benchmark_message_expiry();
+
+    benchmark_batch_messages();
+
+    benchmark_process_acks();
+
+    benchmark_ack_bursts();
+
+    benchmark_block_fragments();
+
+    benchmark_message_aggregation();
+
+    benchmark_block_parity();
+
+    benchmark_packet_parity();
+
+    benchmark_sent_packet_message_ids();
+
+    benchmark_packet_fill();
+
+    benchmark_server_tick();
+
+    benchmark_server_worker_threads();
+
+    benchmark_network_thread_latency();
+
+    benchmark_memory_transport();
+
+    benchmark_transport_packet_rate();
+
+#if defined(__linux__)
+    benchmark_udp_transport_packet_rate();
+#endif // #if defined(__linux__)
+
+    benchmark_idle_keep_alive();
+
+    benchmark_broadcast_message();
+
+    ShutdownYojimbo();
+
+    printf( "\n" );
+
+    return 0;
+}
@@ -13,6 +13,7 @@ solution "Yojimbo"
         libdirs { "./windows" }
     else
         includedirs { ".", "/usr/local/include", "netcode.io", "reliable.io" }
+        links { "pthread" }
         targetdir "bin/"  
     end
     rtti "Off"
@@ -61,6 +62,10 @@ project "soak"
     files { "soak.cpp", "shared.h" }
     links { "yojimbo" }
 
+project "benchmark"
+    files { "benchmark.cpp", "shared.h" }
+    links { "yojimbo" }
+
 if not os.is "windows" then
 
     -- MacOSX and Linux.
@@ -219,6 +224,18 @@ if not os.is "windows" then
         end
     }
 
+    newaction
+    {
+        trigger     = "benchmark",
+        description = "Build and run benchmarks",
+        execute = function ()
+            os.execute "test ! -e Makefile && premake5 gmake"
+            if os.execute "make -j32 benchmark" == 0 then
+                os.execute "./bin/benchmark"
+            end
+        end
+    }
+
     newaction
     {
         trigger     = "cppcheck",
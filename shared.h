@@ -160,4 +160,183 @@ public:
 
 static TestAdapter adapter;
 
+// Server without sockets or netcode.io, for tests and benchmarks. Every packet sent to a client slot is echoed back
+// into the same slot, so each slot's connection talks to itself: messages sent to a client are received from that
+// client, and packets are acked once they come back. Slots are connected directly with ConnectClient.
+
+class EchoServer : public BaseServer
+{
+public:
+
+    EchoServer( Allocator & allocator, const ClientServerConfig & config, Adapter & adapter, double time ) 
+        : BaseServer( allocator, config, adapter, time )
+    {
+        m_allocator = &allocator;
+        m_connected = NULL;
+        m_numPackets = 0;
+        m_maxPackets = 0;
+        m_packetClientIndex = NULL;
+        m_packetBytes = NULL;
+        m_packetData = NULL;
+        m_packetHash = 0xCBF29CE484222325ULL;
+        m_numPacketsSent = 0;
+    }
+
+    ~EchoServer()
+    {
+        Stop();
+    }
+
+    void Start( int maxClients )
+    {
+        Stop();
+        BaseServer::Start( maxClients );
+        m_connected = (bool*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( bool ) * maxClients );
+        memset( m_connected, 0, sizeof( bool ) * maxClients );
+        m_maxPackets = maxClients * MaxQueuedClientPackets;
+        m_packetClientIndex = (int*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( int ) * m_maxPackets );
+        m_packetBytes = (int*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( int ) * m_maxPackets );
+        m_packetData = (uint8_t**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint8_t* ) * m_maxPackets );
+    }
+
+    // with ClientServerConfig::networkThread, call this once the initial clients are connected
+
+    void StartNetworkThread()
+    {
+        BaseServer::StartNetworkThread();
+    }
+
+    void Stop()
+    {
+        if ( !IsRunning() )
+            return;
+        StopNetworkThread();
+        for ( int i = 0; i < m_numPackets; ++i )
+            YOJIMBO_FREE( *m_allocator, m_packetData[i] );
+        m_numPackets = 0;
+        YOJIMBO_FREE( *m_allocator, m_packetData );
+        YOJIMBO_FREE( *m_allocator, m_packetBytes );
+        YOJIMBO_FREE( *m_allocator, m_packetClientIndex );
+        YOJIMBO_FREE( *m_allocator, m_connected );
+        BaseServer::Stop();
+    }
+
+    void ConnectClient( int clientIndex )
+    {
+        yojimbo_assert( !m_connected[clientIndex] );
+        m_connected[clientIndex] = true;
+        AddActiveClient( clientIndex );
+    }
+
+    void DisconnectClient( int clientIndex )
+    {
+        if ( DeferToNetworkThread() )
+        {
+            RequestDisconnectClient( clientIndex );
+            return;
+        }
+        if ( !m_connected[clientIndex] )
+            return;
+        m_connected[clientIndex] = false;
+        RemoveActiveClient( clientIndex );
+        ResetClient( clientIndex );
+    }
+
+    void DisconnectAllClients()
+    {
+        if ( DeferToNetworkThread() )
+        {
+            RequestDisconnectAllClients();
+            return;
+        }
+        for ( int i = 0; i < GetMaxClients(); ++i )
+            DisconnectClient( i );
+    }
+
+    void SendPackets()
+    {
+        if ( DeferToNetworkThread() )
+            return;
+        SendClientPackets();
+    }
+
+    void ReceivePackets()
+    {
+        if ( DeferToNetworkThread() )
+            return;
+        for ( int i = 0; i < m_numPackets; ++i )
+        {
+            const int clientIndex = m_packetClientIndex[i];
+            if ( m_connected[clientIndex] && CanReceiveClientPacket( clientIndex ) )
+                ReceiveClientPacket( clientIndex, m_packetData[i], m_packetBytes[i] );
+            YOJIMBO_FREE( *m_allocator, m_packetData[i] );
+        }
+        m_numPackets = 0;
+        ProcessReceivedClientPackets();
+    }
+
+    bool IsClientConnected( int clientIndex ) const
+    {
+        if ( DeferToNetworkThread() )
+            return IsClientConnectedOutsideNetworkThread( clientIndex );
+        return m_connected[clientIndex];
+    }
+
+    uint64_t GetClientId( int clientIndex ) const { return uint64_t( clientIndex ); }
+
+    int GetNumConnectedClients() const
+    {
+        if ( DeferToNetworkThread() )
+            return GetNumConnectedClientsOutsideNetworkThread();
+        return GetNumActiveClients();
+    }
+
+    void ConnectLoopbackClient( int /*clientIndex*/, uint64_t /*clientId*/, const uint8_t * /*userData*/ ) {}
+
+    void DisconnectLoopbackClient( int /*clientIndex*/ ) {}
+
+    bool IsLoopbackClient( int /*clientIndex*/ ) const { return false; }
+
+    void ProcessLoopbackPacket( int /*clientIndex*/, const uint8_t * /*packetData*/, int /*packetBytes*/, uint64_t /*packetSequence*/ ) {}
+
+    uint64_t GetNumPacketsSent() const { return m_numPacketsSent; }
+
+    // hash of every packet sent, in send order. two servers given the same traffic should always agree on this.
+
+    uint64_t GetPacketHash() const { return m_packetHash; }
+
+private:
+
+    void TransmitPacketFunction( int clientIndex, uint16_t /*packetSequence*/, uint8_t * packetData, int packetBytes )
+    {
+        m_numPacketsSent++;
+        m_packetHash = ( m_packetHash ^ uint64_t( clientIndex ) ) * 0x100000001B3ULL;
+        for ( int i = 0; i < packetBytes; ++i )
+            m_packetHash = ( m_packetHash ^ packetData[i] ) * 0x100000001B3ULL;
+        if ( m_numPackets == m_maxPackets )
+            return;
+        uint8_t * packetCopy = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, packetBytes );
+        memcpy( packetCopy, packetData, packetBytes );
+        m_packetClientIndex[m_numPackets] = clientIndex;
+        m_packetBytes[m_numPackets] = packetBytes;
+        m_packetData[m_numPackets] = packetCopy;
+        m_numPackets++;
+    }
+
+    int ProcessPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    {
+        return (int) GetClientConnection( clientIndex ).ProcessPacket( GetContext(), packetSequence, packetData, packetBytes );
+    }
+
+    Allocator * m_allocator;
+    bool * m_connected;
+    int m_numPackets;
+    int m_maxPackets;
+    int * m_packetClientIndex;
+    int * m_packetBytes;
+    uint8_t ** m_packetData;
+    uint64_t m_packetHash;
+    uint64_t m_numPacketsSent;
+};
+
 #endif // #ifndef SHARED_H
@@ -28,6 +28,12 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <inttypes.h>
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif // #if defined(__linux__)
 
 #include "shared.h"
 
@@ -731,6 +737,16 @@ void test_bit_array()
         }
     }
 
+    // find each set bit by scanning forward from every index
+
+    for ( int i = 0; i < Size; ++i )
+    {
+        const int expected = ( ( i + 9 ) / 10 ) * 10;
+        check( bit_array.FindNextSetBit( i ) == ( expected < Size ? expected : -1 ) );
+    }
+
+    check( bit_array.FindNextSetBit( Size ) == -1 );
+
     // clear and verify all bits are zero
 
     bit_array.Clear();
@@ -739,6 +755,50 @@ void test_bit_array()
     {
         check( bit_array.GetBit(i) == 0 );
     }
+
+    check( bit_array.FindNextSetBit( 0 ) == -1 );
+
+    bit_array.SetBit( Size - 1 );
+
+    check( bit_array.FindNextSetBit( 0 ) == Size - 1 );
+    check( bit_array.FindNextSetBit( Size - 1 ) == Size - 1 );
+    check( bit_array.CountSetBits() == 1 );
+
+    // set a range crossing word boundaries and verify count and find first clear bit
+
+    bit_array.Clear();
+
+    bit_array.SetBitRange( 3, 200 );
+
+    for ( int i = 0; i < Size; ++i )
+    {
+        check( bit_array.GetBit( i ) == ( ( i >= 3 && i < 200 ) ? 1 : 0 ) );
+    }
+
+    check( bit_array.CountSetBits() == 197 );
+    check( bit_array.FindNextClearBit( 0 ) == 0 );
+    check( bit_array.FindNextClearBit( 3 ) == 200 );
+    check( bit_array.FindNextClearBit( 64 ) == 200 );
+    check( bit_array.FindNextClearBit( Size ) == -1 );
+
+    // clear a range inside the set range
+
+    bit_array.ClearBitRange( 64, 128 );
+
+    check( bit_array.CountSetBits() == 197 - 64 );
+    check( bit_array.FindNextClearBit( 3 ) == 64 );
+    check( bit_array.FindNextSetBit( 64 ) == 128 );
+
+    // set all bits and verify there is no clear bit
+
+    bit_array.SetBitRange( 0, Size );
+
+    check( bit_array.CountSetBits() == Size );
+    check( bit_array.FindNextClearBit( 0 ) == -1 );
+
+    bit_array.ClearBitRange( 0, Size );
+
+    check( bit_array.CountSetBits() == 0 );
 }
 
 struct TestSequenceData
@@ -1014,49 +1074,37 @@ void test_connection_reliable_ordered_blocks()
     check( numMessagesReceived == NumMessagesSent );
 }
 
-void test_connection_reliable_ordered_messages_and_blocks()
+void test_connection_reliable_ordered_blocks_parity()
 {
     TestMessageFactory messageFactory( GetDefaultAllocator() );
 
     double time = 100.0;
-    
+
+    // small fragments so blocks span several parity groups, and the last group is usually short. packets are sent
+    // much faster than the fragment resend time, so parity fragments go out before lost fragments are resent.
+
     ConnectionConfig connectionConfig;
-    
-    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    connectionConfig.channel[0].blockFragmentSize = 128;
+    connectionConfig.channel[0].blockParityGroupSize = 4;
 
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
     Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
 
     const int NumMessagesSent = 32;
 
     for ( int i = 0; i < NumMessagesSent; ++i )
     {
-        if ( rand() % 2 )
-        {
-            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
-            check( message );
-            message->sequence = i;
-            sender.SendMessage( 0, message );
-        }
-        else
-        {
-            TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
-            check( message );
-            message->sequence = i;
-            const int blockSize = 1 + ( ( i * 901 ) % 3333 );
-            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
-            for ( int j = 0; j < blockSize; ++j )
-                blockData[j] = i + j;
-            message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
-            sender.SendMessage( 0, message );
-        }
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = i;
+        const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+        for ( int j = 0; j < blockSize; ++j )
+            blockData[j] = i + j;
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+        sender.SendMessage( 0, message );
     }
 
-    const int SenderPort = 10000;
-    const int ReceiverPort = 10001;
-
-    Address senderAddress( "::1", SenderPort );
-    Address receiverAddress( "::1", ReceiverPort );
-
     int numMessagesReceived = 0;
 
     uint16_t senderSequence = 0;
@@ -1066,7 +1114,7 @@ void test_connection_reliable_ordered_messages_and_blocks()
 
     for ( int i = 0; i < NumIterations; ++i )
     {
-        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.01f, 25 );
 
         while ( true )
         {
@@ -1076,42 +1124,27 @@ void test_connection_reliable_ordered_messages_and_blocks()
 
             check( message->GetId() == (int) numMessagesReceived );
 
-            switch ( message->GetType() )
-            {
-                case TEST_MESSAGE:
-                {
-                    TestMessage * testMessage = (TestMessage*) message;
-
-                    check( testMessage->sequence == uint16_t( numMessagesReceived ) );
-
-                    ++numMessagesReceived;
-                }
-                break;
+            check( message->GetType() == TEST_BLOCK_MESSAGE );
 
-                case TEST_BLOCK_MESSAGE:
-                {
-                    TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
 
-                    check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+            check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
 
-                    const int blockSize = blockMessage->GetBlockSize();
+            const int blockSize = blockMessage->GetBlockSize();
 
-                    check( blockSize == 1 + ( ( numMessagesReceived * 901 ) % 3333 ) );
-        
-                    const uint8_t * blockData = blockMessage->GetBlockData();
+            check( blockSize == 1 + ( ( numMessagesReceived * 901 ) % 3333 ) );
 
-                    check( blockData );
+            const uint8_t * blockData = blockMessage->GetBlockData();
 
-                    for ( int j = 0; j < blockSize; ++j )
-                    {
-                        check( blockData[j] == uint8_t( numMessagesReceived + j ) );
-                    }
+            check( blockData );
 
-                    ++numMessagesReceived;
-                }
-                break;
+            for ( int j = 0; j < blockSize; ++j )
+            {
+                check( blockData[j] == uint8_t( numMessagesReceived + j ) );
             }
 
+            ++numMessagesReceived;
+
             messageFactory.ReleaseMessage( message );
         }
 
@@ -1122,170 +1155,176 @@ void test_connection_reliable_ordered_messages_and_blocks()
     check( numMessagesReceived == NumMessagesSent );
 }
 
-void test_connection_reliable_ordered_messages_and_blocks_multiple_channels()
+void test_connection_unreliable_parity()
 {
-    const int NumChannels = 2;
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
 
     double time = 100.0;
-    
-    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    // one message per packet, so each group of four packets is followed by a parity entry in the next packet. the
+    // second packet of every group is lost and rebuilt from parity. packet 10 is lost as well, which leaves its group
+    // with two losses that parity can't rebuild.
 
     ConnectionConfig connectionConfig;
-    connectionConfig.numChannels = NumChannels;
-    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
-    connectionConfig.channel[0].maxMessagesPerPacket = 8;
-    connectionConfig.channel[1].type = CHANNEL_TYPE_RELIABLE_ORDERED;
-    connectionConfig.channel[1].maxMessagesPerPacket = 8;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[0].packetParityGroupSize = 4;
 
     Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
-
     Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
 
-    const int NumMessagesSent = 32;
+    const int NumMessagesSent = 40;
+    const int NumPackets = NumMessagesSent + 4;
 
-    for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+    uint8_t packetData[1024];
+    uint8_t lostPacketData[2][1024];
+    int lostPacketBytes[2] = { 0, 0 };
+
+    int numTimesReceived[NumMessagesSent];
+    memset( numTimesReceived, 0, sizeof( numTimesReceived ) );
+
+    for ( int i = 0; i < NumPackets; ++i )
     {
-        for ( int i = 0; i < NumMessagesSent; ++i )
+        if ( i < NumMessagesSent )
         {
-            if ( rand() % 2 )
-            {
-                TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
-                check( message );
-                message->sequence = i;
-                sender.SendMessage( channelIndex, message );
-            }
-            else
-            {
-                TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
-                check( message );
-                message->sequence = i;
-                const int blockSize = 1 + ( ( i * 901 ) % 3333 );
-                uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
-                for ( int j = 0; j < blockSize; ++j )
-                    blockData[j] = i + j;
-                message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
-                sender.SendMessage( channelIndex, message );
-            }
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            sender.SendMessage( 0, message );
         }
-    }
-
-    const int SenderPort = 10000;
-    const int ReceiverPort = 10001;
-
-    Address senderAddress( "::1", SenderPort );
-    Address receiverAddress( "::1", ReceiverPort );
-
-    const int NumIterations = 10000;
-
-    int numMessagesReceived[NumChannels];
-    memset( numMessagesReceived, 0, sizeof( numMessagesReceived ) );
 
-    uint16_t senderSequence = 0;
-    uint16_t receiverSequence = 0;
-
-    for ( int i = 0; i < NumIterations; ++i )
-    {
-        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+        const uint16_t sequence = uint16_t( i );
 
-        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+        int packetBytes = 0;
+        if ( sender.GeneratePacket( NULL, sequence, packetData, sizeof( packetData ), packetBytes ) )
         {
-            while ( true )
+            if ( i == 1 || i == 37 )
             {
-                Message * message = receiver.ReceiveMessage( channelIndex );
-                if ( !message )
-                    break;
-
-                check( message->GetId() == (int) numMessagesReceived[channelIndex] );
-
-                switch ( message->GetType() )
-                {
-                    case TEST_MESSAGE:
-                    {
-                        TestMessage * testMessage = (TestMessage*) message;
-
-                        check( testMessage->sequence == uint16_t( numMessagesReceived[channelIndex] ) );
+                const int lostIndex = ( i == 1 ) ? 0 : 1;
+                memcpy( lostPacketData[lostIndex], packetData, packetBytes );
+                lostPacketBytes[lostIndex] = packetBytes;
+            }
 
-                        ++numMessagesReceived[channelIndex];
-                    }
-                    break;
+            if ( ( i % 4 ) != 1 && i != 10 )
+                check( receiver.ProcessPacket( NULL, sequence, packetData, packetBytes ) );
+        }
 
-                    case TEST_BLOCK_MESSAGE:
-                    {
-                        TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+        time += 0.01;
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
 
-                        check( blockMessage->sequence == uint16_t( numMessagesReceived[channelIndex] ) );
+        while ( Message * message = receiver.ReceiveMessage( 0 ) )
+        {
+            check( message->GetType() == TEST_MESSAGE );
+            const int messageSequence = ( (TestMessage*) message )->sequence;
+            check( messageSequence >= 0 && messageSequence < NumMessagesSent );
+            check( message->GetId() == messageSequence );
+            numTimesReceived[messageSequence]++;
+            messageFactory.ReleaseMessage( message );
+        }
+    }
 
-                        const int blockSize = blockMessage->GetBlockSize();
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        if ( i == 9 || i == 10 )
+            check( numTimesReceived[i] == 0 );
+        else
+            check( numTimesReceived[i] == 1 );
+    }
 
-                        check( blockSize == 1 + ( ( numMessagesReceived[channelIndex] * 901 ) % 3333 ) );
-            
-                        const uint8_t * blockData = blockMessage->GetBlockData();
+    // a lost packet that turns up after it was rebuilt doesn't deliver its messages again. neither does one so late
+    // that the receiver no longer knows whether it was rebuilt
 
-                        check( blockData );
+    check( lostPacketBytes[0] > 0 );
+    check( lostPacketBytes[1] > 0 );
+    check( receiver.ProcessPacket( NULL, 37, lostPacketData[1], lostPacketBytes[1] ) );
+    check( receiver.ReceiveMessage( 0 ) == NULL );
+    check( receiver.ProcessPacket( NULL, 1, lostPacketData[0], lostPacketBytes[0] ) );
+    check( receiver.ReceiveMessage( 0 ) == NULL );
+}
 
-                        for ( int j = 0; j < blockSize; ++j )
-                        {
-                            check( blockData[j] == uint8_t( numMessagesReceived[channelIndex] + j ) );
-                        }
+class TestBlockSource : public BlockSource
+{
+public:
 
-                        ++numMessagesReceived[channelIndex];
-                    }
-                    break;
-                }
+    explicit TestBlockSource( int seed = 0 ) : seed( seed ) {}
 
-                messageFactory.ReleaseMessage( message );
-            }
-        }
+    bool ReadBlockData( int offset, uint8_t * data, int bytes )
+    {
+        for ( int i = 0; i < bytes; ++i )
+            data[i] = uint8_t( seed + offset + i );
+        return true;
+    }
 
-        bool receivedAllMessages = true;
+    int seed;
+};
 
-        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
-        {
-            if ( numMessagesReceived[channelIndex] != NumMessagesSent )
-            {
-                receivedAllMessages = false;
-                break;
-            }
-        }
+class TestBlockSink : public BlockSink
+{
+public:
 
-        if ( receivedAllMessages )
-            break;
-    }
+    TestBlockSink( uint8_t * data, int maxBytes ) : data( data ), maxBytes( maxBytes ), bytesWritten( 0 ), messageId( 0 ) {}
 
-    for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+    bool WriteBlockData( uint16_t id, int offset, const uint8_t * fragmentData, int bytes )
     {
-        check( numMessagesReceived[channelIndex] == NumMessagesSent );
+        if ( offset < 0 || offset + bytes > maxBytes )
+            return false;
+        memcpy( data + offset, fragmentData, bytes );
+        bytesWritten += bytes;
+        messageId = id;
+        return true;
     }
-}
 
-void test_connection_unreliable_unordered_messages()
+    uint8_t * data;
+    int maxBytes;
+    int bytesWritten;
+    uint16_t messageId;
+};
+
+void test_connection_reliable_ordered_blocks_streamed()
 {
     TestMessageFactory messageFactory( GetDefaultAllocator() );
 
     double time = 100.0;
 
+    // streamed blocks are many times larger than the maximum block size, so they only fit through the channel a window
+    // of eight fragments at a time. regular blocks are sent in between to check the channel switches back and forth.
+
     ConnectionConfig connectionConfig;
-    connectionConfig.numChannels = 1;
-    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[0].blockFragmentSize = 128;
+    connectionConfig.channel[0].maxBlockSize = 1024;
 
-    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
-    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    const int NumMessagesSent = 16;
+    const int MaxStreamedBlockSize = 4000 + NumMessagesSent * 531;
 
-    const int SenderPort = 10000;
-    const int ReceiverPort = 10001;
+    TestBlockSource blockSource[NumMessagesSent];
 
-    Address senderAddress( "::1", SenderPort );
-    Address receiverAddress( "::1", ReceiverPort );
+    uint8_t * streamedData = (uint8_t*) YOJIMBO_ALLOCATE( GetDefaultAllocator(), MaxStreamedBlockSize );
 
-    const int NumIterations = 256;
+    TestBlockSink blockSink( streamedData, MaxStreamedBlockSize );
 
-    const int NumMessagesSent = 16;
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
 
-    for ( int j = 0; j < NumMessagesSent; ++j )
+    receiver.SetBlockSink( 0, &blockSink );
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
     {
-        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
         check( message );
-        message->sequence = j;
+        message->sequence = i;
+        if ( ( i % 2 ) == 0 )
+        {
+            blockSource[i].seed = i;
+            message->AttachBlockSource( &blockSource[i], 4000 + i * 531 );
+        }
+        else
+        {
+            const int blockSize = 1 + ( ( i * 97 ) % 1024 );
+            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+            for ( int j = 0; j < blockSize; ++j )
+                blockData[j] = i + j;
+            message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+        }
         sender.SendMessage( 0, message );
     }
 
@@ -1294,9 +1333,11 @@ void test_connection_unreliable_unordered_messages()
     uint16_t senderSequence = 0;
     uint16_t receiverSequence = 0;
 
+    const int NumIterations = 10000;
+
     for ( int i = 0; i < NumIterations; ++i )
     {
-        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 25 );
 
         while ( true )
         {
@@ -1304,11 +1345,45 @@ void test_connection_unreliable_unordered_messages()
             if ( !message )
                 break;
 
-            check( message->GetType() == TEST_MESSAGE );
+            check( message->GetId() == (int) numMessagesReceived );
 
-            TestMessage * testMessage = (TestMessage*) message;
+            check( message->GetType() == TEST_BLOCK_MESSAGE );
 
-            check( testMessage->sequence == uint16_t( numMessagesReceived ) );
+            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+            check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+
+            const int blockSize = blockMessage->GetBlockSize();
+
+            if ( ( numMessagesReceived % 2 ) == 0 )
+            {
+                check( blockMessage->IsStreamedBlock() );
+                check( !blockMessage->GetBlockData() );
+                check( blockSize == 4000 + numMessagesReceived * 531 );
+                check( blockSink.bytesWritten == blockSize );
+                check( blockSink.messageId == message->GetId() );
+
+                for ( int j = 0; j < blockSize; ++j )
+                {
+                    check( streamedData[j] == uint8_t( numMessagesReceived + j ) );
+                }
+
+                blockSink.bytesWritten = 0;
+            }
+            else
+            {
+                check( !blockMessage->IsStreamedBlock() );
+                check( blockSize == 1 + ( ( numMessagesReceived * 97 ) % 1024 ) );
+
+                const uint8_t * blockData = blockMessage->GetBlockData();
+
+                check( blockData );
+
+                for ( int j = 0; j < blockSize; ++j )
+                {
+                    check( blockData[j] == uint8_t( numMessagesReceived + j ) );
+                }
+            }
 
             ++numMessagesReceived;
 
@@ -1320,265 +1395,2539 @@ void test_connection_unreliable_unordered_messages()
     }
 
     check( numMessagesReceived == NumMessagesSent );
+
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+
+    YOJIMBO_FREE( GetDefaultAllocator(), streamedData );
 }
 
-void test_connection_unreliable_unordered_blocks()
+void test_connection_packet_top_up()
 {
     TestMessageFactory messageFactory( GetDefaultAllocator() );
 
     double time = 100.0;
-    
+
     ConnectionConfig connectionConfig;
-    connectionConfig.numChannels = 1;
-    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.maxPacketSize = 1024;
+    connectionConfig.channel[0].blockFragmentSize = 64;
 
     Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
-
     Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
 
-    const int SenderPort = 10000;
-    const int ReceiverPort = 10001;
+    const int BlockSize = 64 * 64;
 
-    Address senderAddress( "::1", SenderPort );
-    Address receiverAddress( "::1", ReceiverPort );
+    TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+    check( message );
+    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+    for ( int i = 0; i < BlockSize; ++i )
+        blockData[i] = uint8_t( i );
+    message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+    sender.SendMessage( 0, message );
 
-    const int NumIterations = 256;
+    uint8_t packetData[1024];
 
-    const int NumMessagesSent = 8;
+    uint16_t sequence = 0;
 
-    for ( int j = 0; j < NumMessagesSent; ++j )
+    bool received = false;
+
+    int numPackets = 0;
+
+    while ( !received && numPackets < 100 )
     {
-        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
-        check( message );
-        message->sequence = j;
-        const int blockSize = 1 + ( j * 7 );
-        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
-        for ( int k = 0; k < blockSize; ++k )
-            blockData[k] = j + k;
-        message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
-        sender.SendMessage( 0, message );
-    }
+        int packetBytes = 0;
+        check( sender.GeneratePacket( NULL, sequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+        check( packetBytes <= connectionConfig.maxPacketSize );
 
-    int numMessagesReceived = 0;
+        // every packet is filled with fragments up to the last few bytes, not just the first one
 
-    uint16_t senderSequence = 0;
-    uint16_t receiverSequence = 0;
+        if ( numPackets == 0 )
+            check( packetBytes >= connectionConfig.maxPacketSize * 9 / 10 );
 
-    for ( int i = 0; i < NumIterations; ++i )
-    {
-        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+        // drop the second packet, so the fragments topped up into it have to be resent
 
-        while ( true )
+        if ( sequence != 1 )
         {
-            Message * message = receiver.ReceiveMessage( 0 );
-            if ( !message )
-                break;
+            check( receiver.ProcessPacket( NULL, sequence, packetData, packetBytes ) );
+            sender.ProcessAcks( &sequence, 1 );
+        }
 
-            check( message->GetType() == TEST_BLOCK_MESSAGE );
+        time += 0.1;
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
 
-            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+        Message * receivedMessage = receiver.ReceiveMessage( 0 );
+        if ( receivedMessage )
+        {
+            check( receivedMessage->GetType() == TEST_BLOCK_MESSAGE );
+            BlockMessage * blockMessage = (BlockMessage*) receivedMessage;
+            check( blockMessage->GetBlockSize() == BlockSize );
+            for ( int i = 0; i < BlockSize; ++i )
+                check( blockMessage->GetBlockData()[i] == uint8_t( i ) );
+            receiver.ReleaseMessage( receivedMessage );
+            received = true;
+        }
 
-            check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+        sequence++;
+        numPackets++;
+    }
 
-            const int blockSize = blockMessage->GetBlockSize();
+    check( received );
 
-            check( blockSize == 1 + ( numMessagesReceived * 7 ) );
+    // 64 fragments at 14 per packet is 5 packets, plus one to resend the lost packet after blockFragmentResendTime
 
-            const uint8_t * blockData = blockMessage->GetBlockData();
+    check( numPackets <= 8 );
+}
 
-            check( blockData );
+void test_connection_bandwidth_limit()
+{
+    // 64 kbps is 8000 bytes per second. sent at 100 ticks per second with plenty of messages queued, packets
+    // should come out at about 80 bytes each on the wire once the initial bucket is spent, and the total on the wire,
+    // packet data plus packetOverhead per datagram, should track the limit. at 512 kbps packets are above
+    // fragmentPacketsAbove, so each fragment pays the overhead.
 
-            for ( int j = 0; j < blockSize; ++j )
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.maxPacketSize = 1024;
+    connectionConfig.fragmentPacketsAbove = 256;
+    connectionConfig.packetFragmentSize = 256;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+
+    const int NumTicks = 1000;
+    const double DeltaTime = 0.01;
+
+    uint8_t packetData[1024];
+
+    uint16_t sequence = 0;
+
+    const int bandwidthLimit[] = { 64, 512 };
+
+    for ( int setupIndex = 0; setupIndex < int( sizeof( bandwidthLimit ) / sizeof( bandwidthLimit[0] ) ); ++setupIndex )
+    {
+        connectionConfig.bandwidthLimit = bandwidthLimit[setupIndex];
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        const int BytesPerSecond = connectionConfig.bandwidthLimit * 1000 / 8;
+
+        int totalBytes = 0;
+        int numFragmentedPackets = 0;
+
+        for ( int i = 0; i < NumTicks; ++i )
+        {
+            while ( sender.CanSendMessage( 0 ) )
+                sender.SendMessage( 0, messageFactory.CreateMessage( TEST_MESSAGE ) );
+
+            int packetBytes = 0;
+            if ( sender.GeneratePacket( NULL, sequence++, packetData, connectionConfig.maxPacketSize, packetBytes ) )
             {
-                check( blockData[j] == uint8_t( numMessagesReceived + j ) );
+                check( packetBytes <= connectionConfig.maxPacketSize );
+                int numDatagrams = 1;
+                if ( packetBytes > connectionConfig.fragmentPacketsAbove )
+                {
+                    numDatagrams = ( packetBytes + connectionConfig.packetFragmentSize - 1 ) / connectionConfig.packetFragmentSize;
+                    numFragmentedPackets++;
+                }
+                const int wireBytes = packetBytes + numDatagrams * connectionConfig.packetOverhead;
+                if ( i >= 100 )
+                    check( wireBytes <= 2 * BytesPerSecond * DeltaTime );
+                totalBytes += wireBytes;
             }
 
-            ++numMessagesReceived;
-
-            messageFactory.ReleaseMessage( message );
+            time += DeltaTime;
+            sender.AdvanceTime( time );
         }
 
-        if ( numMessagesReceived == NumMessagesSent )
-            break;
+        const int expectedBytes = int( BytesPerSecond * NumTicks * DeltaTime );
+
+        check( totalBytes <= expectedBytes + connectionConfig.maxPacketSize * 2 );
+        check( totalBytes >= expectedBytes * 9 / 10 );
+
+        if ( setupIndex == 1 )
+            check( numFragmentedPackets > NumTicks / 2 );
     }
 
-    check( numMessagesReceived == NumMessagesSent );
-}
+    connectionConfig.bandwidthLimit = 64;
 
-void PumpClientServerUpdate( double & time, Client ** client, int numClients, Server ** server, int numServers, float deltaTime = 0.1f )
-{
-    for ( int i = 0; i < numClients; ++i )
-        client[i]->SendPackets();
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
 
-    for ( int i = 0; i < numServers; ++i )
-        server[i]->SendPackets();
+    const int BytesPerSecond = connectionConfig.bandwidthLimit * 1000 / 8;
 
-    for ( int i = 0; i < numClients; ++i )
-        client[i]->ReceivePackets();
+    // with the limit off, packets are only limited by maxPacketSize and maxMessagesPerPacket again
 
-    for ( int i = 0; i < numServers; ++i )
-        server[i]->ReceivePackets();
+    sender.SetBandwidthLimit( 0 );
 
-    time += deltaTime;
+    while ( sender.CanSendMessage( 0 ) )
+        sender.SendMessage( 0, messageFactory.CreateMessage( TEST_MESSAGE ) );
 
-    for ( int i = 0; i < numClients; ++i )
-        client[i]->AdvanceTime( time );
+    int packetBytes = 0;
+    check( sender.GeneratePacket( NULL, sequence++, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( packetBytes > 4 * BytesPerSecond * DeltaTime );
 
-    for ( int i = 0; i < numServers; ++i )
-        server[i]->AdvanceTime( time );
+    // at 1 kbps a tick adds just over a byte to the bucket. it takes a few ticks to hold the smallest packet,
+    // and the ticks in between send nothing at all
 
-    yojimbo_sleep( 0.0f );
-}
+    sender.SetBandwidthLimit( 1 );
 
-void SendClientToServerMessages( Client & client, int numMessagesToSend, int channelIndex = 0 )
-{
-    for ( int i = 0; i < numMessagesToSend; ++i )
+    int numSkipped = 0;
+
+    for ( int i = 0; i < 200; ++i )
     {
-        if ( !client.CanSendMessage( channelIndex ) )
-            break;
+        while ( sender.CanSendMessage( 0 ) )
+            sender.SendMessage( 0, messageFactory.CreateMessage( TEST_MESSAGE ) );
 
-        if ( rand() % 10 )
-        {
-            TestMessage * message = (TestMessage*) client.CreateMessage( TEST_MESSAGE );
-            check( message );
-            message->sequence = i;
-            client.SendMessage( channelIndex, message );
-        }
-        else
-        {
-            TestBlockMessage * message = (TestBlockMessage*) client.CreateMessage( TEST_BLOCK_MESSAGE );
-            check( message );
-            message->sequence = i;
-            const int blockSize = 1 + ( ( i * 901 ) % 1001 );
-            uint8_t * blockData = client.AllocateBlock( blockSize );
-            check( blockData );
-            for ( int j = 0; j < blockSize; ++j )
-                blockData[j] = i + j;
-            client.AttachBlockToMessage( message, blockData, blockSize );
-            client.SendMessage( channelIndex, message );
-        }
+        if ( !sender.GeneratePacket( NULL, sequence++, packetData, connectionConfig.maxPacketSize, packetBytes ) )
+            numSkipped++;
+
+        time += DeltaTime;
+        sender.AdvanceTime( time );
     }
+
+    check( numSkipped > 100 );
 }
 
-void SendServerToClientMessages( Server & server, int clientIndex, int numMessagesToSend, int channelIndex = 0 )
+void test_connection_skip_empty_packets()
 {
-    for ( int i = 0; i < numMessagesToSend; ++i )
-    {
-        if ( !server.CanSendMessage( clientIndex, channelIndex ) )
-            break;
+    // with keepAliveInterval set, a packet with nothing in it only goes out when acks are due or as a keep-alive
 
-        if ( rand() % 10 )
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.maxPacketSize = 1024;
+    connectionConfig.keepAliveInterval = 1.0f;
+    connectionConfig.ackDelay = 0.1f;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const double DeltaTime = 0.01;
+
+    uint8_t packetData[1024];
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    int packetBytes = 0;
+
+    // idle for two and a half seconds. only the keep-alives go out, two each way
+
+    int numPackets = 0;
+
+    for ( int i = 0; i < 250; ++i )
+    {
+        if ( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) )
         {
-            TestMessage * message = (TestMessage*) server.CreateMessage( clientIndex, TEST_MESSAGE );
-            check( message );
-            message->sequence = i;
-            server.SendMessage( clientIndex, channelIndex, message );
+            senderSequence++;
+            numPackets++;
         }
-        else
+        if ( receiver.GeneratePacket( NULL, receiverSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) )
         {
-            TestBlockMessage * message = (TestBlockMessage*) server.CreateMessage( clientIndex, TEST_BLOCK_MESSAGE );
-            check( message );
-            message->sequence = i;
-            const int blockSize = 1 + ( ( i * 901 ) % 1001 );
-            uint8_t * blockData = server.AllocateBlock( clientIndex, blockSize );
-            check( blockData );
-            for ( int j = 0; j < blockSize; ++j )
-                blockData[j] = i + j;
-            server.AttachBlockToMessage( clientIndex, message, blockData, blockSize );
-            server.SendMessage( clientIndex, channelIndex, message );
+            receiverSequence++;
+            numPackets++;
         }
+        time += DeltaTime;
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
     }
-}
 
-void ProcessServerToClientMessages( Client & client, int & numMessagesReceivedFromServer )
-{
-    while ( true )
-    {
-        Message * message = client.ReceiveMessage( 0 );
+    check( numPackets == 4 );
 
-        if ( !message )
-            break;
+    // a packet with a reliable message is sent straight away
 
-        check( message->GetId() == (int) numMessagesReceivedFromServer );
-        
-        switch ( message->GetType() )
-        {
-            case TEST_MESSAGE:
-            {
-                TestMessage * testMessage = (TestMessage*) message;
-                check( !message->IsBlockMessage() );
-                check( testMessage->sequence == uint16_t( numMessagesReceivedFromServer ) );
-                ++numMessagesReceivedFromServer;
-            }
-            break;
+    sender.SendMessage( 0, messageFactory.CreateMessage( TEST_MESSAGE ) );
 
-            case TEST_BLOCK_MESSAGE:
-            {
-                check( message->IsBlockMessage() );
-                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
-                check( blockMessage->sequence == uint16_t( numMessagesReceivedFromServer ) );
-                const int blockSize = blockMessage->GetBlockSize();
-                check( blockSize == 1 + ( ( numMessagesReceivedFromServer * 901 ) % 1001 ) );
-                const uint8_t * blockData = blockMessage->GetBlockData();
-                check( blockData );
-                for ( int j = 0; j < blockSize; ++j )
-                {
-                    check( blockData[j] == uint8_t( numMessagesReceivedFromServer + j ) );
-                }
-                ++numMessagesReceivedFromServer;
-            }
-            break;
-        }
+    const uint16_t messageSequence = senderSequence;
 
-        client.ReleaseMessage( message );
-    }
-}
+    check( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+    check( receiver.ProcessPacket( NULL, senderSequence, packetData, packetBytes ) );
+    senderSequence++;
+
+    Message * message = receiver.ReceiveMessage( 0 );
+    check( message );
+    receiver.ReleaseMessage( message );
+
+    // the receiver holds the ack back for ackDelay, in case a message to send comes along, then sends a packet just for it
+
+    int numTicksToAck = 0;
+
+    while ( !receiver.GeneratePacket( NULL, receiverSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) )
+    {
+        time += DeltaTime;
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
+        numTicksToAck++;
+        check( numTicksToAck < 100 );
+    }
+
+    receiverSequence++;
+
+    check( numTicksToAck >= 9 && numTicksToAck <= 11 );
+
+    // once the ack is out there is nothing left to send
+
+    check( !receiver.GeneratePacket( NULL, receiverSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+
+    // the ack only packet doesn't need acking itself, so once the message is acked the sender goes quiet again
+
+    check( sender.ProcessPacket( NULL, receiverSequence - 1, packetData, packetBytes ) );
+    sender.ProcessAcks( &messageSequence, 1 );
+
+    time += 0.3;
+    sender.AdvanceTime( time );
+
+    check( !sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+
+    // unreliable data is acked too, so the other side can measure packet loss and RTT. with a long ackDelay, an
+    // empty packet still goes out every MaxUnackedReceivedPackets packets received
+
+    ConnectionConfig unreliableConfig = connectionConfig;
+    unreliableConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    unreliableConfig.ackDelay = 0.5f;
+
+    Connection unreliableSender( GetDefaultAllocator(), messageFactory, unreliableConfig, time );
+    Connection unreliableReceiver( GetDefaultAllocator(), messageFactory, unreliableConfig, time );
+
+    senderSequence = 0;
+    receiverSequence = 0;
+
+    const int NumPacketsSent = MaxUnackedReceivedPackets * 2 + 1;
+
+    int numAckPackets = 0;
+
+    for ( int i = 0; i < NumPacketsSent; ++i )
+    {
+        unreliableSender.SendMessage( 0, messageFactory.CreateMessage( TEST_MESSAGE ) );
+
+        check( unreliableSender.GeneratePacket( NULL, senderSequence, packetData, unreliableConfig.maxPacketSize, packetBytes ) );
+        check( unreliableReceiver.ProcessPacket( NULL, senderSequence, packetData, packetBytes ) );
+        senderSequence++;
+
+        while ( Message * receivedMessage = unreliableReceiver.ReceiveMessage( 0 ) )
+            unreliableReceiver.ReleaseMessage( receivedMessage );
+
+        if ( unreliableReceiver.GeneratePacket( NULL, receiverSequence, packetData, unreliableConfig.maxPacketSize, packetBytes ) )
+        {
+            receiverSequence++;
+            numAckPackets++;
+        }
+
+        time += DeltaTime;
+        unreliableSender.AdvanceTime( time );
+        unreliableReceiver.AdvanceTime( time );
+    }
+
+    check( numAckPackets == 2 );
+
+    // and the last packet is acked once ackDelay has passed
+
+    time += unreliableConfig.ackDelay;
+    unreliableReceiver.AdvanceTime( time );
+
+    check( unreliableReceiver.GeneratePacket( NULL, receiverSequence, packetData, unreliableConfig.maxPacketSize, packetBytes ) );
+}
+
+void test_connection_block_allocator()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].maxBlockSize = 4096;
+
+    // the pool only has room for one block receive buffer, so the receivers can only take turns if each buffer goes
+    // back to the pool as soon as its block completes.
+
+    const int PoolSize = 12 * 1024;
+
+    uint8_t * poolMemory = (uint8_t*) YOJIMBO_ALLOCATE( GetDefaultAllocator(), PoolSize );
+
+    TLSF_Allocator poolAllocator( poolMemory, PoolSize );
+
+    {
+        const int NumConnections = 2;
+
+        Connection * sender[NumConnections];
+        Connection * receiver[NumConnections];
+
+        uint16_t senderSequence[NumConnections];
+        uint16_t receiverSequence[NumConnections];
+
+        for ( int i = 0; i < NumConnections; ++i )
+        {
+            sender[i] = YOJIMBO_NEW( GetDefaultAllocator(), Connection, GetDefaultAllocator(), messageFactory, connectionConfig, time );
+            receiver[i] = YOJIMBO_NEW( GetDefaultAllocator(), Connection, GetDefaultAllocator(), messageFactory, connectionConfig, time );
+            receiver[i]->SetBlockAllocator( poolAllocator );
+            senderSequence[i] = 0;
+            receiverSequence[i] = 0;
+        }
+
+        const int NumRounds = 4;
+
+        for ( int round = 0; round < NumRounds; ++round )
+        {
+            for ( int i = 0; i < NumConnections; ++i )
+            {
+                TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+                check( message );
+                message->sequence = round;
+                const int blockSize = 1024 + round * 1000;
+                uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+                for ( int j = 0; j < blockSize; ++j )
+                    blockData[j] = round + j;
+                message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+                sender[i]->SendMessage( 0, message );
+
+                Message * receivedMessage = NULL;
+
+                const int NumIterations = 1000;
+
+                for ( int j = 0; j < NumIterations && !receivedMessage; ++j )
+                {
+                    PumpConnectionUpdate( connectionConfig, time, *sender[i], *receiver[i], senderSequence[i], receiverSequence[i], 0.1f, 0 );
+                    receivedMessage = receiver[i]->ReceiveMessage( 0 );
+                }
+
+                check( receivedMessage );
+                check( receiver[i]->GetErrorLevel() == CONNECTION_ERROR_NONE );
+                check( ((TestBlockMessage*)receivedMessage)->sequence == round );
+                check( ((BlockMessage*)receivedMessage)->GetBlockSize() == blockSize );
+
+                const uint8_t * receivedData = ((BlockMessage*)receivedMessage)->GetBlockData();
+                for ( int j = 0; j < blockSize; ++j )
+                {
+                    check( receivedData[j] == uint8_t( round + j ) );
+                }
+
+                messageFactory.ReleaseMessage( receivedMessage );
+            }
+        }
+
+        for ( int i = 0; i < NumConnections; ++i )
+        {
+            YOJIMBO_DELETE( GetDefaultAllocator(), Connection, sender[i] );
+            YOJIMBO_DELETE( GetDefaultAllocator(), Connection, receiver[i] );
+        }
+    }
+
+    YOJIMBO_FREE( GetDefaultAllocator(), poolMemory );
+}
+
+void test_connection_reliable_ordered_messages_and_blocks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+    
+    ConnectionConfig connectionConfig;
+    
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 32;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        if ( rand() % 2 )
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            sender.SendMessage( 0, message );
+        }
+        else
+        {
+            TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+            check( message );
+            message->sequence = i;
+            const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+            for ( int j = 0; j < blockSize; ++j )
+                blockData[j] = i + j;
+            message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+            sender.SendMessage( 0, message );
+        }
+    }
+
+    const int SenderPort = 10000;
+    const int ReceiverPort = 10001;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    int numMessagesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+
+            switch ( message->GetType() )
+            {
+                case TEST_MESSAGE:
+                {
+                    TestMessage * testMessage = (TestMessage*) message;
+
+                    check( testMessage->sequence == uint16_t( numMessagesReceived ) );
+
+                    ++numMessagesReceived;
+                }
+                break;
+
+                case TEST_BLOCK_MESSAGE:
+                {
+                    TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+                    check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+
+                    const int blockSize = blockMessage->GetBlockSize();
+
+                    check( blockSize == 1 + ( ( numMessagesReceived * 901 ) % 3333 ) );
+        
+                    const uint8_t * blockData = blockMessage->GetBlockData();
+
+                    check( blockData );
+
+                    for ( int j = 0; j < blockSize; ++j )
+                    {
+                        check( blockData[j] == uint8_t( numMessagesReceived + j ) );
+                    }
+
+                    ++numMessagesReceived;
+                }
+                break;
+            }
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_reliable_ordered_messages_and_blocks_multiple_channels()
+{
+    const int NumChannels = 2;
+
+    double time = 100.0;
+    
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = NumChannels;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[0].maxMessagesPerPacket = 8;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[1].maxMessagesPerPacket = 8;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 32;
+
+    for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+    {
+        for ( int i = 0; i < NumMessagesSent; ++i )
+        {
+            if ( rand() % 2 )
+            {
+                TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+                check( message );
+                message->sequence = i;
+                sender.SendMessage( channelIndex, message );
+            }
+            else
+            {
+                TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+                check( message );
+                message->sequence = i;
+                const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+                uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+                for ( int j = 0; j < blockSize; ++j )
+                    blockData[j] = i + j;
+                message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+                sender.SendMessage( channelIndex, message );
+            }
+        }
+    }
+
+    const int SenderPort = 10000;
+    const int ReceiverPort = 10001;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    const int NumIterations = 10000;
+
+    int numMessagesReceived[NumChannels];
+    memset( numMessagesReceived, 0, sizeof( numMessagesReceived ) );
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+        {
+            while ( true )
+            {
+                Message * message = receiver.ReceiveMessage( channelIndex );
+                if ( !message )
+                    break;
+
+                check( message->GetId() == (int) numMessagesReceived[channelIndex] );
+
+                switch ( message->GetType() )
+                {
+                    case TEST_MESSAGE:
+                    {
+                        TestMessage * testMessage = (TestMessage*) message;
+
+                        check( testMessage->sequence == uint16_t( numMessagesReceived[channelIndex] ) );
+
+                        ++numMessagesReceived[channelIndex];
+                    }
+                    break;
+
+                    case TEST_BLOCK_MESSAGE:
+                    {
+                        TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+                        check( blockMessage->sequence == uint16_t( numMessagesReceived[channelIndex] ) );
+
+                        const int blockSize = blockMessage->GetBlockSize();
+
+                        check( blockSize == 1 + ( ( numMessagesReceived[channelIndex] * 901 ) % 3333 ) );
+            
+                        const uint8_t * blockData = blockMessage->GetBlockData();
+
+                        check( blockData );
+
+                        for ( int j = 0; j < blockSize; ++j )
+                        {
+                            check( blockData[j] == uint8_t( numMessagesReceived[channelIndex] + j ) );
+                        }
+
+                        ++numMessagesReceived[channelIndex];
+                    }
+                    break;
+                }
+
+                messageFactory.ReleaseMessage( message );
+            }
+        }
+
+        bool receivedAllMessages = true;
+
+        for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+        {
+            if ( numMessagesReceived[channelIndex] != NumMessagesSent )
+            {
+                receivedAllMessages = false;
+                break;
+            }
+        }
+
+        if ( receivedAllMessages )
+            break;
+    }
+
+    for ( int channelIndex = 0; channelIndex < NumChannels; ++channelIndex )
+    {
+        check( numMessagesReceived[channelIndex] == NumMessagesSent );
+    }
+}
+
+void test_connection_unreliable_unordered_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int SenderPort = 10000;
+    const int ReceiverPort = 10001;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    const int NumIterations = 256;
+
+    const int NumMessagesSent = 16;
+
+    for ( int j = 0; j < NumMessagesSent; ++j )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = j;
+        sender.SendMessage( 0, message );
+    }
+
+    int numMessagesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetType() == TEST_MESSAGE );
+
+            TestMessage * testMessage = (TestMessage*) message;
+
+            check( testMessage->sequence == uint16_t( numMessagesReceived ) );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_unreliable_unordered_blocks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+    
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int SenderPort = 10000;
+    const int ReceiverPort = 10001;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    const int NumIterations = 256;
+
+    const int NumMessagesSent = 8;
+
+    for ( int j = 0; j < NumMessagesSent; ++j )
+    {
+        TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = j;
+        const int blockSize = 1 + ( j * 7 );
+        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+        for ( int k = 0; k < blockSize; ++k )
+            blockData[k] = j + k;
+        message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+        sender.SendMessage( 0, message );
+    }
+
+    int numMessagesReceived = 0;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetType() == TEST_BLOCK_MESSAGE );
+
+            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+            check( blockMessage->sequence == uint16_t( numMessagesReceived ) );
+
+            const int blockSize = blockMessage->GetBlockSize();
+
+            check( blockSize == 1 + ( numMessagesReceived * 7 ) );
+
+            const uint8_t * blockData = blockMessage->GetBlockData();
+
+            check( blockData );
+
+            for ( int j = 0; j < blockSize; ++j )
+            {
+                check( blockData[j] == uint8_t( numMessagesReceived + j ) );
+            }
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_reliable_unordered_messages_and_blocks()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_UNORDERED;
+    connectionConfig.channel[0].maxMessagesPerPacket = 8;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 64;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        if ( rand() % 4 )
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            sender.SendMessage( 0, message );
+        }
+        else
+        {
+            TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+            check( message );
+            message->sequence = i;
+            const int blockSize = 1 + ( ( i * 901 ) % 3333 );
+            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+            for ( int j = 0; j < blockSize; ++j )
+                blockData[j] = i + j;
+            message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+            sender.SendMessage( 0, message );
+        }
+    }
+
+    bool received[NumMessagesSent];
+    memset( received, 0, sizeof( received ) );
+
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 10000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            const int messageId = message->GetId();
+
+            check( messageId >= 0 && messageId < NumMessagesSent );
+            check( !received[messageId] );
+
+            received[messageId] = true;
+
+            switch ( message->GetType() )
+            {
+                case TEST_MESSAGE:
+                {
+                    TestMessage * testMessage = (TestMessage*) message;
+
+                    check( testMessage->sequence == uint16_t( messageId ) );
+                }
+                break;
+
+                case TEST_BLOCK_MESSAGE:
+                {
+                    TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+
+                    check( blockMessage->sequence == uint16_t( messageId ) );
+
+                    const int blockSize = blockMessage->GetBlockSize();
+
+                    check( blockSize == 1 + ( ( messageId * 901 ) % 3333 ) );
+
+                    const uint8_t * blockData = blockMessage->GetBlockData();
+
+                    check( blockData );
+
+                    for ( int j = 0; j < blockSize; ++j )
+                    {
+                        check( blockData[j] == uint8_t( messageId + j ) );
+                    }
+                }
+                break;
+            }
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+}
+
+void test_connection_reliable_unordered_latency()
+{
+    // send the same messages over a reliable-ordered and a reliable-unordered channel under packet loss.
+    // both channels see exactly the same packets, so each message arrives at the same time on both,
+    // but the unordered channel delivers it immediately instead of waiting for earlier messages to be resent.
+
+    const int OrderedChannel = 0;
+    const int UnorderedChannel = 1;
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[OrderedChannel].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[OrderedChannel].messageResendTime = 0.5f;
+    connectionConfig.channel[UnorderedChannel].type = CHANNEL_TYPE_RELIABLE_UNORDERED;
+    connectionConfig.channel[UnorderedChannel].messageResendTime = 0.5f;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 64;
+
+    int deliveryIteration[2][NumMessagesSent];
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        deliveryIteration[OrderedChannel][i] = -1;
+        deliveryIteration[UnorderedChannel][i] = -1;
+    }
+
+    int numMessagesReceived[2] = { 0, 0 };
+
+    const int NumIterations = 1000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        if ( i < NumMessagesSent )
+        {
+            for ( int channelIndex = 0; channelIndex < 2; ++channelIndex )
+            {
+                TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+                check( message );
+                message->sequence = i;
+                sender.SendMessage( channelIndex, message );
+            }
+        }
+
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 50 );
+
+        for ( int channelIndex = 0; channelIndex < 2; ++channelIndex )
+        {
+            while ( true )
+            {
+                Message * message = receiver.ReceiveMessage( channelIndex );
+                if ( !message )
+                    break;
+
+                const int messageId = message->GetId();
+                check( messageId >= 0 && messageId < NumMessagesSent );
+                check( deliveryIteration[channelIndex][messageId] == -1 );
+                deliveryIteration[channelIndex][messageId] = i;
+                numMessagesReceived[channelIndex]++;
+
+                messageFactory.ReleaseMessage( message );
+            }
+        }
+
+        if ( numMessagesReceived[OrderedChannel] == NumMessagesSent && numMessagesReceived[UnorderedChannel] == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived[OrderedChannel] == NumMessagesSent );
+    check( numMessagesReceived[UnorderedChannel] == NumMessagesSent );
+
+    int orderedLatency = 0;
+    int unorderedLatency = 0;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        check( deliveryIteration[UnorderedChannel][i] <= deliveryIteration[OrderedChannel][i] );
+        orderedLatency += deliveryIteration[OrderedChannel][i] - i;
+        unorderedLatency += deliveryIteration[UnorderedChannel][i] - i;
+    }
+
+    check( unorderedLatency < orderedLatency );
+}
+
+void test_connection_unreliable_sequenced_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_SEQUENCED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    // generate one packet per message, then deliver them in reverse order. only the newest message should be received.
+
+    const int NumPackets = 4;
+
+    uint8_t * packetData[NumPackets];
+    int packetBytes[NumPackets];
+
+    for ( int i = 0; i < NumPackets; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message );
+
+        packetData[i] = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+        check( sender.GeneratePacket( NULL, uint16_t( i ), packetData[i], connectionConfig.maxPacketSize, packetBytes[i] ) );
+    }
+
+    for ( int i = NumPackets - 1; i >= 0; --i )
+    {
+        check( receiver.ProcessPacket( NULL, uint16_t( i ), packetData[i], packetBytes[i] ) );
+    }
+
+    Message * message = receiver.ReceiveMessage( 0 );
+    check( message );
+    check( message->GetType() == TEST_MESSAGE );
+    check( message->GetId() == NumPackets - 1 );
+    check( ( (TestMessage*) message )->sequence == NumPackets - 1 );
+    messageFactory.ReleaseMessage( message );
+
+    check( receiver.ReceiveMessage( 0 ) == NULL );
+
+    // under packet loss, messages that arrive are always received in increasing sequence order
+
+    const int NumIterations = 256;
+
+    uint16_t senderSequence = NumPackets;
+    uint16_t receiverSequence = 0;
+
+    int numMessagesReceived = 0;
+    int previousMessageId = NumPackets - 1;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        for ( int j = 0; j < 4; ++j )
+        {
+            TestMessage * testMessage = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( testMessage );
+            testMessage->sequence = NumPackets + i * 4 + j;
+            sender.SendMessage( 0, testMessage );
+        }
+
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 50 );
+
+        while ( true )
+        {
+            message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetType() == TEST_MESSAGE );
+            check( sequence_greater_than( uint16_t( message->GetId() ), uint16_t( previousMessageId ) ) );
+            check( ( (TestMessage*) message )->sequence == uint16_t( message->GetId() ) );
+
+            previousMessageId = message->GetId();
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+
+    check( numMessagesReceived > 0 );
+}
+
+void test_connection_unreliable_sequenced_latest_only()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 1;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_UNRELIABLE_SEQUENCED;
+    connectionConfig.channel[0].latestOnly = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 16;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message );
+
+        if ( i % 2 )
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+    }
+
+    // the receive queue collapses to the newest message, even though none were dequeued
+
+    Message * message = receiver.ReceiveMessage( 0 );
+    check( message );
+    check( message->GetId() == NumMessagesSent - 1 );
+    check( ( (TestMessage*) message )->sequence == NumMessagesSent - 1 );
+    messageFactory.ReleaseMessage( message );
+
+    check( receiver.ReceiveMessage( 0 ) == NULL );
+}
+
+static void SendTestMessages( MessageFactory & messageFactory, Connection & connection, int channelIndex, int numMessages )
+{
+    for ( int i = 0; i < numMessages; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        connection.SendMessage( channelIndex, message );
+    }
+}
+
+static int ReceiveTestMessages( MessageFactory & messageFactory, Connection & connection, int channelIndex )
+{
+    int numMessagesReceived = 0;
+    while ( true )
+    {
+        Message * message = connection.ReceiveMessage( channelIndex );
+        if ( !message )
+            break;
+        messageFactory.ReleaseMessage( message );
+        numMessagesReceived++;
+    }
+    return numMessagesReceived;
+}
+
+void test_connection_channel_scheduling()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    const int NumMessagesSent = 1024;
+
+    // equal weights: channel 0 must not starve channel 1 even though both have more messages than fit in a packet
+
+    {
+        double time = 100.0;
+
+        ConnectionConfig connectionConfig;
+        connectionConfig.maxPacketSize = 1024;
+        connectionConfig.numChannels = 2;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        SendTestMessages( messageFactory, sender, 0, NumMessagesSent );
+        SendTestMessages( messageFactory, sender, 1, NumMessagesSent );
+
+        uint16_t senderSequence = 0;
+        uint16_t receiverSequence = 0;
+
+        int numMessagesReceived[2] = { 0, 0 };
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+            numMessagesReceived[0] += ReceiveTestMessages( messageFactory, receiver, 0 );
+            numMessagesReceived[1] += ReceiveTestMessages( messageFactory, receiver, 1 );
+        }
+
+        check( numMessagesReceived[0] > 0 );
+        check( numMessagesReceived[1] > 0 );
+        check( numMessagesReceived[0] < NumMessagesSent );
+        check( numMessagesReceived[1] < NumMessagesSent );
+    }
+
+    // weights 3:1: while both channels are backlogged, channel 0 gets roughly three times the bandwidth of channel 1
+
+    {
+        double time = 100.0;
+
+        ConnectionConfig connectionConfig;
+        connectionConfig.maxPacketSize = 1024;
+        connectionConfig.numChannels = 2;
+        connectionConfig.channel[0].weight = 3;
+        connectionConfig.channel[1].weight = 1;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        SendTestMessages( messageFactory, sender, 0, NumMessagesSent );
+        SendTestMessages( messageFactory, sender, 1, NumMessagesSent );
+
+        uint16_t senderSequence = 0;
+        uint16_t receiverSequence = 0;
+
+        int numMessagesReceived[2] = { 0, 0 };
+
+        for ( int i = 0; i < 12; ++i )
+        {
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+            numMessagesReceived[0] += ReceiveTestMessages( messageFactory, receiver, 0 );
+            numMessagesReceived[1] += ReceiveTestMessages( messageFactory, receiver, 1 );
+        }
+
+        check( numMessagesReceived[0] < NumMessagesSent );
+        check( numMessagesReceived[1] > 0 );
+        check( numMessagesReceived[0] >= numMessagesReceived[1] * 2 );
+        check( numMessagesReceived[0] <= numMessagesReceived[1] * 4 );
+    }
+
+    // priority: channel 1 has higher priority, so it drains before channel 0 gets any space
+
+    {
+        double time = 100.0;
+
+        ConnectionConfig connectionConfig;
+        connectionConfig.maxPacketSize = 1024;
+        connectionConfig.numChannels = 2;
+        connectionConfig.channel[1].priority = 1;
+
+        Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+        Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+        SendTestMessages( messageFactory, sender, 0, NumMessagesSent );
+        SendTestMessages( messageFactory, sender, 1, NumMessagesSent );
+
+        uint16_t senderSequence = 0;
+        uint16_t receiverSequence = 0;
+
+        int numMessagesReceived[2] = { 0, 0 };
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+            numMessagesReceived[0] += ReceiveTestMessages( messageFactory, receiver, 0 );
+            numMessagesReceived[1] += ReceiveTestMessages( messageFactory, receiver, 1 );
+        }
+
+        check( numMessagesReceived[1] > 0 );
+        check( numMessagesReceived[1] < NumMessagesSent );
+        check( numMessagesReceived[0] * 8 < numMessagesReceived[1] );
+    }
+}
+
+void test_connection_reliable_ordered_message_expiry()
+{
+    // every other message has a time to live. messages that expire before they are acked are replaced by skip markers,
+    // so the receiver moves past them without stalling, and everything else still arrives exactly once and in order.
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 64;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        if ( i % 2 == 0 )
+            sender.SendMessage( 0, message, 0.25, 0 );
+        else
+            sender.SendMessage( 0, message );
+    }
+
+    int numMessagesReceived = 0;
+    int previousMessageId = -1;
+
+    const int NumIterations = 1000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 50 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetType() == TEST_MESSAGE );
+
+            TestMessage * testMessage = (TestMessage*) message;
+
+            check( message->GetId() > previousMessageId );
+            check( testMessage->sequence == message->GetId() );
+
+            previousMessageId = message->GetId();
+
+            if ( message->GetId() % 2 == 1 )
+                numMessagesReceived++;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent / 2 )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent / 2 );
+
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+
+    // messages that expire before they are ever sent are never delivered
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        sender.SendMessage( 0, message, ( i % 2 == 0 ) ? 0.25 : 0.0, 0 );
+    }
+
+    time += 1.0;
+    sender.AdvanceTime( time );
+    receiver.AdvanceTime( time );
+
+    numMessagesReceived = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() % 2 == 1 );
+            check( message->GetId() > previousMessageId );
+
+            previousMessageId = message->GetId();
+            numMessagesReceived++;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent / 2 )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent / 2 );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+}
+
+void test_connection_reliable_message_priority()
+{
+    // high priority messages queued behind a backlog of low priority messages are picked first, as long as they are within the send window.
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_UNORDERED;
+    connectionConfig.channel[0].maxMessagesPerPacket = 8;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumLowPriorityMessages = 64;
+    const int NumHighPriorityMessages = 8;
+    const int NumMessagesSent = NumLowPriorityMessages + NumHighPriorityMessages;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message, 0.0, ( i < NumLowPriorityMessages ) ? 0 : 1 );
+    }
+
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 1000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            if ( numMessagesReceived < NumHighPriorityMessages )
+                check( message->GetId() >= NumLowPriorityMessages );
+            else
+                check( message->GetId() < NumLowPriorityMessages );
+
+            numMessagesReceived++;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+}
+
+void test_connection_batch_messages()
+{
+    // send and receive messages in batches over every channel type. batches must behave exactly like the same messages sent one at a time.
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 4;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_RELIABLE_UNORDERED;
+    connectionConfig.channel[2].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[3].type = CHANNEL_TYPE_UNRELIABLE_SEQUENCED;
+
+    // unreliable messages that don't fit in the packet are dropped. give them priority so the reliable backlog can't crowd them out.
+
+    connectionConfig.channel[2].priority = 1;
+    connectionConfig.channel[3].priority = 1;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 256;
+    const int SendBatchSize = 64;
+    const int ReceiveBatchSize = 16;
+
+    for ( int channelIndex = 0; channelIndex < connectionConfig.numChannels; ++channelIndex )
+    {
+        check( sender.CanSendMessages( channelIndex, connectionConfig.channel[channelIndex].messageSendQueueSize ) );
+        check( !sender.CanSendMessages( channelIndex, connectionConfig.channel[channelIndex].messageSendQueueSize + 1 ) );
+    }
+
+    int numMessagesReceived[4] = { 0, 0, 0, 0 };
+    bool messageReceived[4][NumMessagesSent];
+    memset( messageReceived, 0, sizeof( messageReceived ) );
+
+    const int NumIterations = 1000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        // reliable channels get all their messages up front. unreliable channels get one batch per-packet, so nothing is dropped on send.
+
+        for ( int channelIndex = 0; channelIndex < connectionConfig.numChannels; ++channelIndex )
+        {
+            const bool reliable = channelIndex < 2;
+
+            if ( ( reliable && i > 0 ) || i * SendBatchSize >= NumMessagesSent )
+                continue;
+
+            const int numBatches = reliable ? NumMessagesSent / SendBatchSize : 1;
+
+            for ( int j = 0; j < numBatches; ++j )
+            {
+                Message * messages[SendBatchSize];
+                for ( int k = 0; k < SendBatchSize; ++k )
+                {
+                    TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+                    check( message );
+                    message->sequence = uint16_t( ( reliable ? j : i ) * SendBatchSize + k );
+                    messages[k] = message;
+                }
+
+                check( sender.CanSendMessages( channelIndex, SendBatchSize ) );
+
+                sender.SendMessages( channelIndex, messages, SendBatchSize );
+            }
+        }
+
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        for ( int channelIndex = 0; channelIndex < connectionConfig.numChannels; ++channelIndex )
+        {
+            while ( true )
+            {
+                Message * messages[ReceiveBatchSize];
+                const int numMessages = receiver.ReceiveMessages( channelIndex, messages, ReceiveBatchSize );
+                check( numMessages >= 0 && numMessages <= ReceiveBatchSize );
+
+                for ( int j = 0; j < numMessages; ++j )
+                {
+                    check( messages[j]->GetType() == TEST_MESSAGE );
+                    TestMessage * testMessage = (TestMessage*) messages[j];
+                    check( testMessage->sequence < NumMessagesSent );
+                    check( !messageReceived[channelIndex][testMessage->sequence] );
+                    if ( channelIndex == 0 )
+                        check( testMessage->sequence == numMessagesReceived[channelIndex] );
+                    if ( channelIndex != 2 )
+                        check( messages[j]->GetId() == testMessage->sequence );
+                    messageReceived[channelIndex][testMessage->sequence] = true;
+                    numMessagesReceived[channelIndex]++;
+                    messageFactory.ReleaseMessage( messages[j] );
+                }
+
+                if ( numMessages < ReceiveBatchSize )
+                    break;
+            }
+        }
+
+        bool allMessagesReceived = true;
+        for ( int channelIndex = 0; channelIndex < connectionConfig.numChannels; ++channelIndex )
+        {
+            if ( numMessagesReceived[channelIndex] != NumMessagesSent )
+                allMessagesReceived = false;
+        }
+
+        if ( allMessagesReceived )
+            break;
+    }
+
+    for ( int channelIndex = 0; channelIndex < connectionConfig.numChannels; ++channelIndex )
+        check( numMessagesReceived[channelIndex] == NumMessagesSent );
+
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+}
+
+void test_connection_acks_many_channels()
+{
+    // acks are only passed to the reliable channels that included data in the acked packet. configure every channel,
+    // including the highest channel index, and make sure messages on a few of them are still acked and delivered under packet loss.
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = MaxChannels;
+    for ( int channelIndex = 0; channelIndex < MaxChannels; ++channelIndex )
+    {
+        ChannelConfig & channelConfig = connectionConfig.channel[channelIndex];
+        channelConfig.type = ( channelIndex % 2 ) ? CHANNEL_TYPE_RELIABLE_UNORDERED : CHANNEL_TYPE_RELIABLE_ORDERED;
+        channelConfig.disableBlocks = true;
+        channelConfig.sentPacketBufferSize = 256;
+        channelConfig.messageSendQueueSize = 64;
+        channelConfig.messageReceiveQueueSize = 64;
+        channelConfig.maxMessagesPerPacket = 8;
+    }
+    connectionConfig.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumActiveChannels = 3;
+    const int activeChannels[NumActiveChannels] = { 0, MaxChannels / 2 - 1, MaxChannels - 1 };
+    const int NumMessagesSent = 64;
+
+    for ( int i = 0; i < NumActiveChannels; ++i )
+        SendTestMessages( messageFactory, sender, activeChannels[i], NumMessagesSent );
+
+    int numMessagesReceived[NumActiveChannels] = { 0, 0, 0 };
+
+    const int NumIterations = 1000;
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 50 );
+
+        bool allMessagesReceived = true;
+
+        for ( int j = 0; j < NumActiveChannels; ++j )
+        {
+            numMessagesReceived[j] += ReceiveTestMessages( messageFactory, receiver, activeChannels[j] );
+            if ( numMessagesReceived[j] != NumMessagesSent )
+                allMessagesReceived = false;
+        }
+
+        if ( allMessagesReceived )
+            break;
+    }
+
+    for ( int i = 0; i < NumActiveChannels; ++i )
+    {
+        check( numMessagesReceived[i] == NumMessagesSent );
+
+        // every message was acked, so the send queue is empty again
+
+        check( sender.CanSendMessages( activeChannels[i], connectionConfig.channel[activeChannels[i]].messageSendQueueSize ) );
+    }
+
+    check( receiver.GetErrorLevel() == CONNECTION_ERROR_NONE );
+    check( sender.GetErrorLevel() == CONNECTION_ERROR_NONE );
+}
+
+void test_connection_aggregate_messages()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[0].aggregateMessages = true;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    connectionConfig.channel[1].aggregateMessages = true;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    // reliable-ordered channel: runs of test messages sent with packet loss
+
+    const int NumMessagesSent = 64;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message );
+    }
+
+    // unreliable-unordered channel: alternating runs of test messages and small block messages, so runs start and end mid-packet
+
+    const int NumUnreliableMessagesSent = 20;
+
+    for ( int i = 0; i < NumUnreliableMessagesSent; ++i )
+    {
+        if ( ( i % 5 ) < 3 )
+        {
+            TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            sender.SendMessage( 1, message );
+        }
+        else
+        {
+            TestBlockMessage * message = (TestBlockMessage*) messageFactory.CreateMessage( TEST_BLOCK_MESSAGE );
+            check( message );
+            message->sequence = i;
+            const int blockSize = 4;
+            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+            for ( int j = 0; j < blockSize; ++j )
+                blockData[j] = uint8_t( i + j );
+            message->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+            sender.SendMessage( 1, message );
+        }
+    }
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+    int numUnreliableMessagesReceived = 0;
+
+    while ( true )
+    {
+        Message * message = receiver.ReceiveMessage( 1 );
+        if ( !message )
+            break;
+
+        const int i = numUnreliableMessagesReceived;
+
+        if ( ( i % 5 ) < 3 )
+        {
+            check( message->GetType() == TEST_MESSAGE );
+            check( ( (TestMessage*) message )->sequence == uint16_t( i ) );
+        }
+        else
+        {
+            check( message->GetType() == TEST_BLOCK_MESSAGE );
+            TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+            check( blockMessage->sequence == uint16_t( i ) );
+            check( blockMessage->GetBlockSize() == 4 );
+            for ( int j = 0; j < 4; ++j )
+                check( blockMessage->GetBlockData()[j] == uint8_t( i + j ) );
+        }
+
+        ++numUnreliableMessagesReceived;
+
+        messageFactory.ReleaseMessage( message );
+    }
+
+    check( numUnreliableMessagesReceived == NumUnreliableMessagesSent );
+
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 1000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+            check( message->GetType() == TEST_MESSAGE );
+            check( ( (TestMessage*) message )->sequence == uint16_t( numMessagesReceived ) );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        if ( numMessagesReceived == NumMessagesSent )
+            break;
+
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence );
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+}
+
+void test_connection_channel_status()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.numChannels = 2;
+    connectionConfig.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    connectionConfig.channel[1].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    ChannelStatus status;
+
+    sender.GetChannelStatus( 0, status );
+    check( status.numMessagesQueued == 0 );
+    check( status.sendQueueSize == connectionConfig.channel[0].messageSendQueueSize );
+    check( status.numBytesQueued == 0 );
+    check( status.oldestUnackedAge == 0.0f );
+    check( status.estimatedDrainTime == 0.0f );
+
+    const int NumMessagesSent = 16;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message );
+
+        message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 1, message );
+    }
+
+    // nothing has been acked yet, so the drain time is unknown
+
+    time += 1.0;
+    sender.AdvanceTime( time );
+
+    sender.GetChannelStatus( 0, status );
+    check( status.numMessagesQueued == NumMessagesSent );
+    check( status.numBytesQueued > NumMessagesSent * 2 );
+    check( status.oldestUnackedAge >= 1.0f );
+    check( status.ackedMessagesPerSecond == 0.0f );
+    check( status.estimatedDrainTime < 0.0f );
+
+    sender.GetChannelStatus( 1, status );
+    check( status.numMessagesQueued == NumMessagesSent );
+    check( status.sendQueueSize == connectionConfig.channel[1].messageSendQueueSize );
+
+    // send and ack everything, then the send queues are empty and the ack rate has picked up
+
+    uint16_t senderSequence = 0;
+    uint16_t receiverSequence = 0;
+
+    for ( int i = 0; i < 10; ++i )
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+    sender.GetChannelStatus( 0, status );
+    check( status.numMessagesQueued == 0 );
+    check( status.numBytesQueued == 0 );
+    check( status.oldestUnackedAge == 0.0f );
+    check( status.ackedMessagesPerSecond > 0.0f );
+    check( status.estimatedDrainTime == 0.0f );
+
+    sender.GetChannelStatus( 1, status );
+    check( status.numMessagesQueued == 0 );
+
+    for ( int channelIndex = 0; channelIndex < connectionConfig.numChannels; ++channelIndex )
+    {
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( channelIndex );
+            if ( !message )
+                break;
+            messageFactory.ReleaseMessage( message );
+        }
+    }
+}
+
+void test_connection_sent_packet_message_ids()
+{
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+
+    double time = 100.0;
+
+    // the message id ring buffer only has room for four packets of consecutive message ids
+
+    ConnectionConfig connectionConfig;
+    connectionConfig.channel[0].maxMessagesPerPacket = 4;
+    connectionConfig.channel[0].sentPacketMessageIdBufferSize = 8;
+
+    Connection sender( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    Connection receiver( GetDefaultAllocator(), messageFactory, connectionConfig, time );
+
+    const int NumMessagesSent = 32;
+
+    for ( int i = 0; i < NumMessagesSent; ++i )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.CreateMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = i;
+        sender.SendMessage( 0, message );
+    }
+
+    // send eight packets before acking any of them. the message ids of the first four packets are overwritten by then,
+    // so acking those packets can't ack their messages.
+
+    uint8_t * packetData = (uint8_t*) alloca( connectionConfig.maxPacketSize );
+
+    uint16_t senderSequence = 0;
+
+    const int NumPackets = 8;
+
+    for ( int i = 0; i < NumPackets; ++i )
+    {
+        int packetBytes;
+        check( sender.GeneratePacket( NULL, senderSequence, packetData, connectionConfig.maxPacketSize, packetBytes ) );
+        check( receiver.ProcessPacket( NULL, senderSequence, packetData, packetBytes ) );
+        senderSequence++;
+    }
+
+    for ( uint16_t sequence = 0; sequence < NumPackets; ++sequence )
+        sender.ProcessAcks( &sequence, 1 );
+
+    ChannelStatus status;
+    sender.GetChannelStatus( 0, status );
+    check( status.numMessagesQueued == NumMessagesSent / 2 );
+
+    // the messages in the first four packets are resent and acked
+
+    uint16_t receiverSequence = 0;
+
+    int numMessagesReceived = 0;
+
+    const int NumIterations = 1000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpConnectionUpdate( connectionConfig, time, sender, receiver, senderSequence, receiverSequence, 0.1f, 0 );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMessage( 0 );
+            if ( !message )
+                break;
+
+            check( message->GetId() == (int) numMessagesReceived );
+            check( ((TestMessage*)message)->sequence == numMessagesReceived );
+
+            ++numMessagesReceived;
+
+            messageFactory.ReleaseMessage( message );
+        }
+
+        sender.GetChannelStatus( 0, status );
+
+        if ( numMessagesReceived == NumMessagesSent && status.numMessagesQueued == 0 )
+            break;
+    }
+
+    check( numMessagesReceived == NumMessagesSent );
+    check( status.numMessagesQueued == 0 );
+}
+
+void PumpClientServerUpdate( double & time, Client ** client, int numClients, Server ** server, int numServers, float deltaTime = 0.1f )
+{
+    for ( int i = 0; i < numClients; ++i )
+        client[i]->SendPackets();
+
+    for ( int i = 0; i < numServers; ++i )
+        server[i]->SendPackets();
+
+    for ( int i = 0; i < numClients; ++i )
+        client[i]->ReceivePackets();
+
+    for ( int i = 0; i < numServers; ++i )
+        server[i]->ReceivePackets();
+
+    time += deltaTime;
+
+    for ( int i = 0; i < numClients; ++i )
+        client[i]->AdvanceTime( time );
+
+    for ( int i = 0; i < numServers; ++i )
+        server[i]->AdvanceTime( time );
+
+    yojimbo_sleep( 0.0f );
+}
+
+void SendClientToServerMessages( Client & client, int numMessagesToSend, int channelIndex = 0 )
+{
+    for ( int i = 0; i < numMessagesToSend; ++i )
+    {
+        if ( !client.CanSendMessage( channelIndex ) )
+            break;
+
+        if ( rand() % 10 )
+        {
+            TestMessage * message = (TestMessage*) client.CreateMessage( TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            client.SendMessage( channelIndex, message );
+        }
+        else
+        {
+            TestBlockMessage * message = (TestBlockMessage*) client.CreateMessage( TEST_BLOCK_MESSAGE );
+            check( message );
+            message->sequence = i;
+            const int blockSize = 1 + ( ( i * 901 ) % 1001 );
+            uint8_t * blockData = client.AllocateBlock( blockSize );
+            check( blockData );
+            for ( int j = 0; j < blockSize; ++j )
+                blockData[j] = i + j;
+            client.AttachBlockToMessage( message, blockData, blockSize );
+            client.SendMessage( channelIndex, message );
+        }
+    }
+}
+
+void SendServerToClientMessages( Server & server, int clientIndex, int numMessagesToSend, int channelIndex = 0 )
+{
+    for ( int i = 0; i < numMessagesToSend; ++i )
+    {
+        if ( !server.CanSendMessage( clientIndex, channelIndex ) )
+            break;
+
+        if ( rand() % 10 )
+        {
+            TestMessage * message = (TestMessage*) server.CreateMessage( clientIndex, TEST_MESSAGE );
+            check( message );
+            message->sequence = i;
+            server.SendMessage( clientIndex, channelIndex, message );
+        }
+        else
+        {
+            TestBlockMessage * message = (TestBlockMessage*) server.CreateMessage( clientIndex, TEST_BLOCK_MESSAGE );
+            check( message );
+            message->sequence = i;
+            const int blockSize = 1 + ( ( i * 901 ) % 1001 );
+            uint8_t * blockData = server.AllocateBlock( clientIndex, blockSize );
+            check( blockData );
+            for ( int j = 0; j < blockSize; ++j )
+                blockData[j] = i + j;
+            server.AttachBlockToMessage( clientIndex, message, blockData, blockSize );
+            server.SendMessage( clientIndex, channelIndex, message );
+        }
+    }
+}
+
+void ProcessServerToClientMessages( Client & client, int & numMessagesReceivedFromServer )
+{
+    while ( true )
+    {
+        Message * message = client.ReceiveMessage( 0 );
+
+        if ( !message )
+            break;
+
+        check( message->GetId() == (int) numMessagesReceivedFromServer );
+        
+        switch ( message->GetType() )
+        {
+            case TEST_MESSAGE:
+            {
+                TestMessage * testMessage = (TestMessage*) message;
+                check( !message->IsBlockMessage() );
+                check( testMessage->sequence == uint16_t( numMessagesReceivedFromServer ) );
+                ++numMessagesReceivedFromServer;
+            }
+            break;
+
+            case TEST_BLOCK_MESSAGE:
+            {
+                check( message->IsBlockMessage() );
+                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+                check( blockMessage->sequence == uint16_t( numMessagesReceivedFromServer ) );
+                const int blockSize = blockMessage->GetBlockSize();
+                check( blockSize == 1 + ( ( numMessagesReceivedFromServer * 901 ) % 1001 ) );
+                const uint8_t * blockData = blockMessage->GetBlockData();
+                check( blockData );
+                for ( int j = 0; j < blockSize; ++j )
+                {
+                    check( blockData[j] == uint8_t( numMessagesReceivedFromServer + j ) );
+                }
+                ++numMessagesReceivedFromServer;
+            }
+            break;
+        }
+
+        client.ReleaseMessage( message );
+    }
+}
 
 void ProcessClientToServerMessages( Server & server, int clientIndex, int & numMessagesReceivedFromClient )
 {
-    while ( true )
+    while ( true )
+    {
+        Message * message = server.ReceiveMessage( clientIndex, 0 );
+
+        if ( !message )
+            break;
+
+        check( message->GetId() == (int) numMessagesReceivedFromClient );
+
+        switch ( message->GetType() )
+        {
+            case TEST_MESSAGE:
+            {
+                check( !message->IsBlockMessage() );
+                TestMessage * testMessage = (TestMessage*) message;
+                check( testMessage->sequence == uint16_t( numMessagesReceivedFromClient ) );
+                ++numMessagesReceivedFromClient;
+            }
+            break;
+
+            case TEST_BLOCK_MESSAGE:
+            {
+                check( message->IsBlockMessage() );
+                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+                check( blockMessage->sequence == uint16_t( numMessagesReceivedFromClient ) );
+                const int blockSize = blockMessage->GetBlockSize();
+                check( blockSize == 1 + ( ( numMessagesReceivedFromClient * 901 ) % 1001 ) );
+                const uint8_t * blockData = blockMessage->GetBlockData();
+                check( blockData );
+                for ( int j = 0; j < blockSize; ++j )
+                {
+                    check( blockData[j] == uint8_t( numMessagesReceivedFromClient + j ) );
+                }
+                ++numMessagesReceivedFromClient;
+            }
+            break;
+        }
+
+        server.ReleaseMessage( clientIndex, message );
+    }
+}
+
+void test_client_server_messages()
+{
+    const uint64_t clientId = 1;
+
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+    
+    ClientServerConfig config;
+    config.channel[0].messageSendQueueSize = 32;
+    config.channel[0].maxMessagesPerPacket = 8;
+    config.channel[0].maxBlockSize = 1024;
+    config.channel[0].blockFragmentSize = 200;
+
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    client.SetLatency( 250 );
+    client.SetJitter( 100 );
+    client.SetPacketLoss( 25 );
+    client.SetDuplicates( 25 );
+
+    server.SetLatency( 250 );
+    server.SetJitter( 100 );
+    server.SetPacketLoss( 25 );
+    server.SetDuplicates( 25 );
+
+    for ( int iteration = 0; iteration < 2; ++iteration )
+    {
+        client.InsecureConnect( privateKey, clientId, serverAddress );
+
+        const int NumIterations = 10000;
+
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+            
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+            if ( client.ConnectionFailed() )
+                break;
+
+            if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+                break;
+        }
+
+        check( !client.IsConnecting() );
+        check( client.IsConnected() );
+        check( server.GetNumConnectedClients() == 1 );
+        check( client.GetClientIndex() == 0 );
+        check( server.IsClientConnected(0) );
+
+        const int NumMessagesSent = config.channel[0].messageSendQueueSize;
+
+        SendClientToServerMessages( client, NumMessagesSent );
+
+        SendServerToClientMessages( server, client.GetClientIndex(), NumMessagesSent );
+
+        int numMessagesReceivedFromClient = 0;
+        int numMessagesReceivedFromServer = 0;
+
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            if ( !client.IsConnected() )
+                break;
+
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+            ProcessServerToClientMessages( client, numMessagesReceivedFromServer );
+
+            ProcessClientToServerMessages( server, client.GetClientIndex(), numMessagesReceivedFromClient );
+
+            if ( numMessagesReceivedFromClient == NumMessagesSent && numMessagesReceivedFromServer == NumMessagesSent )
+                break;
+        }
+
+        check( client.IsConnected() );
+        check( server.IsClientConnected( client.GetClientIndex() ) );
+        check( numMessagesReceivedFromClient == NumMessagesSent );
+        check( numMessagesReceivedFromServer == NumMessagesSent );
+
+        client.Disconnect();
+
+        for ( int i = 0; i < NumIterations; ++i )
+        {
+            Client * clients[] = { &client };
+            Server * servers[] = { &server };
+
+            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+            if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
+                break;
+        }
+
+        check( !client.IsConnected() && server.GetNumConnectedClients() == 0 );
+    }
+
+    server.Stop();
+}
+
+void CreateClients( int numClients, Client ** clients, const Address & address, const ClientServerConfig & config, Adapter & _adapter, double time )
+{
+    for ( int i = 0; i < numClients; ++i )
+    {
+        clients[i] = YOJIMBO_NEW( GetDefaultAllocator(), Client, GetDefaultAllocator(), address, config, _adapter, time );
+        clients[i]->SetLatency( 250 );
+        clients[i]->SetJitter( 100 );
+        clients[i]->SetPacketLoss( 25 );
+        clients[i]->SetDuplicates( 25 );
+    }
+}
+
+void ConnectClients( int numClients, Client ** clients, const uint8_t privateKey[], const Address & serverAddress )
+{
+    for ( int i = 0; i < numClients; ++i )
+    {
+        clients[i]->InsecureConnect( privateKey, i + 1, serverAddress );
+    }
+}
+
+void DestroyClients( int numClients, Client ** clients )
+{
+    for ( int i = 0; i < numClients; ++i )
+    {
+        clients[i]->Disconnect();
+
+        YOJIMBO_DELETE( GetDefaultAllocator(), Client, clients[i] );
+    }
+}
+
+bool AllClientsConnected( int numClients, Server & server, Client ** clients )
+{
+    if ( server.GetNumConnectedClients() != numClients )
+        return false;
+
+    for ( int i = 0; i < numClients; ++i )
+    {
+        if ( !clients[i]->IsConnected() )
+            return false;
+    }
+
+    return true;    
+}
+
+bool AnyClientDisconnected( int numClients, Client ** clients )
+{
+    for ( int i = 0; i < numClients; ++i )
+    {
+        if ( clients[i]->IsDisconnected() )
+            return true;
+    }
+
+    return false;
+}
+
+void test_client_server_start_stop_restart()
+{
+    Address clientAddress( "0.0.0.0", 0 );
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+    
+    ClientServerConfig config;
+    config.channel[0].messageSendQueueSize = 32;
+    config.channel[0].maxMessagesPerPacket = 8;
+    config.channel[0].maxBlockSize = 1024;
+    config.channel[0].blockFragmentSize = 200;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    server.SetLatency( 250 );
+    server.SetJitter( 100 );
+    server.SetPacketLoss( 25 );
+    server.SetDuplicates( 25 );
+
+    int numClients[] = { 3, 5, 1 };
+
+    const int NumIterations = sizeof( numClients ) / sizeof( int );
+
+    for ( int iteration = 0; iteration < NumIterations; ++iteration )
+    {
+        server.Start( numClients[iteration] );
+
+        Client * clients[MaxClients];
+
+        CreateClients( numClients[iteration], clients, clientAddress, config, adapter, time );
+
+        ConnectClients( numClients[iteration], clients, privateKey, serverAddress );
+
+        while ( true )
+        {
+            Server * servers[] = { &server };
+
+            PumpClientServerUpdate( time, (Client**) clients, numClients[iteration], servers, 1 );
+
+            if ( AnyClientDisconnected( numClients[iteration], clients ) )
+                break;
+
+            if ( AllClientsConnected( numClients[iteration], server, clients ) )
+                break;
+        }
+
+        check( AllClientsConnected( numClients[iteration], server, clients ) );
+
+        const int NumMessagesSent = config.channel[0].messageSendQueueSize;
+
+        for ( int clientIndex = 0; clientIndex < numClients[iteration]; ++clientIndex )
+        {
+            SendClientToServerMessages( *clients[clientIndex], NumMessagesSent );
+            SendServerToClientMessages( server, clientIndex, NumMessagesSent );
+        }
+
+        int numMessagesReceivedFromClient[MaxClients];
+        int numMessagesReceivedFromServer[MaxClients];
+
+        memset( numMessagesReceivedFromClient, 0, sizeof( numMessagesReceivedFromClient ) );
+        memset( numMessagesReceivedFromServer, 0, sizeof( numMessagesReceivedFromServer ) );
+
+		const int NumInternalIterations = 10000;
+
+        for ( int i = 0; i < NumInternalIterations; ++i )
+        {
+            Server * servers[] = { &server };
+
+            PumpClientServerUpdate( time, clients, numClients[iteration], servers, 1 );
+
+            bool allMessagesReceived = true;
+
+            for ( int j = 0; j < numClients[iteration]; ++j )
+            {
+                ProcessServerToClientMessages( *clients[j], numMessagesReceivedFromServer[j] );
+
+                if ( numMessagesReceivedFromServer[j] != NumMessagesSent )
+                    allMessagesReceived = false;
+
+                int clientIndex = clients[j]->GetClientIndex();
+
+                ProcessClientToServerMessages( server, clientIndex, numMessagesReceivedFromClient[clientIndex] );
+
+                if ( numMessagesReceivedFromClient[clientIndex] != NumMessagesSent )
+                    allMessagesReceived = false;
+            }
+
+            if ( allMessagesReceived )
+                break;
+        }
+
+        for ( int clientIndex = 0; clientIndex < numClients[iteration]; ++clientIndex )
+        {
+            check( numMessagesReceivedFromClient[clientIndex] == NumMessagesSent );
+            check( numMessagesReceivedFromServer[clientIndex] == NumMessagesSent );
+        }
+
+        DestroyClients( numClients[iteration], clients );
+
+        server.Stop();
+    }
+}
+
+void test_client_server_message_failed_to_serialize_reliable_ordered()
+{
+    const uint64_t clientId = 1;
+
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+    
+    ClientServerConfig config;
+    config.maxPacketSize = 1100;
+    config.numChannels = 1;
+    config.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    config.channel[0].maxBlockSize = 1024;
+    config.channel[0].blockFragmentSize = 200;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+
+    client.InsecureConnect( privateKey, clientId, serverAddress );
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
+        
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+        if ( client.ConnectionFailed() )
+            break;
+
+        if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+            break;
+    }
+
+    check( !client.IsConnecting() );
+    check( client.IsConnected() );
+    check( server.GetNumConnectedClients() == 1 );
+    check( client.GetClientIndex() == 0 );
+    check( server.IsClientConnected(0) );
+
+    // send a message from client to server that fails to serialize on read, this should disconnect the client from the server
+
+    Message * message = client.CreateMessage( TEST_SERIALIZE_FAIL_ON_READ_MESSAGE );
+    check( message );
+    client.SendMessage( 0, message );
+
+    for ( int i = 0; i < 256; ++i )
     {
-        Message * message = server.ReceiveMessage( clientIndex, 0 );
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
+        
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
 
-        if ( !message )
+        if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
             break;
+    }
 
-        check( message->GetId() == (int) numMessagesReceivedFromClient );
+    check( !client.IsConnected() && server.GetNumConnectedClients() == 0 );
 
-        switch ( message->GetType() )
-        {
-            case TEST_MESSAGE:
-            {
-                check( !message->IsBlockMessage() );
-                TestMessage * testMessage = (TestMessage*) message;
-                check( testMessage->sequence == uint16_t( numMessagesReceivedFromClient ) );
-                ++numMessagesReceivedFromClient;
-            }
+    client.Disconnect();
+
+    server.Stop();
+}
+
+void test_client_server_message_failed_to_serialize_unreliable_unordered()
+{
+    const uint64_t clientId = 1;
+
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+    
+    ClientServerConfig config;
+    config.maxPacketSize = 1100;
+    config.numChannels = 1;
+    config.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
+    config.channel[0].maxBlockSize = 1024;
+    config.channel[0].blockFragmentSize = 200;
+
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+
+    client.InsecureConnect( privateKey, clientId, serverAddress );
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
+        
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+        if ( client.ConnectionFailed() )
             break;
 
-            case TEST_BLOCK_MESSAGE:
-            {
-                check( message->IsBlockMessage() );
-                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
-                check( blockMessage->sequence == uint16_t( numMessagesReceivedFromClient ) );
-                const int blockSize = blockMessage->GetBlockSize();
-                check( blockSize == 1 + ( ( numMessagesReceivedFromClient * 901 ) % 1001 ) );
-                const uint8_t * blockData = blockMessage->GetBlockData();
-                check( blockData );
-                for ( int j = 0; j < blockSize; ++j )
-                {
-                    check( blockData[j] == uint8_t( numMessagesReceivedFromClient + j ) );
-                }
-                ++numMessagesReceivedFromClient;
-            }
+        if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
             break;
-        }
+    }
 
-        server.ReleaseMessage( clientIndex, message );
+    check( !client.IsConnecting() );
+    check( client.IsConnected() );
+    check( server.GetNumConnectedClients() == 1 );
+    check( client.GetClientIndex() == 0 );
+    check( server.IsClientConnected(0) );
+
+    // send a message from client to server that fails to serialize on read, this should disconnect the client from the server
+
+    for ( int i = 0; i < 256; ++i )
+    {
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
+        
+        Message * message = client.CreateMessage( TEST_SERIALIZE_FAIL_ON_READ_MESSAGE );
+        check( message );
+        client.SendMessage( 0, message );
+
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+        if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
+            break;
     }
+
+    check( !client.IsConnected() );
+    check( server.GetNumConnectedClients() == 0 );
+
+    client.Disconnect();
+
+    server.Stop();
 }
 
-void test_client_server_messages()
+void test_client_server_message_exhaust_stream_allocator()
 {
     const uint64_t clientId = 1;
 
@@ -1588,13 +3937,87 @@ void test_client_server_messages()
     double time = 100.0;
     
     ClientServerConfig config;
-    config.channel[0].messageSendQueueSize = 32;
-    config.channel[0].maxMessagesPerPacket = 8;
+    config.maxPacketSize = 1100;
+    config.numChannels = 1;
+    config.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
     config.channel[0].maxBlockSize = 1024;
     config.channel[0].blockFragmentSize = 200;
 
+    uint8_t privateKey[KeyBytes];
+    memset( privateKey, 0, KeyBytes );
+
+    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+
+    server.Start( MaxClients );
+
     Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
 
+    client.InsecureConnect( privateKey, clientId, serverAddress );
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
+        
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+        if ( client.ConnectionFailed() )
+            break;
+
+        if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+            break;
+    }
+
+    check( !client.IsConnecting() );
+    check( client.IsConnected() );
+    check( server.GetNumConnectedClients() == 1 );
+    check( client.GetClientIndex() == 0 );
+    check( server.IsClientConnected(0) );
+
+    // send a message from client to server that exhausts the stream allocator on read, this should disconnect the client from the server
+
+    Message * message = client.CreateMessage( TEST_EXHAUST_STREAM_ALLOCATOR_ON_READ_MESSAGE );
+    check( message );
+    client.SendMessage( 0, message );
+
+    for ( int i = 0; i < 256; ++i )
+    {
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
+        
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+
+        if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
+            break;
+    }
+
+    check( !client.IsConnected() && server.GetNumConnectedClients() == 0 );
+
+    client.Disconnect();
+
+    server.Stop();
+}
+
+void test_client_server_message_receive_queue_overflow()
+{
+    const uint64_t clientId = 1;
+
+    Address clientAddress( "0.0.0.0", ClientPort );
+    Address serverAddress( "127.0.0.1", ServerPort );
+
+    double time = 100.0;
+    
+    ClientServerConfig config;
+    config.maxPacketSize = 1100;
+    config.numChannels = 1;
+    config.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    config.channel[0].maxBlockSize = 1024;
+    config.channel[0].blockFragmentSize = 200;
+    config.channel[0].messageSendQueueSize = 1024;
+    config.channel[0].messageReceiveQueueSize = 256;
+    
     uint8_t privateKey[KeyBytes];
     memset( privateKey, 0, KeyBytes );
 
@@ -1602,547 +4025,857 @@ void test_client_server_messages()
 
     server.Start( MaxClients );
 
-    client.SetLatency( 250 );
-    client.SetJitter( 100 );
-    client.SetPacketLoss( 25 );
-    client.SetDuplicates( 25 );
+    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
 
-    server.SetLatency( 250 );
-    server.SetJitter( 100 );
-    server.SetPacketLoss( 25 );
-    server.SetDuplicates( 25 );
+    client.InsecureConnect( privateKey, clientId, serverAddress );
 
-    for ( int iteration = 0; iteration < 2; ++iteration )
+    while ( true )
     {
-        client.InsecureConnect( privateKey, clientId, serverAddress );
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };
+        
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
 
-        const int NumIterations = 10000;
+        if ( client.ConnectionFailed() )
+            break;
 
-        for ( int i = 0; i < NumIterations; ++i )
-        {
-            Client * clients[] = { &client };
-            Server * servers[] = { &server };
-            
-            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+        if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+            break;
+    }
+
+    check( !client.IsConnecting() );
+    check( client.IsConnected() );
+    check( server.GetNumConnectedClients() == 1 );
+    check( client.GetClientIndex() == 0 );
+    check( server.IsClientConnected(0) );
+
+    // send a lot of messages, but don't dequeue them, this tests that the receive queue is able to handle overflow
+    // eg. the receiver should detect an error and disconnect the client, because the message is out of bounds.
+
+    const int NumMessagesSent = config.channel[0].messageSendQueueSize;
+
+    SendClientToServerMessages( client, NumMessagesSent );
+
+    for ( int i = 0; i < NumMessagesSent * 4; ++i )
+    {
+        Client * clients[] = { &client };
+        Server * servers[] = { &server };  
+
+        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+    }
+
+    check( !client.IsConnected() );
+    check( server.GetNumConnectedClients() == 0 );
+
+    client.Disconnect();
+
+    server.Stop();
+}
+
+void test_server_worker_threads()
+{
+    // the same traffic through a single threaded server and a server with worker threads must produce exactly the
+    // same packets in the same order. block messages go through the shared block allocator from the workers.
 
-            if ( client.ConnectionFailed() )
-                break;
+    const int NumClients = 16;
+    const int NumTicks = 300;
+    const int NumMessagesPerClient = 32;
 
-            if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
-                break;
-        }
+    const int numWorkerThreads[] = { 0, 4 };
 
-        check( !client.IsConnecting() );
-        check( client.IsConnected() );
-        check( server.GetNumConnectedClients() == 1 );
-        check( client.GetClientIndex() == 0 );
-        check( server.IsClientConnected(0) );
+    uint64_t packetHash[2];
+    int numMessagesReceived[2];
 
-        const int NumMessagesSent = config.channel[0].messageSendQueueSize;
+    for ( int pass = 0; pass < 2; ++pass )
+    {
+        ClientServerConfig config;
+        config.networkSimulator = false;
+        config.serverPerClientMemory = 1024 * 1024;
+        config.serverBlockMemory = 256 * 1024;
+        config.serverWorkerThreads = numWorkerThreads[pass];
+        config.channel[0].maxBlockSize = 4096;
 
-        SendClientToServerMessages( client, NumMessagesSent );
+        double time = 100.0;
 
-        SendServerToClientMessages( server, client.GetClientIndex(), NumMessagesSent );
+        EchoServer server( GetDefaultAllocator(), config, adapter, time );
 
-        int numMessagesReceivedFromClient = 0;
-        int numMessagesReceivedFromServer = 0;
+        server.Start( NumClients );
 
-        for ( int i = 0; i < NumIterations; ++i )
-        {
-            if ( !client.IsConnected() )
-                break;
+        for ( int i = 0; i < NumClients; ++i )
+            server.ConnectClient( i );
 
-            Client * clients[] = { &client };
-            Server * servers[] = { &server };
+        uint16_t numMessagesSent[NumClients];
+        uint16_t numMessagesReceivedFromClient[NumClients];
 
-            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+        memset( numMessagesSent, 0, sizeof( numMessagesSent ) );
+        memset( numMessagesReceivedFromClient, 0, sizeof( numMessagesReceivedFromClient ) );
 
-            ProcessServerToClientMessages( client, numMessagesReceivedFromServer );
+        numMessagesReceived[pass] = 0;
 
-            ProcessClientToServerMessages( server, client.GetClientIndex(), numMessagesReceivedFromClient );
+        for ( int tick = 0; tick < NumTicks; ++tick )
+        {
+            for ( int i = 0; i < NumClients; ++i )
+            {
+                while ( Message * message = server.ReceiveMessage( i, 0 ) )
+                {
+                    check( message->GetId() == numMessagesReceivedFromClient[i] );
+                    if ( message->GetType() == TEST_BLOCK_MESSAGE )
+                    {
+                        BlockMessage * blockMessage = (BlockMessage*) message;
+                        const uint8_t * blockData = blockMessage->GetBlockData();
+                        for ( int j = 0; j < blockMessage->GetBlockSize(); ++j )
+                            check( blockData[j] == uint8_t( i + message->GetId() + j ) );
+                    }
+                    numMessagesReceivedFromClient[i]++;
+                    numMessagesReceived[pass]++;
+                    server.ReleaseMessage( i, message );
+                }
 
-            if ( numMessagesReceivedFromClient == NumMessagesSent && numMessagesReceivedFromServer == NumMessagesSent )
-                break;
-        }
+                if ( numMessagesSent[i] == NumMessagesPerClient || !server.CanSendMessage( i, 0 ) )
+                    continue;
 
-        check( client.IsConnected() );
-        check( server.IsClientConnected( client.GetClientIndex() ) );
-        check( numMessagesReceivedFromClient == NumMessagesSent );
-        check( numMessagesReceivedFromServer == NumMessagesSent );
+                const uint16_t sequence = numMessagesSent[i]++;
 
-        client.Disconnect();
+                if ( sequence % 4 == 0 )
+                {
+                    TestBlockMessage * message = (TestBlockMessage*) server.CreateMessage( i, TEST_BLOCK_MESSAGE );
+                    check( message );
+                    message->sequence = sequence;
+                    const int blockSize = 1 + ( i * 97 + sequence * 131 ) % 4096;
+                    uint8_t * blockData = server.AllocateBlock( i, blockSize );
+                    check( blockData );
+                    for ( int j = 0; j < blockSize; ++j )
+                        blockData[j] = uint8_t( i + sequence + j );
+                    server.AttachBlockToMessage( i, message, blockData, blockSize );
+                    server.SendMessage( i, 0, message );
+                }
+                else
+                {
+                    TestMessage * message = (TestMessage*) server.CreateMessage( i, TEST_MESSAGE );
+                    check( message );
+                    message->sequence = sequence;
+                    server.SendMessage( i, 0, message );
+                }
+            }
 
-        for ( int i = 0; i < NumIterations; ++i )
-        {
-            Client * clients[] = { &client };
-            Server * servers[] = { &server };
+            server.ReceivePackets();
 
-            PumpClientServerUpdate( time, clients, 1, servers, 1 );
+            server.AdvanceTime( time );
 
-            if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
-                break;
+            server.SendPackets();
+
+            time += 0.1;
         }
 
-        check( !client.IsConnected() && server.GetNumConnectedClients() == 0 );
+        for ( int i = 0; i < NumClients; ++i )
+        {
+            check( server.IsClientConnected( i ) );
+            check( numMessagesReceivedFromClient[i] == NumMessagesPerClient );
+        }
+
+        packetHash[pass] = server.GetPacketHash();
+
+        server.Stop();
     }
 
-    server.Stop();
+    check( numMessagesReceived[0] == NumClients * NumMessagesPerClient );
+    check( numMessagesReceived[1] == numMessagesReceived[0] );
+    check( packetHash[0] == packetHash[1] );
 }
 
-void CreateClients( int numClients, Client ** clients, const Address & address, const ClientServerConfig & config, Adapter & _adapter, double time )
+class TransmitBatchServer : public EchoServer
 {
-    for ( int i = 0; i < numClients; ++i )
+public:
+
+    TransmitBatchServer( Allocator & allocator, const ClientServerConfig & config, Adapter & adapter, double time ) 
+        : EchoServer( allocator, config, adapter, time )
     {
-        clients[i] = YOJIMBO_NEW( GetDefaultAllocator(), Client, GetDefaultAllocator(), address, config, _adapter, time );
-        clients[i]->SetLatency( 250 );
-        clients[i]->SetJitter( 100 );
-        clients[i]->SetPacketLoss( 25 );
-        clients[i]->SetDuplicates( 25 );
+        numBatches = 0;
+        numPackets = 0;
+        memset( batchSize, 0, sizeof( batchSize ) );
+        memset( packetClientIndex, 0, sizeof( packetClientIndex ) );
     }
-}
 
-void ConnectClients( int numClients, Client ** clients, const uint8_t privateKey[], const Address & serverAddress )
-{
-    for ( int i = 0; i < numClients; ++i )
+    void TransmitPackets( const int * clientIndex, const uint16_t * packetSequence, uint8_t * const * packetData, const int * packetBytes, int count )
     {
-        clients[i]->InsecureConnect( privateKey, i + 1, serverAddress );
+        if ( numBatches < MaxBatches )
+            batchSize[numBatches] = count;
+        numBatches++;
+        for ( int i = 0; i < count && numPackets < MaxPackets; ++i )
+            packetClientIndex[numPackets++] = clientIndex[i];
+        EchoServer::TransmitPackets( clientIndex, packetSequence, packetData, packetBytes, count );
     }
-}
 
-void DestroyClients( int numClients, Client ** clients )
-{
-    for ( int i = 0; i < numClients; ++i )
-    {
-        clients[i]->Disconnect();
+    enum { MaxBatches = 8, MaxPackets = 1024 };
 
-        YOJIMBO_DELETE( GetDefaultAllocator(), Client, clients[i] );
-    }
-}
+    int numBatches;
+    int batchSize[MaxBatches];
+    int numPackets;
+    int packetClientIndex[MaxPackets];
+};
 
-bool AllClientsConnected( int numClients, Server & server, Client ** clients )
+void test_server_transmit_packets()
 {
-    if ( server.GetNumConnectedClients() != numClients )
-        return false;
+    // packets for every client are generated first, then handed over in batches of up to MaxTransmitPackets
 
-    for ( int i = 0; i < numClients; ++i )
+    const int NumClients = 300;
+
+    ClientServerConfig config;
+    config.networkSimulator = false;
+    config.serverPerClientMemory = 256 * 1024;
+    config.channel[0].maxBlockSize = 1024;
+
+    double time = 100.0;
+
+    TransmitBatchServer server( GetDefaultAllocator(), config, adapter, time );
+
+    server.Start( NumClients );
+
+    for ( int i = 0; i < NumClients; ++i )
+        server.ConnectClient( i );
+
+    for ( int i = 0; i < NumClients; i += 10 )
+        server.DisconnectClient( i );
+
+    const int NumConnectedClients = NumClients - NumClients / 10;
+
+    check( server.GetNumConnectedClients() == NumConnectedClients );
+
+    server.SendPackets();
+
+    check( server.numBatches == 2 );
+    check( server.batchSize[0] == MaxTransmitPackets );
+    check( server.batchSize[1] == NumConnectedClients - MaxTransmitPackets );
+    check( server.numPackets == NumConnectedClients );
+
+    bool sent[NumClients];
+    memset( sent, 0, sizeof( sent ) );
+    for ( int i = 0; i < server.numPackets; ++i )
     {
-        if ( !clients[i]->IsConnected() )
-            return false;
+        const int clientIndex = server.packetClientIndex[i];
+        check( clientIndex >= 0 && clientIndex < NumClients );
+        check( clientIndex % 10 != 0 );
+        check( !sent[clientIndex] );
+        sent[clientIndex] = true;
     }
 
-    return true;    
-}
+    // every third client gets a block, so its packet is above fragmentPacketsAbove and goes out as two fragments.
+    // the first fragment of each client is sent before the second fragment of any client.
 
-bool AnyClientDisconnected( int numClients, Client ** clients )
-{
-    for ( int i = 0; i < numClients; ++i )
+    int numFragmentedClients = 0;
+
+    for ( int i = 1; i < NumClients; i += 3 )
     {
-        if ( clients[i]->IsDisconnected() )
-            return true;
+        if ( i % 10 == 0 )
+            continue;
+        const int BlockSize = config.channel[0].maxBlockSize;
+        TestBlockMessage * message = (TestBlockMessage*) server.CreateMessage( i, TEST_BLOCK_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        uint8_t * blockData = server.AllocateBlock( i, BlockSize );
+        check( blockData );
+        for ( int j = 0; j < BlockSize; ++j )
+            blockData[j] = uint8_t( i + j );
+        server.AttachBlockToMessage( i, message, blockData, BlockSize );
+        server.SendMessage( i, 0, message );
+        numFragmentedClients++;
     }
 
-    return false;
-}
-
-void test_client_server_start_stop_restart()
-{
-    Address clientAddress( "0.0.0.0", 0 );
-    Address serverAddress( "127.0.0.1", ServerPort );
+    server.numBatches = 0;
+    server.numPackets = 0;
 
-    double time = 100.0;
-    
-    ClientServerConfig config;
-    config.channel[0].messageSendQueueSize = 32;
-    config.channel[0].maxMessagesPerPacket = 8;
-    config.channel[0].maxBlockSize = 1024;
-    config.channel[0].blockFragmentSize = 200;
+    server.SendPackets();
 
-    uint8_t privateKey[KeyBytes];
-    memset( privateKey, 0, KeyBytes );
+    const int NumPackets = NumConnectedClients + numFragmentedClients;
 
-    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+    check( server.numBatches == 2 );
+    check( server.batchSize[0] == MaxTransmitPackets );
+    check( server.batchSize[1] == NumPackets - MaxTransmitPackets );
+    check( server.numPackets == NumPackets );
 
-    server.Start( MaxClients );
+    memset( sent, 0, sizeof( sent ) );
+    for ( int i = 0; i < NumConnectedClients; ++i )
+    {
+        const int clientIndex = server.packetClientIndex[i];
+        check( clientIndex % 10 != 0 );
+        check( !sent[clientIndex] );
+        sent[clientIndex] = true;
+    }
 
-    server.SetLatency( 250 );
-    server.SetJitter( 100 );
-    server.SetPacketLoss( 25 );
-    server.SetDuplicates( 25 );
+    memset( sent, 0, sizeof( sent ) );
+    for ( int i = NumConnectedClients; i < NumPackets; ++i )
+    {
+        const int clientIndex = server.packetClientIndex[i];
+        check( clientIndex % 3 == 1 );
+        check( !sent[clientIndex] );
+        sent[clientIndex] = true;
+    }
 
-    int numClients[] = { 3, 5, 1 };
+    // the fragments are reassembled on the way back in, so each block is received intact
 
-    const int NumIterations = sizeof( numClients ) / sizeof( int );
+    server.ReceivePackets();
 
-    for ( int iteration = 0; iteration < NumIterations; ++iteration )
+    for ( int i = 1; i < NumClients; i += 3 )
     {
-        server.Start( numClients[iteration] );
-
-        Client * clients[MaxClients];
+        if ( i % 10 == 0 )
+            continue;
+        Message * message = server.ReceiveMessage( i, 0 );
+        check( message );
+        check( message->GetType() == TEST_BLOCK_MESSAGE );
+        BlockMessage * blockMessage = (BlockMessage*) message;
+        check( blockMessage->GetBlockSize() == config.channel[0].maxBlockSize );
+        const uint8_t * blockData = blockMessage->GetBlockData();
+        for ( int j = 0; j < blockMessage->GetBlockSize(); ++j )
+            check( blockData[j] == uint8_t( i + j ) );
+        server.ReleaseMessage( i, message );
+    }
 
-        CreateClients( numClients[iteration], clients, clientAddress, config, adapter, time );
+    server.Stop();
+}
 
-        ConnectClients( numClients[iteration], clients, privateKey, serverAddress );
+void test_server_network_thread()
+{
+    // messages sent from this thread go through the message queues to the network thread, which ticks the server on
+    // its own. each echo server slot gets its own packets back, so every message sent to a client comes back from it.
 
-        while ( true )
-        {
-            Server * servers[] = { &server };
+    const int NumClients = 8;
+    const int NumMessagesPerClient = 256;
 
-            PumpClientServerUpdate( time, (Client**) clients, numClients[iteration], servers, 1 );
+    ClientServerConfig config;
+    config.networkSimulator = false;
+    config.serverPerClientMemory = 1024 * 1024;
+    config.networkThread = true;
+    config.networkTickRate = 1000;
 
-            if ( AnyClientDisconnected( numClients[iteration], clients ) )
-                break;
+    double time = 100.0;
 
-            if ( AllClientsConnected( numClients[iteration], server, clients ) )
-                break;
-        }
+    EchoServer server( GetDefaultAllocator(), config, adapter, time );
 
-        check( AllClientsConnected( numClients[iteration], server, clients ) );
+    server.Start( NumClients );
 
-        const int NumMessagesSent = config.channel[0].messageSendQueueSize;
+    for ( int i = 0; i < NumClients; ++i )
+        server.ConnectClient( i );
 
-        for ( int clientIndex = 0; clientIndex < numClients[iteration]; ++clientIndex )
-        {
-            SendClientToServerMessages( *clients[clientIndex], NumMessagesSent );
-            SendServerToClientMessages( server, clientIndex, NumMessagesSent );
-        }
+    server.StartNetworkThread();
 
-        int numMessagesReceivedFromClient[MaxClients];
-        int numMessagesReceivedFromServer[MaxClients];
+    check( server.GetNumConnectedClients() == NumClients );
 
-        memset( numMessagesReceivedFromClient, 0, sizeof( numMessagesReceivedFromClient ) );
-        memset( numMessagesReceivedFromServer, 0, sizeof( numMessagesReceivedFromServer ) );
+    uint16_t numMessagesSent[NumClients];
+    uint16_t numMessagesReceived[NumClients];
 
-		const int NumInternalIterations = 10000;
+    memset( numMessagesSent, 0, sizeof( numMessagesSent ) );
+    memset( numMessagesReceived, 0, sizeof( numMessagesReceived ) );
 
-        for ( int i = 0; i < NumInternalIterations; ++i )
-        {
-            Server * servers[] = { &server };
+    int numClientsDone = 0;
 
-            PumpClientServerUpdate( time, clients, numClients[iteration], servers, 1 );
+    const double startTime = yojimbo_time();
 
-            bool allMessagesReceived = true;
+    while ( numClientsDone < NumClients && yojimbo_time() - startTime < 10.0 )
+    {
+        for ( int i = 0; i < NumClients; ++i )
+        {
+            while ( Message * message = server.ReceiveMessage( i, 0 ) )
+            {
+                check( message->GetId() == numMessagesReceived[i] );
+                check( ( (TestMessage*) message )->sequence == numMessagesReceived[i] );
+                if ( ++numMessagesReceived[i] == NumMessagesPerClient )
+                    numClientsDone++;
+                server.ReleaseMessage( i, message );
+            }
 
-            for ( int j = 0; j < numClients[iteration]; ++j )
+            while ( numMessagesSent[i] < NumMessagesPerClient && server.CanSendMessage( i, 0 ) )
             {
-                ProcessServerToClientMessages( *clients[j], numMessagesReceivedFromServer[j] );
+                TestMessage * message = (TestMessage*) server.CreateMessage( i, TEST_MESSAGE );
+                check( message );
+                message->sequence = numMessagesSent[i]++;
+                server.SendMessage( i, 0, message );
+            }
+        }
 
-                if ( numMessagesReceivedFromServer[j] != NumMessagesSent )
-                    allMessagesReceived = false;
+        // these only sync with the network thread now
 
-                int clientIndex = clients[j]->GetClientIndex();
+        server.ReceivePackets();
 
-                ProcessClientToServerMessages( server, clientIndex, numMessagesReceivedFromClient[clientIndex] );
+        server.AdvanceTime( time );
 
-                if ( numMessagesReceivedFromClient[clientIndex] != NumMessagesSent )
-                    allMessagesReceived = false;
-            }
+        server.SendPackets();
 
-            if ( allMessagesReceived )
-                break;
-        }
+        yojimbo_sleep( 0.001 );
+    }
 
-        for ( int clientIndex = 0; clientIndex < numClients[iteration]; ++clientIndex )
-        {
-            check( numMessagesReceivedFromClient[clientIndex] == NumMessagesSent );
-            check( numMessagesReceivedFromServer[clientIndex] == NumMessagesSent );
-        }
+    for ( int i = 0; i < NumClients; ++i )
+        check( numMessagesReceived[i] == NumMessagesPerClient );
 
-        DestroyClients( numClients[iteration], clients );
+    // disconnects are requested here and carried out on the network thread
 
-        server.Stop();
+    server.DisconnectClient( 0 );
+
+    while ( server.IsClientConnected( 0 ) && yojimbo_time() - startTime < 20.0 )
+    {
+        server.AdvanceTime( time );
+        yojimbo_sleep( 0.001 );
     }
+
+    check( !server.IsClientConnected( 0 ) );
+    check( server.GetNumConnectedClients() == NumClients - 1 );
+
+    server.Stop();
 }
 
-void test_client_server_message_failed_to_serialize_reliable_ordered()
+void test_client_server_memory_transport()
 {
-    const uint64_t clientId = 1;
+    // the same client and server code as over netcode.io, but packets go through in memory queues
 
-    Address clientAddress( "0.0.0.0", ClientPort );
-    Address serverAddress( "127.0.0.1", ServerPort );
+    const int NumClients = 4;
 
-    double time = 100.0;
-    
     ClientServerConfig config;
-    config.maxPacketSize = 1100;
-    config.numChannels = 1;
-    config.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
+    config.channel[0].messageSendQueueSize = 32;
+    config.channel[0].maxMessagesPerPacket = 8;
     config.channel[0].maxBlockSize = 1024;
     config.channel[0].blockFragmentSize = 200;
 
-    uint8_t privateKey[KeyBytes];
-    memset( privateKey, 0, KeyBytes );
+    double time = 100.0;
 
-    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+    MemoryServerTransport serverTransport( GetDefaultAllocator(), Address( "127.0.0.1", ServerPort ) );
+
+    Server server( GetDefaultAllocator(), serverTransport, config, adapter, time );
 
     server.Start( MaxClients );
 
-    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+    server.SetLatency( 250 );
+    server.SetJitter( 100 );
+    server.SetPacketLoss( 25 );
+    server.SetDuplicates( 25 );
+
+    MemoryClientTransport * clientTransport[NumClients];
+    Client * clients[NumClients];
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        clientTransport[i] = YOJIMBO_NEW( GetDefaultAllocator(), MemoryClientTransport, serverTransport );
+        clients[i] = YOJIMBO_NEW( GetDefaultAllocator(), Client, GetDefaultAllocator(), *clientTransport[i], config, adapter, time );
+    }
+
+    uint8_t connectToken[ConnectTokenBytes];
+    memset( connectToken, 0, sizeof( connectToken ) );
+
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        clients[i]->Connect( i + 1, connectToken );
+        check( clients[i]->IsConnecting() );
+    }
+
+    Server * servers[] = { &server };
+
+    const int NumIterations = 10000;
+
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpClientServerUpdate( time, clients, NumClients, servers, 1 );
+        if ( server.GetNumConnectedClients() == NumClients && AllClientsConnected( NumClients, server, clients ) )
+            break;
+    }
+
+    check( server.GetNumConnectedClients() == NumClients );
+    check( AllClientsConnected( NumClients, server, clients ) );
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        check( server.GetClientId( clients[i]->GetClientIndex() ) == clients[i]->GetClientId() );
+    }
+
+    const int NumMessagesSent = config.channel[0].messageSendQueueSize;
 
-    client.InsecureConnect( privateKey, clientId, serverAddress );
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        SendClientToServerMessages( *clients[i], NumMessagesSent );
+        SendServerToClientMessages( server, clients[i]->GetClientIndex(), NumMessagesSent );
+    }
 
-    const int NumIterations = 10000;
+    int numMessagesReceivedFromClient[NumClients];
+    int numMessagesReceivedFromServer[NumClients];
+    memset( numMessagesReceivedFromClient, 0, sizeof( numMessagesReceivedFromClient ) );
+    memset( numMessagesReceivedFromServer, 0, sizeof( numMessagesReceivedFromServer ) );
 
     for ( int i = 0; i < NumIterations; ++i )
     {
-        Client * clients[] = { &client };
-        Server * servers[] = { &server };
-        
-        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+        PumpClientServerUpdate( time, clients, NumClients, servers, 1 );
 
-        if ( client.ConnectionFailed() )
-            break;
+        bool allReceived = true;
+        for ( int j = 0; j < NumClients; ++j )
+        {
+            ProcessServerToClientMessages( *clients[j], numMessagesReceivedFromServer[j] );
+            ProcessClientToServerMessages( server, clients[j]->GetClientIndex(), numMessagesReceivedFromClient[j] );
+            if ( numMessagesReceivedFromClient[j] != NumMessagesSent || numMessagesReceivedFromServer[j] != NumMessagesSent )
+                allReceived = false;
+        }
 
-        if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+        if ( allReceived )
             break;
     }
 
-    check( !client.IsConnecting() );
-    check( client.IsConnected() );
-    check( server.GetNumConnectedClients() == 1 );
-    check( client.GetClientIndex() == 0 );
-    check( server.IsClientConnected(0) );
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        check( clients[i]->IsConnected() );
+        check( numMessagesReceivedFromClient[i] == NumMessagesSent );
+        check( numMessagesReceivedFromServer[i] == NumMessagesSent );
+    }
 
-    // send a message from client to server that fails to serialize on read, this should disconnect the client from the server
+    // one client leaves, and the server kicks another
 
-    Message * message = client.CreateMessage( TEST_SERIALIZE_FAIL_ON_READ_MESSAGE );
-    check( message );
-    client.SendMessage( 0, message );
+    clients[0]->Disconnect();
 
-    for ( int i = 0; i < 256; ++i )
-    {
-        Client * clients[] = { &client };
-        Server * servers[] = { &server };
-        
-        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+    server.DisconnectClient( clients[1]->GetClientIndex() );
 
-        if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpClientServerUpdate( time, clients, NumClients, servers, 1 );
+        if ( server.GetNumConnectedClients() == NumClients - 2 && !clients[1]->IsConnected() )
             break;
     }
 
-    check( !client.IsConnected() && server.GetNumConnectedClients() == 0 );
+    check( server.GetNumConnectedClients() == NumClients - 2 );
+    check( clients[1]->IsDisconnected() );
+    check( clients[2]->IsConnected() );
+    check( clients[3]->IsConnected() );
 
-    client.Disconnect();
+    // stopping the server disconnects everybody else
 
     server.Stop();
+
+    PumpClientServerUpdate( time, clients, NumClients, servers, 0 );
+
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        check( clients[i]->IsDisconnected() );
+        YOJIMBO_DELETE( GetDefaultAllocator(), Client, clients[i] );
+        YOJIMBO_DELETE( GetDefaultAllocator(), MemoryClientTransport, clientTransport[i] );
+    }
 }
 
-void test_client_server_message_failed_to_serialize_unreliable_unordered()
+#if defined(__linux__)
+
+struct UdpTransportConnectDisconnect
 {
-    const uint64_t clientId = 1;
+    int numConnects;
+    int numDisconnects;
+};
 
-    Address clientAddress( "0.0.0.0", ClientPort );
-    Address serverAddress( "127.0.0.1", ServerPort );
+static void UdpTransportConnectDisconnectFunction( void * context, int clientIndex, int connected )
+{
+    (void) clientIndex;
+    UdpTransportConnectDisconnect * counts = (UdpTransportConnectDisconnect*) context;
+    if ( connected )
+        counts->numConnects++;
+    else
+        counts->numDisconnects++;
+}
+
+void test_server_udp_transport()
+{
+    // raw sockets stand in for clients. each packet is the client number followed by the packet number
+
+    const int NumClients = 3;
+    const int NumPackets = 20;
+    const int BatchSize = 8;
+    const double Timeout = 5.0;
+
+    UdpServerTransport transport( GetDefaultAllocator(), Address( "127.0.0.1", 0 ), BatchSize, Timeout );
+
+    UdpTransportConnectDisconnect counts;
+    counts.numConnects = 0;
+    counts.numDisconnects = 0;
 
     double time = 100.0;
-    
-    ClientServerConfig config;
-    config.maxPacketSize = 1100;
-    config.numChannels = 1;
-    config.channel[0].type = CHANNEL_TYPE_UNRELIABLE_UNORDERED;
-    config.channel[0].maxBlockSize = 1024;
-    config.channel[0].blockFragmentSize = 200;
 
-    uint8_t privateKey[KeyBytes];
-    memset( privateKey, 0, KeyBytes );
+    check( transport.Start( GetDefaultAllocator(), 4, UdpTransportConnectDisconnectFunction, &counts, time ) );
+    check( transport.GetAddress().GetPort() != 0 );
 
-    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+    sockaddr_in serverAddress;
+    memset( &serverAddress, 0, sizeof( serverAddress ) );
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons( transport.GetAddress().GetPort() );
+    serverAddress.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
 
-    server.Start( MaxClients );
+    int clientSocket[NumClients];
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        clientSocket[i] = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+        check( clientSocket[i] >= 0 );
+        timeval receiveTimeout;
+        receiveTimeout.tv_sec = 1;
+        receiveTimeout.tv_usec = 0;
+        setsockopt( clientSocket[i], SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof( receiveTimeout ) );
+        for ( int j = 0; j < NumPackets; ++j )
+        {
+            uint8_t packet[2] = { uint8_t( i ), uint8_t( j ) };
+            check( sendto( clientSocket[i], packet, sizeof( packet ), 0, (sockaddr*) &serverAddress, sizeof( serverAddress ) ) == sizeof( packet ) );
+        }
+    }
 
-    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+    // without capacity the packets wait in their slots. a packet from a new address connects on the next update
 
-    client.InsecureConnect( privateKey, clientId, serverAddress );
+    int clientCapacity[4];
+    int clientIndex[256];
+    uint8_t * packetData[256];
+    int packetBytes[256];
 
-    const int NumIterations = 10000;
+    memset( clientCapacity, 0, sizeof( clientCapacity ) );
+    check( transport.ReceiveAllPackets( clientCapacity, clientIndex, packetData, packetBytes, 256 ) == 0 );
+    check( counts.numConnects == 0 );
 
-    for ( int i = 0; i < NumIterations; ++i )
+    transport.Update( time );
+
+    check( counts.numConnects == NumClients );
+    check( transport.GetNumConnectedClients() == NumClients );
+
+    // slots 0 to 2 in the order the clients sent. slot 0 can only take a few packets, the rest stay queued
+
+    for ( int i = 0; i < NumClients; ++i )
     {
-        Client * clients[] = { &client };
-        Server * servers[] = { &server };
-        
-        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+        check( transport.IsClientConnected( i ) );
+        check( transport.GetClientId( i ) != 0 );
+        clientCapacity[i] = ( i == 0 ) ? 5 : 100;
+    }
+    check( !transport.IsClientConnected( 3 ) );
+    check( transport.GetClientId( 0 ) != transport.GetClientId( 1 ) );
 
-        if ( client.ConnectionFailed() )
-            break;
+    int numReceived[NumClients];
+    memset( numReceived, 0, sizeof( numReceived ) );
 
-        if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
-            break;
+    int numPackets = transport.ReceiveAllPackets( clientCapacity, clientIndex, packetData, packetBytes, 256 );
+
+    check( numPackets == 5 + NumPackets * ( NumClients - 1 ) );
+    check( clientCapacity[0] == 0 );
+    check( clientCapacity[1] == 100 - NumPackets );
+
+    for ( int i = 0; i < numPackets; ++i )
+    {
+        check( packetBytes[i] == 2 );
+        check( packetData[i][0] == clientIndex[i] );
+        check( packetData[i][1] == numReceived[clientIndex[i]] );
+        numReceived[clientIndex[i]]++;
     }
 
-    check( !client.IsConnecting() );
-    check( client.IsConnected() );
-    check( server.GetNumConnectedClients() == 1 );
-    check( client.GetClientIndex() == 0 );
-    check( server.IsClientConnected(0) );
+    transport.FreePackets( packetData, numPackets );
 
-    // send a message from client to server that fails to serialize on read, this should disconnect the client from the server
+    numPackets = transport.ReceivePackets( 0, packetData, packetBytes, 256 );
 
-    for ( int i = 0; i < 256; ++i )
+    check( numPackets == NumPackets - 5 );
+
+    for ( int i = 0; i < numPackets; ++i )
     {
-        Client * clients[] = { &client };
-        Server * servers[] = { &server };
-        
-        Message * message = client.CreateMessage( TEST_SERIALIZE_FAIL_ON_READ_MESSAGE );
-        check( message );
-        client.SendMessage( 0, message );
+        check( packetData[i][0] == 0 );
+        check( packetData[i][1] == 5 + i );
+    }
 
-        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+    transport.FreePackets( packetData, numPackets );
 
-        if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
-            break;
+    // one packet back to each client, in one batch
+
+    uint8_t sendData[NumClients][4];
+    uint8_t * sendPacketData[NumClients];
+    int sendPacketBytes[NumClients];
+    int sendClientIndex[NumClients];
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        memset( sendData[i], 100 + i, sizeof( sendData[i] ) );
+        sendPacketData[i] = sendData[i];
+        sendPacketBytes[i] = sizeof( sendData[i] );
+        sendClientIndex[i] = i;
     }
 
-    check( !client.IsConnected() );
-    check( server.GetNumConnectedClients() == 0 );
+    transport.SendPackets( sendClientIndex, sendPacketData, sendPacketBytes, NumClients );
 
-    client.Disconnect();
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        uint8_t packet[16];
+        check( recv( clientSocket[i], packet, sizeof( packet ), 0 ) == 4 );
+        check( packet[0] == 100 + i );
+    }
 
-    server.Stop();
+    // clients that go quiet time out
+
+    time += Timeout + 1.0;
+
+    transport.Update( time );
+
+    check( counts.numDisconnects == NumClients );
+    check( transport.GetNumConnectedClients() == 0 );
+
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        close( clientSocket[i] );
+    }
+
+    transport.Stop();
 }
 
-void test_client_server_message_exhaust_stream_allocator()
+#endif // #if defined(__linux__)
+
+void test_server_broadcast_message()
 {
-    const uint64_t clientId = 1;
+    // broadcast messages are created and measured once, then shared by every client connection they are sent to
 
-    Address clientAddress( "0.0.0.0", ClientPort );
-    Address serverAddress( "127.0.0.1", ServerPort );
+    const int NumClients = 4;
 
-    double time = 100.0;
-    
     ClientServerConfig config;
-    config.maxPacketSize = 1100;
-    config.numChannels = 1;
-    config.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
-    config.channel[0].maxBlockSize = 1024;
-    config.channel[0].blockFragmentSize = 200;
+    config.networkSimulator = false;
+    config.serverBroadcastMemory = 64 * 1024;
+    config.channel[0].messageSendQueueSize = 32;
+    config.channel[0].maxMessagesPerPacket = 8;
 
-    uint8_t privateKey[KeyBytes];
-    memset( privateKey, 0, KeyBytes );
+    double time = 100.0;
 
-    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+    MemoryServerTransport serverTransport( GetDefaultAllocator(), Address( "127.0.0.1", ServerPort ) );
+
+    Server server( GetDefaultAllocator(), serverTransport, config, adapter, time );
 
     server.Start( MaxClients );
 
-    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+    MemoryClientTransport * clientTransport[NumClients];
+    Client * clients[NumClients];
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        clientTransport[i] = YOJIMBO_NEW( GetDefaultAllocator(), MemoryClientTransport, serverTransport );
+        clients[i] = YOJIMBO_NEW( GetDefaultAllocator(), Client, GetDefaultAllocator(), *clientTransport[i], config, adapter, time );
+    }
 
-    client.InsecureConnect( privateKey, clientId, serverAddress );
+    uint8_t connectToken[ConnectTokenBytes];
+    memset( connectToken, 0, sizeof( connectToken ) );
 
-    const int NumIterations = 10000;
+    for ( int i = 0; i < NumClients; ++i )
+        clients[i]->Connect( i + 1, connectToken );
 
-    for ( int i = 0; i < NumIterations; ++i )
-    {
-        Client * clients[] = { &client };
-        Server * servers[] = { &server };
-        
-        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+    Server * servers[] = { &server };
 
-        if ( client.ConnectionFailed() )
-            break;
+    const int NumIterations = 1000;
 
-        if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpClientServerUpdate( time, clients, NumClients, servers, 1 );
+        if ( server.GetNumConnectedClients() == NumClients && AllClientsConnected( NumClients, server, clients ) )
             break;
     }
 
-    check( !client.IsConnecting() );
-    check( client.IsConnected() );
-    check( server.GetNumConnectedClients() == 1 );
-    check( client.GetClientIndex() == 0 );
-    check( server.IsClientConnected(0) );
+    check( AllClientsConnected( NumClients, server, clients ) );
 
-    // send a message from client to server that exhausts the stream allocator on read, this should disconnect the client from the server
+    // every client gets every message, in order
 
-    Message * message = client.CreateMessage( TEST_EXHAUST_STREAM_ALLOCATOR_ON_READ_MESSAGE );
-    check( message );
-    client.SendMessage( 0, message );
+    const int NumMessagesSent = config.channel[0].messageSendQueueSize / 2;
 
-    for ( int i = 0; i < 256; ++i )
+    for ( int i = 0; i < NumMessagesSent; ++i )
     {
-        Client * clients[] = { &client };
-        Server * servers[] = { &server };
-        
-        PumpClientServerUpdate( time, clients, 1, servers, 1 );
-
-        if ( !client.IsConnected() && server.GetNumConnectedClients() == 0 )
-            break;
+        TestMessage * message = (TestMessage*) server.CreateBroadcastMessage( TEST_MESSAGE );
+        check( message );
+        message->sequence = uint16_t( i );
+        server.BroadcastMessage( 0, message, NULL );
     }
 
-    check( !client.IsConnected() && server.GetNumConnectedClients() == 0 );
+    // then only clients 0 and 2 get one more
 
-    client.Disconnect();
+    uint64_t clientMask[( MaxClients + 63 ) / 64];
+    memset( clientMask, 0, sizeof( clientMask ) );
+    clientMask[clients[0]->GetClientIndex()/64] |= uint64_t(1) << ( clients[0]->GetClientIndex() % 64 );
+    clientMask[clients[2]->GetClientIndex()/64] |= uint64_t(1) << ( clients[2]->GetClientIndex() % 64 );
 
-    server.Stop();
-}
+    TestMessage * maskedMessage = (TestMessage*) server.CreateBroadcastMessage( TEST_MESSAGE );
+    check( maskedMessage );
+    maskedMessage->sequence = uint16_t( NumMessagesSent );
+    server.BroadcastMessage( 0, maskedMessage, clientMask );
 
-void test_client_server_message_receive_queue_overflow()
-{
-    const uint64_t clientId = 1;
+    int numMessagesReceivedFromServer[NumClients];
+    memset( numMessagesReceivedFromServer, 0, sizeof( numMessagesReceivedFromServer ) );
 
-    Address clientAddress( "0.0.0.0", ClientPort );
-    Address serverAddress( "127.0.0.1", ServerPort );
+    for ( int i = 0; i < NumIterations; ++i )
+    {
+        PumpClientServerUpdate( time, clients, NumClients, servers, 1 );
 
-    double time = 100.0;
-    
-    ClientServerConfig config;
-    config.maxPacketSize = 1100;
-    config.numChannels = 1;
-    config.channel[0].type = CHANNEL_TYPE_RELIABLE_ORDERED;
-    config.channel[0].maxBlockSize = 1024;
-    config.channel[0].blockFragmentSize = 200;
-    config.channel[0].messageSendQueueSize = 1024;
-    config.channel[0].messageReceiveQueueSize = 256;
-    
-    uint8_t privateKey[KeyBytes];
-    memset( privateKey, 0, KeyBytes );
+        bool allReceived = true;
+        for ( int j = 0; j < NumClients; ++j )
+        {
+            ProcessServerToClientMessages( *clients[j], numMessagesReceivedFromServer[j] );
+            if ( numMessagesReceivedFromServer[j] != NumMessagesSent + ( ( j % 2 ) == 0 ? 1 : 0 ) )
+                allReceived = false;
+        }
 
-    Server server( GetDefaultAllocator(), privateKey, serverAddress, config, adapter, time );
+        if ( allReceived )
+            break;
+    }
 
-    server.Start( MaxClients );
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        check( clients[i]->IsConnected() );
+        check( numMessagesReceivedFromServer[i] == NumMessagesSent + ( ( i % 2 ) == 0 ? 1 : 0 ) );
+    }
 
-    Client client( GetDefaultAllocator(), clientAddress, config, adapter, time );
+    // message ids are per connection, so the same shared message arrives with a different id on clients 0 and 2
 
-    client.InsecureConnect( privateKey, clientId, serverAddress );
+    TestMessage * message = (TestMessage*) server.CreateBroadcastMessage( TEST_MESSAGE );
+    check( message );
+    message->sequence = 1000;
+    server.BroadcastMessage( 0, message, NULL );
 
-    while ( true )
+    bool received[NumClients];
+    memset( received, 0, sizeof( received ) );
+
+    for ( int i = 0; i < NumIterations; ++i )
     {
-        Client * clients[] = { &client };
-        Server * servers[] = { &server };
-        
-        PumpClientServerUpdate( time, clients, 1, servers, 1 );
+        PumpClientServerUpdate( time, clients, NumClients, servers, 1 );
 
-        if ( client.ConnectionFailed() )
-            break;
+        bool allReceived = true;
+        for ( int j = 0; j < NumClients; ++j )
+        {
+            Message * receivedMessage = clients[j]->ReceiveMessage( 0 );
+            if ( receivedMessage )
+            {
+                check( receivedMessage->GetType() == TEST_MESSAGE );
+                check( ( (TestMessage*) receivedMessage )->sequence == 1000 );
+                check( receivedMessage->GetId() == numMessagesReceivedFromServer[j] );
+                clients[j]->ReleaseMessage( receivedMessage );
+                received[j] = true;
+            }
+            if ( !received[j] )
+                allReceived = false;
+        }
 
-        if ( !client.IsConnecting() && client.IsConnected() && server.GetNumConnectedClients() == 1 )
+        if ( allReceived )
             break;
     }
 
-    check( !client.IsConnecting() );
-    check( client.IsConnected() );
-    check( server.GetNumConnectedClients() == 1 );
-    check( client.GetClientIndex() == 0 );
-    check( server.IsClientConnected(0) );
+    for ( int i = 0; i < NumClients; ++i )
+        check( received[i] );
 
-    // send a lot of messages, but don't dequeue them, this tests that the receive queue is able to handle overflow
-    // eg. the receiver should detect an error and disconnect the client, because the message is out of bounds.
+    // stopping the server frees the broadcast messages. the broadcast message factory checks for leaks
 
-    const int NumMessagesSent = config.channel[0].messageSendQueueSize;
+    server.Stop();
 
-    SendClientToServerMessages( client, NumMessagesSent );
+    // broadcasting is opt-in. without serverBroadcastMemory there is nothing to create broadcast messages from
 
-    for ( int i = 0; i < NumMessagesSent * 4; ++i )
-    {
-        Client * clients[] = { &client };
-        Server * servers[] = { &server };  
+    ClientServerConfig defaultConfig;
+    defaultConfig.networkSimulator = false;
 
-        PumpClientServerUpdate( time, clients, 1, servers, 1 );
-    }
+    Server defaultServer( GetDefaultAllocator(), serverTransport, defaultConfig, adapter, time );
 
-    check( !client.IsConnected() );
-    check( server.GetNumConnectedClients() == 0 );
+    defaultServer.Start( 1 );
 
-    client.Disconnect();
+    check( !defaultServer.CreateBroadcastMessage( TEST_MESSAGE ) );
 
-    server.Stop();
+    // broadcasting without a pool logs an error and leaves the message with the caller
+
+    TestMessageFactory messageFactory( GetDefaultAllocator() );
+    Message * unownedMessage = messageFactory.CreateMessage( TEST_MESSAGE );
+    check( unownedMessage );
+    defaultServer.BroadcastMessage( 0, unownedMessage, NULL );
+    messageFactory.ReleaseMessage( unownedMessage );
+
+    defaultServer.Stop();
+
+    PumpClientServerUpdate( time, clients, NumClients, servers, 0 );
+
+    for ( int i = 0; i < NumClients; ++i )
+    {
+        YOJIMBO_DELETE( GetDefaultAllocator(), Client, clients[i] );
+        YOJIMBO_DELETE( GetDefaultAllocator(), MemoryClientTransport, clientTransport[i] );
+    }
 }
 
 // Github Issue #78
@@ -2315,10 +5048,29 @@ int main()
 
         RUN_TEST( test_connection_reliable_ordered_messages );
         RUN_TEST( test_connection_reliable_ordered_blocks );
+        RUN_TEST( test_connection_reliable_ordered_blocks_parity );
+        RUN_TEST( test_connection_unreliable_parity );
+        RUN_TEST( test_connection_reliable_ordered_blocks_streamed );
+        RUN_TEST( test_connection_packet_top_up );
+        RUN_TEST( test_connection_bandwidth_limit );
+        RUN_TEST( test_connection_skip_empty_packets );
+        RUN_TEST( test_connection_block_allocator );
         RUN_TEST( test_connection_reliable_ordered_messages_and_blocks );
         RUN_TEST( test_connection_reliable_ordered_messages_and_blocks_multiple_channels );
         RUN_TEST( test_connection_unreliable_unordered_messages );
         RUN_TEST( test_connection_unreliable_unordered_blocks );
+        RUN_TEST( test_connection_reliable_unordered_messages_and_blocks );
+        RUN_TEST( test_connection_reliable_unordered_latency );
+        RUN_TEST( test_connection_unreliable_sequenced_messages );
+        RUN_TEST( test_connection_unreliable_sequenced_latest_only );
+        RUN_TEST( test_connection_channel_scheduling );
+        RUN_TEST( test_connection_reliable_ordered_message_expiry );
+        RUN_TEST( test_connection_reliable_message_priority );
+        RUN_TEST( test_connection_batch_messages );
+        RUN_TEST( test_connection_acks_many_channels );
+        RUN_TEST( test_connection_aggregate_messages );
+        RUN_TEST( test_connection_channel_status );
+        RUN_TEST( test_connection_sent_packet_message_ids );
 
         RUN_TEST( test_client_server_messages );
         RUN_TEST( test_client_server_start_stop_restart );
@@ -2326,6 +5078,14 @@ int main()
         RUN_TEST( test_client_server_message_failed_to_serialize_unreliable_unordered );
         RUN_TEST( test_client_server_message_exhaust_stream_allocator );
         RUN_TEST( test_client_server_message_receive_queue_overflow );
+        RUN_TEST( test_server_worker_threads );
+        RUN_TEST( test_server_transmit_packets );
+        RUN_TEST( test_server_network_thread );
+        RUN_TEST( test_client_server_memory_transport );
+#if defined(__linux__)
+        RUN_TEST( test_server_udp_transport );
+#endif // #if defined(__linux__)
+        RUN_TEST( test_server_broadcast_message );
         RUN_TEST( test_reliable_fragment_overflow_bug );
         
 #if SOAK
@@ -1162,7 +1162,12 @@ namespace yojimbo
         channelIndex = 0;
         blockMessage = 0;
         messageFailedToSerialize = 0;
+        packetParity = 0;
         message.numMessages = 0;
+        message.numSkippedIds = 0;
+        message.skippedIds = NULL;
+        message.payloadData = NULL;
+        message.payloadBytes = 0;
         initialized = 1;
     }
 
@@ -1170,7 +1175,13 @@ namespace yojimbo
     {
         yojimbo_assert( initialized );
         Allocator & allocator = messageFactory.GetAllocator();
-        if ( !blockMessage )
+        if ( packetParity )
+        {
+            YOJIMBO_FREE( allocator, parity.packetSequence );
+            YOJIMBO_FREE( allocator, parity.packetBytes );
+            YOJIMBO_FREE( allocator, parity.parityData );
+        }
+        else if ( !blockMessage )
         {
             if ( message.numMessages > 0 )
             {
@@ -1183,6 +1194,11 @@ namespace yojimbo
                 }
                 YOJIMBO_FREE( allocator, message.messages );
             }
+            if ( message.numSkippedIds > 0 )
+            {
+                YOJIMBO_FREE( allocator, message.skippedIds );
+            }
+            YOJIMBO_FREE( allocator, message.payloadData );
         }
         else
         {
@@ -1196,11 +1212,72 @@ namespace yojimbo
         initialized = 0;
     }
 
+    template <typename Stream> bool SerializeMessageType( Stream & stream, 
+                                                          int * messageTypes, 
+                                                          int index, 
+                                                          int numMessages, 
+                                                          int maxMessageType, 
+                                                          bool aggregateMessages, 
+                                                          int & runEnd )
+    {
+        if ( maxMessageType == 0 )
+        {
+            messageTypes[index] = 0;
+            return true;
+        }
+
+        if ( !aggregateMessages )
+        {
+            serialize_int( stream, messageTypes[index], 0, maxMessageType );
+            return true;
+        }
+
+        // aggregated messages: the type is written once at the start of each run of messages with the same type, followed by the run length
+
+        if ( index < runEnd )
+        {
+            yojimbo_assert( index > 0 );
+            messageTypes[index] = messageTypes[index-1];
+            return true;
+        }
+
+        serialize_int( stream, messageTypes[index], 0, maxMessageType );
+
+        int runLength = 1;
+
+        if ( Stream::IsWriting )
+        {
+            while ( index + runLength < numMessages && messageTypes[index+runLength] == messageTypes[index] )
+                runLength++;
+        }
+
+        if ( numMessages - index > 1 )
+            serialize_int( stream, runLength, 1, numMessages - index );
+
+        runEnd = index + runLength;
+
+        return true;
+    }
+
+    static int GetMessageTypeBits( const ChannelConfig & config, int messageTypeBits, int numMessages, int previousMessageType, int messageType )
+    {
+        if ( !config.aggregateMessages || messageTypeBits == 0 )
+            return messageTypeBits;
+
+        if ( numMessages > 0 && messageType == previousMessageType )
+            return 0;
+
+        return messageTypeBits + bits_required( 1, config.maxMessagesPerPacket );
+    }
+
     template <typename Stream> bool SerializeOrderedMessages( Stream & stream, 
                                                               MessageFactory & messageFactory, 
                                                               int & numMessages, 
                                                               Message ** & messages, 
-                                                              int maxMessagesPerPacket )
+                                                              int & numSkippedIds, 
+                                                              uint16_t * & skippedIds, 
+                                                              int maxMessagesPerPacket, 
+                                                              bool aggregateMessages )
     {
         const int maxMessageType = messageFactory.GetNumTypes() - 1;
 
@@ -1247,16 +1324,12 @@ namespace yojimbo
             for ( int i = 1; i < numMessages; ++i )
                 serialize_sequence_relative( stream, messageIds[i-1], messageIds[i] );
 
+            int runEnd = 0;
+
             for ( int i = 0; i < numMessages; ++i )
             {
-                if ( maxMessageType > 0 )
-                {
-                    serialize_int( stream, messageTypes[i], 0, maxMessageType );
-                }
-                else
-                {
-                    messageTypes[i] = 0;
-                }
+                if ( !SerializeMessageType( stream, messageTypes, i, numMessages, maxMessageType, aggregateMessages, runEnd ) )
+                    return false;
 
                 if ( Stream::IsReading )
                 {
@@ -1281,6 +1354,32 @@ namespace yojimbo
             }
         }
 
+        bool hasSkippedIds = Stream::IsWriting && numSkippedIds != 0;
+
+        serialize_bool( stream, hasSkippedIds );
+
+        if ( hasSkippedIds )
+        {
+            int count = Stream::IsWriting ? numSkippedIds : 0;
+
+            serialize_int( stream, count, 1, maxMessagesPerPacket );
+
+            if ( Stream::IsReading )
+            {
+                Allocator & allocator = messageFactory.GetAllocator();
+                skippedIds = (uint16_t*) YOJIMBO_ALLOCATE( allocator, sizeof( uint16_t ) * count );
+                memset( skippedIds, 0, sizeof( uint16_t ) * count );
+                numSkippedIds = count;
+            }
+
+            yojimbo_assert( skippedIds );
+
+            serialize_bits( stream, skippedIds[0], 16 );
+
+            for ( int i = 1; i < numSkippedIds; ++i )
+                serialize_sequence_relative( stream, skippedIds[i-1], skippedIds[i] );
+        }
+
         return true;
     }
 
@@ -1318,7 +1417,9 @@ namespace yojimbo
                                                                 int & numMessages, 
                                                                 Message ** & messages, 
                                                                 int maxMessagesPerPacket, 
-                                                                int maxBlockSize )
+                                                                int maxBlockSize,
+                                                                bool sequenced, 
+                                                                bool aggregateMessages )
     {
         const int maxMessageType = messageFactory.GetNumTypes() - 1;
 
@@ -1332,7 +1433,10 @@ namespace yojimbo
 
             int * messageTypes = (int*) alloca( sizeof( int ) * numMessages );
 
+            uint16_t * messageIds = (uint16_t*) alloca( sizeof( uint16_t ) * numMessages );
+
             memset( messageTypes, 0, sizeof( int ) * numMessages );
+            memset( messageIds, 0, sizeof( uint16_t ) * numMessages );
 
             if ( Stream::IsWriting )
             {
@@ -1342,6 +1446,7 @@ namespace yojimbo
                 {
                     yojimbo_assert( messages[i] );
                     messageTypes[i] = messages[i]->GetType();
+                    messageIds[i] = messages[i]->GetId();
                 }
             }
             else
@@ -1354,16 +1459,20 @@ namespace yojimbo
                     messages[i] = NULL;
             }
 
+            if ( sequenced )
+            {
+                serialize_bits( stream, messageIds[0], 16 );
+
+                for ( int i = 1; i < numMessages; ++i )
+                    serialize_sequence_relative( stream, messageIds[i-1], messageIds[i] );
+            }
+
+            int runEnd = 0;
+
             for ( int i = 0; i < numMessages; ++i )
             {
-                if ( maxMessageType > 0 )
-                {
-                    serialize_int( stream, messageTypes[i], 0, maxMessageType );
-                }
-                else
-                {
-                    messageTypes[i] = 0;
-                }
+                if ( !SerializeMessageType( stream, messageTypes, i, numMessages, maxMessageType, aggregateMessages, runEnd ) )
+                    return false;
 
                 if ( Stream::IsReading )
                 {
@@ -1374,6 +1483,11 @@ namespace yojimbo
                         yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create message type %d (SerializeUnorderedMessages)\n", messageTypes[i] );
                         return false;
                     }
+
+                    if ( sequenced )
+                    {
+                        messages[i]->SetId( messageIds[i] );
+                    }
                 }
 
                 yojimbo_assert( messages[i] );
@@ -1399,6 +1513,20 @@ namespace yojimbo
         return true;
     }
 
+    static int GetNumBlockParityFragments( const ChannelConfig & channelConfig, int numFragments, bool streamed )
+    {
+        // streamed blocks are never held in memory, so they can't be rebuilt from parity
+
+        return streamed ? 0 : channelConfig.GetNumParityFragments( numFragments );
+    }
+
+    static bool FragmentHasBlockMessage( int fragmentId, int numFragments, int numParityFragments )
+    {
+        // the block message goes with the first fragment, and with the first parity fragment in case the first fragment is rebuilt from parity
+
+        return fragmentId == 0 || ( fragmentId == numFragments && numParityFragments > 0 );
+    }
+
     template <typename Stream> bool SerializeBlockFragment( Stream & stream, 
                                                             MessageFactory & messageFactory, 
                                                             ChannelPacketData::BlockData & block, 
@@ -1408,7 +1536,13 @@ namespace yojimbo
 
         serialize_bits( stream, block.messageId, 16 );
 
-        if ( channelConfig.GetMaxFragmentsPerBlock() > 1 )
+        serialize_bool( stream, block.streamed );
+
+        if ( block.streamed )
+        {
+            serialize_int( stream, block.numFragments, 1, MaxStreamedBlockFragments );
+        }
+        else if ( channelConfig.GetMaxFragmentsPerBlock() > 1 )
         {
             serialize_int( stream, block.numFragments, 1, channelConfig.GetMaxFragmentsPerBlock() );
         }
@@ -1418,9 +1552,13 @@ namespace yojimbo
                 block.numFragments = 1;
         }
 
-        if ( block.numFragments > 1 )
+        const int numParityFragments = GetNumBlockParityFragments( channelConfig, block.numFragments, block.streamed );
+
+        const int numSendFragments = block.numFragments + numParityFragments;
+
+        if ( numSendFragments > 1 )
         {
-            serialize_int( stream, block.fragmentId, 0, block.numFragments - 1 );
+            serialize_int( stream, block.fragmentId, 0, numSendFragments - 1 );
         }
         else
         {
@@ -1443,7 +1581,17 @@ namespace yojimbo
 
         serialize_bytes( stream, block.fragmentData, block.fragmentSize );
 
-        if ( block.fragmentId == 0 )
+        if ( numParityFragments > 0 && block.fragmentId == numSendFragments - 1 )
+        {
+            serialize_int( stream, block.lastFragmentSize, 1, channelConfig.blockFragmentSize );
+        }
+        else
+        {
+            if ( Stream::IsReading )
+                block.lastFragmentSize = 0;
+        }
+
+        if ( FragmentHasBlockMessage( block.fragmentId, block.numFragments, numParityFragments ) )
         {
             // block message
 
@@ -1485,6 +1633,112 @@ namespace yojimbo
         return true;
     }
 
+    template <typename Stream> bool SerializeParityPacketData( Stream & stream, 
+                                                               MessageFactory & messageFactory, 
+                                                               ChannelPacketData & packetData, 
+                                                               const ChannelConfig & channelConfig )
+    {
+        // messages on a channel with packet parity are written as payload bytes, so the receiver holds exactly the
+        // bytes the parity was made from. parity entries hold the XOR of the payloads of a group of packets.
+
+        bool packetParity = Stream::IsWriting && packetData.packetParity;
+
+        serialize_bool( stream, packetParity );
+
+        Allocator & allocator = messageFactory.GetAllocator();
+
+        if ( packetParity )
+        {
+            ChannelPacketData::ParityData & parity = packetData.parity;
+
+            if ( Stream::IsReading )
+            {
+                packetData.packetParity = 1;
+                parity.packetSequence = NULL;
+                parity.packetBytes = NULL;
+                parity.parityData = NULL;
+                parity.parityBytes = 0;
+                parity.context = stream.GetContext();
+            }
+
+            serialize_int( stream, parity.numPackets, 1, channelConfig.packetParityGroupSize );
+
+            if ( Stream::IsReading )
+            {
+                parity.packetSequence = (uint16_t*) YOJIMBO_ALLOCATE( allocator, sizeof( uint16_t ) * parity.numPackets );
+                parity.packetBytes = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * parity.numPackets );
+                if ( !parity.packetSequence || !parity.packetBytes )
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate parity entry (SerializeParityPacketData)\n" );
+                    return false;
+                }
+            }
+
+            serialize_bits( stream, parity.packetSequence[0], 16 );
+
+            for ( int i = 1; i < parity.numPackets; ++i )
+                serialize_sequence_relative( stream, parity.packetSequence[i-1], parity.packetSequence[i] );
+
+            for ( int i = 0; i < parity.numPackets; ++i )
+            {
+                serialize_int( stream, parity.packetBytes[i], 1, MaxParityPayloadBytes );
+                if ( Stream::IsReading )
+                    parity.parityBytes = yojimbo_max( parity.parityBytes, parity.packetBytes[i] );
+            }
+
+            if ( Stream::IsReading )
+            {
+                parity.parityData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, parity.parityBytes );
+                if ( !parity.parityData )
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate parity data (SerializeParityPacketData)\n" );
+                    return false;
+                }
+            }
+
+            serialize_bytes( stream, parity.parityData, parity.parityBytes );
+
+            return true;
+        }
+
+        serialize_int( stream, packetData.message.payloadBytes, 1, MaxParityPayloadBytes );
+
+        if ( Stream::IsReading )
+        {
+            // padded to a whole word, since the bit reader reads a word at a time
+
+            const int bufferBytes = ( packetData.message.payloadBytes + 3 ) & ~3;
+            packetData.message.payloadData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, bufferBytes );
+            if ( !packetData.message.payloadData )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate message payload (SerializeParityPacketData)\n" );
+                return false;
+            }
+            memset( packetData.message.payloadData + packetData.message.payloadBytes, 0, bufferBytes - packetData.message.payloadBytes );
+        }
+
+        serialize_bytes( stream, packetData.message.payloadData, packetData.message.payloadBytes );
+
+        if ( Stream::IsReading )
+        {
+            ReadStream payloadStream( stream.GetAllocator(), packetData.message.payloadData, packetData.message.payloadBytes );
+            payloadStream.SetContext( stream.GetContext() );
+            if ( !SerializeUnorderedMessages( payloadStream, 
+                                              messageFactory, 
+                                              packetData.message.numMessages, 
+                                              packetData.message.messages, 
+                                              channelConfig.maxMessagesPerPacket, 
+                                              channelConfig.maxBlockSize,
+                                              channelConfig.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED, 
+                                              channelConfig.aggregateMessages ) )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
     template <typename Stream> bool ChannelPacketData::Serialize( Stream & stream, 
                                                                   MessageFactory & messageFactory, 
                                                                   const ChannelConfig * channelConfigs, 
@@ -1492,10 +1746,6 @@ namespace yojimbo
     {
         yojimbo_assert( initialized );
 
-#if YOJIMBO_DEBUG_MESSAGE_BUDGET
-        int startBits = stream.GetBitsProcessed();
-#endif // #if YOJIMBO_DEBUG_MESSAGE_BUDGET
-
         if ( numChannels > 1 )
             serialize_int( stream, channelIndex, 0, numChannels - 1 );
         else
@@ -1505,13 +1755,25 @@ namespace yojimbo
 
         serialize_bool( stream, blockMessage );
 
+#if YOJIMBO_DEBUG_MESSAGE_BUDGET
+        int startBits = stream.GetBitsProcessed();
+#endif // #if YOJIMBO_DEBUG_MESSAGE_BUDGET
+
         if ( !blockMessage )
         {
             switch ( channelConfig.type )
             {
                 case CHANNEL_TYPE_RELIABLE_ORDERED:
+                case CHANNEL_TYPE_RELIABLE_UNORDERED:
                 {
-                    if ( !SerializeOrderedMessages( stream, messageFactory, message.numMessages, message.messages, channelConfig.maxMessagesPerPacket ) )
+                    if ( !SerializeOrderedMessages( stream, 
+                                                    messageFactory, 
+                                                    message.numMessages, 
+                                                    message.messages, 
+                                                    message.numSkippedIds, 
+                                                    message.skippedIds, 
+                                                    channelConfig.maxMessagesPerPacket, 
+                                                    channelConfig.aggregateMessages ) )
                     {
                         messageFailedToSerialize = 1;
                         return true;
@@ -1520,13 +1782,26 @@ namespace yojimbo
                 break;
 
                 case CHANNEL_TYPE_UNRELIABLE_UNORDERED:
+                case CHANNEL_TYPE_UNRELIABLE_SEQUENCED:
                 {
+                    if ( channelConfig.packetParityGroupSize > 0 )
+                    {
+                        if ( !SerializeParityPacketData( stream, messageFactory, *this, channelConfig ) )
+                        {
+                            messageFailedToSerialize = 1;
+                            return true;
+                        }
+                        break;
+                    }
+
                     if ( !SerializeUnorderedMessages( stream, 
                                                       messageFactory, 
                                                       message.numMessages, 
                                                       message.messages, 
                                                       channelConfig.maxMessagesPerPacket, 
-                                                      channelConfig.maxBlockSize ) )
+                                                      channelConfig.maxBlockSize,
+                                                      channelConfig.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED, 
+                                                      channelConfig.aggregateMessages ) )
                     {
                         messageFailedToSerialize = 1;
                         return true;
@@ -1578,6 +1853,8 @@ namespace yojimbo
         m_channelIndex = channelIndex;
         m_allocator = &allocator;
         m_messageFactory = &messageFactory;
+        m_blockAllocator = &allocator;
+        m_blockSink = NULL;
         m_errorLevel = CHANNEL_ERROR_NONE;
         m_time = time;
         ResetCounters();
@@ -1600,6 +1877,16 @@ namespace yojimbo
         return m_channelIndex;
     }
 
+    void Channel::SetBlockSink( BlockSink * blockSink )
+    {
+        m_blockSink = blockSink;
+    }
+
+    void Channel::SetBlockAllocator( Allocator & allocator )
+    {
+        m_blockAllocator = &allocator;
+    }
+
     void Channel::SetErrorLevel( ChannelErrorLevel errorLevel )
     {
         if ( errorLevel != m_errorLevel && errorLevel != CHANNEL_ERROR_NONE )
@@ -1619,21 +1906,25 @@ namespace yojimbo
     ReliableOrderedChannel::ReliableOrderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, double time ) 
         : Channel( allocator, messageFactory, config, channelIndex, time )
     {
-        yojimbo_assert( config.type == CHANNEL_TYPE_RELIABLE_ORDERED );
+        yojimbo_assert( config.type == CHANNEL_TYPE_RELIABLE_ORDERED || config.type == CHANNEL_TYPE_RELIABLE_UNORDERED );
 
         yojimbo_assert( ( 65536 % config.sentPacketBufferSize ) == 0 );
         yojimbo_assert( ( 65536 % config.messageSendQueueSize ) == 0 );
         yojimbo_assert( ( 65536 % config.messageReceiveQueueSize ) == 0 );
+        yojimbo_assert( ( 65536 % config.sentPacketMessageIdBufferSize ) == 0 );
+        yojimbo_assert( config.sentPacketMessageIdBufferSize >= 2 * config.maxMessagesPerPacket );
 
         m_sentPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<SentPacketEntry>, *m_allocator, m_config.sentPacketBufferSize );
         m_messageSendQueue = YOJIMBO_NEW( *m_allocator, SequenceBuffer<MessageSendQueueEntry>, *m_allocator, m_config.messageSendQueueSize );
+        m_sendQueueOccupancy = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, m_config.messageSendQueueSize );
         m_messageReceiveQueue = YOJIMBO_NEW( *m_allocator, SequenceBuffer<MessageReceiveQueueEntry>, *m_allocator, m_config.messageReceiveQueueSize );
-        m_sentPacketMessageIds = (uint16_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint16_t ) * m_config.maxMessagesPerPacket * m_config.sentPacketBufferSize );
+        m_sentPacketMessageIds = NULL;
+        m_sentPacketMessageIdHead = 0;
 
         if ( !config.disableBlocks )
         {
-            m_sendBlock = YOJIMBO_NEW( *m_allocator, SendBlockData, *m_allocator, m_config.maxBlockSize, m_config.GetMaxFragmentsPerBlock() ); 
-            m_receiveBlock = YOJIMBO_NEW( *m_allocator, ReceiveBlockData, *m_allocator, m_config.maxBlockSize, m_config.GetMaxFragmentsPerBlock() );
+            m_sendBlock = YOJIMBO_NEW( *m_allocator, SendBlockData, *m_allocator, m_config.GetMaxFragmentsPerBlock() + m_config.GetMaxParityFragmentsPerBlock() ); 
+            m_receiveBlock = YOJIMBO_NEW( *m_allocator, ReceiveBlockData, *m_allocator, m_config.maxBlockSize, m_config.GetMaxFragmentsPerBlock(), m_config.GetMaxParityFragmentsPerBlock(), m_config.blockFragmentSize );
         }
         else
         {
@@ -1652,6 +1943,7 @@ namespace yojimbo
         YOJIMBO_DELETE( *m_allocator, ReceiveBlockData, m_receiveBlock );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<SentPacketEntry>, m_sentPackets );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<MessageSendQueueEntry>, m_messageSendQueue );
+        YOJIMBO_DELETE( *m_allocator, BitArray, m_sendQueueOccupancy );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<MessageReceiveQueueEntry>, m_messageReceiveQueue );
         
         YOJIMBO_FREE( *m_allocator, m_sentPacketMessageIds );
@@ -1666,6 +1958,14 @@ namespace yojimbo
         m_sendMessageId = 0;
         m_receiveMessageId = 0;
         m_oldestUnackedMessageId = 0;
+        m_numPriorityMessages = 0;
+        m_numQueuedMessages = 0;
+        m_numQueuedBits = 0;
+        m_minQueuedMessageBits = 0;
+        m_numMessagesAcked = 0;
+        m_ackRateSampleMessagesAcked = 0;
+        m_ackRateSampleTime = m_time;
+        m_ackedMessagesPerSecond = 0.0f;
 
         for ( int i = 0; i < m_messageSendQueue->GetSize(); ++i )
         {
@@ -1683,6 +1983,7 @@ namespace yojimbo
 
         m_sentPackets->Reset();
         m_messageSendQueue->Reset();
+        m_sendQueueOccupancy->Clear();
         m_messageReceiveQueue->Reset();
 
         if ( m_sendBlock )
@@ -1711,7 +2012,49 @@ namespace yojimbo
         return m_messageSendQueue->Available( m_sendMessageId );
     }
 
-    void ReliableOrderedChannel::SendMessage( Message * message, void *context )
+    bool ReliableOrderedChannel::CanSendMessages( int numMessages ) const
+    {
+        yojimbo_assert( m_messageSendQueue );
+        yojimbo_assert( numMessages >= 0 );
+
+        if ( numMessages > m_messageSendQueue->GetSize() )
+            return false;
+
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            if ( !m_messageSendQueue->Available( uint16_t( m_sendMessageId + i ) ) )
+                return false;
+        }
+
+        return true;
+    }
+
+    void ReliableOrderedChannel::SendMessage( Message * message, void *context, double timeToLive, int priority )
+    {
+        MeasureStream measureStream( m_messageFactory->GetAllocator() );
+		measureStream.SetContext( context );
+        QueueMessage( message, measureStream, timeToLive, priority );
+    }
+
+    void ReliableOrderedChannel::SendMessages( Message ** messages, int numMessages, void *context )
+    {
+        yojimbo_assert( messages || numMessages == 0 );
+
+        MeasureStream measureStream( m_messageFactory->GetAllocator() );
+		measureStream.SetContext( context );
+
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            if ( !QueueMessage( messages[i], measureStream, 0.0, 0 ) )
+            {
+                for ( int j = i + 1; j < numMessages; ++j )
+                    m_messageFactory->ReleaseMessage( messages[j] );
+                return;
+            }
+        }
+    }
+
+    bool ReliableOrderedChannel::QueueMessage( Message * message, MeasureStream & measureStream, double timeToLive, int priority )
     {
         yojimbo_assert( message );
         
@@ -1720,7 +2063,7 @@ namespace yojimbo
         if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
         {
             m_messageFactory->ReleaseMessage( message );
-            return;
+            return false;
         }
 
         if ( !CanSendMessage() )
@@ -1728,7 +2071,7 @@ namespace yojimbo
             // Increase your send queue size!
             SetErrorLevel( CHANNEL_ERROR_SEND_QUEUE_FULL );
             m_messageFactory->ReleaseMessage( message );
-            return;
+            return false;
         }
 
         yojimbo_assert( !( message->IsBlockMessage() && m_config.disableBlocks ) );
@@ -1738,7 +2081,7 @@ namespace yojimbo
             // You tried to send a block message, but block messages are disabled for this channel!
             SetErrorLevel( CHANNEL_ERROR_BLOCKS_DISABLED );
             m_messageFactory->ReleaseMessage( message );
-            return;
+            return false;
         }
 
         message->SetId( m_sendMessageId );
@@ -1747,23 +2090,40 @@ namespace yojimbo
 
         yojimbo_assert( entry );
 
+        m_sendQueueOccupancy->SetBit( m_sendMessageId % m_config.messageSendQueueSize );
+
         entry->block = message->IsBlockMessage();
         entry->message = message;
         entry->measuredBits = 0;
         entry->timeLastSent = -1.0;
+        entry->timeQueued = m_time;
+        entry->expireTime = ( timeToLive > 0.0 && !entry->block ) ? m_time + timeToLive : -1.0;
+        entry->priority = entry->block ? 0 : priority;
+
+        if ( entry->priority != 0 )
+            m_numPriorityMessages++;
 
         if ( message->IsBlockMessage() )
         {
             yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() > 0 );
-            yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() <= m_config.maxBlockSize );
+            yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() <= m_config.maxBlockSize || ((BlockMessage*)message)->GetBlockSource() );
         }
 
-        MeasureStream measureStream( m_messageFactory->GetAllocator() );
-		measureStream.SetContext( context );
+        const int startBits = measureStream.GetBitsProcessed();
         message->SerializeInternal( measureStream );
-        entry->measuredBits = measureStream.GetBitsProcessed();
+        entry->measuredBits = measureStream.GetBitsProcessed() - startBits;
         m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
         m_sendMessageId++;
+
+        if ( m_numQueuedMessages == 0 || (int) entry->measuredBits < m_minQueuedMessageBits )
+            m_minQueuedMessageBits = entry->measuredBits;
+
+        m_numQueuedMessages++;
+        m_numQueuedBits += entry->measuredBits;
+        if ( entry->block )
+            m_numQueuedBits += uint64_t( ((BlockMessage*)message)->GetBlockSize() ) * 8;
+
+        return true;
     }
 
     Message * ReliableOrderedChannel::ReceiveMessage()
@@ -1771,23 +2131,67 @@ namespace yojimbo
         if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
             return NULL;
 
-        MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Find( m_receiveMessageId );
-        if ( !entry )
-            return NULL;
+        while ( true )
+        {
+            MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Find( m_receiveMessageId );
+            if ( !entry )
+                return NULL;
 
-        Message * message = entry->message;
-        yojimbo_assert( message );
-        yojimbo_assert( message->GetId() == m_receiveMessageId );
-        m_messageReceiveQueue->Remove( m_receiveMessageId );
-        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
-        m_receiveMessageId++;
+            Message * message = entry->message;
+            yojimbo_assert( !message || message->GetId() == m_receiveMessageId );
+            m_messageReceiveQueue->Remove( m_receiveMessageId );
+            m_receiveMessageId++;
 
-        return message;
+            // a NULL message means the sender skipped this message id because it expired
+
+            if ( !message )
+                continue;
+
+            m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
+
+            return message;
+        }
+    }
+
+    int ReliableOrderedChannel::ReceiveMessages( Message ** messages, int maxMessages )
+    {
+        yojimbo_assert( messages || maxMessages == 0 );
+
+        int numMessages = 0;
+
+        while ( numMessages < maxMessages )
+        {
+            Message * message = ReliableOrderedChannel::ReceiveMessage();
+            if ( !message )
+                break;
+            messages[numMessages++] = message;
+        }
+
+        return numMessages;
     }
 
     void ReliableOrderedChannel::AdvanceTime( double time )
     {
         m_time = time;
+
+        // sample the ack rate a few times per-second and smooth it, so the drain time estimate doesn't jump around with every packet
+
+        const double AckRateSampleTime = 0.25;
+        const float AckRateSmoothingFactor = 0.25f;
+
+        const double sampleTime = m_time - m_ackRateSampleTime;
+
+        if ( sampleTime >= AckRateSampleTime )
+        {
+            const float ackRate = float( double( m_numMessagesAcked - m_ackRateSampleMessagesAcked ) / sampleTime );
+            m_ackedMessagesPerSecond += ( ackRate - m_ackedMessagesPerSecond ) * AckRateSmoothingFactor;
+            m_ackRateSampleMessagesAcked = m_numMessagesAcked;
+            m_ackRateSampleTime = m_time;
+        }
+        else if ( sampleTime < 0.0 )
+        {
+            m_ackRateSampleTime = m_time;
+        }
     }
     
     int ReliableOrderedChannel::GetPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
@@ -1797,16 +2201,13 @@ namespace yojimbo
 
         if ( SendingBlockMessage() )
         {
-            if (m_config.blockFragmentSize * 8 > availableBits)
-                return 0;
-
             uint16_t messageId;
-            uint16_t fragmentId;
+            int fragmentId;
             int fragmentBytes;
             int numFragments;
             int messageType;
 
-            uint8_t * fragmentData = GetFragmentToSend( messageId, fragmentId, fragmentBytes, numFragments, messageType );
+            uint8_t * fragmentData = GetFragmentToSend( messageId, fragmentId, fragmentBytes, numFragments, messageType, availableBits );
 
             if ( fragmentData )
             {
@@ -1819,7 +2220,8 @@ namespace yojimbo
         {
             int numMessageIds = 0;
             uint16_t * messageIds = (uint16_t*) alloca( m_config.maxMessagesPerPacket * sizeof( uint16_t ) );
-            const int messageBits = GetMessagesToSend( messageIds, numMessageIds, availableBits, context );
+            const int messageBits = ( m_numPriorityMessages > 0 ) ? GetPriorityMessagesToSend( messageIds, numMessageIds, availableBits ) 
+                                                                  : GetMessagesToSend( messageIds, numMessageIds, availableBits, context );
 
             if ( numMessageIds > 0 )
             {
@@ -1832,30 +2234,85 @@ namespace yojimbo
         return 0;
     }
 
-    bool ReliableOrderedChannel::HasMessagesToSend() const
+    int ReliableOrderedChannel::GetTopUpPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
     {
-        return m_oldestUnackedMessageId != m_sendMessageId;
-    }
+        (void) context;
 
-    int ReliableOrderedChannel::GetMessagesToSend( uint16_t * messageIds, int & numMessageIds, int availableBits, void *context )
-    {
-        yojimbo_assert( HasMessagesToSend() );
+        // packets carrying a fragment of the block being sent are topped up with more fragments of that block. packets carrying
+        // messages are not, because GetPacketData already had all of the space left over to pick messages from.
 
-        numMessageIds = 0;
+        if ( !HasMessagesToSend() || !SendingBlockMessage() )
+            return 0;
+
+        SentPacketEntry * sentPacket = m_sentPackets->Find( packetSequence );
+        if ( !sentPacket || !sentPacket->block || !m_sendBlock->active || sentPacket->blockMessageId != m_sendBlock->blockMessageId )
+            return 0;
+
+        // fragment ids after the first take up two slots each in the sent packet message id ring buffer
+
+        if ( 2 * int( sentPacket->numBlockFragments ) > m_config.sentPacketMessageIdBufferSize )
+            return 0;
+
+        uint16_t messageId;
+        int fragmentId;
+        int fragmentBytes;
+        int numFragments;
+        int messageType;
+
+        uint8_t * fragmentData = GetFragmentToSend( messageId, fragmentId, fragmentBytes, numFragments, messageType, availableBits );
+
+        if ( !fragmentData )
+            return 0;
+
+        const int fragmentBits = GetFragmentPacketData( packetData, messageId, fragmentId, fragmentData, fragmentBytes, numFragments, messageType );
+        AddFragmentToPacketEntry( fragmentId, packetSequence );
+        return fragmentBits;
+    }
+
+    bool ReliableOrderedChannel::HasMessagesToSend() const
+    {
+        return m_oldestUnackedMessageId != m_sendMessageId;
+    }
+
+    // the has messages and has skipped ids flags. the message and skipped id counts are charged with the first of each. see SerializeOrderedMessages
+
+    static const int OrderedMessagesHeaderBits = 2;
+
+    static int GetRelativeMessageIdBits( uint16_t previousMessageId, uint16_t messageId )
+    {
+        MeasureStream stream( GetDefaultAllocator() );
+        serialize_sequence_relative_internal( stream, previousMessageId, messageId );
+        return stream.GetBitsProcessed();
+    }
+
+    int ReliableOrderedChannel::GetMessagesToSend( uint16_t * messageIds, int & numMessageIds, int availableBits, void *context )
+    {
+        yojimbo_assert( HasMessagesToSend() );
+
+        (void) context;
+
+        numMessageIds = 0;
 
         if ( m_config.packetBudget > 0 )
             availableBits = yojimbo_min( m_config.packetBudget * 8, availableBits );
 
-        const int giveUpBits = 4 * 8;
+        const int minMessageIdBits = GetRelativeMessageIdBits( 0, 1 );
         const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+        const int messageCountBits = bits_required( 1, m_config.maxMessagesPerPacket );
         const int messageLimit = yojimbo_min( m_config.messageSendQueueSize, m_config.messageReceiveQueueSize );
         uint16_t previousMessageId = 0;
-        int usedBits = ConservativeMessageHeaderBits;
+        uint16_t previousSkippedId = 0;
+        int previousMessageType = 0;
+        int numMessages = 0;
+        int numSkippedIds = 0;
+        int usedBits = OrderedMessagesHeaderBits;
         int giveUpCounter = 0;
 
         for ( int i = 0; i < messageLimit; ++i )
         {
-            if ( availableBits - usedBits < giveUpBits )
+            // nothing else fits once there is less space left than the smallest queued message with the cheapest message id
+
+            if ( availableBits - usedBits < minMessageIdBits + m_minQueuedMessageBits )
                 break;
 
             if ( giveUpCounter > m_config.messageSendQueueSize )
@@ -1868,21 +2325,22 @@ namespace yojimbo
 
             if ( entry->block )
                 break;
+
+            RetireExpiredMessage( entry );
             
             if ( entry->timeLastSent + m_config.messageResendTime <= m_time && availableBits >= (int) entry->measuredBits )
             {                
-                int messageBits = entry->measuredBits + messageTypeBits;
-                
-                if ( numMessageIds == 0 )
+                int messageBits;
+
+                if ( entry->message )
                 {
-                    messageBits += 16;
+                    messageBits = entry->measuredBits + GetMessageTypeBits( m_config, messageTypeBits, numMessages, previousMessageType, entry->message->GetType() );
+                    messageBits += ( numMessages == 0 ) ? 16 + messageCountBits : GetRelativeMessageIdBits( previousMessageId, messageId );
                 }
                 else
                 {
-                    MeasureStream stream( GetDefaultAllocator() );
-                    stream.SetContext( context );
-                    serialize_sequence_relative_internal( stream, previousMessageId, messageId );
-                    messageBits += stream.GetBitsProcessed();
+                    // skip marker. only the message id is sent
+                    messageBits = ( numSkippedIds == 0 ) ? 16 + messageCountBits : GetRelativeMessageIdBits( previousSkippedId, messageId );
                 }
 
                 if ( usedBits + messageBits > availableBits )
@@ -1893,8 +2351,19 @@ namespace yojimbo
 
                 usedBits += messageBits;
                 messageIds[numMessageIds++] = messageId;
-                previousMessageId = messageId;
                 entry->timeLastSent = m_time;
+
+                if ( entry->message )
+                {
+                    previousMessageId = messageId;
+                    previousMessageType = entry->message->GetType();
+                    numMessages++;
+                }
+                else
+                {
+                    previousSkippedId = messageId;
+                    numSkippedIds++;
+                }
             }
 
             if ( numMessageIds == m_config.maxMessagesPerPacket )
@@ -1904,32 +2373,224 @@ namespace yojimbo
         return usedBits;
     }
 
+    int ReliableOrderedChannel::GetPriorityMessagesToSend( uint16_t * messageIds, int & numMessageIds, int availableBits )
+    {
+        yojimbo_assert( HasMessagesToSend() );
+
+        numMessageIds = 0;
+
+        if ( m_config.packetBudget > 0 )
+            availableBits = yojimbo_min( m_config.packetBudget * 8, availableBits );
+
+        const int minMessageIdBits = GetRelativeMessageIdBits( 0, 1 );
+        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+        const int messageCountBits = bits_required( 1, m_config.maxMessagesPerPacket );
+        const int messageLimit = yojimbo_min( m_config.messageSendQueueSize, m_config.messageReceiveQueueSize );
+
+        // collect every message in the send window that is due to be sent
+
+        uint16_t * candidateIds = (uint16_t*) alloca( sizeof( uint16_t ) * messageLimit );
+        bool * selected = (bool*) alloca( sizeof( bool ) * messageLimit );
+        int numCandidates = 0;
+
+        for ( int i = 0; i < messageLimit; ++i )
+        {
+            const uint16_t messageId = m_oldestUnackedMessageId + i;
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
+            if ( !entry )
+                continue;
+
+            if ( entry->block )
+                break;
+
+            RetireExpiredMessage( entry );
+
+            if ( entry->timeLastSent + m_config.messageResendTime <= m_time && availableBits >= (int) entry->measuredBits )
+            {
+                candidateIds[numCandidates] = messageId;
+                selected[numCandidates] = false;
+                numCandidates++;
+            }
+        }
+
+        // select skip markers first, then messages in order of decreasing priority. message ids are charged at their worst case
+        // cost here, because the final cost depends on which ids end up next to each other once sorted back into id order.
+
+        const int maxMessageIdBits = yojimbo_max( 16 + messageCountBits, GetRelativeMessageIdBits( 0, uint16_t( messageLimit ) ) );
+        const int maxMessageTypeBits = GetMessageTypeBits( m_config, messageTypeBits, 0, 0, 0 );
+
+        int usedBits = OrderedMessagesHeaderBits;
+        int numSelected = 0;
+        bool selectingSkippedIds = true;
+        int priority = 0;
+
+        while ( numSelected < m_config.maxMessagesPerPacket && availableBits - usedBits >= minMessageIdBits + m_minQueuedMessageBits )
+        {
+            for ( int i = 0; i < numCandidates; ++i )
+            {
+                if ( selected[i] )
+                    continue;
+
+                MessageSendQueueEntry * entry = m_messageSendQueue->Find( candidateIds[i] );
+                yojimbo_assert( entry );
+
+                if ( selectingSkippedIds ? ( entry->message != NULL ) : ( entry->message == NULL || entry->priority != priority ) )
+                    continue;
+
+                const int messageBits = maxMessageIdBits + ( entry->message ? entry->measuredBits + maxMessageTypeBits : 0 );
+
+                if ( usedBits + messageBits > availableBits )
+                    continue;
+
+                usedBits += messageBits;
+                selected[i] = true;
+                numSelected++;
+
+                if ( numSelected == m_config.maxMessagesPerPacket )
+                    break;
+            }
+
+            // move on to the highest priority below the current one
+
+            bool foundPriority = false;
+            int nextPriority = 0;
+
+            for ( int i = 0; i < numCandidates; ++i )
+            {
+                if ( selected[i] )
+                    continue;
+
+                MessageSendQueueEntry * entry = m_messageSendQueue->Find( candidateIds[i] );
+                yojimbo_assert( entry );
+
+                if ( !entry->message || ( !selectingSkippedIds && entry->priority >= priority ) )
+                    continue;
+
+                if ( !foundPriority || entry->priority > nextPriority )
+                {
+                    nextPriority = entry->priority;
+                    foundPriority = true;
+                }
+            }
+
+            if ( !foundPriority )
+                break;
+
+            selectingSkippedIds = false;
+            priority = nextPriority;
+        }
+
+        // write out the selected message ids in id order, and measure their exact cost
+
+        uint16_t previousMessageId = 0;
+        uint16_t previousSkippedId = 0;
+        int previousMessageType = 0;
+        int numMessages = 0;
+        int numSkippedIds = 0;
+
+        usedBits = OrderedMessagesHeaderBits;
+
+        for ( int i = 0; i < numCandidates; ++i )
+        {
+            if ( !selected[i] )
+                continue;
+
+            const uint16_t messageId = candidateIds[i];
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
+            yojimbo_assert( entry );
+
+            if ( entry->message )
+            {
+                usedBits += entry->measuredBits + GetMessageTypeBits( m_config, messageTypeBits, numMessages, previousMessageType, entry->message->GetType() );
+                usedBits += ( numMessages == 0 ) ? 16 + messageCountBits : GetRelativeMessageIdBits( previousMessageId, messageId );
+                previousMessageId = messageId;
+                previousMessageType = entry->message->GetType();
+                numMessages++;
+            }
+            else
+            {
+                usedBits += ( numSkippedIds == 0 ) ? 16 + messageCountBits : GetRelativeMessageIdBits( previousSkippedId, messageId );
+                previousSkippedId = messageId;
+                numSkippedIds++;
+            }
+
+            entry->timeLastSent = m_time;
+            messageIds[numMessageIds++] = messageId;
+        }
+
+        return usedBits;
+    }
+
     void ReliableOrderedChannel::GetMessagePacketData( ChannelPacketData & packetData, const uint16_t * messageIds, int numMessageIds )
     {
         yojimbo_assert( messageIds );
 
         packetData.Initialize();
         packetData.channelIndex = GetChannelIndex();
-        packetData.message.numMessages = numMessageIds;
         
         if ( numMessageIds == 0 )
             return;
 
-        packetData.message.messages = (Message**) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), sizeof( Message* ) * numMessageIds );
+        int numMessages = 0;
+        int numSkippedIds = 0;
 
         for ( int i = 0; i < numMessageIds; ++i )
         {
             MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageIds[i] );
             yojimbo_assert( entry );
-            yojimbo_assert( entry->message );
-            yojimbo_assert( entry->message->GetRefCount() > 0 );
-            packetData.message.messages[i] = entry->message;
-            m_messageFactory->AcquireMessage( packetData.message.messages[i] );
+            if ( entry->message )
+                numMessages++;
+            else
+                numSkippedIds++;
+        }
+
+        Allocator & allocator = m_messageFactory->GetAllocator();
+
+        if ( numMessages > 0 )
+            packetData.message.messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
+
+        if ( numSkippedIds > 0 )
+            packetData.message.skippedIds = (uint16_t*) YOJIMBO_ALLOCATE( allocator, sizeof( uint16_t ) * numSkippedIds );
+
+        for ( int i = 0; i < numMessageIds; ++i )
+        {
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageIds[i] );
+            if ( entry->message )
+            {
+                yojimbo_assert( entry->message->GetRefCount() > 0 );
+                Message * message = entry->message;
+                packetData.message.messages[packetData.message.numMessages++] = message;
+                m_messageFactory->AcquireMessage( message );
+            }
+            else
+            {
+                packetData.message.skippedIds[packetData.message.numSkippedIds++] = messageIds[i];
+            }
+        }
+    }
+
+    bool ReliableOrderedChannel::AllocateSentPacketMessageIds()
+    {
+        if ( m_sentPacketMessageIds )
+            return true;
+
+        m_sentPacketMessageIds = (uint16_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint16_t ) * m_config.sentPacketMessageIdBufferSize );
+
+        if ( !m_sentPacketMessageIds )
+        {
+            // Not enough memory to track the messages included in sent packets
+            SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+            return false;
         }
+
+        return true;
     }
 
     void ReliableOrderedChannel::AddMessagePacketEntry( const uint16_t * messageIds, int numMessageIds, uint16_t sequence )
     {
+        if ( !AllocateSentPacketMessageIds() )
+            return;
+
         SentPacketEntry * sentPacket = m_sentPackets->Insert( sequence );
         yojimbo_assert( sentPacket );
         if ( sentPacket )
@@ -1937,11 +2598,26 @@ namespace yojimbo
             sentPacket->acked = 0;
             sentPacket->block = 0;
             sentPacket->timeSent = m_time;
-            sentPacket->messageIds = &m_sentPacketMessageIds[ ( sequence % m_config.sentPacketBufferSize ) * m_config.maxMessagesPerPacket ];
-            sentPacket->numMessageIds = numMessageIds;            
-            for ( int i = 0; i < numMessageIds; ++i )
+            sentPacket->messageIdRunStart = m_sentPacketMessageIdHead;
+            sentPacket->numMessageIdRuns = 0;
+            sentPacket->numBlockFragments = 0;
+
+            // message ids are mostly picked in order, so most packets are a single run of consecutive ids
+
+            const uint32_t mask = m_config.sentPacketMessageIdBufferSize - 1;
+
+            int i = 0;
+            while ( i < numMessageIds )
             {
-                sentPacket->messageIds[i] = messageIds[i];
+                const uint16_t firstMessageId = messageIds[i];
+                int runLength = 1;
+                while ( i + runLength < numMessageIds && messageIds[i+runLength] == uint16_t( firstMessageId + runLength ) )
+                    runLength++;
+                m_sentPacketMessageIds[m_sentPacketMessageIdHead & mask] = firstMessageId;
+                m_sentPacketMessageIds[( m_sentPacketMessageIdHead + 1 ) & mask] = uint16_t( runLength );
+                m_sentPacketMessageIdHead += 2;
+                sentPacket->numMessageIdRuns++;
+                i += runLength;
             }
         }
     }
@@ -1988,6 +2664,39 @@ namespace yojimbo
         }
     }
 
+    void ReliableOrderedChannel::ProcessPacketSkippedIds( int numSkippedIds, const uint16_t * skippedIds )
+    {
+        const uint16_t minMessageId = m_receiveMessageId;
+        const uint16_t maxMessageId = m_receiveMessageId + m_config.messageReceiveQueueSize - 1;
+
+        for ( int i = 0; i < numSkippedIds; ++i )
+        {
+            const uint16_t messageId = skippedIds[i];
+
+            if ( sequence_less_than( messageId, minMessageId ) )
+                continue;
+
+            if ( sequence_greater_than( messageId, maxMessageId ) )
+            {
+                // The sender ran ahead of the receive window. This should never happen.
+                SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                return;
+            }
+
+            if ( m_messageReceiveQueue->Find( messageId ) )
+                continue;
+
+            MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
+            if ( !entry )
+            {
+                SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                return;
+            }
+
+            entry->message = NULL;
+        }
+    }
+
     void ReliableOrderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
     {
         if ( m_errorLevel != CHANNEL_ERROR_NONE )
@@ -2007,14 +2716,19 @@ namespace yojimbo
             ProcessPacketFragment( packetData.block.messageType, 
                                    packetData.block.messageId, 
                                    packetData.block.numFragments, 
+                                   packetData.block.streamed, 
                                    packetData.block.fragmentId, 
                                    packetData.block.fragmentData, 
                                    packetData.block.fragmentSize, 
+                                   packetData.block.lastFragmentSize, 
                                    packetData.block.message );
         }
         else
         {
             ProcessPacketMessages( packetData.message.numMessages, packetData.message.messages );
+
+            if ( packetData.message.numSkippedIds > 0 && m_errorLevel == CHANNEL_ERROR_NONE )
+                ProcessPacketSkippedIds( packetData.message.numSkippedIds, packetData.message.skippedIds );
         }
     }
 
@@ -2026,122 +2740,295 @@ namespace yojimbo
 
         yojimbo_assert( !sentPacketEntry->acked );
 
-        for ( int i = 0; i < (int) sentPacketEntry->numMessageIds; ++i )
+        bool removedMessages = false;
+
+        // if later packets have overwritten the message ids of this packet in the ring buffer, its messages are resent instead
+
+        const uint32_t mask = m_config.sentPacketMessageIdBufferSize - 1;
+
+        const bool messageIdsValid = m_sentPacketMessageIdHead - sentPacketEntry->messageIdRunStart <= (uint32_t) m_config.sentPacketMessageIdBufferSize;
+
+        const int numMessageIdRuns = messageIdsValid ? (int) sentPacketEntry->numMessageIdRuns : 0;
+
+        for ( int i = 0; i < numMessageIdRuns; ++i )
         {
-            const uint16_t messageId = sentPacketEntry->messageIds[i];
-            MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( messageId );
-            if ( sendQueueEntry )
+            const uint32_t run = sentPacketEntry->messageIdRunStart + i * 2;
+            const uint16_t firstMessageId = m_sentPacketMessageIds[run & mask];
+            const int runLength = m_sentPacketMessageIds[( run + 1 ) & mask];
+
+            for ( int j = 0; j < runLength; ++j )
             {
-                yojimbo_assert( sendQueueEntry->message );
-                yojimbo_assert( sendQueueEntry->message->GetId() == messageId );
-                m_messageFactory->ReleaseMessage( sendQueueEntry->message );
-                m_messageSendQueue->Remove( messageId );
-                UpdateOldestUnackedMessageId();
+                const uint16_t messageId = uint16_t( firstMessageId + j );
+                MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( messageId );
+                if ( sendQueueEntry )
+                {
+                    if ( sendQueueEntry->message )
+                    {
+                        yojimbo_assert( sendQueueEntry->message->GetId() == messageId );
+                        m_messageFactory->ReleaseMessage( sendQueueEntry->message );
+                    }
+                    if ( sendQueueEntry->priority != 0 )
+                    {
+                        yojimbo_assert( m_numPriorityMessages > 0 );
+                        m_numPriorityMessages--;
+                    }
+                    yojimbo_assert( m_numQueuedMessages > 0 );
+                    yojimbo_assert( m_numQueuedBits >= sendQueueEntry->measuredBits );
+                    m_numQueuedMessages--;
+                    m_numQueuedBits -= sendQueueEntry->measuredBits;
+                    m_numMessagesAcked++;
+                    m_messageSendQueue->Remove( messageId );
+                    m_sendQueueOccupancy->ClearBit( messageId % m_config.messageSendQueueSize );
+                    removedMessages = true;
+                }
             }
         }
 
+        if ( removedMessages )
+            UpdateOldestUnackedMessageId();
+
         if ( !m_config.disableBlocks && sentPacketEntry->block && m_sendBlock->active && m_sendBlock->blockMessageId == sentPacketEntry->blockMessageId )
-        {        
-            const int messageId = sentPacketEntry->blockMessageId;
-            const int fragmentId = sentPacketEntry->blockFragmentId;
+        {
+            // fragments the packet was topped up with follow the first one in the ring buffer. if they have been overwritten, they are resent instead
 
-            if ( !m_sendBlock->ackedFragment->GetBit( fragmentId ) )
+            const int numBlockFragments = messageIdsValid ? (int) sentPacketEntry->numBlockFragments : 1;
+
+            AckBlockFragment( sentPacketEntry->blockFragmentId );
+
+            for ( int i = 1; i < numBlockFragments && m_sendBlock->active; ++i )
             {
-                m_sendBlock->ackedFragment->SetBit( fragmentId );
-                m_sendBlock->numAckedFragments++;
-                if ( m_sendBlock->numAckedFragments == m_sendBlock->numFragments )
-                {
-                    m_sendBlock->active = false;
-                    MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( messageId );
-                    yojimbo_assert( sendQueueEntry );
-                    m_messageFactory->ReleaseMessage( sendQueueEntry->message );
-                    m_messageSendQueue->Remove( messageId );
-                    UpdateOldestUnackedMessageId();
-                }
+                const uint32_t index = sentPacketEntry->messageIdRunStart + ( i - 1 ) * 2;
+                AckBlockFragment( int( m_sentPacketMessageIds[index & mask] ) | ( int( m_sentPacketMessageIds[( index + 1 ) & mask] ) << 16 ) );
             }
         }
     }
 
-    void ReliableOrderedChannel::UpdateOldestUnackedMessageId()
+    void ReliableOrderedChannel::AckBlockFragment( int fragmentId )
     {
-        const uint16_t stopMessageId = m_messageSendQueue->GetSequence();
+        if ( m_sendBlock->IsFragmentAcked( fragmentId ) )
+            return;
 
-        while ( true )
+        const uint16_t messageId = m_sendBlock->blockMessageId;
+
+        m_sendBlock->ackedFragment->SetBit( fragmentId % m_sendBlock->windowSize );
+        if ( fragmentId < m_sendBlock->numFragments )
+            m_sendBlock->numAckedFragments++;
+        if ( m_sendBlock->numParityFragments > 0 )
+            AckParityGroup( fragmentId );
+        if ( m_sendBlock->streamed )
         {
-            if ( m_oldestUnackedMessageId == stopMessageId || m_messageSendQueue->Find( m_oldestUnackedMessageId ) )
+            // slide the window past acked fragments, freeing their slots for fragments not sent yet
+
+            while ( m_sendBlock->fragmentBase < m_sendBlock->numFragments && m_sendBlock->ackedFragment->GetBit( m_sendBlock->fragmentBase % m_sendBlock->windowSize ) )
             {
-                break;
+                m_sendBlock->ackedFragment->ClearBit( m_sendBlock->fragmentBase % m_sendBlock->windowSize );
+                m_sendBlock->fragmentBase++;
             }
-            ++m_oldestUnackedMessageId;
         }
-
-        yojimbo_assert( !sequence_greater_than( m_oldestUnackedMessageId, stopMessageId ) );
+        if ( m_sendBlock->numAckedFragments == m_sendBlock->numFragments )
+        {
+            yojimbo_assert( m_sendBlock->streamed || m_sendBlock->ackedFragment->FindNextClearBit( 0 ) == -1 || m_sendBlock->ackedFragment->FindNextClearBit( 0 ) >= m_sendBlock->numFragments );
+            m_sendBlock->active = false;
+            MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( messageId );
+            yojimbo_assert( sendQueueEntry );
+            const uint64_t blockBits = sendQueueEntry->measuredBits + uint64_t( ((BlockMessage*)sendQueueEntry->message)->GetBlockSize() ) * 8;
+            yojimbo_assert( m_numQueuedMessages > 0 );
+            yojimbo_assert( m_numQueuedBits >= blockBits );
+            m_numQueuedMessages--;
+            m_numQueuedBits -= blockBits;
+            m_numMessagesAcked++;
+            m_messageFactory->ReleaseMessage( sendQueueEntry->message );
+            m_messageSendQueue->Remove( messageId );
+            m_sendQueueOccupancy->ClearBit( messageId % m_config.messageSendQueueSize );
+            UpdateOldestUnackedMessageId();
+        }
     }
 
-    bool ReliableOrderedChannel::SendingBlockMessage()
+    void ReliableOrderedChannel::UpdateOldestUnackedMessageId()
     {
-        yojimbo_assert( HasMessagesToSend() );
+        const uint16_t stopMessageId = m_messageSendQueue->GetSequence();
 
-        MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
+        const int size = m_config.messageSendQueueSize;
+        const int distance = uint16_t( stopMessageId - m_oldestUnackedMessageId );
 
-        return entry ? entry->block : false;
+        yojimbo_assert( distance <= size );
+
+        // every message before the oldest unacked message has been removed from the send queue, so the first occupied slot
+        // at or after the slot of the oldest unacked message (wrapping around) holds the new oldest unacked message.
+
+        const int startIndex = m_oldestUnackedMessageId % size;
+
+        int offset = -1;
+
+        int index = m_sendQueueOccupancy->FindNextSetBit( startIndex );
+        if ( index >= 0 )
+        {
+            offset = index - startIndex;
+        }
+        else if ( startIndex > 0 )
+        {
+            index = m_sendQueueOccupancy->FindNextSetBit( 0 );
+            if ( index >= 0 && index < startIndex )
+                offset = size - startIndex + index;
+        }
+
+        if ( offset >= 0 && offset < distance )
+            m_oldestUnackedMessageId += offset;
+        else
+            m_oldestUnackedMessageId = stopMessageId;
+
+        yojimbo_assert( m_oldestUnackedMessageId == stopMessageId || m_messageSendQueue->Find( m_oldestUnackedMessageId ) );
+        yojimbo_assert( !sequence_greater_than( m_oldestUnackedMessageId, stopMessageId ) );
     }
 
-    uint8_t * ReliableOrderedChannel::GetFragmentToSend( uint16_t & messageId, uint16_t & fragmentId, int & fragmentBytes, int & numFragments, int & messageType )
+    void ReliableOrderedChannel::RetireExpiredMessage( MessageSendQueueEntry * entry )
     {
-        MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
-
         yojimbo_assert( entry );
-        yojimbo_assert( entry->block );
-
-        BlockMessage * blockMessage = (BlockMessage*) entry->message;
 
-        yojimbo_assert( blockMessage );
+        if ( !entry->message || entry->expireTime < 0.0 || entry->expireTime > m_time )
+            return;
 
-        messageId = blockMessage->GetId();
+        yojimbo_assert( !entry->block );
 
-        const int blockSize = blockMessage->GetBlockSize();
+        m_messageFactory->ReleaseMessage( entry->message );
 
-        if ( !m_sendBlock->active )
+        if ( entry->priority != 0 )
         {
-            // start sending this block
+            yojimbo_assert( m_numPriorityMessages > 0 );
+            m_numPriorityMessages--;
+        }
+
+        yojimbo_assert( m_numQueuedBits >= entry->measuredBits );
+        m_numQueuedBits -= entry->measuredBits;
+
+        entry->message = NULL;
+        entry->measuredBits = 0;
+        entry->priority = 0;
+        entry->timeLastSent = -1.0;
+
+        m_minQueuedMessageBits = 0;
+    }
+
+    void ReliableOrderedChannel::GetStatus( ChannelStatus & status ) const
+    {
+        status.numMessagesQueued = m_numQueuedMessages;
+        status.sendQueueSize = m_config.messageSendQueueSize;
+        status.numBytesQueued = int( ( m_numQueuedBits + 7 ) / 8 );
+        status.ackedMessagesPerSecond = m_ackedMessagesPerSecond;
+
+        const MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
+        status.oldestUnackedAge = entry ? float( m_time - entry->timeQueued ) : 0.0f;
+
+        if ( m_numQueuedMessages == 0 )
+            status.estimatedDrainTime = 0.0f;
+        else if ( m_ackedMessagesPerSecond > 0.0f )
+            status.estimatedDrainTime = m_numQueuedMessages / m_ackedMessagesPerSecond;
+        else
+            status.estimatedDrainTime = -1.0f;
+    }
+
+    bool ReliableOrderedChannel::SendingBlockMessage()
+    {
+        yojimbo_assert( HasMessagesToSend() );
+
+        MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
+
+        return entry ? entry->block : false;
+    }
+
+    int ReliableOrderedChannel::GetBlockFragmentIdToSend( int sendIndex ) const
+    {
+        if ( m_sendBlock->numParityFragments == 0 )
+            return sendIndex;
+
+        // each parity fragment is sent right after the last fragment in its group
+
+        const int group = sendIndex / ( m_config.blockParityGroupSize + 1 );
+        const int groupIndex = sendIndex % ( m_config.blockParityGroupSize + 1 );
+        const int fragmentId = group * m_config.blockParityGroupSize + groupIndex;
+
+        if ( groupIndex < m_config.blockParityGroupSize && fragmentId < m_sendBlock->numFragments )
+            return fragmentId;
+
+        return m_sendBlock->numFragments + group;
+    }
+
+    uint8_t * ReliableOrderedChannel::GetFragmentToSend( uint16_t & messageId, int & fragmentId, int & fragmentBytes, int & numFragments, int & messageType, int availableBits )
+    {
+        MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
+
+        yojimbo_assert( entry );
+        yojimbo_assert( entry->block );
+
+        BlockMessage * blockMessage = (BlockMessage*) entry->message;
+
+        yojimbo_assert( blockMessage );
+
+        messageId = blockMessage->GetId();
+
+        const int blockSize = blockMessage->GetBlockSize();
+
+        if ( !m_sendBlock->active )
+        {
+            // start sending this block
 
             m_sendBlock->active = true;
+            m_sendBlock->streamed = blockMessage->IsStreamedBlock();
             m_sendBlock->blockSize = blockSize;
             m_sendBlock->blockMessageId = messageId;
-            m_sendBlock->numFragments = (int) ceil( blockSize / float( m_config.blockFragmentSize ) );
+            m_sendBlock->numFragments = blockSize / m_config.blockFragmentSize + ( ( blockSize % m_config.blockFragmentSize ) ? 1 : 0 );
+            m_sendBlock->numParityFragments = GetNumBlockParityFragments( m_config, m_sendBlock->numFragments, m_sendBlock->streamed );
             m_sendBlock->numAckedFragments = 0;
 
             const int MaxFragmentsPerBlock = m_config.GetMaxFragmentsPerBlock();
 
             yojimbo_assert( m_sendBlock->numFragments > 0 );
-            yojimbo_assert( m_sendBlock->numFragments <= MaxFragmentsPerBlock );
+            yojimbo_assert( m_sendBlock->numFragments <= MaxFragmentsPerBlock || m_sendBlock->streamed );
 
             m_sendBlock->ackedFragment->Clear();
+            m_sendBlock->resendQueue->Clear();
+            m_sendBlock->nextFragmentId = 0;
+            m_sendBlock->fragmentBase = 0;
 
-            for ( int i = 0; i < MaxFragmentsPerBlock; ++i )
+            for ( int i = 0; i < m_sendBlock->windowSize; ++i )
                 m_sendBlock->fragmentSendTime[i] = -1.0;
         }
 
         numFragments = m_sendBlock->numFragments;
 
-        // find the next fragment to send (there may not be one)
+        // find the next fragment to send (there may not be one). fragments due to be resent go first, then fragments not sent yet.
+
+        Queue<int> & resendQueue = *m_sendBlock->resendQueue;
+
+        while ( !resendQueue.IsEmpty() && m_sendBlock->IsFragmentAcked( resendQueue[0] ) )
+            resendQueue.Pop();
 
-        fragmentId = 0xFFFF;
+        bool resend = false;
 
-        for ( int i = 0; i < m_sendBlock->numFragments; ++i )
+        if ( !resendQueue.IsEmpty() && m_sendBlock->fragmentSendTime[resendQueue[0] % m_sendBlock->windowSize] + m_config.blockFragmentResendTime < m_time )
         {
-            if ( !m_sendBlock->ackedFragment->GetBit( i ) && m_sendBlock->fragmentSendTime[i] + m_config.blockFragmentResendTime < m_time )
-            {
-                fragmentId = uint16_t( i );
-                break;
-            }
+            fragmentId = resendQueue[0];
+            resend = true;
         }
+        else
+        {
+            // skip over fragments acked as part of a parity group before they were ever sent
 
-        if ( fragmentId == 0xFFFF )
-            return NULL;
+            const int numSendFragments = m_sendBlock->numFragments + m_sendBlock->numParityFragments;
 
-        // allocate and return a copy of the fragment data
+            while ( m_sendBlock->nextFragmentId < numSendFragments && m_sendBlock->IsFragmentAcked( GetBlockFragmentIdToSend( m_sendBlock->nextFragmentId ) ) )
+                m_sendBlock->nextFragmentId++;
+
+            if ( m_sendBlock->nextFragmentId == numSendFragments )
+                return NULL;
+
+            // streamed blocks wait for the oldest unacked fragment before sending past the end of the window
+
+            if ( m_sendBlock->nextFragmentId >= m_sendBlock->fragmentBase + m_sendBlock->windowSize )
+                return NULL;
+
+            fragmentId = GetBlockFragmentIdToSend( m_sendBlock->nextFragmentId );
+        }
 
         messageType = blockMessage->GetType();
 
@@ -2152,13 +3039,56 @@ namespace yojimbo
         if ( fragmentRemainder && fragmentId == m_sendBlock->numFragments - 1 )
             fragmentBytes = fragmentRemainder;
 
+        if ( GetFragmentBits( fragmentId, fragmentBytes ) > availableBits )
+            return NULL;
+
+        // allocate and return a copy of the fragment data
+
         uint8_t * fragmentData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), fragmentBytes );
 
         if ( fragmentData )
         {
-            memcpy( fragmentData, blockMessage->GetBlockData() + fragmentId * m_config.blockFragmentSize, fragmentBytes );
+            if ( m_sendBlock->streamed )
+            {
+                if ( !blockMessage->GetBlockSource()->ReadBlockData( fragmentId * m_config.blockFragmentSize, fragmentData, fragmentBytes ) )
+                {
+                    // The block source failed to read the fragment.
+                    YOJIMBO_FREE( m_messageFactory->GetAllocator(), fragmentData );
+                    SetErrorLevel( CHANNEL_ERROR_BLOCK_STREAM_FAILED );
+                    return NULL;
+                }
+            }
+            else if ( fragmentId < m_sendBlock->numFragments )
+            {
+                memcpy( fragmentData, blockMessage->GetBlockData() + fragmentId * m_config.blockFragmentSize, fragmentBytes );
+            }
+            else
+            {
+                // parity fragment: XOR of the fragments in its group, with the short last fragment padded with zeros
+
+                const int group = fragmentId - m_sendBlock->numFragments;
+                const int groupStart = group * m_config.blockParityGroupSize;
+                const int groupEnd = yojimbo_min( groupStart + m_config.blockParityGroupSize, m_sendBlock->numFragments );
+
+                memset( fragmentData, 0, fragmentBytes );
+
+                for ( int i = groupStart; i < groupEnd; ++i )
+                {
+                    const uint8_t * data = blockMessage->GetBlockData() + i * m_config.blockFragmentSize;
+                    const int bytes = yojimbo_min( m_config.blockFragmentSize, blockSize - i * m_config.blockFragmentSize );
+                    for ( int j = 0; j < bytes; ++j )
+                        fragmentData[j] ^= data[j];
+                }
+            }
+
+            m_sendBlock->fragmentSendTime[fragmentId % m_sendBlock->windowSize] = m_time;
+
+            if ( resend )
+                resendQueue.Pop();
+            else
+                m_sendBlock->nextFragmentId++;
 
-            m_sendBlock->fragmentSendTime[fragmentId] = m_time;
+            resendQueue.Push( fragmentId );
         }
 
         return fragmentData;
@@ -2166,7 +3096,7 @@ namespace yojimbo
 
     int ReliableOrderedChannel::GetFragmentPacketData( ChannelPacketData & packetData, 
                                                        uint16_t messageId, 
-                                                       uint16_t fragmentId, 
+                                                       int fragmentId, 
                                                        uint8_t * fragmentData, 
                                                        int fragmentSize, 
                                                        int numFragments, 
@@ -2183,13 +3113,11 @@ namespace yojimbo
         packetData.block.fragmentId = fragmentId;
         packetData.block.fragmentSize = fragmentSize;
         packetData.block.numFragments = numFragments;
+        packetData.block.streamed = m_sendBlock->streamed;
         packetData.block.messageType = messageType;
+        packetData.block.lastFragmentSize = m_sendBlock->blockSize - ( numFragments - 1 ) * m_config.blockFragmentSize;
 
-        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
-
-        int fragmentBits = ConservativeFragmentHeaderBits + fragmentSize * 8;
-
-        if ( fragmentId == 0 )
+        if ( FragmentHasBlockMessage( fragmentId, numFragments, m_sendBlock->numParityFragments ) )
         {
             MessageSendQueueEntry * entry = m_messageSendQueue->Find( packetData.block.messageId );
 
@@ -2199,39 +3127,95 @@ namespace yojimbo
             packetData.block.message = (BlockMessage*) entry->message;
 
             m_messageFactory->AcquireMessage( packetData.block.message );
-
-            fragmentBits += entry->measuredBits + messageTypeBits;
         }
         else
         {
             packetData.block.message = NULL;
         }
 
+        return GetFragmentBits( fragmentId, fragmentSize );
+    }
+
+    int ReliableOrderedChannel::GetFragmentBits( int fragmentId, int fragmentBytes ) const
+    {
+        const int numSendFragments = m_sendBlock->numFragments + m_sendBlock->numParityFragments;
+
+        // message id and streamed flag
+
+        int fragmentBits = 16 + 1;
+
+        if ( m_sendBlock->streamed )
+            fragmentBits += bits_required( 1, MaxStreamedBlockFragments );
+        else if ( m_config.GetMaxFragmentsPerBlock() > 1 )
+            fragmentBits += bits_required( 1, m_config.GetMaxFragmentsPerBlock() );
+
+        if ( numSendFragments > 1 )
+            fragmentBits += bits_required( 0, numSendFragments - 1 );
+
+        // fragment size, then the fragment data after a worst case byte alignment
+
+        fragmentBits += bits_required( 1, m_config.blockFragmentSize ) + 7 + fragmentBytes * 8;
+
+        if ( m_sendBlock->numParityFragments > 0 && fragmentId == numSendFragments - 1 )
+            fragmentBits += bits_required( 1, m_config.blockFragmentSize );
+
+        if ( FragmentHasBlockMessage( fragmentId, m_sendBlock->numFragments, m_sendBlock->numParityFragments ) )
+        {
+            const MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_sendBlock->blockMessageId );
+
+            yojimbo_assert( entry );
+
+            fragmentBits += bits_required( 0, m_messageFactory->GetNumTypes() - 1 ) + entry->measuredBits;
+        }
+
         return fragmentBits;
     }
 
-    void ReliableOrderedChannel::AddFragmentPacketEntry( uint16_t messageId, uint16_t fragmentId, uint16_t sequence )
+    void ReliableOrderedChannel::AddFragmentPacketEntry( uint16_t messageId, int fragmentId, uint16_t sequence )
     {
         SentPacketEntry * sentPacket = m_sentPackets->Insert( sequence );
         yojimbo_assert( sentPacket );
         if ( sentPacket )
         {
-            sentPacket->numMessageIds = 0;
-            sentPacket->messageIds = NULL;
+            sentPacket->numMessageIdRuns = 0;
+            sentPacket->messageIdRunStart = m_sentPacketMessageIdHead;
             sentPacket->timeSent = m_time;
             sentPacket->acked = 0;
             sentPacket->block = 1;
             sentPacket->blockMessageId = messageId;
             sentPacket->blockFragmentId = fragmentId;
+            sentPacket->numBlockFragments = 1;
         }
     }
 
+    void ReliableOrderedChannel::AddFragmentToPacketEntry( int fragmentId, uint16_t sequence )
+    {
+        SentPacketEntry * sentPacket = m_sentPackets->Find( sequence );
+        yojimbo_assert( sentPacket && sentPacket->block );
+        if ( !sentPacket || !AllocateSentPacketMessageIds() )
+            return;
+
+        // nothing else is written to the ring buffer while the packet is generated, so the fragment ids follow on from messageIdRunStart
+
+        yojimbo_assert( m_sentPacketMessageIdHead == sentPacket->messageIdRunStart + ( sentPacket->numBlockFragments - 1 ) * 2 );
+
+        const uint32_t mask = m_config.sentPacketMessageIdBufferSize - 1;
+
+        m_sentPacketMessageIds[m_sentPacketMessageIdHead & mask] = uint16_t( fragmentId & 0xFFFF );
+        m_sentPacketMessageIds[( m_sentPacketMessageIdHead + 1 ) & mask] = uint16_t( fragmentId >> 16 );
+        m_sentPacketMessageIdHead += 2;
+
+        sentPacket->numBlockFragments++;
+    }
+
     void ReliableOrderedChannel::ProcessPacketFragment( int messageType, 
                                                         uint16_t messageId, 
                                                         int numFragments, 
-                                                        uint16_t fragmentId, 
+                                                        bool streamed, 
+                                                        int fragmentId, 
                                                         const uint8_t * fragmentData, 
                                                         int fragmentBytes, 
+                                                        int lastFragmentBytes, 
                                                         BlockMessage * blockMessage )
     {  
         yojimbo_assert( !m_config.disableBlocks );
@@ -2247,11 +3231,27 @@ namespace yojimbo
             if ( !m_receiveBlock->active )
             {
                 yojimbo_assert( numFragments >= 0 );
-                yojimbo_assert( numFragments <= m_config.GetMaxFragmentsPerBlock() );
+                yojimbo_assert( numFragments <= m_config.GetMaxFragmentsPerBlock() || streamed );
+
+                if ( streamed && !m_blockSink )
+                {
+                    // Streamed blocks need a block sink to write to. See Connection::SetBlockSink.
+                    SetErrorLevel( CHANNEL_ERROR_BLOCK_STREAM_FAILED );
+                    return;
+                }
+
+                if ( !streamed && !m_receiveBlock->AllocateBuffers( *m_blockAllocator ) )
+                {
+                    // Not enough memory to receive the block. If the block allocator is shared, it is too small for the number of blocks received at once.
+                    SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                    return;
+                }
 
                 m_receiveBlock->active = true;
+                m_receiveBlock->streamed = streamed;
                 m_receiveBlock->numFragments = numFragments;
                 m_receiveBlock->numReceivedFragments = 0;
+                m_receiveBlock->fragmentBase = 0;
                 m_receiveBlock->messageId = messageId;
                 m_receiveBlock->blockSize = 0;
                 m_receiveBlock->receivedFragment->Clear();
@@ -2259,38 +3259,94 @@ namespace yojimbo
 
             // validate fragment
 
-            if ( fragmentId >= m_receiveBlock->numFragments )
+            const int numParityFragments = GetNumBlockParityFragments( m_config, m_receiveBlock->numFragments, m_receiveBlock->streamed );
+
+            if ( fragmentId >= m_receiveBlock->numFragments + numParityFragments )
             {
                 // The fragment id is out of range.
                 SetErrorLevel( CHANNEL_ERROR_DESYNC );
                 return;
             }
 
-            if ( numFragments != m_receiveBlock->numFragments )
+            if ( numFragments != m_receiveBlock->numFragments || streamed != m_receiveBlock->streamed )
+            {
+                // The fragment doesn't match the block being received.
+                SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                return;
+            }
+
+            if ( fragmentId < m_receiveBlock->fragmentBase )
+            {
+                // Already received and moved past.
+                return;
+            }
+
+            if ( fragmentId >= m_receiveBlock->fragmentBase + m_receiveBlock->windowSize )
             {
-                // The number of fragments is out of range.
+                // The sender never sends past the end of the window.
                 SetErrorLevel( CHANNEL_ERROR_DESYNC );
                 return;
             }
 
             // receive the fragment
 
-            if ( !m_receiveBlock->receivedFragment->GetBit( fragmentId ) )
+            if ( !m_receiveBlock->receivedFragment->GetBit( fragmentId % m_receiveBlock->windowSize ) )
             {
-                m_receiveBlock->receivedFragment->SetBit( fragmentId );
+                m_receiveBlock->receivedFragment->SetBit( fragmentId % m_receiveBlock->windowSize );
 
-                memcpy( m_receiveBlock->blockData + fragmentId * m_config.blockFragmentSize, fragmentData, fragmentBytes );
+                int lastBytes = 0;
 
-                if ( fragmentId == 0 )
+                if ( m_receiveBlock->streamed )
                 {
-                    m_receiveBlock->messageType = messageType;
+                    if ( !m_blockSink || !m_blockSink->WriteBlockData( messageId, fragmentId * m_config.blockFragmentSize, fragmentData, fragmentBytes ) )
+                    {
+                        // The block sink failed to write the fragment, or was removed while the block was being received.
+                        SetErrorLevel( CHANNEL_ERROR_BLOCK_STREAM_FAILED );
+                        return;
+                    }
+
+                    if ( fragmentId == m_receiveBlock->numFragments - 1 )
+                        lastBytes = fragmentBytes;
+
+                    m_receiveBlock->numReceivedFragments++;
+
+                    // slide the window past received fragments, freeing their slots for fragments not received yet
+
+                    while ( m_receiveBlock->fragmentBase < m_receiveBlock->numFragments && m_receiveBlock->receivedFragment->GetBit( m_receiveBlock->fragmentBase % m_receiveBlock->windowSize ) )
+                    {
+                        m_receiveBlock->receivedFragment->ClearBit( m_receiveBlock->fragmentBase % m_receiveBlock->windowSize );
+                        m_receiveBlock->fragmentBase++;
+                    }
+                }
+                else if ( fragmentId < m_receiveBlock->numFragments )
+                {
+                    memcpy( m_receiveBlock->blockData + fragmentId * m_config.blockFragmentSize, fragmentData, fragmentBytes );
+
+                    if ( fragmentId == m_receiveBlock->numFragments - 1 )
+                        lastBytes = fragmentBytes;
+
+                    m_receiveBlock->numReceivedFragments++;
+                }
+                else
+                {
+                    if ( fragmentBytes != m_config.blockFragmentSize )
+                    {
+                        // Parity fragments are always full size.
+                        SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                        return;
+                    }
+
+                    memcpy( m_receiveBlock->parityData + ( fragmentId - m_receiveBlock->numFragments ) * m_config.blockFragmentSize, fragmentData, fragmentBytes );
+
+                    if ( fragmentId == m_receiveBlock->numFragments + numParityFragments - 1 )
+                        lastBytes = lastFragmentBytes;
                 }
 
-                if ( fragmentId == m_receiveBlock->numFragments - 1 )
+                if ( lastBytes > 0 )
                 {
-                    m_receiveBlock->blockSize = ( m_receiveBlock->numFragments - 1 ) * m_config.blockFragmentSize + fragmentBytes;
+                    m_receiveBlock->blockSize = ( m_receiveBlock->numFragments - 1 ) * m_config.blockFragmentSize + lastBytes;
 
-                    if ( m_receiveBlock->blockSize > (uint32_t) m_config.maxBlockSize )
+                    if ( m_receiveBlock->blockSize > (uint32_t) m_config.maxBlockSize && !m_receiveBlock->streamed )
                     {
                         // The block size is outside range
                         SetErrorLevel( CHANNEL_ERROR_DESYNC );
@@ -2298,262 +3354,2756 @@ namespace yojimbo
                     }
                 }
 
-                m_receiveBlock->numReceivedFragments++;
-
-                if ( fragmentId == 0 )
+                if ( blockMessage && !m_receiveBlock->blockMessage )
                 {
-                    // save block message (sent with fragment 0)
+                    // save block message (sent with fragment 0 and the first parity fragment)
+                    m_receiveBlock->messageType = messageType;
                     m_receiveBlock->blockMessage = blockMessage;
                     m_messageFactory->AcquireMessage( m_receiveBlock->blockMessage );
                 }
 
+                if ( numParityFragments > 0 )
+                    RecoverBlockFragment( fragmentId );
+
                 if ( m_receiveBlock->numReceivedFragments == m_receiveBlock->numFragments )
                 {
                     // finished receiving block
 
-                    if ( m_messageReceiveQueue->GetAtIndex( m_messageReceiveQueue->GetIndex( messageId ) ) )
-                    {
-                        // Did you forget to dequeue messages on the receiver?
-                        SetErrorLevel( CHANNEL_ERROR_DESYNC );
-                        return;
-                    }
-
                     blockMessage = m_receiveBlock->blockMessage;
 
                     yojimbo_assert( blockMessage );
 
-                    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), m_receiveBlock->blockSize );
-
-                    if ( !blockData )
+                    if ( m_receiveBlock->streamed )
                     {
-                        // Not enough memory to allocate block data
-                        SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
-                        return;
+                        // the block data has already been written to the block sink
+
+                        blockMessage->AttachBlockSource( NULL, m_receiveBlock->blockSize );
                     }
+                    else
+                    {
+                        uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), m_receiveBlock->blockSize );
 
-                    memcpy( blockData, m_receiveBlock->blockData, m_receiveBlock->blockSize );
+                        if ( !blockData )
+                        {
+                            // Not enough memory to allocate block data
+                            SetErrorLevel( CHANNEL_ERROR_OUT_OF_MEMORY );
+                            return;
+                        }
 
-                    blockMessage->AttachBlock( m_messageFactory->GetAllocator(), blockData, m_receiveBlock->blockSize );
+                        memcpy( blockData, m_receiveBlock->blockData, m_receiveBlock->blockSize );
+
+                        blockMessage->AttachBlock( m_messageFactory->GetAllocator(), blockData, m_receiveBlock->blockSize );
+                    }
 
                     blockMessage->SetId( messageId );
 
-                    MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
-                    yojimbo_assert( entry );
-                    entry->message = blockMessage;
                     m_receiveBlock->active = false;
                     m_receiveBlock->blockMessage = NULL;
+                    m_receiveBlock->FreeBuffers();
+
+                    // hand the block message over to the receive side like any other message. it takes its own reference.
+
+                    Message * message = blockMessage;
+                    ProcessPacketMessages( 1, &message );
+                    m_messageFactory->ReleaseMessage( blockMessage );
                 }
             }
         }
     }
 
-    // ------------------------------------------------
-
-    UnreliableUnorderedChannel::UnreliableUnorderedChannel( Allocator & allocator, 
-                                                            MessageFactory & messageFactory, 
-                                                            const ChannelConfig & config, 
-                                                            int channelIndex, 
-                                                            double time ) 
-        : Channel( allocator, 
-                   messageFactory, 
-                   config, 
-                   channelIndex, 
-                   time )
+    void ReliableOrderedChannel::RecoverBlockFragment( int fragmentId )
     {
-        yojimbo_assert( config.type == CHANNEL_TYPE_UNRELIABLE_UNORDERED );
-        m_messageSendQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.messageSendQueueSize );
-        m_messageReceiveQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.messageReceiveQueueSize );
-        Reset();
-    }
+        const int groupSize = m_config.blockParityGroupSize;
+        const int fragmentSize = m_config.blockFragmentSize;
+        const int numFragments = m_receiveBlock->numFragments;
 
-    UnreliableUnorderedChannel::~UnreliableUnorderedChannel()
-    {
-        Reset();
-        YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageSendQueue );
-        YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageReceiveQueue );
-    }
+        yojimbo_assert( groupSize > 0 );
 
-    void UnreliableUnorderedChannel::Reset()
-    {
-        SetErrorLevel( CHANNEL_ERROR_NONE );
+        const int group = ( fragmentId < numFragments ) ? fragmentId / groupSize : fragmentId - numFragments;
+        const int groupStart = group * groupSize;
+        const int groupEnd = yojimbo_min( groupStart + groupSize, numFragments );
 
-        for ( int i = 0; i < m_messageSendQueue->GetNumEntries(); ++i )
-            m_messageFactory->ReleaseMessage( (*m_messageSendQueue)[i] );
+        BitArray & receivedFragment = *m_receiveBlock->receivedFragment;
 
-        for ( int i = 0; i < m_messageReceiveQueue->GetNumEntries(); ++i )
-            m_messageFactory->ReleaseMessage( (*m_messageReceiveQueue)[i] );
+        if ( !receivedFragment.GetBit( numFragments + group ) )
+            return;
 
-        m_messageSendQueue->Clear();
-        m_messageReceiveQueue->Clear();
-  
-        ResetCounters();
-    }
+        const int missingFragmentId = receivedFragment.FindNextClearBit( groupStart );
 
-    bool UnreliableUnorderedChannel::CanSendMessage() const
-    {
-        yojimbo_assert( m_messageSendQueue );
-        return !m_messageSendQueue->IsFull();
-    }
+        if ( missingFragmentId == -1 || missingFragmentId >= groupEnd )
+            return;
 
-    void UnreliableUnorderedChannel::SendMessage( Message * message, void *context )
-    {
-        yojimbo_assert( message );
-        yojimbo_assert( CanSendMessage() );
-		(void)context;
+        const int nextMissingFragmentId = receivedFragment.FindNextClearBit( missingFragmentId + 1 );
 
-        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
-        {
-            m_messageFactory->ReleaseMessage( message );
+        if ( nextMissingFragmentId != -1 && nextMissingFragmentId < groupEnd )
             return;
-        }
 
-        if ( !CanSendMessage() )
-        {
-            SetErrorLevel( CHANNEL_ERROR_SEND_QUEUE_FULL );
-            m_messageFactory->ReleaseMessage( message );
-            return;
-        }
+        // the block size is known here: the group holding the last fragment either has the last fragment, or it is the one being rebuilt and the parity fragment carries its size
 
-        yojimbo_assert( !( message->IsBlockMessage() && m_config.disableBlocks ) );
+        yojimbo_assert( groupEnd < numFragments || m_receiveBlock->blockSize > 0 );
 
-        if ( message->IsBlockMessage() && m_config.disableBlocks )
-        {
-            SetErrorLevel( CHANNEL_ERROR_BLOCKS_DISABLED );
-            m_messageFactory->ReleaseMessage( message );
-            return;
-        }
+        const int lastFragmentBytes = m_receiveBlock->blockSize - ( numFragments - 1 ) * fragmentSize;
+        const int missingBytes = ( missingFragmentId == numFragments - 1 ) ? lastFragmentBytes : fragmentSize;
 
-        if ( message->IsBlockMessage() )
+        uint8_t * missingData = m_receiveBlock->blockData + missingFragmentId * fragmentSize;
+
+        memcpy( missingData, m_receiveBlock->parityData + group * fragmentSize, missingBytes );
+
+        for ( int i = groupStart; i < groupEnd; ++i )
         {
-            yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() > 0 );
-            yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() <= m_config.maxBlockSize );
+            if ( i == missingFragmentId )
+                continue;
+            const uint8_t * data = m_receiveBlock->blockData + i * fragmentSize;
+            const int bytes = yojimbo_min( missingBytes, ( i == numFragments - 1 ) ? lastFragmentBytes : fragmentSize );
+            for ( int j = 0; j < bytes; ++j )
+                missingData[j] ^= data[j];
         }
 
-        m_messageSendQueue->Push( message );
+        receivedFragment.SetBit( missingFragmentId );
 
-        m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
+        m_receiveBlock->numReceivedFragments++;
     }
 
-    Message * UnreliableUnorderedChannel::ReceiveMessage()
+    void ReliableOrderedChannel::AckParityGroup( int fragmentId )
     {
-        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
-            return NULL;
+        const int groupSize = m_config.blockParityGroupSize;
+        const int numFragments = m_sendBlock->numFragments;
 
-        if ( m_messageReceiveQueue->IsEmpty() )
-            return NULL;
+        yojimbo_assert( groupSize > 0 );
 
-        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
+        const int group = ( fragmentId < numFragments ) ? fragmentId / groupSize : fragmentId - numFragments;
+        const int groupStart = group * groupSize;
+        const int groupEnd = yojimbo_min( groupStart + groupSize, numFragments );
+        const int parityFragmentId = numFragments + group;
 
-        return m_messageReceiveQueue->Pop();
-    }
+        BitArray & ackedFragment = *m_sendBlock->ackedFragment;
 
-    void UnreliableUnorderedChannel::AdvanceTime( double time )
-    {
-        (void) time;
-    }
-    
-    int UnreliableUnorderedChannel::GetPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
-    {
-        (void) packetSequence;
+        int numAcked = ackedFragment.GetBit( parityFragmentId ) ? 1 : 0;
 
-        if ( m_messageSendQueue->IsEmpty() )
-            return 0;
+        for ( int i = groupStart; i < groupEnd; ++i )
+            numAcked += ackedFragment.GetBit( i ) ? 1 : 0;
 
-        if ( m_config.packetBudget > 0 )
-            availableBits = yojimbo_min( m_config.packetBudget * 8, availableBits );
+        if ( numAcked < groupEnd - groupStart )
+            return;
 
-        const int giveUpBits = 4 * 8;
+        // the receiver has enough of this group to rebuild the rest of it
 
-        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+        for ( int i = groupStart; i < groupEnd; ++i )
+        {
+            if ( !ackedFragment.GetBit( i ) )
+            {
+                ackedFragment.SetBit( i );
+                m_sendBlock->numAckedFragments++;
+            }
+        }
+
+        ackedFragment.SetBit( parityFragmentId );
+    }
+
+    // ------------------------------------------------
+
+    ReliableUnorderedChannel::ReliableUnorderedChannel( Allocator & allocator, 
+                                                        MessageFactory & messageFactory, 
+                                                        const ChannelConfig & config, 
+                                                        int channelIndex, 
+                                                        double time ) 
+        : ReliableOrderedChannel( allocator, 
+                                  messageFactory, 
+                                  config, 
+                                  channelIndex, 
+                                  time )
+    {
+        yojimbo_assert( config.type == CHANNEL_TYPE_RELIABLE_UNORDERED );
+        m_messageDeliveryQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.messageReceiveQueueSize );
+    }
+
+    ReliableUnorderedChannel::~ReliableUnorderedChannel()
+    {
+        ClearDeliveryQueue();
+
+        YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageDeliveryQueue );
+    }
+
+    void ReliableUnorderedChannel::Reset()
+    {
+        ReliableOrderedChannel::Reset();
+
+        ClearDeliveryQueue();
+    }
+
+    void ReliableUnorderedChannel::ClearDeliveryQueue()
+    {
+        for ( int i = 0; i < m_messageDeliveryQueue->GetNumEntries(); ++i )
+            m_messageFactory->ReleaseMessage( (*m_messageDeliveryQueue)[i] );
+
+        m_messageDeliveryQueue->Clear();
+    }
+
+    Message * ReliableUnorderedChannel::ReceiveMessage()
+    {
+        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
+            return NULL;
+
+        if ( m_messageDeliveryQueue->IsEmpty() )
+            return NULL;
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
+
+        return m_messageDeliveryQueue->Pop();
+    }
+
+    int ReliableUnorderedChannel::ReceiveMessages( Message ** messages, int maxMessages )
+    {
+        yojimbo_assert( messages || maxMessages == 0 );
+
+        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
+            return 0;
 
-        int usedBits = ConservativeMessageHeaderBits;
         int numMessages = 0;
-        Message ** messages = (Message**) alloca( sizeof( Message* ) * m_config.maxMessagesPerPacket );
 
-        while ( true )
+        while ( numMessages < maxMessages && !m_messageDeliveryQueue->IsEmpty() )
+            messages[numMessages++] = m_messageDeliveryQueue->Pop();
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED] += numMessages;
+
+        return numMessages;
+    }
+
+    void ReliableUnorderedChannel::ProcessPacketMessages( int numMessages, Message ** messages )
+    {
+        const uint16_t minMessageId = m_receiveMessageId;
+        const uint16_t maxMessageId = m_receiveMessageId + m_config.messageReceiveQueueSize - 1;
+
+        for ( int i = 0; i < (int) numMessages; ++i )
         {
-            if ( m_messageSendQueue->IsEmpty() )
-                break;
+            Message * message = messages[i];
 
-            if ( availableBits - usedBits < giveUpBits )
-                break;
+            yojimbo_assert( message );  
 
-            if ( numMessages == m_config.maxMessagesPerPacket )
-                break;
+            const uint16_t messageId = message->GetId();
 
-            Message * message = m_messageSendQueue->Pop();
+            if ( sequence_less_than( messageId, minMessageId ) )
+                continue;
 
-            yojimbo_assert( message );
+            if ( sequence_greater_than( messageId, maxMessageId ) )
+            {
+                // The sender ran ahead of the receive window. This should never happen.
+                SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                return;
+            }
 
-            MeasureStream measureStream( m_messageFactory->GetAllocator() );
-			measureStream.SetContext( context );
-            message->SerializeInternal( measureStream );
-            
-            if ( message->IsBlockMessage() )
+            if ( m_messageReceiveQueue->Find( messageId ) )
+                continue;
+
+            if ( m_messageDeliveryQueue->IsFull() )
             {
-                BlockMessage * blockMessage = (BlockMessage*) message;
-                SerializeMessageBlock( measureStream, *m_messageFactory, blockMessage, m_config.maxBlockSize );
+                // Did you forget to dequeue messages on the receiver?
+                SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                return;
             }
 
-            const int messageBits = messageTypeBits + measureStream.GetBitsProcessed();
-            
-            if ( usedBits + messageBits > availableBits )
+            // the receive queue only records that this message id has been received. the message itself goes straight to the delivery queue.
+
+            MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
+            if ( !entry )
             {
-                m_messageFactory->ReleaseMessage( message );
-                continue;
+                // For some reason we can't insert the message in the receive queue
+                SetErrorLevel( CHANNEL_ERROR_DESYNC );
+                return;
             }
 
-            usedBits += messageBits;        
+            entry->message = NULL;
 
-            yojimbo_assert( usedBits <= availableBits );
+            m_messageFactory->AcquireMessage( message );
 
-            messages[numMessages++] = message;
+            m_messageDeliveryQueue->Push( message );
         }
 
-        if ( numMessages == 0 )
-            return 0;
+        AdvanceReceiveWindow();
+    }
 
-        Allocator & allocator = m_messageFactory->GetAllocator();
+    void ReliableUnorderedChannel::ProcessPacketSkippedIds( int numSkippedIds, const uint16_t * skippedIds )
+    {
+        ReliableOrderedChannel::ProcessPacketSkippedIds( numSkippedIds, skippedIds );
 
-        packetData.Initialize();
-        packetData.channelIndex = GetChannelIndex();
-        packetData.message.numMessages = numMessages;
-        packetData.message.messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
-        for ( int i = 0; i < numMessages; ++i )
+        AdvanceReceiveWindow();
+    }
+
+    void ReliableUnorderedChannel::AdvanceReceiveWindow()
+    {
+        const uint16_t stopMessageId = m_messageReceiveQueue->GetSequence();
+
+        while ( m_receiveMessageId != stopMessageId && m_messageReceiveQueue->Find( m_receiveMessageId ) )
         {
-            packetData.message.messages[i] = messages[i];
+            ++m_receiveMessageId;
         }
+    }
 
-        return usedBits;
+    // ------------------------------------------------
+
+    UnreliableUnorderedChannel::UnreliableUnorderedChannel( Allocator & allocator, 
+                                                            MessageFactory & messageFactory, 
+                                                            const ChannelConfig & config, 
+                                                            int channelIndex, 
+                                                            double time ) 
+        : Channel( allocator, 
+                   messageFactory, 
+                   config, 
+                   channelIndex, 
+                   time )
+    {
+        yojimbo_assert( config.type == CHANNEL_TYPE_UNRELIABLE_UNORDERED || config.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED );
+        yojimbo_assert( config.packetParityGroupSize >= 0 );
+        const int messageReceiveQueueSize = ( config.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED && config.latestOnly ) ? 1 : m_config.messageReceiveQueueSize;
+        m_messageSendQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.messageSendQueueSize );
+        m_messageReceiveQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, messageReceiveQueueSize );
+        m_parityData = NULL;
+        m_parityCapacity = 0;
+        m_parityBytes = 0;
+        m_parityPacketSequence = NULL;
+        m_parityPacketBytes = NULL;
+        m_numParityReceiveEntries = 0;
+        m_parityReceiveEntries = NULL;
+        if ( m_config.packetParityGroupSize > 0 )
+        {
+            // the parity for a group arrives after the whole group, so keep several groups worth of payloads around
+            m_parityPacketSequence = (uint16_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint16_t ) * m_config.packetParityGroupSize );
+            m_parityPacketBytes = (int*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( int ) * m_config.packetParityGroupSize );
+            m_numParityReceiveEntries = 8 * m_config.packetParityGroupSize;
+            m_parityReceiveEntries = (ParityReceiveEntry*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( ParityReceiveEntry ) * m_numParityReceiveEntries );
+            memset( m_parityReceiveEntries, 0, sizeof( ParityReceiveEntry ) * m_numParityReceiveEntries );
+        }
+        Reset();
     }
 
-    void UnreliableUnorderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    UnreliableUnorderedChannel::~UnreliableUnorderedChannel()
     {
-        if ( m_errorLevel != CHANNEL_ERROR_NONE )
+        Reset();
+        YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageSendQueue );
+        YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageReceiveQueue );
+        for ( int i = 0; i < m_numParityReceiveEntries; ++i )
+        {
+            YOJIMBO_FREE( *m_allocator, m_parityReceiveEntries[i].data );
+        }
+        YOJIMBO_FREE( *m_allocator, m_parityReceiveEntries );
+        YOJIMBO_FREE( *m_allocator, m_parityPacketBytes );
+        YOJIMBO_FREE( *m_allocator, m_parityPacketSequence );
+        YOJIMBO_FREE( *m_allocator, m_parityData );
+    }
+
+    void UnreliableUnorderedChannel::Reset()
+    {
+        SetErrorLevel( CHANNEL_ERROR_NONE );
+
+        for ( int i = 0; i < m_messageSendQueue->GetNumEntries(); ++i )
+            m_messageFactory->ReleaseMessage( (*m_messageSendQueue)[i] );
+
+        for ( int i = 0; i < m_messageReceiveQueue->GetNumEntries(); ++i )
+            m_messageFactory->ReleaseMessage( (*m_messageReceiveQueue)[i] );
+
+        m_messageSendQueue->Clear();
+        m_messageReceiveQueue->Clear();
+
+        ResetParityGroup();
+        m_parityTopUpSequence = -1;
+        m_parityTopUpBits = 0;
+        for ( int i = 0; i < m_numParityReceiveEntries; ++i )
+            m_parityReceiveEntries[i].valid = false;
+  
+        ResetCounters();
+    }
+
+    bool UnreliableUnorderedChannel::CanSendMessage() const
+    {
+        yojimbo_assert( m_messageSendQueue );
+        return !m_messageSendQueue->IsFull();
+    }
+
+    bool UnreliableUnorderedChannel::CanSendMessages( int numMessages ) const
+    {
+        yojimbo_assert( m_messageSendQueue );
+        yojimbo_assert( numMessages >= 0 );
+        return m_messageSendQueue->GetNumEntries() + numMessages <= m_messageSendQueue->GetSize();
+    }
+
+    bool UnreliableUnorderedChannel::HasMessagesToSend() const
+    {
+        yojimbo_assert( m_messageSendQueue );
+        if ( m_config.packetParityGroupSize > 0 && m_numParityPackets == m_config.packetParityGroupSize )
+            return true;
+        return !m_messageSendQueue->IsEmpty();
+    }
+
+    void UnreliableUnorderedChannel::SendMessage( Message * message, void *context, double timeToLive, int priority )
+    {
+        yojimbo_assert( message );
+        yojimbo_assert( CanSendMessage() );
+		(void)context;
+        (void)timeToLive;
+        (void)priority;
+
+        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
+        {
+            m_messageFactory->ReleaseMessage( message );
             return;
-        
-        if ( packetData.messageFailedToSerialize )
+        }
+
+        if ( !CanSendMessage() )
         {
-            SetErrorLevel( CHANNEL_ERROR_FAILED_TO_SERIALIZE );
+            SetErrorLevel( CHANNEL_ERROR_SEND_QUEUE_FULL );
+            m_messageFactory->ReleaseMessage( message );
             return;
         }
 
-        for ( int i = 0; i < (int) packetData.message.numMessages; ++i )
+        yojimbo_assert( !( message->IsBlockMessage() && m_config.disableBlocks ) );
+
+        if ( message->IsBlockMessage() && m_config.disableBlocks )
         {
-            Message * message = packetData.message.messages[i];
-            yojimbo_assert( message );  
-            message->SetId( packetSequence );
-            if ( !m_messageReceiveQueue->IsFull() )
-            {
-                m_messageFactory->AcquireMessage( message );
-                m_messageReceiveQueue->Push( message );
-            }
+            SetErrorLevel( CHANNEL_ERROR_BLOCKS_DISABLED );
+            m_messageFactory->ReleaseMessage( message );
+            return;
+        }
+
+        yojimbo_assert( !( message->IsBlockMessage() && ((BlockMessage*)message)->IsStreamedBlock() ) );
+
+        if ( message->IsBlockMessage() && ((BlockMessage*)message)->IsStreamedBlock() )
+        {
+            // Streamed blocks can only be sent over reliable channels.
+            SetErrorLevel( CHANNEL_ERROR_BLOCK_STREAM_FAILED );
+            m_messageFactory->ReleaseMessage( message );
+            return;
+        }
+
+        if ( message->IsBlockMessage() )
+        {
+            yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() > 0 );
+            yojimbo_assert( ((BlockMessage*)message)->GetBlockSize() <= m_config.maxBlockSize );
         }
+
+        m_messageSendQueue->Push( message );
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
+    }
+
+    void UnreliableUnorderedChannel::SendMessages( Message ** messages, int numMessages, void *context )
+    {
+        yojimbo_assert( messages || numMessages == 0 );
+
+        for ( int i = 0; i < numMessages; ++i )
+            UnreliableUnorderedChannel::SendMessage( messages[i], context, 0.0, 0 );
+    }
+
+    Message * UnreliableUnorderedChannel::ReceiveMessage()
+    {
+        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
+            return NULL;
+
+        if ( m_messageReceiveQueue->IsEmpty() )
+            return NULL;
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
+
+        return m_messageReceiveQueue->Pop();
+    }
+
+    int UnreliableUnorderedChannel::ReceiveMessages( Message ** messages, int maxMessages )
+    {
+        yojimbo_assert( messages || maxMessages == 0 );
+
+        if ( GetErrorLevel() != CHANNEL_ERROR_NONE )
+            return 0;
+
+        int numMessages = 0;
+
+        while ( numMessages < maxMessages && !m_messageReceiveQueue->IsEmpty() )
+            messages[numMessages++] = m_messageReceiveQueue->Pop();
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED] += numMessages;
+
+        return numMessages;
+    }
+
+    void UnreliableUnorderedChannel::AdvanceTime( double time )
+    {
+        (void) time;
+    }
+    
+    int UnreliableUnorderedChannel::GetPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
+    {
+        m_parityTopUpSequence = -1;
+
+        // once a parity group is complete its parity goes first, and this packet's messages follow as a top up entry
+
+        if ( m_config.packetParityGroupSize > 0 && m_numParityPackets == m_config.packetParityGroupSize )
+        {
+            const int parityBits = GetParityPacketData( packetData, packetSequence, availableBits );
+            if ( parityBits > 0 )
+                return parityBits;
+        }
+
+        return GetMessagePacketData( context, packetData, packetSequence, availableBits );
+    }
+
+    int UnreliableUnorderedChannel::GetMessagePacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
+    {
+        if ( m_messageSendQueue->IsEmpty() )
+            return 0;
+
+        if ( m_config.packetBudget > 0 )
+            availableBits = yojimbo_min( m_config.packetBudget * 8, availableBits );
+
+        // with packet parity the messages are written as payload bytes after the parity flag and the payload size.
+        // leave room for those, the alignment before the payload, and the payload rounding up to whole bytes
+
+        const bool packetParity = m_config.packetParityGroupSize > 0;
+
+        const int payloadHeaderBits = 1 + bits_required( 1, MaxParityPayloadBytes ) + 7;
+
+        if ( packetParity )
+            availableBits = yojimbo_min( availableBits - payloadHeaderBits - 7, MaxParityPayloadBytes * 8 );
+
+        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+
+        const int messageCountBits = bits_required( 1, m_config.maxMessagesPerPacket );
+
+        const bool sequenced = m_config.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED;
+
+        // messages that don't fit are dropped, so stop once there isn't room left for even the smallest message
+
+        const int minMessageBits = yojimbo_max( 1, ( m_config.aggregateMessages ? 0 : messageTypeBits ) + ( sequenced ? GetRelativeMessageIdBits( 0, 1 ) : 0 ) );
+
+        // the has messages flag. the message count is charged with the first message. see SerializeUnorderedMessages
+
+        int usedBits = 1;
+        int numMessages = 0;
+        Message ** messages = (Message**) alloca( sizeof( Message* ) * m_config.maxMessagesPerPacket );
+
+        while ( true )
+        {
+            if ( m_messageSendQueue->IsEmpty() )
+                break;
+
+            if ( availableBits - usedBits < minMessageBits )
+                break;
+
+            if ( numMessages == m_config.maxMessagesPerPacket )
+                break;
+
+            Message * message = m_messageSendQueue->Pop();
+
+            yojimbo_assert( message );
+
+            MeasureStream measureStream( m_messageFactory->GetAllocator() );
+			measureStream.SetContext( context );
+            message->SerializeInternal( measureStream );
+            
+            if ( message->IsBlockMessage() )
+            {
+                BlockMessage * blockMessage = (BlockMessage*) message;
+                SerializeMessageBlock( measureStream, *m_messageFactory, blockMessage, m_config.maxBlockSize );
+            }
+
+            int messageBits = measureStream.GetBitsProcessed();
+
+            messageBits += GetMessageTypeBits( m_config, messageTypeBits, numMessages, numMessages > 0 ? messages[numMessages-1]->GetType() : 0, message->GetType() );
+
+            if ( numMessages == 0 )
+                messageBits += messageCountBits;
+
+            if ( sequenced )
+            {
+                if ( numMessages == 0 )
+                {
+                    messageBits += 16;
+                }
+                else
+                {
+                    MeasureStream stream( GetDefaultAllocator() );
+                    uint16_t messageId = message->GetId();
+                    serialize_sequence_relative_internal( stream, messages[numMessages-1]->GetId(), messageId );
+                    messageBits += stream.GetBitsProcessed();
+                }
+            }
+            
+            if ( usedBits + messageBits > availableBits )
+            {
+                m_messageFactory->ReleaseMessage( message );
+                continue;
+            }
+
+            usedBits += messageBits;        
+
+            yojimbo_assert( usedBits <= availableBits );
+
+            messages[numMessages++] = message;
+        }
+
+        if ( numMessages == 0 )
+            return 0;
+
+        Allocator & allocator = m_messageFactory->GetAllocator();
+
+        packetData.Initialize();
+        packetData.channelIndex = GetChannelIndex();
+        packetData.message.numMessages = numMessages;
+        packetData.message.messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            packetData.message.messages[i] = messages[i];
+        }
+
+        if ( !packetParity )
+            return usedBits;
+
+        const int bufferBytes = ( ( usedBits + 7 ) / 8 + 3 ) & ~3;
+
+        packetData.message.payloadData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, bufferBytes );
+
+        if ( !packetData.message.payloadData )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate message payload\n" );
+            packetData.Free( *m_messageFactory );
+            return 0;
+        }
+
+        WriteStream stream( allocator, packetData.message.payloadData, bufferBytes );
+        stream.SetContext( context );
+
+        if ( !SerializeUnorderedMessages( stream, 
+                                          *m_messageFactory, 
+                                          packetData.message.numMessages, 
+                                          packetData.message.messages, 
+                                          m_config.maxMessagesPerPacket, 
+                                          m_config.maxBlockSize,
+                                          sequenced, 
+                                          m_config.aggregateMessages ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to write message payload\n" );
+            packetData.Free( *m_messageFactory );
+            return 0;
+        }
+
+        stream.Flush();
+
+        packetData.message.payloadBytes = stream.GetBytesProcessed();
+
+        AddParityPacket( packetSequence, packetData.message.payloadData, packetData.message.payloadBytes );
+
+        return payloadHeaderBits + packetData.message.payloadBytes * 8;
+    }
+
+    int UnreliableUnorderedChannel::GetParityPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
+    {
+        yojimbo_assert( m_numParityPackets > 0 );
+
+        if ( m_config.packetBudget > 0 )
+            availableBits = yojimbo_min( m_config.packetBudget * 8, availableBits );
+
+        // the parity flag, the group size, the packet sequences, the payload sizes, alignment and the parity itself
+
+        MeasureStream measureStream( m_messageFactory->GetAllocator() );
+        for ( int i = 1; i < m_numParityPackets; ++i )
+        {
+            uint16_t sequence = m_parityPacketSequence[i];
+            serialize_sequence_relative_internal( measureStream, m_parityPacketSequence[i-1], sequence );
+        }
+
+        const int parityBits = 1 + bits_required( 1, m_config.packetParityGroupSize ) + 16 + measureStream.GetBitsProcessed() + 
+                               m_numParityPackets * bits_required( 1, MaxParityPayloadBytes ) + 7 + m_parityBytes * 8;
+
+        if ( parityBits > availableBits )
+        {
+            ResetParityGroup();
+            return 0;
+        }
+
+        Allocator & allocator = m_messageFactory->GetAllocator();
+
+        packetData.Initialize();
+        packetData.channelIndex = GetChannelIndex();
+        packetData.packetParity = 1;
+        packetData.parity.numPackets = m_numParityPackets;
+        packetData.parity.packetSequence = (uint16_t*) YOJIMBO_ALLOCATE( allocator, sizeof( uint16_t ) * m_numParityPackets );
+        packetData.parity.packetBytes = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * m_numParityPackets );
+        packetData.parity.parityData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, m_parityBytes );
+        packetData.parity.parityBytes = m_parityBytes;
+        packetData.parity.context = NULL;
+
+        if ( !packetData.parity.packetSequence || !packetData.parity.packetBytes || !packetData.parity.parityData )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate parity entry\n" );
+            packetData.Free( *m_messageFactory );
+            ResetParityGroup();
+            return 0;
+        }
+
+        memcpy( packetData.parity.packetSequence, m_parityPacketSequence, sizeof( uint16_t ) * m_numParityPackets );
+        memcpy( packetData.parity.packetBytes, m_parityPacketBytes, sizeof( int ) * m_numParityPackets );
+        memcpy( packetData.parity.parityData, m_parityData, m_parityBytes );
+
+        ResetParityGroup();
+
+        m_parityTopUpSequence = packetSequence;
+        m_parityTopUpBits = parityBits;
+
+        return parityBits;
+    }
+
+    bool UnreliableUnorderedChannel::AddParityPacket( uint16_t packetSequence, const uint8_t * payloadData, int payloadBytes )
+    {
+        yojimbo_assert( m_numParityPackets < m_config.packetParityGroupSize );
+
+        if ( payloadBytes > m_parityCapacity )
+        {
+            uint8_t * parityData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, payloadBytes );
+            if ( !parityData )
+            {
+                ResetParityGroup();
+                return false;
+            }
+            memset( parityData, 0, payloadBytes );
+            if ( m_parityData )
+            {
+                memcpy( parityData, m_parityData, m_parityBytes );
+                YOJIMBO_FREE( *m_allocator, m_parityData );
+            }
+            m_parityData = parityData;
+            m_parityCapacity = payloadBytes;
+        }
+
+        for ( int i = 0; i < payloadBytes; ++i )
+            m_parityData[i] ^= payloadData[i];
+
+        m_parityPacketSequence[m_numParityPackets] = packetSequence;
+        m_parityPacketBytes[m_numParityPackets] = payloadBytes;
+        m_numParityPackets++;
+        m_parityBytes = yojimbo_max( m_parityBytes, payloadBytes );
+
+        return true;
+    }
+
+    void UnreliableUnorderedChannel::ResetParityGroup()
+    {
+        if ( m_parityData )
+            memset( m_parityData, 0, m_parityBytes );
+        m_parityBytes = 0;
+        m_numParityPackets = 0;
+    }
+
+    int UnreliableUnorderedChannel::GetTopUpPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
+    {
+        // every message that could fit was already added by GetPacketData, unless it sent a parity entry instead
+
+        if ( m_parityTopUpSequence != int( packetSequence ) )
+            return 0;
+
+        m_parityTopUpSequence = -1;
+
+        if ( m_config.packetBudget > 0 )
+            availableBits = yojimbo_min( m_config.packetBudget * 8 - m_parityTopUpBits, availableBits );
+
+        return GetMessagePacketData( context, packetData, packetSequence, availableBits );
+    }
+
+    bool UnreliableUnorderedChannel::ProcessParityPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        if ( packetData.packetParity )
+        {
+            RecoverParityPacket( packetData.parity );
+            return false;
+        }
+
+        // a packet that was rebuilt from parity can still turn up late. its messages were already received. a packet
+        // so late that a newer packet has taken its entry may have been rebuilt too, so it is dropped as well
+
+        ParityReceiveEntry & entry = m_parityReceiveEntries[packetSequence % m_numParityReceiveEntries];
+
+        if ( entry.valid && ( entry.packetSequence == packetSequence || sequence_greater_than( entry.packetSequence, packetSequence ) ) )
+            return false;
+
+        const int payloadBytes = packetData.message.payloadBytes;
+
+        if ( payloadBytes > entry.capacity )
+        {
+            YOJIMBO_FREE( *m_allocator, entry.data );
+            entry.capacity = 0;
+            entry.valid = false;
+            entry.data = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, payloadBytes );
+            if ( !entry.data )
+                return true;
+            entry.capacity = payloadBytes;
+        }
+
+        memcpy( entry.data, packetData.message.payloadData, payloadBytes );
+        entry.bytes = payloadBytes;
+        entry.packetSequence = packetSequence;
+        entry.valid = true;
+
+        return true;
+    }
+
+    void UnreliableUnorderedChannel::RecoverParityPacket( const ChannelPacketData::ParityData & parity )
+    {
+        int missing = -1;
+
+        for ( int i = 0; i < parity.numPackets; ++i )
+        {
+            const uint16_t packetSequence = parity.packetSequence[i];
+            const ParityReceiveEntry & entry = m_parityReceiveEntries[packetSequence % m_numParityReceiveEntries];
+
+            if ( entry.valid && entry.packetSequence == packetSequence )
+            {
+                if ( entry.bytes != parity.packetBytes[i] )
+                    return;
+                continue;
+            }
+
+            // if a newer packet has taken the entry, this packet is too old to tell whether it was received
+
+            if ( entry.valid && sequence_greater_than( entry.packetSequence, packetSequence ) )
+                return;
+
+            if ( missing >= 0 )
+                return;
+
+            missing = i;
+        }
+
+        if ( missing < 0 )
+            return;
+
+        Allocator & allocator = m_messageFactory->GetAllocator();
+
+        const int bufferBytes = ( parity.parityBytes + 3 ) & ~3;
+
+        ChannelPacketData packetData;
+        packetData.Initialize();
+        packetData.channelIndex = GetChannelIndex();
+        packetData.message.payloadData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, bufferBytes );
+        packetData.message.payloadBytes = parity.packetBytes[missing];
+
+        if ( !packetData.message.payloadData )
+        {
+            packetData.Free( *m_messageFactory );
+            return;
+        }
+
+        uint8_t * payloadData = packetData.message.payloadData;
+
+        memset( payloadData, 0, bufferBytes );
+        memcpy( payloadData, parity.parityData, parity.parityBytes );
+
+        for ( int i = 0; i < parity.numPackets; ++i )
+        {
+            if ( i == missing )
+                continue;
+            const ParityReceiveEntry & entry = m_parityReceiveEntries[parity.packetSequence[i] % m_numParityReceiveEntries];
+            for ( int j = 0; j < entry.bytes; ++j )
+                payloadData[j] ^= entry.data[j];
+        }
+
+        memset( payloadData + packetData.message.payloadBytes, 0, bufferBytes - packetData.message.payloadBytes );
+
+        ReadStream stream( allocator, payloadData, packetData.message.payloadBytes );
+        stream.SetContext( parity.context );
+
+        if ( SerializeUnorderedMessages( stream, 
+                                         *m_messageFactory, 
+                                         packetData.message.numMessages, 
+                                         packetData.message.messages, 
+                                         m_config.maxMessagesPerPacket, 
+                                         m_config.maxBlockSize,
+                                         m_config.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED, 
+                                         m_config.aggregateMessages ) )
+        {
+            ProcessPacketData( packetData, parity.packetSequence[missing] );
+        }
+
+        packetData.Free( *m_messageFactory );
+    }
+
+    void UnreliableUnorderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        if ( m_errorLevel != CHANNEL_ERROR_NONE )
+            return;
+        
+        if ( packetData.messageFailedToSerialize )
+        {
+            SetErrorLevel( CHANNEL_ERROR_FAILED_TO_SERIALIZE );
+            return;
+        }
+
+        if ( m_config.packetParityGroupSize > 0 && !ProcessParityPacketData( packetData, packetSequence ) )
+            return;
+
+        for ( int i = 0; i < (int) packetData.message.numMessages; ++i )
+        {
+            Message * message = packetData.message.messages[i];
+            yojimbo_assert( message );  
+            message->SetId( packetSequence );
+            if ( !m_messageReceiveQueue->IsFull() )
+            {
+                m_messageFactory->AcquireMessage( message );
+                m_messageReceiveQueue->Push( message );
+            }
+        }
+    }
+
+    void UnreliableUnorderedChannel::ProcessAck( uint16_t ack )
+    {
+        (void) ack;
+    }
+
+    void UnreliableUnorderedChannel::GetStatus( ChannelStatus & status ) const
+    {
+        memset( &status, 0, sizeof( status ) );
+        status.numMessagesQueued = m_messageSendQueue->GetNumEntries();
+        status.sendQueueSize = m_config.messageSendQueueSize;
+    }
+
+    // ------------------------------------------------
+
+    UnreliableSequencedChannel::UnreliableSequencedChannel( Allocator & allocator, 
+                                                            MessageFactory & messageFactory, 
+                                                            const ChannelConfig & config, 
+                                                            int channelIndex, 
+                                                            double time ) 
+        : UnreliableUnorderedChannel( allocator, 
+                                      messageFactory, 
+                                      config, 
+                                      channelIndex, 
+                                      time )
+    {
+        yojimbo_assert( config.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED );
+        Reset();
+    }
+
+    void UnreliableSequencedChannel::Reset()
+    {
+        UnreliableUnorderedChannel::Reset();
+
+        m_sendMessageId = 0;
+        m_receiveMessageId = 0;
+        m_receivedMessage = false;
+    }
+
+    void UnreliableSequencedChannel::SendMessage( Message * message, void *context, double timeToLive, int priority )
+    {
+        yojimbo_assert( message );
+
+        message->SetId( m_sendMessageId++ );
+
+        UnreliableUnorderedChannel::SendMessage( message, context, timeToLive, priority );
+    }
+
+    void UnreliableSequencedChannel::SendMessages( Message ** messages, int numMessages, void *context )
+    {
+        yojimbo_assert( messages || numMessages == 0 );
+
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            yojimbo_assert( messages[i] );
+            messages[i]->SetId( m_sendMessageId++ );
+        }
+
+        UnreliableUnorderedChannel::SendMessages( messages, numMessages, context );
+    }
+
+    void UnreliableSequencedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        if ( m_errorLevel != CHANNEL_ERROR_NONE )
+            return;
+        
+        if ( packetData.messageFailedToSerialize )
+        {
+            SetErrorLevel( CHANNEL_ERROR_FAILED_TO_SERIALIZE );
+            return;
+        }
+
+        if ( m_config.packetParityGroupSize > 0 && !ProcessParityPacketData( packetData, packetSequence ) )
+            return;
+
+        for ( int i = 0; i < (int) packetData.message.numMessages; ++i )
+        {
+            Message * message = packetData.message.messages[i];
+
+            yojimbo_assert( message );  
+
+            const uint16_t messageId = message->GetId();
+
+            // discard anything that is not newer than the most recent message received
+
+            if ( m_receivedMessage && !sequence_greater_than( messageId, m_receiveMessageId ) )
+                continue;
+
+            m_receivedMessage = true;
+            m_receiveMessageId = messageId;
+
+            if ( m_config.latestOnly )
+            {
+                while ( !m_messageReceiveQueue->IsEmpty() )
+                    m_messageFactory->ReleaseMessage( m_messageReceiveQueue->Pop() );
+            }
+
+            if ( !m_messageReceiveQueue->IsFull() )
+            {
+                m_messageFactory->AcquireMessage( message );
+                m_messageReceiveQueue->Push( message );
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------
+
+namespace yojimbo
+{
+    static int GetPacketHeaderBits()
+    {
+        // the channel entry count, plus the serialize check at the end of the packet (worst case alignment)
+
+        int packetHeaderBits = bits_required( 0, MaxPacketChannelEntries );
+#if YOJIMBO_SERIALIZE_CHECKS
+        packetHeaderBits += 7 + 32;
+#endif // #if YOJIMBO_SERIALIZE_CHECKS
+        return packetHeaderBits;
+    }
+
+    static int GetChannelHeaderBits( int numChannels )
+    {
+        // the channel index and the block message flag. see ChannelPacketData::Serialize
+
+        return ( numChannels > 1 ? bits_required( 0, numChannels - 1 ) : 0 ) + 1;
+    }
+
+    struct ConnectionPacket
+    {
+        int numChannelEntries;
+        ChannelPacketData * channelEntry;
+        MessageFactory * messageFactory;
+
+        ConnectionPacket()
+        {
+            messageFactory = NULL;
+            numChannelEntries = 0;
+            channelEntry = NULL;
+        }
+
+        ~ConnectionPacket()
+        {
+            if ( messageFactory )
+            {
+                for ( int i = 0; i < numChannelEntries; ++i )
+                {
+                    channelEntry[i].Free( *messageFactory );
+                }
+                YOJIMBO_FREE( messageFactory->GetAllocator(), channelEntry );
+                messageFactory = NULL;
+            }        
+        }
+
+        bool AllocateChannelData( MessageFactory & _messageFactory, int numEntries )
+        {
+            yojimbo_assert( numEntries > 0 );
+            yojimbo_assert( numEntries <= MaxPacketChannelEntries );
+            messageFactory = &_messageFactory;
+            Allocator & allocator = messageFactory->GetAllocator();
+            channelEntry = (ChannelPacketData*) YOJIMBO_ALLOCATE( allocator, sizeof( ChannelPacketData ) * numEntries );
+            if ( channelEntry == NULL )
+                return false;
+            for ( int i = 0; i < numEntries; ++i )
+            {
+                channelEntry[i].Initialize();
+            }
+            numChannelEntries = numEntries;
+            return true;
+        }
+
+        template <typename Stream> bool Serialize( Stream & stream, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig )
+        {
+            const int numChannels = connectionConfig.numChannels;
+            serialize_int( stream, numChannelEntries, 0, MaxPacketChannelEntries );
+#if YOJIMBO_DEBUG_MESSAGE_BUDGET
+            yojimbo_assert( stream.GetBitsProcessed() <= GetPacketHeaderBits() );
+#endif // #if YOJIMBO_DEBUG_MESSAGE_BUDGET
+            if ( numChannelEntries > 0 )
+            {
+                if ( Stream::IsReading )
+                {
+                    if ( !AllocateChannelData( messageFactory, numChannelEntries ) )
+                    {
+                        yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate channel data (ConnectionPacket)\n" );
+                        return false;
+                    }
+                    for ( int i = 0; i < numChannelEntries; ++i )
+                    {
+                        yojimbo_assert( channelEntry[i].messageFailedToSerialize == 0 );
+                    }
+                }
+                for ( int i = 0; i < numChannelEntries; ++i )
+                {
+                    yojimbo_assert( channelEntry[i].messageFailedToSerialize == 0 );
+                    if ( !channelEntry[i].SerializeInternal( stream, messageFactory, connectionConfig.channel, numChannels ) )
+                    {
+                        yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to serialize channel %d\n", i );
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool SerializeInternal( ReadStream & stream, MessageFactory & _messageFactory, const ConnectionConfig & connectionConfig )
+        {
+            return Serialize( stream, _messageFactory, connectionConfig );
+        }
+
+        bool SerializeInternal( WriteStream & stream, MessageFactory & _messageFactory, const ConnectionConfig & connectionConfig )
+        {
+            return Serialize( stream, _messageFactory, connectionConfig );            
+        }
+
+        bool SerializeInternal( MeasureStream & stream, MessageFactory & _messageFactory, const ConnectionConfig & connectionConfig )
+        {
+            return Serialize( stream, _messageFactory, connectionConfig );            
+        }
+
+    private:
+
+        ConnectionPacket( const ConnectionPacket & other );
+
+        const ConnectionPacket & operator = ( const ConnectionPacket & other );
+    };
+
+    // ------------------------------------------------------------------------------
+
+    Connection::Connection( Allocator & allocator, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig, double time ) 
+        : m_connectionConfig( connectionConfig )
+    {
+        m_allocator = &allocator;
+        m_messageFactory = &messageFactory;
+        m_errorLevel = CONNECTION_ERROR_NONE;
+        memset( m_channel, 0, sizeof( m_channel ) );
+        memset( m_channelDeficit, 0, sizeof( m_channelDeficit ) );
+        m_scheduleOffset = 0;
+        yojimbo_assert( m_connectionConfig.bandwidthLimit >= 0 );
+        yojimbo_assert( m_connectionConfig.packetOverhead >= 0 );
+        m_bandwidthLimit = m_connectionConfig.bandwidthLimit;
+        m_bandwidthTokens = GetBandwidthCost( m_connectionConfig.maxPacketSize );
+        m_time = time;
+        m_lastPacketSendTime = time;
+        m_ackPendingTime = -1.0;
+        m_numUnackedReceivedPackets = 0;
+        yojimbo_assert( m_connectionConfig.numChannels >= 1 );
+        yojimbo_assert( m_connectionConfig.numChannels <= MaxChannels );
+        for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+        {
+            yojimbo_assert( m_connectionConfig.channel[channelIndex].weight >= 1 );
+
+            switch ( m_connectionConfig.channel[channelIndex].type )
+            {
+                case CHANNEL_TYPE_RELIABLE_ORDERED: 
+                {
+                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, 
+                                                           ReliableOrderedChannel, 
+                                                           *m_allocator, 
+                                                           messageFactory, 
+                                                           m_connectionConfig.channel[channelIndex],
+                                                           channelIndex, 
+                                                           time ); 
+                }
+                break;
+
+                case CHANNEL_TYPE_UNRELIABLE_UNORDERED: 
+                {
+                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, 
+                                                           UnreliableUnorderedChannel, 
+                                                           *m_allocator, 
+                                                           messageFactory, 
+                                                           m_connectionConfig.channel[channelIndex], 
+                                                           channelIndex, 
+                                                           time ); 
+                }
+                break;
+
+                case CHANNEL_TYPE_RELIABLE_UNORDERED: 
+                {
+                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, 
+                                                           ReliableUnorderedChannel, 
+                                                           *m_allocator, 
+                                                           messageFactory, 
+                                                           m_connectionConfig.channel[channelIndex], 
+                                                           channelIndex, 
+                                                           time ); 
+                }
+                break;
+
+                case CHANNEL_TYPE_UNRELIABLE_SEQUENCED: 
+                {
+                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, 
+                                                           UnreliableSequencedChannel, 
+                                                           *m_allocator, 
+                                                           messageFactory, 
+                                                           m_connectionConfig.channel[channelIndex], 
+                                                           channelIndex, 
+                                                           time ); 
+                }
+                break;
+
+                default: 
+                    yojimbo_assert( !"unknown channel type" );
+            }
+        }
+
+        // size the sent packet buffer to match the largest reliable channel, so an ack is never forgotten while a channel still needs it
+
+        yojimbo_assert( MaxChannels <= 64 );
+
+        int sentPacketBufferSize = 1;
+        m_reliableChannelMask = 0;
+
+        for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+        {
+            const ChannelConfig & channelConfig = m_connectionConfig.channel[channelIndex];
+            if ( channelConfig.type == CHANNEL_TYPE_RELIABLE_ORDERED || channelConfig.type == CHANNEL_TYPE_RELIABLE_UNORDERED )
+            {
+                m_reliableChannelMask |= uint64_t(1) << channelIndex;
+                sentPacketBufferSize = yojimbo_max( sentPacketBufferSize, channelConfig.sentPacketBufferSize );
+            }
+        }
+
+        m_sentPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<SentPacketEntry>, *m_allocator, sentPacketBufferSize );
+    }
+
+    Connection::~Connection()
+    {
+        yojimbo_assert( m_allocator );
+        Reset();
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            YOJIMBO_DELETE( *m_allocator, Channel, m_channel[i] );
+        }
+        YOJIMBO_DELETE( *m_allocator, SequenceBuffer<SentPacketEntry>, m_sentPackets );
+        m_allocator = NULL;
+    }
+
+    void Connection::Reset()
+    {
+        m_errorLevel = CONNECTION_ERROR_NONE;
+        memset( m_channelDeficit, 0, sizeof( m_channelDeficit ) );
+        m_scheduleOffset = 0;
+        m_sentPackets->Reset();
+        m_bandwidthLimit = m_connectionConfig.bandwidthLimit;
+        m_bandwidthTokens = GetBandwidthCost( m_connectionConfig.maxPacketSize );
+        m_lastPacketSendTime = m_time;
+        m_ackPendingTime = -1.0;
+        m_numUnackedReceivedPackets = 0;
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            m_channel[i]->Reset();
+        }
+    }
+
+    bool Connection::CanSendMessage( int channelIndex ) const
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        return m_channel[channelIndex]->CanSendMessage();
+    }
+
+    bool Connection::CanSendMessages( int channelIndex, int numMessages ) const
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        return m_channel[channelIndex]->CanSendMessages( numMessages );
+    }
+
+    void Connection::GetChannelStatus( int channelIndex, ChannelStatus & status ) const
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        m_channel[channelIndex]->GetStatus( status );
+    }
+
+    void Connection::SetBlockSink( int channelIndex, BlockSink * blockSink )
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        m_channel[channelIndex]->SetBlockSink( blockSink );
+    }
+
+    void Connection::SetBlockAllocator( Allocator & allocator )
+    {
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+            m_channel[i]->SetBlockAllocator( allocator );
+    }
+
+    void Connection::SendMessage( int channelIndex, Message * message, void *context)
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        return m_channel[channelIndex]->SendMessage( message, context, 0.0, 0 );
+    }
+
+    void Connection::SendMessage( int channelIndex, Message * message, double timeToLive, int priority, void *context )
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        return m_channel[channelIndex]->SendMessage( message, context, timeToLive, priority );
+    }
+
+    void Connection::SendMessages( int channelIndex, Message ** messages, int numMessages, void *context )
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        m_channel[channelIndex]->SendMessages( messages, numMessages, context );
+    }
+
+    Message * Connection::ReceiveMessage( int channelIndex )
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        return m_channel[channelIndex]->ReceiveMessage();
+    }
+
+    int Connection::ReceiveMessages( int channelIndex, Message ** messages, int maxMessages )
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
+        return m_channel[channelIndex]->ReceiveMessages( messages, maxMessages );
+    }
+
+    void Connection::ReleaseMessage( Message * message )
+    {
+        yojimbo_assert( message );
+        m_messageFactory->ReleaseMessage( message );
+    }
+
+    static int WritePacket( void * context, 
+                            MessageFactory & messageFactory, 
+                            const ConnectionConfig & connectionConfig, 
+                            ConnectionPacket & packet, 
+                            uint8_t * buffer, 
+                            int bufferSize )
+    {
+        WriteStream stream( messageFactory.GetAllocator(), buffer, bufferSize );
+        
+        stream.SetContext( context );
+        
+        if ( !packet.SerializeInternal( stream, messageFactory, connectionConfig ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (write packet)\n" );
+            return 0;
+        }
+
+#if YOJIMBO_SERIALIZE_CHECKS
+        if ( !stream.SerializeCheck() )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize check at end of connection packed failed (write packet)\n" );
+            return 0;
+        }
+#endif // #if YOJIMBO_SERIALIZE_CHECKS
+
+        stream.Flush();
+
+        return stream.GetBytesProcessed();
+    }
+
+    bool Connection::GeneratePacket( void * context, uint16_t packetSequence, uint8_t * packetData, int maxPacketBytes, int & packetBytes )
+    {
+        if ( m_bandwidthLimit > 0 )
+        {
+            // the token bucket decides whether a packet goes out at all, and how big it can be
+
+            // the bucket pays for transport headers too, so take those off before sizing the packet. packets are
+            // written a word at a time, so round down to a multiple of four bytes
+
+            const int tokens = (int) m_bandwidthTokens;
+            int bandwidthBytes = tokens - m_connectionConfig.packetOverhead;
+            while ( bandwidthBytes > 0 && GetBandwidthCost( bandwidthBytes ) > tokens )
+                bandwidthBytes -= yojimbo_max( m_connectionConfig.packetOverhead, 1 );
+            bandwidthBytes &= ~3;
+            if ( bandwidthBytes * 8 <= GetPacketHeaderBits() )
+                return false;
+            maxPacketBytes = yojimbo_min( maxPacketBytes, bandwidthBytes );
+        }
+
+        ConnectionPacket packet;
+
+        if ( m_connectionConfig.numChannels > 0 )
+        {
+            int numChannelsWithData = 0;
+            bool channelHasData[MaxChannels];
+            bool channelActive[MaxChannels];
+            int channelBits[MaxChannels];
+            int channelOrder[MaxChannels];
+            memset( channelHasData, 0, sizeof( channelHasData ) );
+            memset( channelBits, 0, sizeof( channelBits ) );
+            ChannelPacketData channelData[MaxChannels];
+
+            for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+            {
+                channelActive[channelIndex] = m_channel[channelIndex]->HasMessagesToSend();
+            }
+
+            GetChannelSchedule( channelOrder );
+
+            const int channelHeaderBits = GetChannelHeaderBits( m_connectionConfig.numChannels );
+            
+            int availableBits = maxPacketBytes * 8 - GetPacketHeaderBits();
+            
+            for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+            {
+                const int channelIndex = channelOrder[i];
+
+                if ( !channelActive[channelIndex] )
+                    continue;
+
+                int packetDataBits = m_channel[channelIndex]->GetPacketData( context, channelData[channelIndex], packetSequence, availableBits - channelHeaderBits );
+                if ( packetDataBits > 0 )
+                {
+                    availableBits -= channelHeaderBits + packetDataBits;
+                    channelHasData[channelIndex] = true;
+                    channelBits[channelIndex] = packetDataBits;
+                    numChannelsWithData++;
+                }
+            }
+
+            // top up the space left over. channels take turns adding another entry to the packet, until none of them can
+
+            int numTopUpEntries = 0;
+            ChannelPacketData topUpData[MaxPacketChannelEntries];
+
+            bool toppedUp = numChannelsWithData > 0;
+
+            while ( toppedUp )
+            {
+                toppedUp = false;
+
+                for ( int i = 0; i < m_connectionConfig.numChannels && numChannelsWithData + numTopUpEntries < MaxPacketChannelEntries; ++i )
+                {
+                    const int channelIndex = channelOrder[i];
+
+                    if ( !channelActive[channelIndex] )
+                        continue;
+
+                    int packetDataBits = m_channel[channelIndex]->GetTopUpPacketData( context, topUpData[numTopUpEntries], packetSequence, availableBits - channelHeaderBits );
+                    if ( packetDataBits > 0 )
+                    {
+                        availableBits -= channelHeaderBits + packetDataBits;
+                        channelBits[channelIndex] += packetDataBits;
+                        numTopUpEntries++;
+                        toppedUp = true;
+                    }
+                }
+            }
+
+            yojimbo_assert( availableBits >= 0 );
+
+            // a packet without message data only carries acks. skip it unless acks have waited long enough, or the
+            // other side hasn't heard from us in a while
+
+            if ( numChannelsWithData == 0 && m_connectionConfig.keepAliveInterval > 0.0f )
+            {
+                const bool ackDue = ( m_ackPendingTime >= 0.0 && m_time - m_ackPendingTime >= m_connectionConfig.ackDelay ) || m_numUnackedReceivedPackets >= MaxUnackedReceivedPackets;
+                const bool keepAliveDue = m_time - m_lastPacketSendTime >= m_connectionConfig.keepAliveInterval;
+                if ( !ackDue && !keepAliveDue )
+                    return false;
+            }
+
+            UpdateChannelDeficits( channelOrder, channelActive, channelBits, maxPacketBytes * 8 );
+
+            uint64_t channelMask = 0;
+            for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+            {
+                if ( channelHasData[channelIndex] )
+                    channelMask |= uint64_t(1) << channelIndex;
+            }
+
+            SentPacketEntry * sentPacket = m_sentPackets->Insert( packetSequence );
+            if ( sentPacket )
+                sentPacket->channelMask = channelMask & m_reliableChannelMask;
+
+            if ( numChannelsWithData > 0 )
+            {
+                if ( !packet.AllocateChannelData( *m_messageFactory, numChannelsWithData + numTopUpEntries ) )
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate channel data\n" );
+                    return false;
+                }
+
+                int index = 0;
+
+                for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+                {
+                    if ( channelHasData[channelIndex] )
+                    {
+                        memcpy( &packet.channelEntry[index], &channelData[channelIndex], sizeof( ChannelPacketData ) );
+                        index++;
+                    }
+                }
+
+                for ( int i = 0; i < numTopUpEntries; ++i )
+                {
+                    memcpy( &packet.channelEntry[index], &topUpData[i], sizeof( ChannelPacketData ) );
+                    index++;
+                }
+            }
+        }
+
+        packetBytes = WritePacket( context, *m_messageFactory, m_connectionConfig, packet, packetData, maxPacketBytes );
+
+        if ( m_bandwidthLimit > 0 )
+        {
+            m_bandwidthTokens -= GetBandwidthCost( packetBytes );
+        }
+
+        m_lastPacketSendTime = m_time;
+        m_ackPendingTime = -1.0;
+        m_numUnackedReceivedPackets = 0;
+
+        return true;
+    }
+
+    int Connection::GetBandwidthCost( int packetBytes ) const
+    {
+        int numDatagrams = 1;
+        if ( packetBytes > m_connectionConfig.fragmentPacketsAbove )
+            numDatagrams = ( packetBytes + m_connectionConfig.packetFragmentSize - 1 ) / m_connectionConfig.packetFragmentSize;
+        return packetBytes + numDatagrams * m_connectionConfig.packetOverhead;
+    }
+
+    void Connection::SetBandwidthLimit( int kbps )
+    {
+        yojimbo_assert( kbps >= 0 );
+        m_bandwidthLimit = kbps;
+    }
+
+    void Connection::GetChannelSchedule( int * channelOrder ) const
+    {
+        yojimbo_assert( channelOrder );
+
+        const int numChannels = m_connectionConfig.numChannels;
+
+        // insertion sort. there are only a handful of channels and they are usually already in order from the previous packet.
+
+        for ( int i = 0; i < numChannels; ++i )
+        {
+            const int channelIndex = ( i + m_scheduleOffset ) % numChannels;
+            const int priority = m_connectionConfig.channel[channelIndex].priority;
+            const int deficit = m_channelDeficit[channelIndex];
+
+            int j = i;
+
+            while ( j > 0 )
+            {
+                const int otherIndex = channelOrder[j-1];
+                const int otherPriority = m_connectionConfig.channel[otherIndex].priority;
+
+                if ( otherPriority > priority || ( otherPriority == priority && m_channelDeficit[otherIndex] >= deficit ) )
+                    break;
+
+                channelOrder[j] = otherIndex;
+                --j;
+            }
+
+            channelOrder[j] = channelIndex;
+        }
+    }
+
+    void Connection::UpdateChannelDeficits( const int * channelOrder, const bool * channelActive, const int * channelBits, int maxPacketBits )
+    {
+        const int numChannels = m_connectionConfig.numChannels;
+
+        // channels are sorted by priority, so each priority level is a contiguous run of channels in the schedule
+
+        int begin = 0;
+
+        while ( begin < numChannels )
+        {
+            const int priority = m_connectionConfig.channel[channelOrder[begin]].priority;
+
+            int end = begin;
+            int levelBits = 0;
+            int levelWeight = 0;
+
+            while ( end < numChannels && m_connectionConfig.channel[channelOrder[end]].priority == priority )
+            {
+                const int channelIndex = channelOrder[end];
+                if ( channelActive[channelIndex] )
+                {
+                    levelBits += channelBits[channelIndex];
+                    levelWeight += m_connectionConfig.channel[channelIndex].weight;
+                }
+                ++end;
+            }
+
+            for ( int i = begin; i < end; ++i )
+            {
+                const int channelIndex = channelOrder[i];
+
+                if ( !channelActive[channelIndex] )
+                {
+                    m_channelDeficit[channelIndex] = 0;
+                    continue;
+                }
+
+                const int share = (int) ( ( int64_t( levelBits ) * m_connectionConfig.channel[channelIndex].weight ) / levelWeight );
+
+                int deficit = m_channelDeficit[channelIndex] + share - channelBits[channelIndex];
+
+                deficit = yojimbo_clamp( deficit, -maxPacketBits, maxPacketBits );
+
+                m_channelDeficit[channelIndex] = deficit;
+            }
+
+            begin = end;
+        }
+
+        m_scheduleOffset = ( m_scheduleOffset + 1 ) % numChannels;
+    }
+
+    static bool ReadPacket( void * context, 
+                            MessageFactory & messageFactory, 
+                            const ConnectionConfig & connectionConfig, 
+                            ConnectionPacket & packet, 
+                            const uint8_t * buffer, 
+                            int bufferSize )
+    {
+        yojimbo_assert( buffer );
+        yojimbo_assert( bufferSize > 0 );
+
+        ReadStream stream( messageFactory.GetAllocator(), buffer, bufferSize );
+        
+        stream.SetContext( context );
+        
+        if ( !packet.SerializeInternal( stream, messageFactory, connectionConfig ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (read packet)\n" );
+            return false;
+        }
+
+#if YOJIMBO_SERIALIZE_CHECKS
+        if ( !stream.SerializeCheck() )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize check failed at end of connection packet (read packet)\n" );
+            return false;
+        }
+#endif // #if YOJIMBO_SERIALIZE_CHECKS
+
+        return true;
+    }
+
+    bool Connection::ProcessPacket( void * context, uint16_t packetSequence, const uint8_t * packetData, int packetBytes )
+    {
+        if ( m_errorLevel != CONNECTION_ERROR_NONE )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "failed to read packet because connection is in error state\n" );
+            return false;
+        }
+
+        ConnectionPacket packet;
+
+        if ( !ReadPacket( context, *m_messageFactory, m_connectionConfig, packet, packetData, packetBytes ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to read packet\n" );
+            m_errorLevel = CONNECTION_ERROR_READ_PACKET_FAILED;
+            return false;            
+        }
+
+        for ( int i = 0; i < packet.numChannelEntries; ++i )
+        {
+            const int channelIndex = packet.channelEntry[i].channelIndex;
+            yojimbo_assert( channelIndex >= 0 );
+            yojimbo_assert( channelIndex <= m_connectionConfig.numChannels );
+            m_channel[channelIndex]->ProcessPacketData( packet.channelEntry[i], packetSequence );
+            if ( m_channel[channelIndex]->GetErrorLevel() != CHANNEL_ERROR_NONE )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "failed to read packet because channel %d is in error state\n", channelIndex );
+                return false;
+            }
+        }
+
+        // the other side measures packet loss and RTT from acks, so acks are owed for every packet, not just reliable data
+
+        m_numUnackedReceivedPackets++;
+
+        if ( m_ackPendingTime < 0.0 && packet.numChannelEntries > 0 )
+        {
+            m_ackPendingTime = m_time;
+        }
+
+        return true;
+    }
+
+    void Connection::ProcessAcks( const uint16_t * acks, int numAcks )
+    {
+        for ( int i = 0; i < numAcks; ++i )
+        {
+            SentPacketEntry * sentPacket = m_sentPackets->Find( acks[i] );
+            if ( !sentPacket )
+                continue;
+
+            uint64_t channelMask = sentPacket->channelMask;
+
+            m_sentPackets->Remove( acks[i] );
+
+            while ( channelMask )
+            {
+                const int channelIndex = trailing_zeros( channelMask );
+                channelMask &= channelMask - 1;
+                m_channel[channelIndex]->ProcessAck( acks[i] );
+            }
+        }
+    }
+
+    void Connection::AdvanceTime( double time )
+    {
+        if ( time > m_time )
+        {
+            m_bandwidthTokens += ( time - m_time ) * m_bandwidthLimit * 1000.0 / 8.0;
+            m_bandwidthTokens = yojimbo_min( m_bandwidthTokens, double( GetBandwidthCost( m_connectionConfig.maxPacketSize ) ) );
+        }
+        m_time = time;
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            m_channel[i]->AdvanceTime( time );
+
+            if ( m_channel[i]->GetErrorLevel() != CHANNEL_ERROR_NONE )
+            {
+                m_errorLevel = CONNECTION_ERROR_CHANNEL;
+                return;
+            }
+        }
+        if ( m_allocator->GetErrorLevel() != ALLOCATOR_ERROR_NONE )
+        {
+            m_errorLevel = CONNECTION_ERROR_ALLOCATOR;
+            return;
+        }
+        if ( m_messageFactory->GetErrorLevel() != MESSAGE_FACTORY_ERROR_NONE )
+        {
+            m_errorLevel = CONNECTION_ERROR_MESSAGE_FACTORY;
+            return;
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------
+
+    MessageQueues::MessageQueues( Allocator & allocator, const ConnectionConfig & connectionConfig )
+    {
+        m_allocator = &allocator;
+        m_numChannels = connectionConfig.numChannels;
+        memset( m_sendQueue, 0, sizeof( m_sendQueue ) );
+        memset( m_receiveQueue, 0, sizeof( m_receiveQueue ) );
+        for ( int i = 0; i < m_numChannels; ++i )
+        {
+            m_sendQueue[i] = YOJIMBO_NEW( allocator, SPSCQueue<QueuedMessage>, allocator, connectionConfig.channel[i].messageSendQueueSize );
+            m_receiveQueue[i] = YOJIMBO_NEW( allocator, SPSCQueue<Message*>, allocator, connectionConfig.channel[i].messageReceiveQueueSize );
+        }
+    }
+
+    MessageQueues::~MessageQueues()
+    {
+        typedef SPSCQueue<QueuedMessage> SendQueue;
+        typedef SPSCQueue<Message*> ReceiveQueue;
+        for ( int i = 0; i < m_numChannels; ++i )
+        {
+            YOJIMBO_DELETE( *m_allocator, SendQueue, m_sendQueue[i] );
+            YOJIMBO_DELETE( *m_allocator, ReceiveQueue, m_receiveQueue[i] );
+        }
+        m_allocator = NULL;
+    }
+
+    bool MessageQueues::CanSendMessages( int channelIndex, int numMessages ) const
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_numChannels );
+        return m_sendQueue[channelIndex]->GetNumFreeEntries() >= numMessages;
+    }
+
+    bool MessageQueues::SendMessage( int channelIndex, Message * message, double timeToLive, int priority )
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_numChannels );
+        yojimbo_assert( message );
+        QueuedMessage entry;
+        entry.message = message;
+        entry.timeToLive = timeToLive;
+        entry.priority = priority;
+        return m_sendQueue[channelIndex]->Push( entry );
+    }
+
+    Message * MessageQueues::ReceiveMessage( int channelIndex )
+    {
+        yojimbo_assert( channelIndex >= 0 );
+        yojimbo_assert( channelIndex < m_numChannels );
+        Message * message;
+        if ( !m_receiveQueue[channelIndex]->Pop( message ) )
+            return NULL;
+        return message;
+    }
+
+    void MessageQueues::Update( Connection & connection, void * context )
+    {
+        for ( int i = 0; i < m_numChannels; ++i )
+        {
+            // messages stay in the send queue until the channel has room, so a busy channel holds back the game thread instead of failing
+
+            QueuedMessage entry;
+            while ( connection.CanSendMessage( i ) && m_sendQueue[i]->Pop( entry ) )
+            {
+                connection.SendMessage( i, entry.message, entry.timeToLive, entry.priority, context );
+            }
+
+            int numFreeEntries = m_receiveQueue[i]->GetNumFreeEntries();
+            while ( numFreeEntries > 0 )
+            {
+                Message * message = connection.ReceiveMessage( i );
+                if ( !message )
+                    break;
+                m_receiveQueue[i]->Push( message );
+                numFreeEntries--;
+            }
+        }
+    }
+
+    void MessageQueues::ReleaseSendQueue( MessageFactory & messageFactory )
+    {
+        for ( int i = 0; i < m_numChannels; ++i )
+        {
+            QueuedMessage entry;
+            while ( m_sendQueue[i]->Pop( entry ) )
+            {
+                messageFactory.ReleaseMessage( entry.message );
+            }
+        }
+    }
+
+    void MessageQueues::ReleaseReceiveQueue( MessageFactory & messageFactory )
+    {
+        for ( int i = 0; i < m_numChannels; ++i )
+        {
+            Message * message;
+            while ( m_receiveQueue[i]->Pop( message ) )
+            {
+                messageFactory.ReleaseMessage( message );
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------
+
+namespace yojimbo
+{
+    BaseClient::BaseClient( Allocator & allocator, const ClientServerConfig & config, Adapter & adapter, double time ) : m_config( config )
+    {
+        m_allocator = &allocator;
+        m_adapter = &adapter;
+        m_time = time;
+        m_context = NULL;
+        m_clientMemory = NULL;
+        m_clientAllocator = NULL;
+        m_endpoint = NULL;
+        m_connection = NULL;
+        m_messageFactory = NULL;
+        m_networkSimulator = NULL;
+        m_clientState = CLIENT_STATE_DISCONNECTED;
+        m_clientIndex = -1;
+        m_packetBuffer = (uint8_t*) YOJIMBO_ALLOCATE( allocator, config.maxPacketSize );
+        m_messageQueues = NULL;
+        m_disconnectRequested = 0;
+    }
+
+    BaseClient::~BaseClient()
+    {
+        // IMPORTANT: Please disconnect the client before destroying it
+        yojimbo_assert( IsDisconnected() );
+        yojimbo_assert( !m_networkThread.IsRunning() );
+        YOJIMBO_FREE( *m_allocator, m_packetBuffer );
+        m_allocator = NULL;
+    }
+
+    void BaseClient::Disconnect()
+    {
+        StopNetworkThread();
+        SetClientState( CLIENT_STATE_DISCONNECTED );
+    }
+
+    void BaseClient::AdvanceTime( double time )
+    {
+        if ( DeferToNetworkThread() )
+        {
+            // the network thread only flags disconnects. the client is torn down here, keeping the state it flagged
+            if ( IsDisconnected() )
+            {
+                const ClientState clientState = GetClientState();
+                Disconnect();
+                SetClientState( clientState );
+            }
+            return;
+        }
+        m_time = time;
+        if ( m_endpoint )
+        {
+            m_connection->AdvanceTime( time );
+            if ( m_connection->GetErrorLevel() != CONNECTION_ERROR_NONE )
+            {
+                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "connection error. disconnecting client\n" );
+                if ( IsNetworkThread() )
+                    SetClientState( CLIENT_STATE_DISCONNECTED );
+                else
+                    Disconnect();
+                return;
+            }
+            reliable_endpoint_update( m_endpoint, m_time );
+            int numAcks;
+            const uint16_t * acks = reliable_endpoint_get_acks( m_endpoint, &numAcks );
+            m_connection->ProcessAcks( acks, numAcks );
+            reliable_endpoint_clear_acks( m_endpoint );
+        }
+        NetworkSimulator * networkSimulator = GetNetworkSimulator();
+        if ( networkSimulator )
+        {
+            networkSimulator->AdvanceTime( time );
+        }
+    }
+
+    void BaseClient::SetLatency( float milliseconds )
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetLatency( milliseconds );
+        }
+    }
+
+    void BaseClient::SetJitter( float milliseconds )
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetJitter( milliseconds );
+        }
+    }
+
+    void BaseClient::SetPacketLoss( float percent )
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetPacketLoss( percent );
+        }
+    }
+
+    void BaseClient::SetDuplicates( float percent )
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetDuplicates( percent );
+        }
+    }
+
+    void BaseClient::SetClientState( ClientState clientState )
+    {
+        yojimbo_atomic_store( &m_clientState, clientState );
+    }
+
+    void BaseClient::StartNetworkThread()
+    {
+        if ( m_config.networkThread && !m_networkThread.IsRunning() )
+        {
+            yojimbo_assert( m_messageQueues );
+            m_disconnectRequested = 0;
+            m_networkThread.Start( StaticNetworkThreadTick, this, m_time, m_config.networkTickRate );
+        }
+    }
+
+    void BaseClient::StopNetworkThread()
+    {
+        yojimbo_assert( !m_networkThread.IsCurrentThread() );
+        if ( m_networkThread.IsRunning() )
+        {
+            m_networkThread.Stop();
+        }
+    }
+
+    void BaseClient::NetworkThreadTick( double time )
+    {
+        m_lock.Lock();
+        if ( yojimbo_atomic_load( &m_disconnectRequested ) )
+        {
+            SetClientState( CLIENT_STATE_DISCONNECTED );
+        }
+        // once a disconnect is flagged, stop ticking and wait to be torn down outside the network thread
+        if ( !IsDisconnected() )
+        {
+            ReceivePackets();
+            AdvanceTime( time );
+            if ( IsConnected() )
+            {
+                m_messageQueues->Update( *m_connection, m_context );
+            }
+            SendPackets();
+        }
+        m_lock.Unlock();
+    }
+
+    void BaseClient::StaticNetworkThreadTick( void * context, double time )
+    {
+        BaseClient * client = (BaseClient*) context;
+        client->NetworkThreadTick( time );
+    }
+
+    void BaseClient::CreateInternal()
+    {
+        yojimbo_assert( m_allocator );
+        yojimbo_assert( m_adapter );
+        yojimbo_assert( m_clientMemory == NULL );
+        yojimbo_assert( m_clientAllocator == NULL );
+        yojimbo_assert( m_messageFactory == NULL );
+        m_clientMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.clientMemory );
+        m_clientAllocator = m_adapter->CreateAllocator( *m_allocator, m_clientMemory, m_config.clientMemory );
+        m_messageFactory = m_adapter->CreateMessageFactory( *m_clientAllocator );
+        m_connection = YOJIMBO_NEW( *m_clientAllocator, Connection, *m_clientAllocator, *m_messageFactory, m_config, m_time );
+        yojimbo_assert( m_connection );
+        if ( m_config.networkThread )
+        {
+            yojimbo_assert( m_config.networkTickRate > 0 );
+            m_messageQueues = YOJIMBO_NEW( *m_clientAllocator, MessageQueues, *m_clientAllocator, m_config );
+        }
+        if ( m_config.networkSimulator )
+        {
+            m_networkSimulator = YOJIMBO_NEW( *m_clientAllocator, NetworkSimulator, *m_clientAllocator, m_config.maxSimulatorPackets, m_time );
+        }
+        reliable_config_t reliable_config;
+        reliable_default_config( &reliable_config );
+        strcpy( reliable_config.name, "client endpoint" );
+        reliable_config.context = (void*) this;
+        reliable_config.max_packet_size = m_config.maxPacketSize;
+        reliable_config.fragment_above = m_config.fragmentPacketsAbove;
+        reliable_config.max_fragments = m_config.maxPacketFragments;
+        reliable_config.fragment_size = m_config.packetFragmentSize; 
+        reliable_config.ack_buffer_size = m_config.ackedPacketsBufferSize;
+        reliable_config.received_packets_buffer_size = m_config.receivedPacketsBufferSize;
+        reliable_config.fragment_reassembly_buffer_size = m_config.packetReassemblyBufferSize;
+        reliable_config.transmit_packet_function = BaseClient::StaticTransmitPacketFunction;
+        reliable_config.process_packet_function = BaseClient::StaticProcessPacketFunction;
+        reliable_config.allocator_context = m_clientAllocator;
+        reliable_config.allocate_function = BaseClient::StaticAllocateFunction;
+        reliable_config.free_function = BaseClient::StaticFreeFunction;
+        m_endpoint = reliable_endpoint_create( &reliable_config, m_time );
+        reliable_endpoint_reset( m_endpoint );
+    }
+
+    void BaseClient::DestroyInternal()
+    {
+        yojimbo_assert( m_allocator );
+        if ( m_endpoint )
+        {
+            reliable_endpoint_destroy( m_endpoint ); 
+            m_endpoint = NULL;
+        }
+        yojimbo_assert( !m_networkThread.IsRunning() );
+        if ( m_messageQueues )
+        {
+            m_messageQueues->ReleaseSendQueue( *m_messageFactory );
+            m_messageQueues->ReleaseReceiveQueue( *m_messageFactory );
+            YOJIMBO_DELETE( *m_clientAllocator, MessageQueues, m_messageQueues );
+        }
+        YOJIMBO_DELETE( *m_clientAllocator, NetworkSimulator, m_networkSimulator );
+        YOJIMBO_DELETE( *m_clientAllocator, Connection, m_connection );
+        YOJIMBO_DELETE( *m_clientAllocator, MessageFactory, m_messageFactory );
+        YOJIMBO_DELETE( *m_allocator, Allocator, m_clientAllocator );
+        YOJIMBO_FREE( *m_allocator, m_clientMemory );
+    }
+
+    void BaseClient::StaticTransmitPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    {
+        (void) index;
+        BaseClient * client = (BaseClient*) context;
+        client->TransmitPacketFunction( packetSequence, packetData, packetBytes );
+    }
+    
+    int BaseClient::StaticProcessPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    {
+        (void) index;
+        BaseClient * client = (BaseClient*) context;
+        return client->ProcessPacketFunction( packetSequence, packetData, packetBytes );
+    }
+
+    void * BaseClient::StaticAllocateFunction( void * context, uint64_t bytes )
+    {
+        yojimbo_assert( context );
+        Allocator * allocator = (Allocator*) context;
+        return YOJIMBO_ALLOCATE( *allocator, bytes );
+    }
+    
+    void BaseClient::StaticFreeFunction( void * context, void * pointer )
+    {
+        yojimbo_assert( context );
+        yojimbo_assert( pointer );
+        Allocator * allocator = (Allocator*) context;
+        YOJIMBO_FREE( *allocator, pointer );
+    }
+
+    Message * BaseClient::CreateMessage( int type )
+    {
+        yojimbo_assert( m_messageFactory );
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            m_lock.Lock();
+        Message * message = m_messageFactory->CreateMessage( type );
+        if ( lock )
+            m_lock.Unlock();
+        return message;
+    }
+
+    uint8_t * BaseClient::AllocateBlock( int bytes )
+    {
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            m_lock.Lock();
+        uint8_t * block = (uint8_t*) YOJIMBO_ALLOCATE( *m_clientAllocator, bytes );
+        if ( lock )
+            m_lock.Unlock();
+        return block;
+    }
+
+    void BaseClient::AttachBlockToMessage( Message * message, uint8_t * block, int bytes )
+    {
+        yojimbo_assert( message );
+        yojimbo_assert( block );
+        yojimbo_assert( bytes > 0 );
+        yojimbo_assert( message->IsBlockMessage() );
+        BlockMessage * blockMessage = (BlockMessage*) message;
+        blockMessage->AttachBlock( *m_clientAllocator, block, bytes );
+    }
+
+    void BaseClient::FreeBlock( uint8_t * block )
+    {
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            m_lock.Lock();
+        YOJIMBO_FREE( *m_clientAllocator, block );
+        if ( lock )
+            m_lock.Unlock();
+    }
+
+    bool BaseClient::CanSendMessage( int channelIndex ) const
+    {
+        yojimbo_assert( m_connection );
+        if ( UseMessageQueues() )
+            return m_messageQueues->CanSendMessages( channelIndex, 1 );
+        return m_connection->CanSendMessage( channelIndex );
+    }
+
+    void BaseClient::SendMessage( int channelIndex, Message * message )
+    {
+        SendMessage( channelIndex, message, 0.0, 0 );
+    }
+
+    void BaseClient::SendMessage( int channelIndex, Message * message, double timeToLive, int priority )
+    {
+        yojimbo_assert( m_connection );
+        if ( !UseMessageQueues() )
+        {
+            m_connection->SendMessage( channelIndex, message, timeToLive, priority, GetContext() );
+            return;
+        }
+        if ( !m_messageQueues->SendMessage( channelIndex, message, timeToLive, priority ) )
+        {
+            // same as a full channel send queue: drop the message and disconnect
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "send queue is full on channel %d. disconnecting client\n", channelIndex );
+            ReleaseMessage( message );
+            yojimbo_atomic_store( &m_disconnectRequested, 1 );
+        }
+    }
+
+    bool BaseClient::CanSendMessages( int channelIndex, int numMessages ) const
+    {
+        yojimbo_assert( m_connection );
+        if ( UseMessageQueues() )
+            return m_messageQueues->CanSendMessages( channelIndex, numMessages );
+        return m_connection->CanSendMessages( channelIndex, numMessages );
+    }
+
+    void BaseClient::GetChannelStatus( int channelIndex, ChannelStatus & status ) const
+    {
+        yojimbo_assert( m_connection );
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            m_lock.Lock();
+        m_connection->GetChannelStatus( channelIndex, status );
+        if ( lock )
+            m_lock.Unlock();
+    }
+
+    void BaseClient::SetBlockSink( int channelIndex, BlockSink * blockSink )
+    {
+        yojimbo_assert( m_connection );
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            m_lock.Lock();
+        m_connection->SetBlockSink( channelIndex, blockSink );
+        if ( lock )
+            m_lock.Unlock();
+    }
+
+    void BaseClient::SendMessages( int channelIndex, Message ** messages, int numMessages )
+    {
+        yojimbo_assert( m_connection );
+        if ( !UseMessageQueues() )
+        {
+            m_connection->SendMessages( channelIndex, messages, numMessages, GetContext() );
+            return;
+        }
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            SendMessage( channelIndex, messages[i], 0.0, 0 );
+        }
+    }
+
+    Message * BaseClient::ReceiveMessage( int channelIndex )
+    {
+        yojimbo_assert( m_connection );
+        if ( UseMessageQueues() )
+            return m_messageQueues->ReceiveMessage( channelIndex );
+        return m_connection->ReceiveMessage( channelIndex );
+    }
+
+    int BaseClient::ReceiveMessages( int channelIndex, Message ** messages, int maxMessages )
+    {
+        yojimbo_assert( m_connection );
+        if ( !UseMessageQueues() )
+            return m_connection->ReceiveMessages( channelIndex, messages, maxMessages );
+        int numMessages = 0;
+        while ( numMessages < maxMessages )
+        {
+            Message * message = m_messageQueues->ReceiveMessage( channelIndex );
+            if ( !message )
+                break;
+            messages[numMessages++] = message;
+        }
+        return numMessages;
+    }
+
+    void BaseClient::ReleaseMessage( Message * message )
+    {
+        yojimbo_assert( m_connection );
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            m_lock.Lock();
+        m_connection->ReleaseMessage( message );
+        if ( lock )
+            m_lock.Unlock();
+    }
+
+    void BaseClient::GetNetworkInfo( NetworkInfo & info ) const
+    {
+        memset( &info, 0, sizeof( info ) );
+        if ( m_connection )
+        {
+            yojimbo_assert( m_endpoint );
+            const bool lock = UseMessageQueues();
+            if ( lock )
+                m_lock.Lock();
+            const uint64_t * counters = reliable_endpoint_counters( m_endpoint );
+            info.numPacketsSent = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_SENT];
+            info.numPacketsReceived = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_RECEIVED];
+            info.numPacketsAcked = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_ACKED];
+            info.RTT = reliable_endpoint_rtt( m_endpoint );
+            info.packetLoss = reliable_endpoint_packet_loss( m_endpoint );
+            reliable_endpoint_bandwidth( m_endpoint, &info.sentBandwidth, &info.receivedBandwidth, &info.ackedBandwidth );
+            if ( lock )
+                m_lock.Unlock();
+        }
+    }
+
+    // ------------------------------------------------------------------------------------------------------------------
+
+    Client::Client( Allocator & allocator, const Address & address, const ClientServerConfig & config, Adapter & adapter, double time ) 
+        : BaseClient( allocator, config, adapter, time ), m_config( config )
+    {
+        m_allocator = &allocator;
+        m_transport = YOJIMBO_NEW( allocator, NetcodeClientTransport, address, adapter );
+        m_ownsTransport = true;
+        m_transportConnected = false;
+        m_clientId = 0;
+    }
+
+    Client::Client( Allocator & allocator, ClientTransport & transport, const ClientServerConfig & config, Adapter & adapter, double time ) 
+        : BaseClient( allocator, config, adapter, time ), m_config( config )
+    {
+        m_allocator = &allocator;
+        m_transport = &transport;
+        m_ownsTransport = false;
+        m_transportConnected = false;
+        m_clientId = 0;
+    }
+
+    Client::~Client()
+    {
+        // IMPORTANT: Please disconnect the client before destroying it
+        yojimbo_assert( !m_transportConnected );
+        if ( m_ownsTransport )
+        {
+            YOJIMBO_DELETE( *m_allocator, ClientTransport, m_transport );
+        }
+        m_transport = NULL;
+    }
+
+    void Client::InsecureConnect( const uint8_t privateKey[], uint64_t clientId, const Address & address )
+    {
+        InsecureConnect( privateKey, clientId, &address, 1 );
+    }
+
+    void Client::InsecureConnect( const uint8_t privateKey[], uint64_t clientId, const Address serverAddresses[], int numServerAddresses )
+    {
+        yojimbo_assert( serverAddresses );
+        yojimbo_assert( numServerAddresses > 0 );
+        yojimbo_assert( numServerAddresses <= NETCODE_MAX_SERVERS_PER_CONNECT );
+        uint8_t connectToken[NETCODE_CONNECT_TOKEN_BYTES];
+        if ( !GenerateInsecureConnectToken( connectToken, privateKey, clientId, serverAddresses, numServerAddresses ) )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to generate insecure connect token\n" );
+            Disconnect();
+            SetClientState( CLIENT_STATE_ERROR );
+            return;
+        }
+        Connect( clientId, connectToken );
+    }
+
+    bool Client::GenerateInsecureConnectToken( uint8_t * connectToken, 
+                                               const uint8_t privateKey[], 
+                                               uint64_t clientId, 
+                                               const Address serverAddresses[], 
+                                               int numServerAddresses )
+    {
+        char serverAddressStrings[NETCODE_MAX_SERVERS_PER_CONNECT][MaxAddressLength];
+        const char * serverAddressStringPointers[NETCODE_MAX_SERVERS_PER_CONNECT];
+        for ( int i = 0; i < numServerAddresses; ++i ) 
+        {
+            serverAddresses[i].ToString( serverAddressStrings[i], MaxAddressLength );
+            serverAddressStringPointers[i] = serverAddressStrings[i];
+        }
+        return netcode_generate_connect_token( numServerAddresses, 
+                                               serverAddressStringPointers, 
+                                               serverAddressStringPointers, 
+                                               m_config.timeout,
+                                               m_config.timeout, 
+                                               clientId, 
+                                               m_config.protocolId, 
+                                               0, 
+                                               (uint8_t*)privateKey, 
+                                               connectToken ) == NETCODE_OK;
+    }
+
+    void Client::Connect( uint64_t clientId, uint8_t * connectToken )
+    {
+        yojimbo_assert( connectToken );
+        Disconnect();
+        CreateInternal();
+        m_clientId = clientId;
+        m_transportConnected = m_transport->Connect( GetClientAllocator(), clientId, connectToken, GetTime() );
+        if ( m_transportConnected )
+        {
+            SetClientState( CLIENT_STATE_CONNECTING );
+            StartNetworkThread();
+        }
+        else
+        {
+            Disconnect();
+        }
+    }
+
+    void Client::Disconnect()
+    {
+        BaseClient::Disconnect();
+        DisconnectTransport();
+        DestroyInternal();
+        m_clientId = 0;
+    }
+
+    void Client::SendPackets()
+    {
+        if ( !IsConnected() || DeferToNetworkThread() )
+            return;
+        yojimbo_assert( m_transportConnected );
+        uint8_t * packetData = GetPacketBuffer();
+        int packetBytes;
+        uint16_t packetSequence = reliable_endpoint_next_packet_sequence( GetEndpoint() );
+        if ( GetConnection().GeneratePacket( GetContext(), packetSequence, packetData, m_config.maxPacketSize, packetBytes ) )
+        {
+            reliable_endpoint_send_packet( GetEndpoint(), packetData, packetBytes );
+        }
+    }
+
+    void Client::ReceivePackets()
+    {
+        if ( !IsConnected() || DeferToNetworkThread() )
+            return;
+        yojimbo_assert( m_transportConnected );
+        const int MaxPackets = 64;
+        uint8_t * packetData[MaxPackets];
+        int packetBytes[MaxPackets];
+        while ( true )
+        {
+            const int numPackets = m_transport->ReceivePackets( packetData, packetBytes, MaxPackets );
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                reliable_endpoint_receive_packet( GetEndpoint(), packetData[i], packetBytes[i] );
+            }
+            m_transport->FreePackets( packetData, numPackets );
+            if ( numPackets < MaxPackets )
+                break;
+        }
+    }
+
+    void Client::AdvanceTime( double time )
+    {
+        if ( DeferToNetworkThread() )
+        {
+            BaseClient::AdvanceTime( time );
+            return;
+        }
+        BaseClient::AdvanceTime( time );
+        // on the network thread a connection error only flags the disconnect, so don't let the transport overwrite it
+        if ( m_transportConnected && !( IsNetworkThread() && IsDisconnected() ) )
+        {
+            m_transport->Update( time );
+            const ClientState state = m_transport->GetState();
+            if ( state <= CLIENT_STATE_DISCONNECTED )
+            {
+                if ( !IsNetworkThread() )
+                    Disconnect();
+                SetClientState( state );
+                return;
+            }
+            SetClientState( state );
+            NetworkSimulator * networkSimulator = GetNetworkSimulator();
+            if ( networkSimulator && networkSimulator->IsActive() )
+            {
+                uint8_t ** packetData = (uint8_t**) alloca( sizeof( uint8_t*) * m_config.maxSimulatorPackets );
+                int * packetBytes = (int*) alloca( sizeof(int) * m_config.maxSimulatorPackets );
+                int numPackets = networkSimulator->ReceivePackets( m_config.maxSimulatorPackets, packetData, packetBytes, NULL );
+                m_transport->SendPackets( packetData, packetBytes, numPackets );
+                for ( int i = 0; i < numPackets; ++i )
+                {
+                    YOJIMBO_FREE( networkSimulator->GetAllocator(), packetData[i] );
+                }
+            }
+        }
+    }
+
+    int Client::GetClientIndex() const
+    {
+        return m_transportConnected ? m_transport->GetClientIndex() : -1;
+    }
+
+    void Client::ConnectLoopback( int clientIndex, uint64_t clientId, int maxClients )
+    {
+        // loopback packets are exchanged on the game thread, so loopback is not supported with the network thread
+        yojimbo_assert( !m_config.networkThread );
+        Disconnect();
+        CreateInternal();
+        m_clientId = clientId;
+        m_transportConnected = m_transport->ConnectLoopback( GetClientAllocator(), clientIndex, maxClients, GetTime() );
+        if ( !m_transportConnected )
+        {
+            Disconnect();
+            return;
+        }
+        SetClientState( CLIENT_STATE_CONNECTED );
+    }
+
+    void Client::DisconnectLoopback()
+    {
+        if ( m_transportConnected )
+        {
+            m_transport->DisconnectLoopback();
+        }
+        BaseClient::Disconnect();
+        DisconnectTransport();
+        DestroyInternal();
+        m_clientId = 0;
+    }
+
+    bool Client::IsLoopback() const
+    {
+        return m_transportConnected && m_transport->IsLoopback();
+    }
+
+    void Client::ProcessLoopbackPacket( const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
+    {
+        yojimbo_assert( m_transportConnected );
+        m_transport->ProcessLoopbackPacket( packetData, packetBytes, packetSequence );
+    }
+
+    void Client::DisconnectTransport()
+    {
+        if ( m_transportConnected )
+        {
+            m_transport->Disconnect();
+            m_transportConnected = false;
+        }
+    }
+
+    void Client::TransmitPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    {
+        (void) packetSequence;
+        NetworkSimulator * networkSimulator = GetNetworkSimulator();
+        if ( networkSimulator && networkSimulator->IsActive() )
+        {
+            networkSimulator->SendPacket( 0, packetData, packetBytes );
+        }
+        else
+        {
+            m_transport->SendPackets( &packetData, &packetBytes, 1 );
+        }
+    }
+
+    int Client::ProcessPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    {
+        return (int) GetConnection().ProcessPacket( GetContext(), packetSequence, packetData, packetBytes );
+    }
+
+    // -----------------------------------------------------------------------------------------------------
+
+    NetcodeClientTransport::NetcodeClientTransport( const Address & address, Adapter & adapter )
+    {
+        m_adapter = &adapter;
+        m_client = NULL;
+        m_address = address;
+        m_boundAddress = address;
+    }
+
+    NetcodeClientTransport::~NetcodeClientTransport()
+    {
+        // IMPORTANT: Please disconnect the transport before destroying it
+        yojimbo_assert( !m_client );
+    }
+
+    bool NetcodeClientTransport::Connect( Allocator & allocator, uint64_t clientId, uint8_t * connectToken, double time )
+    {
+        (void) clientId;
+        if ( !CreateClient( allocator, time ) )
+            return false;
+        netcode_client_connect( m_client, connectToken );
+        if ( netcode_client_state( m_client ) <= NETCODE_CLIENT_STATE_DISCONNECTED )
+        {
+            DestroyClient();
+            return false;
+        }
+        return true;
+    }
+
+    void NetcodeClientTransport::Disconnect()
+    {
+        DestroyClient();
+    }
+
+    void NetcodeClientTransport::Update( double time )
+    {
+        yojimbo_assert( m_client );
+        netcode_client_update( m_client, time );
+    }
+
+    ClientState NetcodeClientTransport::GetState() const
+    {
+        if ( !m_client )
+            return CLIENT_STATE_DISCONNECTED;
+        const int state = netcode_client_state( m_client );
+        if ( state < NETCODE_CLIENT_STATE_DISCONNECTED )
+            return CLIENT_STATE_ERROR;
+        else if ( state == NETCODE_CLIENT_STATE_DISCONNECTED )
+            return CLIENT_STATE_DISCONNECTED;
+        else if ( state == NETCODE_CLIENT_STATE_SENDING_CONNECTION_REQUEST )
+            return CLIENT_STATE_CONNECTING;
+        else
+            return CLIENT_STATE_CONNECTED;
+    }
+
+    int NetcodeClientTransport::GetClientIndex() const
+    {
+        return m_client ? netcode_client_index( m_client ) : -1;
+    }
+
+    void NetcodeClientTransport::SendPackets( uint8_t * const * packetData, const int * packetBytes, int numPackets )
+    {
+        yojimbo_assert( m_client );
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            netcode_client_send_packet( m_client, packetData[i], packetBytes[i] );
+        }
+    }
+
+    int NetcodeClientTransport::ReceivePackets( uint8_t ** packetData, int * packetBytes, int maxPackets )
+    {
+        yojimbo_assert( m_client );
+        int numPackets = 0;
+        while ( numPackets < maxPackets )
+        {
+            uint64_t packetSequence;
+            packetData[numPackets] = netcode_client_receive_packet( m_client, &packetBytes[numPackets], &packetSequence );
+            if ( !packetData[numPackets] )
+                break;
+            numPackets++;
+        }
+        return numPackets;
+    }
+
+    void NetcodeClientTransport::FreePackets( uint8_t ** packetData, int numPackets )
+    {
+        yojimbo_assert( m_client );
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            netcode_client_free_packet( m_client, packetData[i] );
+        }
+    }
+
+    bool NetcodeClientTransport::ConnectLoopback( Allocator & allocator, int clientIndex, int maxClients, double time )
+    {
+        if ( !CreateClient( allocator, time ) )
+            return false;
+        netcode_client_connect_loopback( m_client, clientIndex, maxClients );
+        return true;
+    }
+
+    bool NetcodeClientTransport::IsLoopback() const
+    {
+        return m_client && netcode_client_loopback( m_client ) != 0;
+    }
+
+    void NetcodeClientTransport::DisconnectLoopback()
+    {
+        yojimbo_assert( m_client );
+        netcode_client_disconnect_loopback( m_client );
+    }
+
+    void NetcodeClientTransport::ProcessLoopbackPacket( const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
+    {
+        yojimbo_assert( m_client );
+        netcode_client_process_loopback_packet( m_client, packetData, packetBytes, packetSequence );
+    }
+
+    bool NetcodeClientTransport::CreateClient( Allocator & allocator, double time )
+    {
+        DestroyClient();
+        char addressString[MaxAddressLength];
+        m_address.ToString( addressString, MaxAddressLength );
+
+        struct netcode_client_config_t netcodeConfig;
+        netcode_default_client_config(&netcodeConfig);
+        netcodeConfig.allocator_context             = &allocator;
+        netcodeConfig.allocate_function             = StaticAllocateFunction;
+        netcodeConfig.free_function                 = StaticFreeFunction;
+        netcodeConfig.callback_context              = this;
+        netcodeConfig.send_loopback_packet_callback = StaticSendLoopbackPacketCallbackFunction;
+        m_client = netcode_client_create(addressString, &netcodeConfig, time);
+        
+        if ( !m_client )
+            return false;
+
+        m_boundAddress.SetPort( netcode_client_get_port( m_client ) );
+
+        return true;
+    }
+
+    void NetcodeClientTransport::DestroyClient()
+    {
+        if ( m_client )
+        {
+            m_boundAddress = m_address;
+            netcode_client_destroy( m_client );
+            m_client = NULL;
+        }
+    }
+
+    void NetcodeClientTransport::StaticSendLoopbackPacketCallbackFunction( void * context, int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
+    {
+        NetcodeClientTransport * transport = (NetcodeClientTransport*) context;
+        transport->m_adapter->ClientSendLoopbackPacket( clientIndex, packetData, packetBytes, packetSequence );
+    }
+
+    void * NetcodeClientTransport::StaticAllocateFunction( void * context, uint64_t bytes )
+    {
+        yojimbo_assert( context );
+        Allocator * allocator = (Allocator*) context;
+        return YOJIMBO_ALLOCATE( *allocator, bytes );
+    }
+    
+    void NetcodeClientTransport::StaticFreeFunction( void * context, void * pointer )
+    {
+        yojimbo_assert( context );
+        yojimbo_assert( pointer );
+        Allocator * allocator = (Allocator*) context;
+        YOJIMBO_FREE( *allocator, pointer );
+    }
+
+    // -----------------------------------------------------------------------------------------------------
+
+    MemoryClientTransport::MemoryClientTransport( MemoryServerTransport & server )
+    {
+        m_server = &server;
+        m_clientIndex = -1;
+        m_sequence = 0;
+    }
+
+    MemoryClientTransport::~MemoryClientTransport()
+    {
+        // IMPORTANT: Please disconnect the transport before destroying it
+        yojimbo_assert( m_clientIndex == -1 );
+    }
+
+    bool MemoryClientTransport::Connect( Allocator & allocator, uint64_t clientId, uint8_t * connectToken, double time )
+    {
+        (void) allocator;
+        (void) connectToken;
+        (void) time;
+        Disconnect();
+        m_clientIndex = m_server->ConnectClient( clientId, m_sequence );
+        return m_clientIndex != -1;
+    }
+
+    void MemoryClientTransport::Disconnect()
+    {
+        if ( m_clientIndex != -1 )
+        {
+            m_server->ClientDisconnected( m_clientIndex, m_sequence );
+            m_clientIndex = -1;
+        }
+    }
+
+    ClientState MemoryClientTransport::GetState() const
+    {
+        if ( m_clientIndex == -1 )
+            return CLIENT_STATE_DISCONNECTED;
+        if ( m_server->IsClientSlot( m_clientIndex, m_sequence, MemoryServerTransport::SLOT_CONNECTING ) )
+            return CLIENT_STATE_CONNECTING;
+        if ( m_server->IsClientSlot( m_clientIndex, m_sequence, MemoryServerTransport::SLOT_CONNECTED ) )
+            return CLIENT_STATE_CONNECTED;
+        return CLIENT_STATE_DISCONNECTED;
+    }
+
+    void MemoryClientTransport::SendPackets( uint8_t * const * packetData, const int * packetBytes, int numPackets )
+    {
+        if ( m_clientIndex == -1 || !m_server->IsClientSlot( m_clientIndex, m_sequence, MemoryServerTransport::SLOT_CONNECTED ) )
+            return;
+        Queue<MemoryServerTransport::Packet> & queue = *m_server->m_slots[m_clientIndex].toServer;
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            m_server->QueuePacket( queue, packetData[i], packetBytes[i] );
+        }
+    }
+
+    int MemoryClientTransport::ReceivePackets( uint8_t ** packetData, int * packetBytes, int maxPackets )
+    {
+        if ( m_clientIndex == -1 || !m_server->IsClientSlot( m_clientIndex, m_sequence, MemoryServerTransport::SLOT_CONNECTED ) )
+            return 0;
+        return m_server->PopPackets( *m_server->m_slots[m_clientIndex].toClient, packetData, packetBytes, maxPackets );
     }
 
-    void UnreliableUnorderedChannel::ProcessAck( uint16_t ack )
+    void MemoryClientTransport::FreePackets( uint8_t ** packetData, int numPackets )
     {
-        (void) ack;
+        m_server->FreePackets( packetData, numPackets );
     }
 }
 
@@ -2561,547 +6111,1161 @@ namespace yojimbo
 
 namespace yojimbo
 {
-    struct ConnectionPacket
+    BaseServer::BaseServer( Allocator & allocator, const ClientServerConfig & config, Adapter & adapter, double time ) : m_config( config )
     {
-        int numChannelEntries;
-        ChannelPacketData * channelEntry;
-        MessageFactory * messageFactory;
+        m_allocator = &allocator;
+        m_adapter = &adapter;
+        m_context = NULL;
+        m_time = time;
+        m_running = false;
+        m_maxClients = 0;
+        m_globalMemory = NULL;
+        m_globalAllocator = NULL;
+        m_blockMemory = NULL;
+        m_blockAllocator = NULL;
+        m_broadcastMemory = NULL;
+        m_broadcastAllocator = NULL;
+        m_broadcastMessageFactory = NULL;
+        m_sharedMessages = NULL;
+        m_clientMemory = NULL;
+        m_clientAllocator = NULL;
+        m_clientMessageFactory = NULL;
+        m_clientConnection = NULL;
+        m_clientEndpoint = NULL;
+        m_activeClients = NULL;
+        m_activeClientIndex = NULL;
+        m_numActiveClients = 0;
+        m_workerPool = NULL;
+        m_lockedBlockAllocator = NULL;
+        m_workerPacketBuffer = NULL;
+        m_clientSendQueue = NULL;
+        m_clientReceiveQueue = NULL;
+        m_queueTransmitPackets = false;
+        m_clientLock = NULL;
+        m_clientMessageQueues = NULL;
+        m_clientThreadState = NULL;
+        m_disconnectAllRequested = 0;
+        m_numConnectedClients = 0;
+        m_networkSimulator = NULL;
+        m_packetBuffer = NULL;
+    }
 
-        ConnectionPacket()
+    BaseServer::~BaseServer()
+    {
+        // IMPORTANT: Please stop the server before destroying it!
+        yojimbo_assert( !IsRunning () );
+        m_allocator = NULL;
+    }
+
+    void BaseServer::SetContext( void * context )
+    {
+        yojimbo_assert( !IsRunning() );
+        m_context = context;
+    }
+
+    void BaseServer::Start( int maxClients )
+    {
+        Stop();
+        yojimbo_assert( maxClients >= 1 );
+        m_running = true;
+        m_maxClients = maxClients;
+        yojimbo_assert( !m_clientMemory );
+        m_clientMemory = (uint8_t**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint8_t* ) * maxClients );
+        m_clientAllocator = (Allocator**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( Allocator* ) * maxClients );
+        m_clientMessageFactory = (MessageFactory**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( MessageFactory* ) * maxClients );
+        m_clientConnection = (Connection**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( Connection* ) * maxClients );
+        m_clientEndpoint = (reliable_endpoint_t**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( reliable_endpoint_t* ) * maxClients );
+        memset( m_clientMemory, 0, sizeof( uint8_t* ) * maxClients );
+        memset( m_clientAllocator, 0, sizeof( Allocator* ) * maxClients );
+        memset( m_clientMessageFactory, 0, sizeof( MessageFactory* ) * maxClients );
+        memset( m_clientConnection, 0, sizeof( Connection* ) * maxClients );
+        memset( m_clientEndpoint, 0, sizeof( reliable_endpoint_t* ) * maxClients );
+        m_activeClients = (int*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( int ) * maxClients );
+        m_activeClientIndex = (int*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( int ) * maxClients );
+        for ( int i = 0; i < maxClients; ++i )
+            m_activeClientIndex[i] = -1;
+        m_numActiveClients = 0;
+        yojimbo_assert( !m_globalMemory );
+        yojimbo_assert( !m_globalAllocator );
+        m_globalMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.serverGlobalMemory );
+        m_globalAllocator = m_adapter->CreateAllocator( *m_allocator, m_globalMemory, m_config.serverGlobalMemory );
+        yojimbo_assert( m_globalAllocator );
+        if ( m_config.networkSimulator )
         {
-            messageFactory = NULL;
-            numChannelEntries = 0;
-            channelEntry = NULL;
+            m_networkSimulator = YOJIMBO_NEW( *m_globalAllocator, NetworkSimulator, *m_globalAllocator, m_config.maxSimulatorPackets, m_time );
         }
-
-        ~ConnectionPacket()
+        if ( m_config.serverBlockMemory > 0 )
         {
-            if ( messageFactory )
+            yojimbo_assert( !m_blockMemory );
+            yojimbo_assert( !m_blockAllocator );
+            m_blockMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.serverBlockMemory );
+            m_blockAllocator = m_adapter->CreateAllocator( *m_allocator, m_blockMemory, m_config.serverBlockMemory );
+            yojimbo_assert( m_blockAllocator );
+            if ( m_config.serverWorkerThreads > 1 || m_config.networkThread )
             {
-                for ( int i = 0; i < numChannelEntries; ++i )
-                {
-                    channelEntry[i].Free( *messageFactory );
-                }
-                YOJIMBO_FREE( messageFactory->GetAllocator(), channelEntry );
-                messageFactory = NULL;
-            }        
+                m_lockedBlockAllocator = YOJIMBO_NEW( *m_globalAllocator, LockedAllocator, *m_blockAllocator );
+            }
+        }
+        if ( m_config.serverBroadcastMemory > 0 )
+        {
+            yojimbo_assert( !m_broadcastMemory );
+            yojimbo_assert( !m_broadcastAllocator );
+            m_broadcastMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.serverBroadcastMemory );
+            m_broadcastAllocator = m_adapter->CreateAllocator( *m_allocator, m_broadcastMemory, m_config.serverBroadcastMemory );
+            yojimbo_assert( m_broadcastAllocator );
+            m_broadcastMessageFactory = m_adapter->CreateMessageFactory( *m_broadcastAllocator );
+            yojimbo_assert( m_broadcastMessageFactory );
         }
+        // a packet goes out as at most maxPacketFragments fragments, and each slot sends one packet per tick
+        m_clientSendQueue = CreateClientPacketQueues( m_config.maxPacketFragments > 1 ? m_config.maxPacketFragments : 1 );
+        if ( m_config.serverWorkerThreads > 1 )
+        {
+            const int numWorkers = m_config.serverWorkerThreads;
+            m_workerPool = YOJIMBO_NEW( *m_globalAllocator, WorkerPool, *m_globalAllocator, numWorkers );
+            m_workerPacketBuffer = (uint8_t**) YOJIMBO_ALLOCATE( *m_globalAllocator, sizeof( uint8_t* ) * numWorkers );
+            for ( int i = 0; i < numWorkers; ++i )
+            {
+                m_workerPacketBuffer[i] = (uint8_t*) YOJIMBO_ALLOCATE( *m_globalAllocator, m_config.maxPacketSize );
+            }
+            m_clientReceiveQueue = CreateClientPacketQueues( MaxQueuedClientPackets );
+        }
+        for ( int i = 0; i < m_maxClients; ++i )
+        {
+            yojimbo_assert( !m_clientMemory[i] );
+            yojimbo_assert( !m_clientAllocator[i] );
+            
+            m_clientMemory[i] = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.serverPerClientMemory );
+            m_clientAllocator[i] = m_adapter->CreateAllocator( *m_allocator, m_clientMemory[i], m_config.serverPerClientMemory );
+            yojimbo_assert( m_clientAllocator[i] );
+            
+            m_clientMessageFactory[i] = m_adapter->CreateMessageFactory( *m_clientAllocator[i] );
+            yojimbo_assert( m_clientMessageFactory[i] );
+            
+            m_clientConnection[i] = YOJIMBO_NEW( *m_clientAllocator[i], Connection, *m_clientAllocator[i], *m_clientMessageFactory[i], m_config, m_time );
+            yojimbo_assert( m_clientConnection[i] );
 
-        bool AllocateChannelData( MessageFactory & _messageFactory, int numEntries )
+            if ( m_lockedBlockAllocator )
+                m_clientConnection[i]->SetBlockAllocator( *m_lockedBlockAllocator );
+            else if ( m_blockAllocator )
+                m_clientConnection[i]->SetBlockAllocator( *m_blockAllocator );
+
+            reliable_config_t reliable_config;
+            reliable_default_config( &reliable_config );
+            strcpy( reliable_config.name, "server endpoint" );
+            reliable_config.context = (void*) this;
+            reliable_config.index = i;
+            reliable_config.max_packet_size = m_config.maxPacketSize;
+            reliable_config.fragment_above = m_config.fragmentPacketsAbove;
+            reliable_config.max_fragments = m_config.maxPacketFragments;
+            reliable_config.fragment_size = m_config.packetFragmentSize; 
+            reliable_config.ack_buffer_size = m_config.ackedPacketsBufferSize;
+            reliable_config.received_packets_buffer_size = m_config.receivedPacketsBufferSize;
+            reliable_config.fragment_reassembly_buffer_size = m_config.packetReassemblyBufferSize;
+            reliable_config.transmit_packet_function = BaseServer::StaticTransmitPacketFunction;
+            reliable_config.process_packet_function = BaseServer::StaticProcessPacketFunction;
+            reliable_config.allocator_context = m_clientAllocator[i];
+            reliable_config.allocate_function = BaseServer::StaticAllocateFunction;
+            reliable_config.free_function = BaseServer::StaticFreeFunction;
+            m_clientEndpoint[i] = reliable_endpoint_create( &reliable_config, m_time );
+            reliable_endpoint_reset( m_clientEndpoint[i] );
+        }
+        if ( m_config.networkThread )
         {
-            yojimbo_assert( numEntries > 0 );
-            yojimbo_assert( numEntries <= MaxChannels );
-            messageFactory = &_messageFactory;
-            Allocator & allocator = messageFactory->GetAllocator();
-            channelEntry = (ChannelPacketData*) YOJIMBO_ALLOCATE( allocator, sizeof( ChannelPacketData ) * numEntries );
-            if ( channelEntry == NULL )
-                return false;
-            for ( int i = 0; i < numEntries; ++i )
+            yojimbo_assert( m_config.networkTickRate > 0 );
+            m_clientLock = (Mutex**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( Mutex* ) * maxClients );
+            m_clientMessageQueues = (MessageQueues**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( MessageQueues* ) * maxClients );
+            m_clientThreadState = (ClientThreadState*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( ClientThreadState ) * maxClients );
+            memset( m_clientThreadState, 0, sizeof( ClientThreadState ) * maxClients );
+            for ( int i = 0; i < m_maxClients; ++i )
             {
-                channelEntry[i].Initialize();
+                m_clientLock[i] = YOJIMBO_NEW( *m_allocator, Mutex );
+                m_clientMessageQueues[i] = YOJIMBO_NEW( *m_clientAllocator[i], MessageQueues, *m_clientAllocator[i], m_config );
             }
-            numChannelEntries = numEntries;
-            return true;
+            m_disconnectAllRequested = 0;
+            m_numConnectedClients = 0;
         }
+        m_packetBuffer = (uint8_t*) YOJIMBO_ALLOCATE( *m_globalAllocator, m_config.maxPacketSize );
+    }
 
-        template <typename Stream> bool Serialize( Stream & stream, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig )
+    void BaseServer::Stop()
+    {
+        StopNetworkThread();
+        if ( IsRunning() )
         {
-            const int numChannels = connectionConfig.numChannels;
-            serialize_int( stream, numChannelEntries, 0, connectionConfig.numChannels );
-#if YOJIMBO_DEBUG_MESSAGE_BUDGET
-            yojimbo_assert( stream.GetBitsProcessed() <= ConservativePacketHeaderBits );
-#endif // #if YOJIMBO_DEBUG_MESSAGE_BUDGET
-            if ( numChannelEntries > 0 )
+            if ( m_clientMessageQueues )
             {
-                if ( Stream::IsReading )
+                for ( int i = 0; i < m_maxClients; ++i )
                 {
-                    if ( !AllocateChannelData( messageFactory, numChannelEntries ) )
-                    {
-                        yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate channel data (ConnectionPacket)\n" );
-                        return false;
-                    }
-                    for ( int i = 0; i < numChannelEntries; ++i )
-                    {
-                        yojimbo_assert( channelEntry[i].messageFailedToSerialize == 0 );
-                    }
+                    m_clientMessageQueues[i]->ReleaseSendQueue( *m_clientMessageFactory[i] );
+                    m_clientMessageQueues[i]->ReleaseReceiveQueue( *m_clientMessageFactory[i] );
+                    YOJIMBO_DELETE( *m_clientAllocator[i], MessageQueues, m_clientMessageQueues[i] );
+                    YOJIMBO_DELETE( *m_allocator, Mutex, m_clientLock[i] );
                 }
-                for ( int i = 0; i < numChannelEntries; ++i )
+                YOJIMBO_FREE( *m_allocator, m_clientMessageQueues );
+                YOJIMBO_FREE( *m_allocator, m_clientLock );
+                YOJIMBO_FREE( *m_allocator, m_clientThreadState );
+            }
+            YOJIMBO_FREE( *m_globalAllocator, m_packetBuffer );
+            yojimbo_assert( m_globalMemory );
+            yojimbo_assert( m_globalAllocator );
+            YOJIMBO_DELETE( *m_globalAllocator, NetworkSimulator, m_networkSimulator );
+            if ( m_workerPool )
+            {
+                for ( int i = 0; i < m_maxClients; ++i )
                 {
-                    yojimbo_assert( channelEntry[i].messageFailedToSerialize == 0 );
-                    if ( !channelEntry[i].SerializeInternal( stream, messageFactory, connectionConfig.channel, numChannels ) )
+                    for ( int j = 0; j < m_clientReceiveQueue[i].numPackets; ++j )
                     {
-                        yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to serialize channel %d\n", i );
-                        return false;
+                        YOJIMBO_FREE( *m_clientAllocator[i], m_clientReceiveQueue[i].packetData[j] );
                     }
                 }
+                YOJIMBO_FREE( *m_allocator, m_clientReceiveQueue );
+                for ( int i = 0; i < m_workerPool->GetNumWorkers(); ++i )
+                {
+                    YOJIMBO_FREE( *m_globalAllocator, m_workerPacketBuffer[i] );
+                }
+                YOJIMBO_FREE( *m_globalAllocator, m_workerPacketBuffer );
+                YOJIMBO_DELETE( *m_globalAllocator, WorkerPool, m_workerPool );
             }
-            return true;
+            YOJIMBO_FREE( *m_allocator, m_clientSendQueue );
+            YOJIMBO_DELETE( *m_globalAllocator, LockedAllocator, m_lockedBlockAllocator );
+            for ( int i = 0; i < m_maxClients; ++i )
+            {
+                yojimbo_assert( m_clientMemory[i] );
+                yojimbo_assert( m_clientAllocator[i] );
+                yojimbo_assert( m_clientMessageFactory[i] );
+                yojimbo_assert( m_clientEndpoint[i] );
+                reliable_endpoint_destroy( m_clientEndpoint[i] ); m_clientEndpoint[i] = NULL;
+                YOJIMBO_DELETE( *m_clientAllocator[i], Connection, m_clientConnection[i] );
+                YOJIMBO_DELETE( *m_clientAllocator[i], MessageFactory, m_clientMessageFactory[i] );
+                YOJIMBO_DELETE( *m_allocator, Allocator, m_clientAllocator[i] );
+                YOJIMBO_FREE( *m_allocator, m_clientMemory[i] );
+            }
+            if ( m_broadcastMessageFactory )
+            {
+                // every client connection is gone, so nothing refers to broadcast messages anymore
+                FreeSharedMessages();
+                yojimbo_assert( !m_sharedMessages );
+                YOJIMBO_DELETE( *m_broadcastAllocator, MessageFactory, m_broadcastMessageFactory );
+                YOJIMBO_DELETE( *m_allocator, Allocator, m_broadcastAllocator );
+                YOJIMBO_FREE( *m_allocator, m_broadcastMemory );
+            }
+            YOJIMBO_FREE( *m_allocator, m_clientMemory );
+            YOJIMBO_FREE( *m_allocator, m_clientAllocator );
+            YOJIMBO_FREE( *m_allocator, m_clientMessageFactory );
+            YOJIMBO_FREE( *m_allocator, m_clientConnection );
+            YOJIMBO_FREE( *m_allocator, m_clientEndpoint );
+            YOJIMBO_FREE( *m_allocator, m_activeClients );
+            YOJIMBO_FREE( *m_allocator, m_activeClientIndex );
+            YOJIMBO_DELETE( *m_allocator, Allocator, m_blockAllocator );
+            YOJIMBO_FREE( *m_allocator, m_blockMemory );
+            YOJIMBO_DELETE( *m_allocator, Allocator, m_globalAllocator );
+            YOJIMBO_FREE( *m_allocator, m_globalMemory );
         }
+        m_running = false;
+        m_maxClients = 0;
+        m_numActiveClients = 0;
+        m_packetBuffer = NULL;
+    }
 
-        bool SerializeInternal( ReadStream & stream, MessageFactory & _messageFactory, const ConnectionConfig & connectionConfig )
+    void BaseServer::AdvanceTime( double time )
+    {
+        if ( m_clientThreadState && !m_networkThread.IsCurrentThread() )
         {
-            return Serialize( stream, _messageFactory, connectionConfig );
+            SyncNetworkThread();
         }
-
-        bool SerializeInternal( WriteStream & stream, MessageFactory & _messageFactory, const ConnectionConfig & connectionConfig )
+        if ( !m_networkThread.IsCurrentThread() && m_sharedMessages )
         {
-            return Serialize( stream, _messageFactory, connectionConfig );            
+            FreeSharedMessages();
+        }
+        if ( DeferToNetworkThread() )
+            return;
+        m_time = time;
+        if ( IsRunning() )
+        {
+            if ( m_workerPool )
+            {
+                m_workerPool->Run( StaticAdvanceClientsWork, this );
+            }
+            // iterate backwards: disconnecting a client removes it from the active list by moving the last
+            // entry into its place, and that entry has already been updated this tick.
+            for ( int j = m_numActiveClients - 1; j >= 0; --j )
+            {
+                const int i = m_activeClients[j];
+                if ( m_workerPool ? m_clientConnection[i]->GetErrorLevel() != CONNECTION_ERROR_NONE : !AdvanceClient( i ) )
+                {
+                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "client %d connection is in error state. disconnecting client\n", m_clientConnection[i]->GetErrorLevel() );
+                    DisconnectClient( i );
+                }
+            }
+            NetworkSimulator * networkSimulator = GetNetworkSimulator();
+            if ( networkSimulator )
+            {
+                networkSimulator->AdvanceTime( time );
+            }        
         }
+    }
 
-        bool SerializeInternal( MeasureStream & stream, MessageFactory & _messageFactory, const ConnectionConfig & connectionConfig )
+    bool BaseServer::AdvanceClient( int clientIndex )
+    {
+        LockClient( clientIndex );
+        m_clientConnection[clientIndex]->AdvanceTime( m_time );
+        const bool ok = m_clientConnection[clientIndex]->GetErrorLevel() == CONNECTION_ERROR_NONE;
+        if ( ok )
         {
-            return Serialize( stream, _messageFactory, connectionConfig );            
+            reliable_endpoint_update( m_clientEndpoint[clientIndex], m_time );
+            int numAcks;
+            const uint16_t * acks = reliable_endpoint_get_acks( m_clientEndpoint[clientIndex], &numAcks );
+            m_clientConnection[clientIndex]->ProcessAcks( acks, numAcks );
+            reliable_endpoint_clear_acks( m_clientEndpoint[clientIndex] );
         }
+        UnlockClient( clientIndex );
+        return ok;
+    }
 
-    private:
+    void BaseServer::SendClientPackets()
+    {
+        m_queueTransmitPackets = true;
+        if ( m_workerPool )
+        {
+            m_workerPool->Run( StaticSendClientPacketsWork, this );
+        }
+        else
+        {
+            for ( int j = 0; j < m_numActiveClients; ++j )
+            {
+                SendClientPacket( m_activeClients[j], m_packetBuffer );
+            }
+        }
+        m_queueTransmitPackets = false;
+        FlushTransmitPackets();
+    }
 
-        ConnectionPacket( const ConnectionPacket & other );
+    void BaseServer::FlushTransmitPackets()
+    {
+        int clientIndex[MaxTransmitPackets];
+        uint16_t packetSequence[MaxTransmitPackets];
+        uint8_t * packetData[MaxTransmitPackets];
+        int packetBytes[MaxTransmitPackets];
+        int numPackets = 0;
 
-        const ConnectionPacket & operator = ( const ConnectionPacket & other );
-    };
+        int maxQueuedPackets = 0;
+        for ( int j = 0; j < m_numActiveClients; ++j )
+        {
+            const int queuedPackets = m_clientSendQueue[m_activeClients[j]].numPackets;
+            if ( queuedPackets > maxQueuedPackets )
+                maxQueuedPackets = queuedPackets;
+        }
 
-    // ------------------------------------------------------------------------------
+        // interleave clients so one client's fragments don't all go out ahead of everybody else's packets
 
-    Connection::Connection( Allocator & allocator, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig, double time ) 
-        : m_connectionConfig( connectionConfig )
-    {
-        m_allocator = &allocator;
-        m_messageFactory = &messageFactory;
-        m_errorLevel = CONNECTION_ERROR_NONE;
-        memset( m_channel, 0, sizeof( m_channel ) );
-        yojimbo_assert( m_connectionConfig.numChannels >= 1 );
-        yojimbo_assert( m_connectionConfig.numChannels <= MaxChannels );
-        for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+        for ( int k = 0; k < maxQueuedPackets; ++k )
         {
-            switch ( m_connectionConfig.channel[channelIndex].type )
+            for ( int j = 0; j < m_numActiveClients; ++j )
             {
-                case CHANNEL_TYPE_RELIABLE_ORDERED: 
+                const int i = m_activeClients[j];
+                const ClientPacketQueue & queue = m_clientSendQueue[i];
+                if ( k >= queue.numPackets )
+                    continue;
+                clientIndex[numPackets] = i;
+                packetSequence[numPackets] = queue.packetSequence[k];
+                packetData[numPackets] = queue.packetData[k];
+                packetBytes[numPackets] = queue.packetBytes[k];
+                numPackets++;
+                if ( numPackets == MaxTransmitPackets )
                 {
-                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, 
-                                                           ReliableOrderedChannel, 
-                                                           *m_allocator, 
-                                                           messageFactory, 
-                                                           m_connectionConfig.channel[channelIndex],
-                                                           channelIndex, 
-                                                           time ); 
+                    TransmitPackets( clientIndex, packetSequence, packetData, packetBytes, numPackets );
+                    numPackets = 0;
                 }
-                break;
+            }
+        }
 
-                case CHANNEL_TYPE_UNRELIABLE_UNORDERED: 
-                {
-                    m_channel[channelIndex] = YOJIMBO_NEW( *m_allocator, 
-                                                           UnreliableUnorderedChannel, 
-                                                           *m_allocator, 
-                                                           messageFactory, 
-                                                           m_connectionConfig.channel[channelIndex], 
-                                                           channelIndex, 
-                                                           time ); 
-                }
-                break;
+        if ( numPackets > 0 )
+        {
+            TransmitPackets( clientIndex, packetSequence, packetData, packetBytes, numPackets );
+        }
 
-                default: 
-                    yojimbo_assert( !"unknown channel type" );
+        for ( int j = 0; j < m_numActiveClients; ++j )
+        {
+            const int i = m_activeClients[j];
+            ClientPacketQueue & queue = m_clientSendQueue[i];
+            if ( queue.numPackets == 0 )
+                continue;
+            LockClient( i );
+            for ( int k = 0; k < queue.numPackets; ++k )
+            {
+                YOJIMBO_FREE( *m_clientAllocator[i], queue.packetData[k] );
             }
+            UnlockClient( i );
+            queue.numPackets = 0;
         }
     }
 
-    Connection::~Connection()
+    void BaseServer::TransmitPackets( const int * clientIndex, const uint16_t * packetSequence, uint8_t * const * packetData, const int * packetBytes, int numPackets )
     {
-        yojimbo_assert( m_allocator );
-        Reset();
-        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        for ( int i = 0; i < numPackets; ++i )
         {
-            YOJIMBO_DELETE( *m_allocator, Channel, m_channel[i] );
+            TransmitPacketFunction( clientIndex[i], packetSequence[i], packetData[i], packetBytes[i] );
         }
-        m_allocator = NULL;
     }
 
-    void Connection::Reset()
+    void BaseServer::SendClientPacket( int clientIndex, uint8_t * packetBuffer )
     {
-        m_errorLevel = CONNECTION_ERROR_NONE;
-        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        int packetBytes;
+        LockClient( clientIndex );
+        uint16_t packetSequence = reliable_endpoint_next_packet_sequence( m_clientEndpoint[clientIndex] );
+        if ( m_clientConnection[clientIndex]->GeneratePacket( m_context, packetSequence, packetBuffer, m_config.maxPacketSize, packetBytes ) )
         {
-            m_channel[i]->Reset();
+            reliable_endpoint_send_packet( m_clientEndpoint[clientIndex], packetBuffer, packetBytes );
         }
+        UnlockClient( clientIndex );
     }
 
-    bool Connection::CanSendMessage( int channelIndex ) const
+    BaseServer::ClientPacketQueue * BaseServer::CreateClientPacketQueues( int maxPackets )
     {
-        yojimbo_assert( channelIndex >= 0 );
-        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
-        return m_channel[channelIndex]->CanSendMessage();
+        yojimbo_assert( m_maxClients > 0 );
+        yojimbo_assert( maxPackets > 0 );
+        const int numPackets = m_maxClients * maxPackets;
+        uint8_t * memory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, ( sizeof( ClientPacketQueue ) + maxPackets * ( sizeof( uint8_t* ) + sizeof( int ) + sizeof( uint16_t ) ) ) * m_maxClients );
+        ClientPacketQueue * queues = (ClientPacketQueue*) memory;
+        uint8_t ** packetData = (uint8_t**) ( memory + sizeof( ClientPacketQueue ) * m_maxClients );
+        int * packetBytes = (int*) ( packetData + numPackets );
+        uint16_t * packetSequence = (uint16_t*) ( packetBytes + numPackets );
+        for ( int i = 0; i < m_maxClients; ++i )
+        {
+            queues[i].numPackets = 0;
+            queues[i].maxPackets = maxPackets;
+            queues[i].packetData = packetData + i * maxPackets;
+            queues[i].packetBytes = packetBytes + i * maxPackets;
+            queues[i].packetSequence = packetSequence + i * maxPackets;
+        }
+        return queues;
     }
 
-    void Connection::SendMessage( int channelIndex, Message * message, void *context)
+    void BaseServer::QueueTransmitPacket( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
     {
-        yojimbo_assert( channelIndex >= 0 );
-        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
-        return m_channel[channelIndex]->SendMessage( message, context );
+        ClientPacketQueue & queue = m_clientSendQueue[clientIndex];
+        yojimbo_assert( queue.numPackets < queue.maxPackets );
+        if ( queue.numPackets == queue.maxPackets )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: client %d send queue is full. dropping packet\n", clientIndex );
+            return;
+        }
+        uint8_t * packetCopy = (uint8_t*) YOJIMBO_ALLOCATE( *m_clientAllocator[clientIndex], packetBytes );
+        if ( !packetCopy )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate copy of %d byte packet for client %d. dropping packet\n", packetBytes, clientIndex );
+            return;
+        }
+        memcpy( packetCopy, packetData, packetBytes );
+        queue.packetSequence[queue.numPackets] = packetSequence;
+        queue.packetBytes[queue.numPackets] = packetBytes;
+        queue.packetData[queue.numPackets] = packetCopy;
+        queue.numPackets++;
     }
 
-    Message * Connection::ReceiveMessage( int channelIndex )
+    bool BaseServer::CanReceiveClientPacket( int clientIndex ) const
     {
-        yojimbo_assert( channelIndex >= 0 );
-        yojimbo_assert( channelIndex < m_connectionConfig.numChannels );
-        return m_channel[channelIndex]->ReceiveMessage();
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        return !m_workerPool || m_clientReceiveQueue[clientIndex].numPackets < m_clientReceiveQueue[clientIndex].maxPackets;
     }
 
-    void Connection::ReleaseMessage( Message * message )
+    int BaseServer::GetClientReceiveCapacity( int clientIndex ) const
     {
-        yojimbo_assert( message );
-        m_messageFactory->ReleaseMessage( message );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        if ( !m_workerPool )
+            return MaxQueuedClientPackets;
+        return m_clientReceiveQueue[clientIndex].maxPackets - m_clientReceiveQueue[clientIndex].numPackets;
     }
 
-    static int WritePacket( void * context, 
-                            MessageFactory & messageFactory, 
-                            const ConnectionConfig & connectionConfig, 
-                            ConnectionPacket & packet, 
-                            uint8_t * buffer, 
-                            int bufferSize )
+    void BaseServer::ReceiveClientPacket( int clientIndex, uint8_t * packetData, int packetBytes )
     {
-        WriteStream stream( messageFactory.GetAllocator(), buffer, bufferSize );
-        
-        stream.SetContext( context );
-        
-        if ( !packet.SerializeInternal( stream, messageFactory, connectionConfig ) )
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        LockClient( clientIndex );
+        if ( !m_workerPool )
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (write packet)\n" );
-            return 0;
+            reliable_endpoint_receive_packet( m_clientEndpoint[clientIndex], packetData, packetBytes );
+            UnlockClient( clientIndex );
+            return;
         }
+        ClientPacketQueue & queue = m_clientReceiveQueue[clientIndex];
+        yojimbo_assert( queue.numPackets < queue.maxPackets );
+        uint8_t * packetCopy = (uint8_t*) YOJIMBO_ALLOCATE( *m_clientAllocator[clientIndex], packetBytes );
+        UnlockClient( clientIndex );
+        if ( !packetCopy )
+            return;
+        memcpy( packetCopy, packetData, packetBytes );
+        queue.packetBytes[queue.numPackets] = packetBytes;
+        queue.packetData[queue.numPackets] = packetCopy;
+        queue.numPackets++;
+    }
 
-#if YOJIMBO_SERIALIZE_CHECKS
-        if ( !stream.SerializeCheck() )
+    void BaseServer::ProcessReceivedClientPackets()
+    {
+        if ( m_workerPool )
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize check at end of connection packed failed (write packet)\n" );
-            return 0;
+            m_workerPool->Run( StaticProcessReceivedPacketsWork, this );
         }
-#endif // #if YOJIMBO_SERIALIZE_CHECKS
-
-        stream.Flush();
+    }
 
-        return stream.GetBytesProcessed();
+    void BaseServer::GetWorkerClients( int workerIndex, int numWorkers, int & begin, int & end ) const
+    {
+        // contiguous runs of the active client list, so each client is always handled by exactly one worker
+        begin = int( int64_t( m_numActiveClients ) * workerIndex / numWorkers );
+        end = int( int64_t( m_numActiveClients ) * ( workerIndex + 1 ) / numWorkers );
     }
 
-    bool Connection::GeneratePacket( void * context, uint16_t packetSequence, uint8_t * packetData, int maxPacketBytes, int & packetBytes )
+    void BaseServer::StaticAdvanceClientsWork( void * context, int workerIndex, int numWorkers )
     {
-        ConnectionPacket packet;
+        BaseServer * server = (BaseServer*) context;
+        int begin, end;
+        server->GetWorkerClients( workerIndex, numWorkers, begin, end );
+        for ( int j = begin; j < end; ++j )
+        {
+            server->AdvanceClient( server->m_activeClients[j] );
+        }
+    }
 
-        if ( m_connectionConfig.numChannels > 0 )
+    void BaseServer::StaticSendClientPacketsWork( void * context, int workerIndex, int numWorkers )
+    {
+        BaseServer * server = (BaseServer*) context;
+        int begin, end;
+        server->GetWorkerClients( workerIndex, numWorkers, begin, end );
+        for ( int j = begin; j < end; ++j )
         {
-            int numChannelsWithData = 0;
-            bool channelHasData[MaxChannels];
-            memset( channelHasData, 0, sizeof( channelHasData ) );
-            ChannelPacketData channelData[MaxChannels];
-            
-            int availableBits = maxPacketBytes * 8 - ConservativePacketHeaderBits;
-            
-            for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
+            server->SendClientPacket( server->m_activeClients[j], server->m_workerPacketBuffer[workerIndex] );
+        }
+    }
+
+    void BaseServer::StaticProcessReceivedPacketsWork( void * context, int workerIndex, int numWorkers )
+    {
+        BaseServer * server = (BaseServer*) context;
+        int begin, end;
+        server->GetWorkerClients( workerIndex, numWorkers, begin, end );
+        for ( int j = begin; j < end; ++j )
+        {
+            const int i = server->m_activeClients[j];
+            ClientPacketQueue & queue = server->m_clientReceiveQueue[i];
+            server->LockClient( i );
+            for ( int k = 0; k < queue.numPackets; ++k )
             {
-                int packetDataBits = m_channel[channelIndex]->GetPacketData( context, channelData[channelIndex], packetSequence, availableBits );
-                if ( packetDataBits > 0 )
-                {
-                    availableBits -= ConservativeChannelHeaderBits;
-                    availableBits -= packetDataBits;
-                    channelHasData[channelIndex] = true;
-                    numChannelsWithData++;
-                }
+                reliable_endpoint_receive_packet( server->m_clientEndpoint[i], queue.packetData[k], queue.packetBytes[k] );
+                YOJIMBO_FREE( *server->m_clientAllocator[i], queue.packetData[k] );
             }
+            server->UnlockClient( i );
+            queue.numPackets = 0;
+        }
+    }
 
-            if ( numChannelsWithData > 0 )
-            {
-                if ( !packet.AllocateChannelData( *m_messageFactory, numChannelsWithData ) )
-                {
-                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate channel data\n" );
-                    return false;
-                }
+    void BaseServer::SetLatency( float milliseconds )
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetLatency( milliseconds );
+        }
+    }
 
-                int index = 0;
+    void BaseServer::SetJitter( float milliseconds )
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetJitter( milliseconds );
+        }
+    }
 
-                for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
-                {
-                    if ( channelHasData[channelIndex] )
-                    {
-                        memcpy( &packet.channelEntry[index], &channelData[channelIndex], sizeof( ChannelPacketData ) );
-                        index++;
-                    }
-                }
-            }
+    void BaseServer::SetPacketLoss( float percent )
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetPacketLoss( percent );
         }
+    }
 
-        packetBytes = WritePacket( context, *m_messageFactory, m_connectionConfig, packet, packetData, maxPacketBytes );
+    void BaseServer::SetDuplicates( float percent )
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetDuplicates( percent );
+        }
+    }
 
-        return true;
+    Message * BaseServer::CreateMessage( int clientIndex, int type )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientMessageFactory[clientIndex] );
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            LockClient( clientIndex );
+        Message * message = m_clientMessageFactory[clientIndex]->CreateMessage( type );
+        if ( lock )
+            UnlockClient( clientIndex );
+        return message;
     }
 
-    static bool ReadPacket( void * context, 
-                            MessageFactory & messageFactory, 
-                            const ConnectionConfig & connectionConfig, 
-                            ConnectionPacket & packet, 
-                            const uint8_t * buffer, 
-                            int bufferSize )
+    uint8_t * BaseServer::AllocateBlock( int clientIndex, int bytes )
     {
-        yojimbo_assert( buffer );
-        yojimbo_assert( bufferSize > 0 );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientAllocator[clientIndex] );
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            LockClient( clientIndex );
+        uint8_t * block = (uint8_t*) YOJIMBO_ALLOCATE( *m_clientAllocator[clientIndex], bytes );
+        if ( lock )
+            UnlockClient( clientIndex );
+        return block;
+    }
 
-        ReadStream stream( messageFactory.GetAllocator(), buffer, bufferSize );
-        
-        stream.SetContext( context );
-        
-        if ( !packet.SerializeInternal( stream, messageFactory, connectionConfig ) )
+    void BaseServer::AttachBlockToMessage( int clientIndex, Message * message, uint8_t * block, int bytes )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( message );
+        yojimbo_assert( block );
+        yojimbo_assert( bytes > 0 );
+        yojimbo_assert( message->IsBlockMessage() );
+        BlockMessage * blockMessage = (BlockMessage*) message;
+        blockMessage->AttachBlock( *m_clientAllocator[clientIndex], block, bytes );
+    }
+
+    void BaseServer::FreeBlock( int clientIndex, uint8_t * block )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            LockClient( clientIndex );
+        YOJIMBO_FREE( *m_clientAllocator[clientIndex], block );
+        if ( lock )
+            UnlockClient( clientIndex );
+    }
+
+    bool BaseServer::CanSendMessage( int clientIndex, int channelIndex ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        if ( UseMessageQueues() )
+            return m_clientMessageQueues[clientIndex]->CanSendMessages( channelIndex, 1 );
+        return m_clientConnection[clientIndex]->CanSendMessage( channelIndex );
+    }
+
+    void BaseServer::SendMessage( int clientIndex, int channelIndex, Message * message )
+    {
+        SendMessage( clientIndex, channelIndex, message, 0.0, 0 );
+    }
+
+    void BaseServer::SendMessage( int clientIndex, int channelIndex, Message * message, double timeToLive, int priority )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        if ( !UseMessageQueues() )
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize connection packet failed (read packet)\n" );
-            return false;
+            m_clientConnection[clientIndex]->SendMessage( channelIndex, message, timeToLive, priority, GetContext() );
+            return;
+        }
+        if ( yojimbo_atomic_load( &m_clientThreadState[clientIndex].resetState ) != CLIENT_RESET_NONE )
+        {
+            // the client has disconnected. drop the message
+            ReleaseMessage( clientIndex, message );
+            return;
         }
+        if ( !m_clientMessageQueues[clientIndex]->SendMessage( channelIndex, message, timeToLive, priority ) )
+        {
+            // same as a full channel send queue: drop the message and disconnect the client
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "client %d send queue is full on channel %d. disconnecting client\n", clientIndex, channelIndex );
+            ReleaseMessage( clientIndex, message );
+            RequestDisconnectClient( clientIndex );
+        }
+    }
 
-#if YOJIMBO_SERIALIZE_CHECKS
-        if ( !stream.SerializeCheck() )
+    bool BaseServer::CanSendMessages( int clientIndex, int channelIndex, int numMessages ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        if ( UseMessageQueues() )
+            return m_clientMessageQueues[clientIndex]->CanSendMessages( channelIndex, numMessages );
+        return m_clientConnection[clientIndex]->CanSendMessages( channelIndex, numMessages );
+    }
+
+    void BaseServer::GetChannelStatus( int clientIndex, int channelIndex, ChannelStatus & status ) const
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            LockClient( clientIndex );
+        m_clientConnection[clientIndex]->GetChannelStatus( channelIndex, status );
+        if ( lock )
+            UnlockClient( clientIndex );
+    }
+
+    void BaseServer::SetBlockSink( int clientIndex, int channelIndex, BlockSink * blockSink )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            LockClient( clientIndex );
+        m_clientConnection[clientIndex]->SetBlockSink( channelIndex, blockSink );
+        if ( lock )
+            UnlockClient( clientIndex );
+    }
+
+    void BaseServer::SendMessages( int clientIndex, int channelIndex, Message ** messages, int numMessages )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        if ( !UseMessageQueues() )
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: serialize check failed at end of connection packet (read packet)\n" );
-            return false;
+            m_clientConnection[clientIndex]->SendMessages( channelIndex, messages, numMessages, GetContext() );
+            return;
         }
-#endif // #if YOJIMBO_SERIALIZE_CHECKS
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            SendMessage( clientIndex, channelIndex, messages[i], 0.0, 0 );
+        }
+    }
 
-        return true;
+    Message * BaseServer::CreateBroadcastMessage( int type )
+    {
+        yojimbo_assert( IsRunning() );
+        if ( !m_broadcastMessageFactory )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: can't create broadcast message. set serverBroadcastMemory to enable broadcasts\n" );
+            return NULL;
+        }
+        return m_broadcastMessageFactory->CreateMessage( type );
     }
 
-    bool Connection::ProcessPacket( void * context, uint16_t packetSequence, const uint8_t * packetData, int packetBytes )
-    {
-        if ( m_errorLevel != CONNECTION_ERROR_NONE )
+    void BaseServer::BroadcastMessage( int channelIndex, Message * message, const uint64_t * clientMask )
+    {
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( message );
+        yojimbo_assert( !message->IsBlockMessage() );
+
+        // without a broadcast pool CreateBroadcastMessage returns NULL, so there is no message here that we own to release
+
+        if ( !m_broadcastMessageFactory )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: can't broadcast message. set serverBroadcastMemory to enable broadcasts\n" );
+            return;
+        }
+
+        SharedMessage * sharedMessage = (SharedMessage*) YOJIMBO_ALLOCATE( *m_broadcastAllocator, sizeof( SharedMessage ) );
+        if ( !sharedMessage )
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "failed to read packet because connection is in error state\n" );
-            return false;
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to allocate broadcast message. increase serverBroadcastMemory\n" );
+            m_broadcastMessageFactory->ReleaseMessage( message );
+            return;
         }
 
-        ConnectionPacket packet;
+        MeasureStream measureStream( *m_broadcastAllocator );
+        measureStream.SetContext( GetContext() );
+        message->SerializeInternal( measureStream );
 
-        if ( !ReadPacket( context, *m_messageFactory, m_connectionConfig, packet, packetData, packetBytes ) )
+        // only this thread frees shared messages, so it doesn't matter if a client drops its reference before the others have one
+
+        sharedMessage->message = message;
+        sharedMessage->measuredBits = measureStream.GetBitsProcessed();
+        sharedMessage->numReferences = 0;
+        sharedMessage->next = m_sharedMessages;
+        m_sharedMessages = sharedMessage;
+
+        const bool useMessageQueues = UseMessageQueues();
+        const int numClients = useMessageQueues ? m_maxClients : m_numActiveClients;
+
+        for ( int j = 0; j < numClients; ++j )
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to read packet\n" );
-            m_errorLevel = CONNECTION_ERROR_READ_PACKET_FAILED;
-            return false;            
+            const int clientIndex = useMessageQueues ? j : m_activeClients[j];
+
+            if ( clientMask && !( clientMask[clientIndex/64] & ( uint64_t(1) << ( clientIndex % 64 ) ) ) )
+                continue;
+
+            if ( useMessageQueues && !IsClientConnectedOutsideNetworkThread( clientIndex ) )
+                continue;
+
+            if ( useMessageQueues )
+                LockClient( clientIndex );
+            Message * reference = m_clientMessageFactory[clientIndex]->CreateSharedMessageReference( *sharedMessage );
+            if ( useMessageQueues )
+                UnlockClient( clientIndex );
+
+            // if the reference can't be allocated the message factory error disconnects the client
+
+            if ( reference )
+                SendMessage( clientIndex, channelIndex, reference, 0.0, 0 );
         }
+    }
 
-        for ( int i = 0; i < packet.numChannelEntries; ++i )
+    void BaseServer::FreeSharedMessages()
+    {
+        SharedMessage ** previous = &m_sharedMessages;
+        while ( *previous )
         {
-            const int channelIndex = packet.channelEntry[i].channelIndex;
-            yojimbo_assert( channelIndex >= 0 );
-            yojimbo_assert( channelIndex <= m_connectionConfig.numChannels );
-            m_channel[channelIndex]->ProcessPacketData( packet.channelEntry[i], packetSequence );
-            if ( m_channel[channelIndex]->GetErrorLevel() != CHANNEL_ERROR_NONE )
+            SharedMessage * sharedMessage = *previous;
+            if ( yojimbo_atomic_load( &sharedMessage->numReferences ) != 0 )
             {
-                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "failed to read packet because channel %d is in error state\n", channelIndex );
-                return false;
+                previous = &sharedMessage->next;
+                continue;
             }
+            *previous = sharedMessage->next;
+            m_broadcastMessageFactory->ReleaseMessage( sharedMessage->message );
+            YOJIMBO_FREE( *m_broadcastAllocator, sharedMessage );
         }
+    }
 
-        return true;
+    Message * BaseServer::ReceiveMessage( int clientIndex, int channelIndex )
+    {
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        if ( !UseMessageQueues() )
+            return m_clientConnection[clientIndex]->ReceiveMessage( channelIndex );
+        // messages left over from a disconnected client are released by AdvanceTime, never handed out
+        if ( yojimbo_atomic_load( &m_clientThreadState[clientIndex].resetState ) != CLIENT_RESET_NONE )
+            return NULL;
+        return m_clientMessageQueues[clientIndex]->ReceiveMessage( channelIndex );
     }
 
-    void Connection::ProcessAcks( const uint16_t * acks, int numAcks )
+    int BaseServer::ReceiveMessages( int clientIndex, int channelIndex, Message ** messages, int maxMessages )
     {
-        for ( int i = 0; i < numAcks; ++i )
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        if ( !UseMessageQueues() )
+            return m_clientConnection[clientIndex]->ReceiveMessages( channelIndex, messages, maxMessages );
+        int numMessages = 0;
+        while ( numMessages < maxMessages )
         {
-            for ( int channelIndex = 0; channelIndex < m_connectionConfig.numChannels; ++channelIndex )
-            {
-                m_channel[channelIndex]->ProcessAck( acks[i] );
-            }
+            Message * message = ReceiveMessage( clientIndex, channelIndex );
+            if ( !message )
+                break;
+            messages[numMessages++] = message;
         }
+        return numMessages;
     }
 
-    void Connection::AdvanceTime( double time )
+    void BaseServer::ReleaseMessage( int clientIndex, Message * message )
     {
-        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
-        {
-            m_channel[i]->AdvanceTime( time );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        const bool lock = UseMessageQueues();
+        if ( lock )
+            LockClient( clientIndex );
+        m_clientConnection[clientIndex]->ReleaseMessage( message );
+        if ( lock )
+            UnlockClient( clientIndex );
+    }
 
-            if ( m_channel[i]->GetErrorLevel() != CHANNEL_ERROR_NONE )
-            {
-                m_errorLevel = CONNECTION_ERROR_CHANNEL;
-                return;
-            }
-        }
-        if ( m_allocator->GetErrorLevel() != ALLOCATOR_ERROR_NONE )
-        {
-            m_errorLevel = CONNECTION_ERROR_ALLOCATOR;
-            return;
-        }
-        if ( m_messageFactory->GetErrorLevel() != MESSAGE_FACTORY_ERROR_NONE )
+    void BaseServer::SetClientBandwidthLimit( int clientIndex, int kbps )
+    {
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( clientIndex >= 0 ); 
+        yojimbo_assert( clientIndex < m_maxClients );
+        LockClient( clientIndex );
+        m_clientConnection[clientIndex]->SetBandwidthLimit( kbps );
+        UnlockClient( clientIndex );
+    }
+
+    void BaseServer::GetNetworkInfo( int clientIndex, NetworkInfo & info ) const
+    {
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( clientIndex >= 0 ); 
+        yojimbo_assert( clientIndex < m_maxClients );
+        memset( &info, 0, sizeof( info ) );
+        if ( IsClientConnected( clientIndex ) )
         {
-            m_errorLevel = CONNECTION_ERROR_MESSAGE_FACTORY;
-            return;
+            yojimbo_assert( m_clientEndpoint[clientIndex] );
+            const bool lock = UseMessageQueues();
+            if ( lock )
+                LockClient( clientIndex );
+            const uint64_t * counters = reliable_endpoint_counters( m_clientEndpoint[clientIndex] );
+            info.numPacketsSent = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_SENT];
+            info.numPacketsReceived = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_RECEIVED];
+            info.numPacketsAcked = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_ACKED];
+            info.RTT = reliable_endpoint_rtt( m_clientEndpoint[clientIndex] );
+            info.packetLoss = reliable_endpoint_packet_loss( m_clientEndpoint[clientIndex] );
+            reliable_endpoint_bandwidth( m_clientEndpoint[clientIndex], &info.sentBandwidth, &info.receivedBandwidth, &info.ackedBandwidth );
+            if ( lock )
+                UnlockClient( clientIndex );
         }
     }
-}
 
-// ---------------------------------------------------------------------------------
+    MessageFactory & BaseServer::GetClientMessageFactory( int clientIndex ) 
+    { 
+        yojimbo_assert( IsRunning() ); 
+        yojimbo_assert( clientIndex >= 0 ); 
+        yojimbo_assert( clientIndex < m_maxClients );
+        return *m_clientMessageFactory[clientIndex];
+    }
 
-namespace yojimbo
-{
-    BaseClient::BaseClient( Allocator & allocator, const ClientServerConfig & config, Adapter & adapter, double time ) : m_config( config )
+    reliable_endpoint_t * BaseServer::GetClientEndpoint( int clientIndex )
     {
-        m_allocator = &allocator;
-        m_adapter = &adapter;
-        m_time = time;
-        m_context = NULL;
-        m_clientMemory = NULL;
-        m_clientAllocator = NULL;
-        m_endpoint = NULL;
-        m_connection = NULL;
-        m_messageFactory = NULL;
-        m_networkSimulator = NULL;
-        m_clientState = CLIENT_STATE_DISCONNECTED;
-        m_clientIndex = -1;
-        m_packetBuffer = (uint8_t*) YOJIMBO_ALLOCATE( allocator, config.maxPacketSize );
+        yojimbo_assert( IsRunning() ); 
+        yojimbo_assert( clientIndex >= 0 ); 
+        yojimbo_assert( clientIndex < m_maxClients );
+        return m_clientEndpoint[clientIndex];
     }
 
-    BaseClient::~BaseClient()
+    Connection & BaseServer::GetClientConnection( int clientIndex )
     {
-        // IMPORTANT: Please disconnect the client before destroying it
-        yojimbo_assert( m_clientState <= CLIENT_STATE_DISCONNECTED );
-        YOJIMBO_FREE( *m_allocator, m_packetBuffer );
-        m_allocator = NULL;
+        yojimbo_assert( IsRunning() ); 
+        yojimbo_assert( clientIndex >= 0 ); 
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_clientConnection[clientIndex] );
+        return *m_clientConnection[clientIndex];
     }
 
-    void BaseClient::Disconnect()
+    void BaseServer::AddActiveClient( int clientIndex )
     {
-        SetClientState( CLIENT_STATE_DISCONNECTED );
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_activeClientIndex[clientIndex] == -1 );
+        yojimbo_assert( m_numActiveClients < m_maxClients );
+        m_activeClientIndex[clientIndex] = m_numActiveClients;
+        m_activeClients[m_numActiveClients++] = clientIndex;
+        // idle slots are not advanced, so bring the connection and endpoint up to the current time
+        LockClient( clientIndex );
+        m_clientConnection[clientIndex]->AdvanceTime( m_time );
+        reliable_endpoint_update( m_clientEndpoint[clientIndex], m_time );
+        if ( m_clientThreadState )
+            m_clientThreadState[clientIndex].clientId = GetClientId( clientIndex );
+        UnlockClient( clientIndex );
+        if ( m_clientThreadState )
+        {
+            ClientThreadState & state = m_clientThreadState[clientIndex];
+            yojimbo_atomic_store( &state.disconnectRequested, 0 );
+            // while the slot is still being reset, the client shows up once the reset is done. see NetworkThreadTick
+            if ( yojimbo_atomic_load( &state.resetState ) == CLIENT_RESET_NONE )
+            {
+                yojimbo_atomic_store( &state.connected, 1 );
+                yojimbo_atomic_store( &m_numConnectedClients, m_numConnectedClients + 1 );
+            }
+        }
     }
 
-    void BaseClient::AdvanceTime( double time )
+    void BaseServer::RemoveActiveClient( int clientIndex )
     {
-        m_time = time;
-        if ( m_endpoint )
-        {
-            m_connection->AdvanceTime( time );
-            if ( m_connection->GetErrorLevel() != CONNECTION_ERROR_NONE )
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        const int index = m_activeClientIndex[clientIndex];
+        yojimbo_assert( index >= 0 );
+        yojimbo_assert( index < m_numActiveClients );
+        const int lastClientIndex = m_activeClients[--m_numActiveClients];
+        m_activeClients[index] = lastClientIndex;
+        m_activeClientIndex[lastClientIndex] = index;
+        m_activeClientIndex[clientIndex] = -1;
+        if ( m_workerPool )
+        {
+            ClientPacketQueue & queue = m_clientReceiveQueue[clientIndex];
+            LockClient( clientIndex );
+            for ( int i = 0; i < queue.numPackets; ++i )
             {
-                yojimbo_printf( YOJIMBO_LOG_LEVEL_DEBUG, "connection error. disconnecting client\n" );
-                Disconnect();
-                return;
+                YOJIMBO_FREE( *m_clientAllocator[clientIndex], queue.packetData[i] );
             }
-            reliable_endpoint_update( m_endpoint, m_time );
-            int numAcks;
-            const uint16_t * acks = reliable_endpoint_get_acks( m_endpoint, &numAcks );
-            m_connection->ProcessAcks( acks, numAcks );
-            reliable_endpoint_clear_acks( m_endpoint );
+            UnlockClient( clientIndex );
+            queue.numPackets = 0;
         }
-        NetworkSimulator * networkSimulator = GetNetworkSimulator();
-        if ( networkSimulator )
+        if ( m_clientThreadState )
         {
-            networkSimulator->AdvanceTime( time );
+            ClientThreadState & state = m_clientThreadState[clientIndex];
+            if ( yojimbo_atomic_load( &state.connected ) )
+            {
+                yojimbo_atomic_store( &state.connected, 0 );
+                yojimbo_atomic_store( &m_numConnectedClients, m_numConnectedClients - 1 );
+            }
+            yojimbo_atomic_store( &state.resetState, CLIENT_RESET_RECEIVE_QUEUE );
         }
     }
 
-    void BaseClient::SetLatency( float milliseconds )
+    void BaseServer::ResetClient( int clientIndex )
     {
-        if ( m_networkSimulator )
-        {
-            m_networkSimulator->SetLatency( milliseconds );
-        }
+        yojimbo_assert( IsRunning() );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_assert( m_activeClientIndex[clientIndex] == -1 );
+        LockClient( clientIndex );
+        reliable_endpoint_reset( m_clientEndpoint[clientIndex] );
+        m_clientConnection[clientIndex]->Reset();
+        UnlockClient( clientIndex );
     }
 
-    void BaseClient::SetJitter( float milliseconds )
+    void BaseServer::StartNetworkThread()
     {
-        if ( m_networkSimulator )
+        yojimbo_assert( IsRunning() );
+        if ( m_config.networkThread && !m_networkThread.IsRunning() )
         {
-            m_networkSimulator->SetJitter( milliseconds );
+            m_networkThread.Start( StaticNetworkThreadTick, this, m_time, m_config.networkTickRate );
         }
     }
 
-    void BaseClient::SetPacketLoss( float percent )
+    void BaseServer::StopNetworkThread()
     {
-        if ( m_networkSimulator )
+        yojimbo_assert( !m_networkThread.IsCurrentThread() );
+        if ( m_networkThread.IsRunning() )
         {
-            m_networkSimulator->SetPacketLoss( percent );
+            m_networkThread.Stop();
         }
     }
 
-    void BaseClient::SetDuplicates( float percent )
+    void BaseServer::RequestDisconnectClient( int clientIndex )
     {
-        if ( m_networkSimulator )
+        yojimbo_assert( m_clientThreadState );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        yojimbo_atomic_store( &m_clientThreadState[clientIndex].disconnectRequested, 1 );
+    }
+
+    void BaseServer::RequestDisconnectAllClients()
+    {
+        yojimbo_assert( m_clientThreadState );
+        yojimbo_atomic_store( &m_disconnectAllRequested, 1 );
+    }
+
+    bool BaseServer::IsClientConnectedOutsideNetworkThread( int clientIndex ) const
+    {
+        yojimbo_assert( m_clientThreadState );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        return yojimbo_atomic_load( &m_clientThreadState[clientIndex].connected ) != 0;
+    }
+
+    uint64_t BaseServer::GetClientIdOutsideNetworkThread( int clientIndex ) const
+    {
+        yojimbo_assert( m_clientThreadState );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        LockClient( clientIndex );
+        const uint64_t clientId = m_clientThreadState[clientIndex].clientId;
+        UnlockClient( clientIndex );
+        return clientId;
+    }
+
+    void BaseServer::LockClient( int clientIndex ) const
+    {
+        if ( m_clientLock )
         {
-            m_networkSimulator->SetDuplicates( percent );
+            m_clientLock[clientIndex]->Lock();
         }
     }
 
-    void BaseClient::SetClientState( ClientState clientState )
+    void BaseServer::UnlockClient( int clientIndex ) const
     {
-        m_clientState = clientState;
+        if ( m_clientLock )
+        {
+            m_clientLock[clientIndex]->Unlock();
+        }
     }
 
-    void BaseClient::CreateInternal()
+    void BaseServer::NetworkThreadTick( double time )
     {
-        yojimbo_assert( m_allocator );
-        yojimbo_assert( m_adapter );
-        yojimbo_assert( m_clientMemory == NULL );
-        yojimbo_assert( m_clientAllocator == NULL );
-        yojimbo_assert( m_messageFactory == NULL );
-        m_clientMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.clientMemory );
-        m_clientAllocator = m_adapter->CreateAllocator( *m_allocator, m_clientMemory, m_config.clientMemory );
-        m_messageFactory = m_adapter->CreateMessageFactory( *m_clientAllocator );
-        m_connection = YOJIMBO_NEW( *m_clientAllocator, Connection, *m_clientAllocator, *m_messageFactory, m_config, m_time );
-        yojimbo_assert( m_connection );
-        if ( m_config.networkSimulator )
+        if ( yojimbo_atomic_load( &m_disconnectAllRequested ) )
         {
-            m_networkSimulator = YOJIMBO_NEW( *m_clientAllocator, NetworkSimulator, *m_clientAllocator, m_config.maxSimulatorPackets, m_time );
+            yojimbo_atomic_store( &m_disconnectAllRequested, 0 );
+            DisconnectAllClients();
         }
-        reliable_config_t reliable_config;
-        reliable_default_config( &reliable_config );
-        strcpy( reliable_config.name, "client endpoint" );
-        reliable_config.context = (void*) this;
-        reliable_config.max_packet_size = m_config.maxPacketSize;
-        reliable_config.fragment_above = m_config.fragmentPacketsAbove;
-        reliable_config.max_fragments = m_config.maxPacketFragments;
-        reliable_config.fragment_size = m_config.packetFragmentSize; 
-        reliable_config.ack_buffer_size = m_config.ackedPacketsBufferSize;
-        reliable_config.received_packets_buffer_size = m_config.receivedPacketsBufferSize;
-        reliable_config.fragment_reassembly_buffer_size = m_config.packetReassemblyBufferSize;
-        reliable_config.transmit_packet_function = BaseClient::StaticTransmitPacketFunction;
-        reliable_config.process_packet_function = BaseClient::StaticProcessPacketFunction;
-        reliable_config.allocator_context = m_clientAllocator;
-        reliable_config.allocate_function = BaseClient::StaticAllocateFunction;
-        reliable_config.free_function = BaseClient::StaticFreeFunction;
-        m_endpoint = reliable_endpoint_create( &reliable_config, m_time );
-        reliable_endpoint_reset( m_endpoint );
+
+        for ( int j = m_numActiveClients - 1; j >= 0; --j )
+        {
+            const int i = m_activeClients[j];
+            if ( yojimbo_atomic_load( &m_clientThreadState[i].disconnectRequested ) )
+            {
+                yojimbo_atomic_store( &m_clientThreadState[i].disconnectRequested, 0 );
+                DisconnectClient( i );
+            }
+        }
+
+        // finish resetting slots whose received messages have been released outside the network thread.
+        // anything queued to send before then was meant for the old client, so release it too.
+
+        for ( int i = 0; i < m_maxClients; ++i )
+        {
+            ClientThreadState & state = m_clientThreadState[i];
+            if ( yojimbo_atomic_load( &state.resetState ) != CLIENT_RESET_SEND_QUEUE )
+                continue;
+            LockClient( i );
+            m_clientMessageQueues[i]->ReleaseSendQueue( *m_clientMessageFactory[i] );
+            UnlockClient( i );
+            yojimbo_atomic_store( &state.resetState, CLIENT_RESET_NONE );
+            if ( m_activeClientIndex[i] >= 0 )
+            {
+                yojimbo_atomic_store( &state.connected, 1 );
+                yojimbo_atomic_store( &m_numConnectedClients, m_numConnectedClients + 1 );
+            }
+        }
+
+        ReceivePackets();
+
+        AdvanceTime( time );
+
+        for ( int j = 0; j < m_numActiveClients; ++j )
+        {
+            const int i = m_activeClients[j];
+            if ( yojimbo_atomic_load( &m_clientThreadState[i].resetState ) != CLIENT_RESET_NONE )
+                continue;
+            LockClient( i );
+            m_clientMessageQueues[i]->Update( *m_clientConnection[i], m_context );
+            UnlockClient( i );
+        }
+
+        SendPackets();
     }
 
-    void BaseClient::DestroyInternal()
+    void BaseServer::SyncNetworkThread()
     {
-        yojimbo_assert( m_allocator );
-        if ( m_endpoint )
+        for ( int i = 0; i < m_maxClients; ++i )
         {
-            reliable_endpoint_destroy( m_endpoint ); 
-            m_endpoint = NULL;
+            ClientThreadState & state = m_clientThreadState[i];
+            if ( yojimbo_atomic_load( &state.resetState ) != CLIENT_RESET_RECEIVE_QUEUE )
+                continue;
+            LockClient( i );
+            m_clientMessageQueues[i]->ReleaseReceiveQueue( *m_clientMessageFactory[i] );
+            UnlockClient( i );
+            yojimbo_atomic_store( &state.resetState, CLIENT_RESET_SEND_QUEUE );
         }
-        YOJIMBO_DELETE( *m_clientAllocator, NetworkSimulator, m_networkSimulator );
-        YOJIMBO_DELETE( *m_clientAllocator, Connection, m_connection );
-        YOJIMBO_DELETE( *m_clientAllocator, MessageFactory, m_messageFactory );
-        YOJIMBO_DELETE( *m_allocator, Allocator, m_clientAllocator );
-        YOJIMBO_FREE( *m_allocator, m_clientMemory );
     }
 
-    void BaseClient::StaticTransmitPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    void BaseServer::StaticNetworkThreadTick( void * context, double time )
     {
-        (void) index;
-        BaseClient * client = (BaseClient*) context;
-        client->TransmitPacketFunction( packetSequence, packetData, packetBytes );
+        BaseServer * server = (BaseServer*) context;
+        server->NetworkThreadTick( time );
+    }
+
+    void BaseServer::StaticTransmitPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    {
+        BaseServer * server = (BaseServer*) context;
+        if ( server->m_queueTransmitPackets )
+            server->QueueTransmitPacket( index, packetSequence, packetData, packetBytes );
+        else
+            server->TransmitPacketFunction( index, packetSequence, packetData, packetBytes );
     }
     
-    int BaseClient::StaticProcessPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    int BaseServer::StaticProcessPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
     {
-        (void) index;
-        BaseClient * client = (BaseClient*) context;
-        return client->ProcessPacketFunction( packetSequence, packetData, packetBytes );
+        BaseServer * server = (BaseServer*) context;
+        return server->ProcessPacketFunction( index, packetSequence, packetData, packetBytes );
     }
 
-    void * BaseClient::StaticAllocateFunction( void * context, uint64_t bytes )
+    void * BaseServer::StaticAllocateFunction( void * context, uint64_t bytes )
     {
         yojimbo_assert( context );
         Allocator * allocator = (Allocator*) context;
         return YOJIMBO_ALLOCATE( *allocator, bytes );
     }
     
-    void BaseClient::StaticFreeFunction( void * context, void * pointer )
+    void BaseServer::StaticFreeFunction( void * context, void * pointer )
     {
         yojimbo_assert( context );
         yojimbo_assert( pointer );
@@ -3109,896 +7273,1133 @@ namespace yojimbo
         YOJIMBO_FREE( *allocator, pointer );
     }
 
-    Message * BaseClient::CreateMessage( int type )
+    // -----------------------------------------------------------------------------------------------------
+
+    Server::Server( Allocator & allocator, const uint8_t privateKey[], const Address & address, const ClientServerConfig & config, Adapter & adapter, double time ) 
+        : BaseServer( allocator, config, adapter, time )
     {
-        yojimbo_assert( m_messageFactory );
-        return m_messageFactory->CreateMessage( type );
+        m_config = config;
+        m_allocator = &allocator;
+        m_transport = YOJIMBO_NEW( allocator, NetcodeServerTransport, privateKey, address, config.protocolId, adapter );
+        m_ownsTransport = true;
+        m_transportStarted = false;
     }
 
-    uint8_t * BaseClient::AllocateBlock( int bytes )
+    Server::Server( Allocator & allocator, ServerTransport & transport, const ClientServerConfig & config, Adapter & adapter, double time ) 
+        : BaseServer( allocator, config, adapter, time )
     {
-        return (uint8_t*) YOJIMBO_ALLOCATE( *m_clientAllocator, bytes );
+        m_config = config;
+        m_allocator = &allocator;
+        m_transport = &transport;
+        m_ownsTransport = false;
+        m_transportStarted = false;
     }
 
-    void BaseClient::AttachBlockToMessage( Message * message, uint8_t * block, int bytes )
+    Server::~Server()
     {
-        yojimbo_assert( message );
-        yojimbo_assert( block );
-        yojimbo_assert( bytes > 0 );
-        yojimbo_assert( message->IsBlockMessage() );
-        BlockMessage * blockMessage = (BlockMessage*) message;
-        blockMessage->AttachBlock( *m_clientAllocator, block, bytes );
+        // IMPORTANT: Please stop the server before destroying it!
+        yojimbo_assert( !m_transportStarted );
+        if ( m_ownsTransport )
+        {
+            YOJIMBO_DELETE( *m_allocator, ServerTransport, m_transport );
+        }
+        m_transport = NULL;
     }
 
-    void BaseClient::FreeBlock( uint8_t * block )
+    void Server::Start( int maxClients )
     {
-        YOJIMBO_FREE( *m_clientAllocator, block );
+        if ( IsRunning() )
+            Stop();
+
+        BaseServer::Start( maxClients );
+        
+        if ( !m_transport->Start( GetGlobalAllocator(), maxClients, StaticConnectDisconnectCallbackFunction, this, GetTime() ) )
+        {
+            Stop();
+            return;
+        }
+
+        m_transportStarted = true;
+
+        StartNetworkThread();
     }
 
-    bool BaseClient::CanSendMessage( int channelIndex ) const
+    void Server::Stop()
     {
-        yojimbo_assert( m_connection );
-        return m_connection->CanSendMessage( channelIndex );
+        StopNetworkThread();
+        if ( m_transportStarted )
+        {
+            m_transport->Stop();
+            m_transportStarted = false;
+        }
+        BaseServer::Stop();
     }
 
-    void BaseClient::SendMessage( int channelIndex, Message * message )
+    void Server::DisconnectClient( int clientIndex )
     {
-        yojimbo_assert( m_connection );
-        m_connection->SendMessage( channelIndex, message, GetContext() );
+        yojimbo_assert( m_transportStarted );
+        if ( DeferToNetworkThread() )
+        {
+            RequestDisconnectClient( clientIndex );
+            return;
+        }
+        m_transport->DisconnectClient( clientIndex );
     }
 
-    Message * BaseClient::ReceiveMessage( int channelIndex )
+    void Server::DisconnectAllClients()
     {
-        yojimbo_assert( m_connection );
-        return m_connection->ReceiveMessage( channelIndex );
+        yojimbo_assert( m_transportStarted );
+        if ( DeferToNetworkThread() )
+        {
+            RequestDisconnectAllClients();
+            return;
+        }
+        m_transport->DisconnectAllClients();
     }
 
-    void BaseClient::ReleaseMessage( Message * message )
+    void Server::SendPackets()
     {
-        yojimbo_assert( m_connection );
-        m_connection->ReleaseMessage( message );
+        if ( m_transportStarted && !DeferToNetworkThread() )
+        {
+            SendClientPackets();
+        }
     }
 
-    void BaseClient::GetNetworkInfo( NetworkInfo & info ) const
+    void Server::ReceivePackets()
     {
-        memset( &info, 0, sizeof( info ) );
-        if ( m_connection )
+        if ( m_transportStarted && !DeferToNetworkThread() )
         {
-            yojimbo_assert( m_endpoint );
-            const uint64_t * counters = reliable_endpoint_counters( m_endpoint );
-            info.numPacketsSent = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_SENT];
-            info.numPacketsReceived = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_RECEIVED];
-            info.numPacketsAcked = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_ACKED];
-            info.RTT = reliable_endpoint_rtt( m_endpoint );
-            info.packetLoss = reliable_endpoint_packet_loss( m_endpoint );
-            reliable_endpoint_bandwidth( m_endpoint, &info.sentBandwidth, &info.receivedBandwidth, &info.ackedBandwidth );
+            // one batch spans all client slots, so a transport reading a single socket fills it in as few calls as it can.
+            // capacity is refreshed for each batch, since with worker threads it shrinks as packets are queued
+
+            uint8_t * packetData[MaxReceivePackets];
+            int packetBytes[MaxReceivePackets];
+            int clientIndex[MaxReceivePackets];
+            int * clientCapacity = (int*) alloca( sizeof( int ) * GetMaxClients() );
+            const int numActiveClients = GetNumActiveClients();
+            while ( true )
+            {
+                memset( clientCapacity, 0, sizeof( int ) * GetMaxClients() );
+                for ( int j = 0; j < numActiveClients; ++j )
+                {
+                    const int activeClientIndex = GetActiveClient( j );
+                    clientCapacity[activeClientIndex] = GetClientReceiveCapacity( activeClientIndex );
+                }
+                const int numPackets = m_transport->ReceiveAllPackets( clientCapacity, clientIndex, packetData, packetBytes, MaxReceivePackets );
+                for ( int k = 0; k < numPackets; ++k )
+                {
+                    ReceiveClientPacket( clientIndex[k], packetData[k], packetBytes[k] );
+                }
+                m_transport->FreePackets( packetData, numPackets );
+                if ( numPackets < MaxReceivePackets )
+                    break;
+            }
+            ProcessReceivedClientPackets();
         }
     }
 
-    // ------------------------------------------------------------------------------------------------------------------
+    void Server::AdvanceTime( double time )
+    {
+        if ( DeferToNetworkThread() )
+        {
+            BaseServer::AdvanceTime( time );
+            return;
+        }
+        if ( m_transportStarted )
+        {
+            m_transport->Update( time );
+        }
+        BaseServer::AdvanceTime( time );
+        NetworkSimulator * networkSimulator = GetNetworkSimulator();
+        if ( networkSimulator && networkSimulator->IsActive() )
+        {
+            uint8_t ** packetData = (uint8_t**) alloca( sizeof( uint8_t*) * m_config.maxSimulatorPackets );
+            int * packetBytes = (int*) alloca( sizeof(int) * m_config.maxSimulatorPackets );
+            int * to = (int*) alloca( sizeof(int) * m_config.maxSimulatorPackets );
+            int numPackets = networkSimulator->ReceivePackets( m_config.maxSimulatorPackets, packetData, packetBytes, to );
+            m_transport->SendPackets( to, packetData, packetBytes, numPackets );
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                YOJIMBO_FREE( networkSimulator->GetAllocator(), packetData[i] );
+            }
+        }
+    }
 
-    Client::Client( Allocator & allocator, const Address & address, const ClientServerConfig & config, Adapter & adapter, double time ) 
-        : BaseClient( allocator, config, adapter, time ), m_config( config ), m_address( address )
+    bool Server::IsClientConnected( int clientIndex ) const
     {
-        m_clientId = 0;
-        m_client = NULL;
-        m_boundAddress = m_address;
+        if ( DeferToNetworkThread() )
+            return IsClientConnectedOutsideNetworkThread( clientIndex );
+        return m_transportStarted && m_transport->IsClientConnected( clientIndex );
     }
 
-    Client::~Client()
+    uint64_t Server::GetClientId( int clientIndex ) const
     {
-        // IMPORTANT: Please disconnect the client before destroying it
-        yojimbo_assert( m_client == NULL );
+        if ( DeferToNetworkThread() )
+            return GetClientIdOutsideNetworkThread( clientIndex );
+        return m_transport->GetClientId( clientIndex );
     }
 
-    void Client::InsecureConnect( const uint8_t privateKey[], uint64_t clientId, const Address & address )
+    int Server::GetNumConnectedClients() const
     {
-        InsecureConnect( privateKey, clientId, &address, 1 );
+        if ( DeferToNetworkThread() )
+            return GetNumConnectedClientsOutsideNetworkThread();
+        return m_transportStarted ? m_transport->GetNumConnectedClients() : 0;
     }
 
-    void Client::InsecureConnect( const uint8_t privateKey[], uint64_t clientId, const Address serverAddresses[], int numServerAddresses )
+    void Server::ConnectLoopbackClient( int clientIndex, uint64_t clientId, const uint8_t * userData )
     {
-        yojimbo_assert( serverAddresses );
-        yojimbo_assert( numServerAddresses > 0 );
-        yojimbo_assert( numServerAddresses <= NETCODE_MAX_SERVERS_PER_CONNECT );
-        Disconnect();
-        CreateInternal();
-        m_clientId = clientId;
-        CreateClient( m_address );
-        if ( !m_client )
+        // loopback packets are exchanged on the game thread, so loopback is not supported with the network thread
+        yojimbo_assert( !m_config.networkThread );
+        m_transport->ConnectLoopbackClient( clientIndex, clientId, userData );
+    }
+
+    void Server::DisconnectLoopbackClient( int clientIndex )
+    {
+        m_transport->DisconnectLoopbackClient( clientIndex );
+    }
+
+    bool Server::IsLoopbackClient( int clientIndex ) const
+    {
+        return m_transport->IsLoopbackClient( clientIndex );
+    }
+
+    void Server::ProcessLoopbackPacket( int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
+    {
+        m_transport->ProcessLoopbackPacket( clientIndex, packetData, packetBytes, packetSequence );
+    }
+
+    void Server::TransmitPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    {
+        (void) packetSequence;
+        NetworkSimulator * networkSimulator = GetNetworkSimulator();
+        if ( networkSimulator && networkSimulator->IsActive() )
         {
-            Disconnect();
-            return;
+            networkSimulator->SendPacket( clientIndex, packetData, packetBytes );
         }
-        uint8_t connectToken[NETCODE_CONNECT_TOKEN_BYTES];
-        if ( !GenerateInsecureConnectToken( connectToken, privateKey, clientId, serverAddresses, numServerAddresses ) )
+        else
         {
-            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to generate insecure connect token\n" );
-            SetClientState( CLIENT_STATE_ERROR );
-            return;
+            m_transport->SendPackets( &clientIndex, &packetData, &packetBytes, 1 );
         }
-        netcode_client_connect( m_client, connectToken );
-        SetClientState( CLIENT_STATE_CONNECTING );
     }
 
-    bool Client::GenerateInsecureConnectToken( uint8_t * connectToken, 
-                                               const uint8_t privateKey[], 
-                                               uint64_t clientId, 
-                                               const Address serverAddresses[], 
-                                               int numServerAddresses )
+    void Server::TransmitPackets( const int * clientIndex, const uint16_t * packetSequence, uint8_t * const * packetData, const int * packetBytes, int numPackets )
     {
-        char serverAddressStrings[NETCODE_MAX_SERVERS_PER_CONNECT][MaxAddressLength];
-        const char * serverAddressStringPointers[NETCODE_MAX_SERVERS_PER_CONNECT];
-        for ( int i = 0; i < numServerAddresses; ++i ) 
+        NetworkSimulator * networkSimulator = GetNetworkSimulator();
+        if ( networkSimulator && networkSimulator->IsActive() )
         {
-            serverAddresses[i].ToString( serverAddressStrings[i], MaxAddressLength );
-            serverAddressStringPointers[i] = serverAddressStrings[i];
+            BaseServer::TransmitPackets( clientIndex, packetSequence, packetData, packetBytes, numPackets );
+            return;
         }
-        return netcode_generate_connect_token( numServerAddresses, 
-                                               serverAddressStringPointers, 
-                                               serverAddressStringPointers, 
-                                               m_config.timeout,
-                                               m_config.timeout, 
-                                               clientId, 
-                                               m_config.protocolId, 
-                                               0, 
-                                               (uint8_t*)privateKey, 
-                                               connectToken ) == NETCODE_OK;
+        m_transport->SendPackets( clientIndex, packetData, packetBytes, numPackets );
     }
 
-    void Client::Connect( uint64_t clientId, uint8_t * connectToken )
+    int Server::ProcessPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
     {
-        yojimbo_assert( connectToken );
-        Disconnect();
-        CreateInternal();
-        m_clientId = clientId;
-        CreateClient( m_address );
-        netcode_client_connect( m_client, connectToken );
-        if ( netcode_client_state( m_client ) > NETCODE_CLIENT_STATE_DISCONNECTED )
+        return (int) GetClientConnection(clientIndex).ProcessPacket( GetContext(), packetSequence, packetData, packetBytes );
+    }
+
+    void Server::ConnectDisconnectCallbackFunction( int clientIndex, int connected )
+    {
+        if ( connected == 0 )
         {
-            SetClientState( CLIENT_STATE_CONNECTING );
+            GetAdapter().OnServerClientDisconnected( clientIndex );
+            RemoveActiveClient( clientIndex );
+            ResetClient( clientIndex );
+            NetworkSimulator * networkSimulator = GetNetworkSimulator();
+            if ( networkSimulator && networkSimulator->IsActive() )
+            {
+                networkSimulator->DiscardClientPackets( clientIndex );
+            }
         }
         else
         {
-            Disconnect();
+            AddActiveClient( clientIndex );
+            GetAdapter().OnServerClientConnected( clientIndex );
         }
     }
 
-    void Client::Disconnect()
+    void Server::StaticConnectDisconnectCallbackFunction( void * context, int clientIndex, int connected )
     {
-        BaseClient::Disconnect();
-        DestroyClient();
-        DestroyInternal();
-        m_clientId = 0;
+        Server * server = (Server*) context;
+        server->ConnectDisconnectCallbackFunction( clientIndex, connected );
+    }
+
+    // -----------------------------------------------------------------------------------------------------
+
+    NetcodeServerTransport::NetcodeServerTransport( const uint8_t privateKey[], const Address & address, uint64_t protocolId, Adapter & adapter )
+    {
+        yojimbo_assert( KeyBytes == NETCODE_KEY_BYTES );
+        memcpy( m_privateKey, privateKey, NETCODE_KEY_BYTES );
+        m_adapter = &adapter;
+        m_server = NULL;
+        m_address = address;
+        m_boundAddress = address;
+        m_protocolId = protocolId;
+        m_maxClients = 0;
+        m_connectDisconnectFunction = NULL;
+        m_connectDisconnectContext = NULL;
     }
 
-    void Client::SendPackets()
+    NetcodeServerTransport::~NetcodeServerTransport()
     {
-        if ( !IsConnected() )
-            return;
-        yojimbo_assert( m_client );
-        uint8_t * packetData = GetPacketBuffer();
-        int packetBytes;
-        uint16_t packetSequence = reliable_endpoint_next_packet_sequence( GetEndpoint() );
-        if ( GetConnection().GeneratePacket( GetContext(), packetSequence, packetData, m_config.maxPacketSize, packetBytes ) )
-        {
-            reliable_endpoint_send_packet( GetEndpoint(), packetData, packetBytes );
-        }
+        // IMPORTANT: Please stop the transport before destroying it!
+        yojimbo_assert( !m_server );
     }
 
-    void Client::ReceivePackets()
+    bool NetcodeServerTransport::Start( Allocator & allocator, int maxClients, ConnectDisconnectFunction function, void * context, double time )
     {
-        if ( !IsConnected() )
-            return;
-        yojimbo_assert( m_client );
-        while ( true )
-        {
-            int packetBytes;
-            uint64_t packetSequence;
-            uint8_t * packetData = netcode_client_receive_packet( m_client, &packetBytes, &packetSequence );
-            if ( !packetData )
-                break;
-            reliable_endpoint_receive_packet( GetEndpoint(), packetData, packetBytes );
-            netcode_client_free_packet( m_client, packetData );
-        }
+        yojimbo_assert( !m_server );
+        yojimbo_assert( maxClients <= NETCODE_MAX_CLIENTS );
+
+        m_connectDisconnectFunction = function;
+        m_connectDisconnectContext = context;
+
+        char addressString[MaxAddressLength];
+        m_address.ToString( addressString, MaxAddressLength );
+        
+        struct netcode_server_config_t netcodeConfig;
+        netcode_default_server_config(&netcodeConfig);
+        netcodeConfig.protocol_id = m_protocolId;
+        memcpy(netcodeConfig.private_key, m_privateKey, NETCODE_KEY_BYTES);
+        netcodeConfig.allocator_context = &allocator;
+        netcodeConfig.allocate_function = StaticAllocateFunction;
+        netcodeConfig.free_function     = StaticFreeFunction;
+        netcodeConfig.callback_context = this;
+        netcodeConfig.connect_disconnect_callback = StaticConnectDisconnectCallbackFunction;
+        netcodeConfig.send_loopback_packet_callback = StaticSendLoopbackPacketCallbackFunction;
+        
+        m_server = netcode_server_create(addressString, &netcodeConfig, time);
+        
+        if ( !m_server )
+            return false;
+        
+        netcode_server_start( m_server, maxClients );
+
+        m_maxClients = maxClients;
+
+        m_boundAddress.SetPort( netcode_server_get_port( m_server ) );
+
+        return true;
     }
 
-    void Client::AdvanceTime( double time )
+    void NetcodeServerTransport::Stop()
     {
-        BaseClient::AdvanceTime( time );
-        if ( m_client )
+        if ( m_server )
         {
-            netcode_client_update( m_client, time );
-            const int state = netcode_client_state( m_client );
-            if ( state < NETCODE_CLIENT_STATE_DISCONNECTED )
-            {
-                Disconnect();
-                SetClientState( CLIENT_STATE_ERROR );
-            }
-            else if ( state == NETCODE_CLIENT_STATE_DISCONNECTED )
-            {
-                Disconnect();
-                SetClientState( CLIENT_STATE_DISCONNECTED );
-            }
-            else if ( state == NETCODE_CLIENT_STATE_SENDING_CONNECTION_REQUEST )
-            {
-                SetClientState( CLIENT_STATE_CONNECTING );
-            }
-            else
-            {
-                SetClientState( CLIENT_STATE_CONNECTED );
-            }
-            NetworkSimulator * networkSimulator = GetNetworkSimulator();
-            if ( networkSimulator && networkSimulator->IsActive() )
-            {
-                uint8_t ** packetData = (uint8_t**) alloca( sizeof( uint8_t*) * m_config.maxSimulatorPackets );
-                int * packetBytes = (int*) alloca( sizeof(int) * m_config.maxSimulatorPackets );
-                int numPackets = networkSimulator->ReceivePackets( m_config.maxSimulatorPackets, packetData, packetBytes, NULL );
-                for ( int i = 0; i < numPackets; ++i )
-                {
-                    netcode_client_send_packet( m_client, (uint8_t*) packetData[i], packetBytes[i] );
-                    YOJIMBO_FREE( networkSimulator->GetAllocator(), packetData[i] );
-                }
-            }
+            m_boundAddress = m_address;
+            netcode_server_stop( m_server );
+            netcode_server_destroy( m_server );
+            m_server = NULL;
+            m_maxClients = 0;
         }
     }
 
-    int Client::GetClientIndex() const
+    void NetcodeServerTransport::Update( double time )
     {
-        return m_client ? netcode_client_index( m_client ) : -1;
+        yojimbo_assert( m_server );
+        netcode_server_update( m_server, time );
     }
 
-    void Client::ConnectLoopback( int clientIndex, uint64_t clientId, int maxClients )
+    void NetcodeServerTransport::DisconnectClient( int clientIndex )
     {
-        Disconnect();
-        CreateInternal();
-        m_clientId = clientId;
-        CreateClient( m_address );
-        netcode_client_connect_loopback( m_client, clientIndex, maxClients );
-        SetClientState( CLIENT_STATE_CONNECTED );
+        yojimbo_assert( m_server );
+        netcode_server_disconnect_client( m_server, clientIndex );
     }
 
-    void Client::DisconnectLoopback()
+    void NetcodeServerTransport::DisconnectAllClients()
     {
-        netcode_client_disconnect_loopback( m_client );
-        BaseClient::Disconnect();
-        DestroyClient();
-        DestroyInternal();
-        m_clientId = 0;
+        yojimbo_assert( m_server );
+        netcode_server_disconnect_all_clients( m_server );
     }
 
-    bool Client::IsLoopback() const
+    bool NetcodeServerTransport::IsClientConnected( int clientIndex ) const
     {
-        return netcode_client_loopback( m_client ) != 0;
+        return netcode_server_client_connected( m_server, clientIndex ) != 0;
     }
 
-    void Client::ProcessLoopbackPacket( const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
+    uint64_t NetcodeServerTransport::GetClientId( int clientIndex ) const
     {
-        netcode_client_process_loopback_packet( m_client, packetData, packetBytes, packetSequence );
+        return netcode_server_client_id( m_server, clientIndex );
     }
 
-    void Client::CreateClient( const Address & address )
+    int NetcodeServerTransport::GetNumConnectedClients() const
     {
-        DestroyClient();
-        char addressString[MaxAddressLength];
-        address.ToString( addressString, MaxAddressLength );
-
-        struct netcode_client_config_t netcodeConfig;
-        netcode_default_client_config(&netcodeConfig);
-        netcodeConfig.allocator_context             = &GetClientAllocator();
-        netcodeConfig.allocate_function             = StaticAllocateFunction;
-        netcodeConfig.free_function                 = StaticFreeFunction;
-        netcodeConfig.callback_context              = this;
-        netcodeConfig.state_change_callback         = StaticStateChangeCallbackFunction;
-        netcodeConfig.send_loopback_packet_callback = StaticSendLoopbackPacketCallbackFunction;
-        m_client = netcode_client_create(addressString, &netcodeConfig, GetTime());
-        
-        if ( m_client )
-        {
-            m_boundAddress.SetPort( netcode_client_get_port( m_client ) );
-        }
+        return netcode_server_num_connected_clients( m_server );
     }
 
-    void Client::DestroyClient()
+    void NetcodeServerTransport::SendPackets( const int * clientIndex, uint8_t * const * packetData, const int * packetBytes, int numPackets )
     {
-        if ( m_client )
+        yojimbo_assert( m_server );
+        for ( int i = 0; i < numPackets; ++i )
         {
-            m_boundAddress = m_address;
-            netcode_client_destroy( m_client );
-            m_client = NULL;
+            netcode_server_send_packet( m_server, clientIndex[i], packetData[i], packetBytes[i] );
         }
     }
 
-    void Client::StateChangeCallbackFunction( int previous, int current )
+    int NetcodeServerTransport::ReceivePackets( int clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets )
     {
-        (void) previous;
-        (void) current;
+        yojimbo_assert( m_server );
+        int numPackets = 0;
+        while ( numPackets < maxPackets )
+        {
+            uint64_t packetSequence;
+            packetData[numPackets] = netcode_server_receive_packet( m_server, clientIndex, &packetBytes[numPackets], &packetSequence );
+            if ( !packetData[numPackets] )
+                break;
+            numPackets++;
+        }
+        return numPackets;
     }
 
-    void Client::StaticStateChangeCallbackFunction( void * context, int previous, int current )
+    int NetcodeServerTransport::ReceiveAllPackets( int * clientCapacity, int * clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets )
     {
-        Client * client = (Client*) context;
-        client->StateChangeCallbackFunction( previous, current );
+        yojimbo_assert( m_server );
+        int numPackets = 0;
+        for ( int i = 0; i < m_maxClients && numPackets < maxPackets; ++i )
+        {
+            if ( clientCapacity[i] <= 0 || !IsClientConnected( i ) )
+                continue;
+            const int numClientPackets = ReceivePackets( i, packetData + numPackets, packetBytes + numPackets, yojimbo_min( clientCapacity[i], maxPackets - numPackets ) );
+            for ( int j = 0; j < numClientPackets; ++j )
+            {
+                clientIndex[numPackets+j] = i;
+            }
+            clientCapacity[i] -= numClientPackets;
+            numPackets += numClientPackets;
+        }
+        return numPackets;
     }
 
-    void Client::TransmitPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    void NetcodeServerTransport::FreePackets( uint8_t ** packetData, int numPackets )
     {
-        (void) packetSequence;
-        NetworkSimulator * networkSimulator = GetNetworkSimulator();
-        if ( networkSimulator && networkSimulator->IsActive() )
-        {
-            networkSimulator->SendPacket( 0, packetData, packetBytes );
-        }
-        else
+        yojimbo_assert( m_server );
+        for ( int i = 0; i < numPackets; ++i )
         {
-            netcode_client_send_packet( m_client, packetData, packetBytes );
+            netcode_server_free_packet( m_server, packetData[i] );
         }
     }
 
-    int Client::ProcessPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    void NetcodeServerTransport::ConnectLoopbackClient( int clientIndex, uint64_t clientId, const uint8_t * userData )
     {
-        return (int) GetConnection().ProcessPacket( GetContext(), packetSequence, packetData, packetBytes );
+        netcode_server_connect_loopback_client( m_server, clientIndex, clientId, userData );
     }
 
-    void Client::SendLoopbackPacketCallbackFunction( int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
+    void NetcodeServerTransport::DisconnectLoopbackClient( int clientIndex )
     {
-        GetAdapter().ClientSendLoopbackPacket( clientIndex, packetData, packetBytes, packetSequence );
+        netcode_server_disconnect_loopback_client( m_server, clientIndex );
     }
 
-    void Client::StaticSendLoopbackPacketCallbackFunction( void * context, int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
+    bool NetcodeServerTransport::IsLoopbackClient( int clientIndex ) const
     {
-        Client * client = (Client*) context;
-        client->SendLoopbackPacketCallbackFunction( clientIndex, packetData, packetBytes, packetSequence );
+        return netcode_server_client_loopback( m_server, clientIndex ) != 0;
     }
-}
-
-// ---------------------------------------------------------------------------------
 
-namespace yojimbo
-{
-    BaseServer::BaseServer( Allocator & allocator, const ClientServerConfig & config, Adapter & adapter, double time ) : m_config( config )
+    void NetcodeServerTransport::ProcessLoopbackPacket( int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
     {
-        m_allocator = &allocator;
-        m_adapter = &adapter;
-        m_context = NULL;
-        m_time = time;
-        m_running = false;
-        m_maxClients = 0;
-        m_globalMemory = NULL;
-        m_globalAllocator = NULL;
-        for ( int i = 0; i < MaxClients; ++i )
-        {
-            m_clientMemory[i] = NULL;
-            m_clientAllocator[i] = NULL;
-            m_clientMessageFactory[i] = NULL;
-            m_clientConnection[i] = NULL;
-            m_clientEndpoint[i] = NULL;
-        }
-        m_networkSimulator = NULL;
-        m_packetBuffer = NULL;
+        netcode_server_process_loopback_packet( m_server, clientIndex, packetData, packetBytes, packetSequence );
     }
 
-    BaseServer::~BaseServer()
+    void NetcodeServerTransport::StaticConnectDisconnectCallbackFunction( void * context, int clientIndex, int connected )
     {
-        // IMPORTANT: Please stop the server before destroying it!
-        yojimbo_assert( !IsRunning () );
-        m_allocator = NULL;
+        NetcodeServerTransport * transport = (NetcodeServerTransport*) context;
+        transport->m_connectDisconnectFunction( transport->m_connectDisconnectContext, clientIndex, connected );
     }
 
-    void BaseServer::SetContext( void * context )
+    void NetcodeServerTransport::StaticSendLoopbackPacketCallbackFunction( void * context, int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
     {
-        yojimbo_assert( !IsRunning() );
-        m_context = context;
+        NetcodeServerTransport * transport = (NetcodeServerTransport*) context;
+        transport->m_adapter->ServerSendLoopbackPacket( clientIndex, packetData, packetBytes, packetSequence );
     }
 
-    void BaseServer::Start( int maxClients )
+    void * NetcodeServerTransport::StaticAllocateFunction( void * context, uint64_t bytes )
     {
-        Stop();
-        m_running = true;
-        m_maxClients = maxClients;
-        yojimbo_assert( !m_globalMemory );
-        yojimbo_assert( !m_globalAllocator );
-        m_globalMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.serverGlobalMemory );
-        m_globalAllocator = m_adapter->CreateAllocator( *m_allocator, m_globalMemory, m_config.serverGlobalMemory );
-        yojimbo_assert( m_globalAllocator );
-        if ( m_config.networkSimulator )
-        {
-            m_networkSimulator = YOJIMBO_NEW( *m_globalAllocator, NetworkSimulator, *m_globalAllocator, m_config.maxSimulatorPackets, m_time );
-        }
-        for ( int i = 0; i < m_maxClients; ++i )
-        {
-            yojimbo_assert( !m_clientMemory[i] );
-            yojimbo_assert( !m_clientAllocator[i] );
-            
-            m_clientMemory[i] = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.serverPerClientMemory );
-            m_clientAllocator[i] = m_adapter->CreateAllocator( *m_allocator, m_clientMemory[i], m_config.serverPerClientMemory );
-            yojimbo_assert( m_clientAllocator[i] );
-            
-            m_clientMessageFactory[i] = m_adapter->CreateMessageFactory( *m_clientAllocator[i] );
-            yojimbo_assert( m_clientMessageFactory[i] );
-            
-            m_clientConnection[i] = YOJIMBO_NEW( *m_clientAllocator[i], Connection, *m_clientAllocator[i], *m_clientMessageFactory[i], m_config, m_time );
-            yojimbo_assert( m_clientConnection[i] );
-
-            reliable_config_t reliable_config;
-            reliable_default_config( &reliable_config );
-            strcpy( reliable_config.name, "server endpoint" );
-            reliable_config.context = (void*) this;
-            reliable_config.index = i;
-            reliable_config.max_packet_size = m_config.maxPacketSize;
-            reliable_config.fragment_above = m_config.fragmentPacketsAbove;
-            reliable_config.max_fragments = m_config.maxPacketFragments;
-            reliable_config.fragment_size = m_config.packetFragmentSize; 
-            reliable_config.ack_buffer_size = m_config.ackedPacketsBufferSize;
-            reliable_config.received_packets_buffer_size = m_config.receivedPacketsBufferSize;
-            reliable_config.fragment_reassembly_buffer_size = m_config.packetReassemblyBufferSize;
-            reliable_config.transmit_packet_function = BaseServer::StaticTransmitPacketFunction;
-            reliable_config.process_packet_function = BaseServer::StaticProcessPacketFunction;
-            reliable_config.allocator_context = &GetGlobalAllocator();
-            reliable_config.allocate_function = BaseServer::StaticAllocateFunction;
-            reliable_config.free_function = BaseServer::StaticFreeFunction;
-            m_clientEndpoint[i] = reliable_endpoint_create( &reliable_config, m_time );
-            reliable_endpoint_reset( m_clientEndpoint[i] );
-        }
-        m_packetBuffer = (uint8_t*) YOJIMBO_ALLOCATE( *m_globalAllocator, m_config.maxPacketSize );
+        yojimbo_assert( context );
+        Allocator * allocator = (Allocator*) context;
+        return YOJIMBO_ALLOCATE( *allocator, bytes );
     }
-
-    void BaseServer::Stop()
+    
+    void NetcodeServerTransport::StaticFreeFunction( void * context, void * pointer )
     {
-        if ( IsRunning() )
-        {
-            YOJIMBO_FREE( *m_globalAllocator, m_packetBuffer );
-            yojimbo_assert( m_globalMemory );
-            yojimbo_assert( m_globalAllocator );
-            YOJIMBO_DELETE( *m_globalAllocator, NetworkSimulator, m_networkSimulator );
-            for ( int i = 0; i < m_maxClients; ++i )
-            {
-                yojimbo_assert( m_clientMemory[i] );
-                yojimbo_assert( m_clientAllocator[i] );
-                yojimbo_assert( m_clientMessageFactory[i] );
-                yojimbo_assert( m_clientEndpoint[i] );
-                reliable_endpoint_destroy( m_clientEndpoint[i] ); m_clientEndpoint[i] = NULL;
-                YOJIMBO_DELETE( *m_clientAllocator[i], Connection, m_clientConnection[i] );
-                YOJIMBO_DELETE( *m_clientAllocator[i], MessageFactory, m_clientMessageFactory[i] );
-                YOJIMBO_DELETE( *m_allocator, Allocator, m_clientAllocator[i] );
-                YOJIMBO_FREE( *m_allocator, m_clientMemory[i] );
-            }
-            YOJIMBO_DELETE( *m_allocator, Allocator, m_globalAllocator );
-            YOJIMBO_FREE( *m_allocator, m_globalMemory );
-        }
-        m_running = false;
-        m_maxClients = 0;
-        m_packetBuffer = NULL;
+        yojimbo_assert( context );
+        yojimbo_assert( pointer );
+        Allocator * allocator = (Allocator*) context;
+        YOJIMBO_FREE( *allocator, pointer );
     }
 
-    void BaseServer::AdvanceTime( double time )
+    // -----------------------------------------------------------------------------------------------------
+
+    MemoryServerTransport::MemoryServerTransport( Allocator & allocator, const Address & address, int packetQueueSize )
     {
-        m_time = time;
-        if ( IsRunning() )
-        {
-            for ( int i = 0; i < m_maxClients; ++i )
-            {
-                m_clientConnection[i]->AdvanceTime( time );
-                if ( m_clientConnection[i]->GetErrorLevel() != CONNECTION_ERROR_NONE )
-                {
-                    yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "client %d connection is in error state. disconnecting client\n", m_clientConnection[i]->GetErrorLevel() );
-                    DisconnectClient( i );
-                    continue;
-                }
-                reliable_endpoint_update( m_clientEndpoint[i], m_time );
-                int numAcks;
-                const uint16_t * acks = reliable_endpoint_get_acks( m_clientEndpoint[i], &numAcks );
-                m_clientConnection[i]->ProcessAcks( acks, numAcks );
-                reliable_endpoint_clear_acks( m_clientEndpoint[i] );
-            }
-            NetworkSimulator * networkSimulator = GetNetworkSimulator();
-            if ( networkSimulator )
-            {
-                networkSimulator->AdvanceTime( time );
-            }        
-        }
+        yojimbo_assert( packetQueueSize > 0 );
+        m_allocator = &allocator;
+        m_address = address;
+        m_packetQueueSize = packetQueueSize;
+        m_maxClients = 0;
+        m_numConnectedClients = 0;
+        m_sequence = 0;
+        m_slots = NULL;
+        m_connectDisconnectFunction = NULL;
+        m_connectDisconnectContext = NULL;
     }
 
-    void BaseServer::SetLatency( float milliseconds )
+    MemoryServerTransport::~MemoryServerTransport()
     {
-        if ( m_networkSimulator )
-        {
-            m_networkSimulator->SetLatency( milliseconds );
-        }
+        // IMPORTANT: Please stop the transport before destroying it!
+        yojimbo_assert( !m_slots );
     }
 
-    void BaseServer::SetJitter( float milliseconds )
+    bool MemoryServerTransport::Start( Allocator & allocator, int maxClients, ConnectDisconnectFunction function, void * context, double time )
     {
-        if ( m_networkSimulator )
+        (void) allocator;
+        (void) time;
+        yojimbo_assert( !m_slots );
+        yojimbo_assert( maxClients > 0 );
+        m_connectDisconnectFunction = function;
+        m_connectDisconnectContext = context;
+        m_maxClients = maxClients;
+        m_numConnectedClients = 0;
+        m_slots = (Slot*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( Slot ) * maxClients );
+        for ( int i = 0; i < maxClients; ++i )
         {
-            m_networkSimulator->SetJitter( milliseconds );
+            m_slots[i].state = SLOT_FREE;
+            m_slots[i].clientId = 0;
+            m_slots[i].sequence = 0;
+            m_slots[i].toServer = YOJIMBO_NEW( *m_allocator, Queue<Packet>, *m_allocator, m_packetQueueSize );
+            m_slots[i].toClient = YOJIMBO_NEW( *m_allocator, Queue<Packet>, *m_allocator, m_packetQueueSize );
         }
+        return true;
     }
 
-    void BaseServer::SetPacketLoss( float percent )
+    void MemoryServerTransport::Stop()
     {
-        if ( m_networkSimulator )
+        if ( !m_slots )
+            return;
+        DisconnectAllClients();
+        for ( int i = 0; i < m_maxClients; ++i )
         {
-            m_networkSimulator->SetPacketLoss( percent );
+            FreeSlot( i );
+            YOJIMBO_DELETE( *m_allocator, Queue<Packet>, m_slots[i].toServer );
+            YOJIMBO_DELETE( *m_allocator, Queue<Packet>, m_slots[i].toClient );
         }
+        YOJIMBO_FREE( *m_allocator, m_slots );
+        m_maxClients = 0;
     }
 
-    void BaseServer::SetDuplicates( float percent )
+    void MemoryServerTransport::Update( double time )
     {
-        if ( m_networkSimulator )
+        (void) time;
+        yojimbo_assert( m_slots );
+        for ( int i = 0; i < m_maxClients; ++i )
         {
-            m_networkSimulator->SetDuplicates( percent );
+            if ( m_slots[i].state == SLOT_CONNECTING )
+            {
+                m_slots[i].state = SLOT_CONNECTED;
+                m_numConnectedClients++;
+                m_connectDisconnectFunction( m_connectDisconnectContext, i, 1 );
+            }
+            else if ( m_slots[i].state == SLOT_DISCONNECTING )
+            {
+                DisconnectClient( i );
+            }
         }
     }
 
-    Message * BaseServer::CreateMessage( int clientIndex, int type )
+    void MemoryServerTransport::DisconnectClient( int clientIndex )
     {
+        yojimbo_assert( m_slots );
         yojimbo_assert( clientIndex >= 0 );
         yojimbo_assert( clientIndex < m_maxClients );
-        yojimbo_assert( m_clientMessageFactory[clientIndex] );
-        return m_clientMessageFactory[clientIndex]->CreateMessage( type );
+        if ( !IsClientConnected( clientIndex ) )
+            return;
+        m_numConnectedClients--;
+        m_connectDisconnectFunction( m_connectDisconnectContext, clientIndex, 0 );
+        FreeSlot( clientIndex );
     }
 
-    uint8_t * BaseServer::AllocateBlock( int clientIndex, int bytes )
+    void MemoryServerTransport::DisconnectAllClients()
     {
-        yojimbo_assert( clientIndex >= 0 );
-        yojimbo_assert( clientIndex < m_maxClients );
-        yojimbo_assert( m_clientAllocator[clientIndex] );
-        return (uint8_t*) YOJIMBO_ALLOCATE( *m_clientAllocator[clientIndex], bytes );
+        yojimbo_assert( m_slots );
+        for ( int i = 0; i < m_maxClients; ++i )
+        {
+            DisconnectClient( i );
+        }
     }
 
-    void BaseServer::AttachBlockToMessage( int clientIndex, Message * message, uint8_t * block, int bytes )
+    bool MemoryServerTransport::IsClientConnected( int clientIndex ) const
     {
         yojimbo_assert( clientIndex >= 0 );
         yojimbo_assert( clientIndex < m_maxClients );
-        yojimbo_assert( message );
-        yojimbo_assert( block );
-        yojimbo_assert( bytes > 0 );
-        yojimbo_assert( message->IsBlockMessage() );
-        BlockMessage * blockMessage = (BlockMessage*) message;
-        blockMessage->AttachBlock( *m_clientAllocator[clientIndex], block, bytes );
+        // a slot the client has left stays connected on the server side until the next update
+        return m_slots[clientIndex].state == SLOT_CONNECTED || m_slots[clientIndex].state == SLOT_DISCONNECTING;
     }
 
-    void BaseServer::FreeBlock( int clientIndex, uint8_t * block )
+    uint64_t MemoryServerTransport::GetClientId( int clientIndex ) const
     {
         yojimbo_assert( clientIndex >= 0 );
         yojimbo_assert( clientIndex < m_maxClients );
-        YOJIMBO_FREE( *m_clientAllocator[clientIndex], block );
+        return IsClientConnected( clientIndex ) ? m_slots[clientIndex].clientId : 0;
     }
 
-    bool BaseServer::CanSendMessage( int clientIndex, int channelIndex ) const
+    void MemoryServerTransport::SendPackets( const int * clientIndex, uint8_t * const * packetData, const int * packetBytes, int numPackets )
     {
-        yojimbo_assert( clientIndex >= 0 );
-        yojimbo_assert( clientIndex < m_maxClients );
-        yojimbo_assert( m_clientConnection[clientIndex] );
-        return m_clientConnection[clientIndex]->CanSendMessage( channelIndex );
+        yojimbo_assert( m_slots );
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            yojimbo_assert( clientIndex[i] >= 0 );
+            yojimbo_assert( clientIndex[i] < m_maxClients );
+            if ( m_slots[clientIndex[i]].state == SLOT_CONNECTED )
+            {
+                QueuePacket( *m_slots[clientIndex[i]].toClient, packetData[i], packetBytes[i] );
+            }
+        }
     }
 
-    void BaseServer::SendMessage( int clientIndex, int channelIndex, Message * message )
+    int MemoryServerTransport::ReceivePackets( int clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets )
     {
+        yojimbo_assert( m_slots );
         yojimbo_assert( clientIndex >= 0 );
         yojimbo_assert( clientIndex < m_maxClients );
-        yojimbo_assert( m_clientConnection[clientIndex] );
-        return m_clientConnection[clientIndex]->SendMessage( channelIndex, message, GetContext() );
+        if ( m_slots[clientIndex].state != SLOT_CONNECTED )
+            return 0;
+        return PopPackets( *m_slots[clientIndex].toServer, packetData, packetBytes, maxPackets );
     }
 
-    Message * BaseServer::ReceiveMessage( int clientIndex, int channelIndex )
+    int MemoryServerTransport::ReceiveAllPackets( int * clientCapacity, int * clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets )
     {
-        yojimbo_assert( clientIndex >= 0 );
-        yojimbo_assert( clientIndex < m_maxClients );
-        yojimbo_assert( m_clientConnection[clientIndex] );
-        return m_clientConnection[clientIndex]->ReceiveMessage( channelIndex );
+        yojimbo_assert( m_slots );
+        int numPackets = 0;
+        for ( int i = 0; i < m_maxClients && numPackets < maxPackets; ++i )
+        {
+            if ( clientCapacity[i] <= 0 || m_slots[i].state != SLOT_CONNECTED )
+                continue;
+            const int numClientPackets = PopPackets( *m_slots[i].toServer, packetData + numPackets, packetBytes + numPackets, yojimbo_min( clientCapacity[i], maxPackets - numPackets ) );
+            for ( int j = 0; j < numClientPackets; ++j )
+            {
+                clientIndex[numPackets+j] = i;
+            }
+            clientCapacity[i] -= numClientPackets;
+            numPackets += numClientPackets;
+        }
+        return numPackets;
     }
 
-    void BaseServer::ReleaseMessage( int clientIndex, Message * message )
+    void MemoryServerTransport::FreePackets( uint8_t ** packetData, int numPackets )
     {
-        yojimbo_assert( clientIndex >= 0 );
-        yojimbo_assert( clientIndex < m_maxClients );
-        yojimbo_assert( m_clientConnection[clientIndex] );
-        m_clientConnection[clientIndex]->ReleaseMessage( message );
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            YOJIMBO_FREE( *m_allocator, packetData[i] );
+        }
     }
 
-    void BaseServer::GetNetworkInfo( int clientIndex, NetworkInfo & info ) const
+    int MemoryServerTransport::ConnectClient( uint64_t clientId, uint64_t & sequence )
     {
-        yojimbo_assert( IsRunning() );
-        yojimbo_assert( clientIndex >= 0 ); 
-        yojimbo_assert( clientIndex < m_maxClients );
-        memset( &info, 0, sizeof( info ) );
-        if ( IsClientConnected( clientIndex ) )
+        if ( !m_slots )
+            return -1;
+        for ( int i = 0; i < m_maxClients; ++i )
         {
-            yojimbo_assert( m_clientEndpoint[clientIndex] );
-            const uint64_t * counters = reliable_endpoint_counters( m_clientEndpoint[clientIndex] );
-            info.numPacketsSent = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_SENT];
-            info.numPacketsReceived = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_RECEIVED];
-            info.numPacketsAcked = counters[RELIABLE_ENDPOINT_COUNTER_NUM_PACKETS_ACKED];
-            info.RTT = reliable_endpoint_rtt( m_clientEndpoint[clientIndex] );
-            info.packetLoss = reliable_endpoint_packet_loss( m_clientEndpoint[clientIndex] );
-            reliable_endpoint_bandwidth( m_clientEndpoint[clientIndex], &info.sentBandwidth, &info.receivedBandwidth, &info.ackedBandwidth );
+            if ( m_slots[i].state == SLOT_FREE )
+            {
+                m_slots[i].state = SLOT_CONNECTING;
+                m_slots[i].clientId = clientId;
+                m_slots[i].sequence = ++m_sequence;
+                sequence = m_slots[i].sequence;
+                return i;
+            }
         }
+        return -1;
     }
 
-    MessageFactory & BaseServer::GetClientMessageFactory( int clientIndex ) 
-    { 
-        yojimbo_assert( IsRunning() ); 
-        yojimbo_assert( clientIndex >= 0 ); 
-        yojimbo_assert( clientIndex < m_maxClients );
-        return *m_clientMessageFactory[clientIndex];
-    }
-
-    reliable_endpoint_t * BaseServer::GetClientEndpoint( int clientIndex )
+    void MemoryServerTransport::ClientDisconnected( int clientIndex, uint64_t sequence )
     {
-        yojimbo_assert( IsRunning() ); 
-        yojimbo_assert( clientIndex >= 0 ); 
-        yojimbo_assert( clientIndex < m_maxClients );
-        return m_clientEndpoint[clientIndex];
+        if ( IsClientSlot( clientIndex, sequence, SLOT_CONNECTING ) )
+        {
+            FreeSlot( clientIndex );
+        }
+        else if ( IsClientSlot( clientIndex, sequence, SLOT_CONNECTED ) )
+        {
+            m_slots[clientIndex].state = SLOT_DISCONNECTING;
+            ClearPackets( *m_slots[clientIndex].toServer );
+            ClearPackets( *m_slots[clientIndex].toClient );
+        }
     }
 
-    Connection & BaseServer::GetClientConnection( int clientIndex )
+    bool MemoryServerTransport::IsClientSlot( int clientIndex, uint64_t sequence, SlotState state ) const
     {
-        yojimbo_assert( IsRunning() ); 
-        yojimbo_assert( clientIndex >= 0 ); 
-        yojimbo_assert( clientIndex < m_maxClients );
-        yojimbo_assert( m_clientConnection[clientIndex] );
-        return *m_clientConnection[clientIndex];
+        if ( !m_slots || clientIndex < 0 || clientIndex >= m_maxClients )
+            return false;
+        return m_slots[clientIndex].sequence == sequence && m_slots[clientIndex].state == state;
     }
 
-    void BaseServer::StaticTransmitPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    void MemoryServerTransport::QueuePacket( Queue<Packet> & queue, const uint8_t * packetData, int packetBytes )
     {
-        BaseServer * server = (BaseServer*) context;
-        server->TransmitPacketFunction( index, packetSequence, packetData, packetBytes );
+        if ( queue.IsFull() )
+            return;
+        Packet packet;
+        packet.data = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, packetBytes );
+        packet.bytes = packetBytes;
+        memcpy( packet.data, packetData, packetBytes );
+        queue.Push( packet );
     }
-    
-    int BaseServer::StaticProcessPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+
+    int MemoryServerTransport::PopPackets( Queue<Packet> & queue, uint8_t ** packetData, int * packetBytes, int maxPackets )
     {
-        BaseServer * server = (BaseServer*) context;
-        return server->ProcessPacketFunction( index, packetSequence, packetData, packetBytes );
+        int numPackets = 0;
+        while ( numPackets < maxPackets && !queue.IsEmpty() )
+        {
+            Packet packet = queue.Pop();
+            packetData[numPackets] = packet.data;
+            packetBytes[numPackets] = packet.bytes;
+            numPackets++;
+        }
+        return numPackets;
     }
 
-    void * BaseServer::StaticAllocateFunction( void * context, uint64_t bytes )
+    void MemoryServerTransport::ClearPackets( Queue<Packet> & queue )
     {
-        yojimbo_assert( context );
-        Allocator * allocator = (Allocator*) context;
-        return YOJIMBO_ALLOCATE( *allocator, bytes );
+        while ( !queue.IsEmpty() )
+        {
+            Packet packet = queue.Pop();
+            YOJIMBO_FREE( *m_allocator, packet.data );
+        }
     }
-    
-    void BaseServer::StaticFreeFunction( void * context, void * pointer )
+
+    void MemoryServerTransport::FreeSlot( int clientIndex )
     {
-        yojimbo_assert( context );
-        yojimbo_assert( pointer );
-        Allocator * allocator = (Allocator*) context;
-        YOJIMBO_FREE( *allocator, pointer );
+        m_slots[clientIndex].state = SLOT_FREE;
+        m_slots[clientIndex].clientId = 0;
+        ClearPackets( *m_slots[clientIndex].toServer );
+        ClearPackets( *m_slots[clientIndex].toClient );
     }
 
     // -----------------------------------------------------------------------------------------------------
 
-    Server::Server( Allocator & allocator, const uint8_t privateKey[], const Address & address, const ClientServerConfig & config, Adapter & adapter, double time ) 
-        : BaseServer( allocator, config, adapter, time )
+#if defined(__linux__)
+
+    static int GetSocketAddress( const Address & address, sockaddr_storage & socketAddress )
     {
-        yojimbo_assert( KeyBytes == NETCODE_KEY_BYTES );
-        memcpy( m_privateKey, privateKey, NETCODE_KEY_BYTES );
+        memset( &socketAddress, 0, sizeof( socketAddress ) );
+        if ( address.GetType() == ADDRESS_IPV6 )
+        {
+            sockaddr_in6 * socketAddress6 = (sockaddr_in6*) &socketAddress;
+            socketAddress6->sin6_family = AF_INET6;
+            socketAddress6->sin6_port = htons( address.GetPort() );
+            for ( int i = 0; i < 8; ++i )
+            {
+                socketAddress6->sin6_addr.s6_addr[i*2] = uint8_t( address.GetAddress6()[i] >> 8 );
+                socketAddress6->sin6_addr.s6_addr[i*2+1] = uint8_t( address.GetAddress6()[i] & 0xFF );
+            }
+            return sizeof( sockaddr_in6 );
+        }
+        sockaddr_in * socketAddress4 = (sockaddr_in*) &socketAddress;
+        socketAddress4->sin_family = AF_INET;
+        socketAddress4->sin_port = htons( address.GetPort() );
+        memcpy( &socketAddress4->sin_addr, address.GetAddress4(), 4 );
+        return sizeof( sockaddr_in );
+    }
+
+    UdpServerTransport::UdpServerTransport( Allocator & allocator, const Address & address, int batchSize, double timeout, int packetQueueSize )
+    {
+        yojimbo_assert( batchSize > 0 );
+        yojimbo_assert( packetQueueSize > 0 );
+        m_allocator = &allocator;
         m_address = address;
         m_boundAddress = address;
-        m_config = config;
-        m_server = NULL;
+        m_batchSize = batchSize;
+        m_timeout = timeout;
+        m_packetQueueSize = packetQueueSize;
+        m_socket = -1;
+        m_time = 0.0;
+        m_maxClients = 0;
+        m_numConnectedClients = 0;
+        m_slots = NULL;
+        m_slotAddress = NULL;
+        m_messages = NULL;
+        m_iovecs = NULL;
+        m_messageAddress = NULL;
+        m_receiveBuffers = NULL;
+        m_connectDisconnectFunction = NULL;
+        m_connectDisconnectContext = NULL;
     }
 
-    Server::~Server()
+    UdpServerTransport::~UdpServerTransport()
     {
-        // IMPORTANT: Please stop the server before destroying it!
-        yojimbo_assert( !m_server );
+        // IMPORTANT: Please stop the transport before destroying it!
+        yojimbo_assert( m_socket == -1 );
     }
 
-    void Server::Start( int maxClients )
+    bool UdpServerTransport::Start( Allocator & allocator, int maxClients, ConnectDisconnectFunction function, void * context, double time )
     {
-        if ( IsRunning() )
-            Stop();
-        
-        BaseServer::Start( maxClients );
-        
-        char addressString[MaxAddressLength];
-        m_address.ToString( addressString, MaxAddressLength );
-        
-        struct netcode_server_config_t netcodeConfig;
-        netcode_default_server_config(&netcodeConfig);
-        netcodeConfig.protocol_id = m_config.protocolId;
-        memcpy(netcodeConfig.private_key, m_privateKey, NETCODE_KEY_BYTES);
-        netcodeConfig.allocator_context = &GetGlobalAllocator();
-        netcodeConfig.allocate_function = StaticAllocateFunction;
-        netcodeConfig.free_function     = StaticFreeFunction;
-        netcodeConfig.callback_context = this;
-        netcodeConfig.connect_disconnect_callback = StaticConnectDisconnectCallbackFunction;
-        netcodeConfig.send_loopback_packet_callback = StaticSendLoopbackPacketCallbackFunction;
-        
-        m_server = netcode_server_create(addressString, &netcodeConfig, GetTime());
-        
-        if ( !m_server )
+        (void) allocator;
+        yojimbo_assert( m_socket == -1 );
+        yojimbo_assert( maxClients > 0 );
+
+        if ( !m_address.IsValid() )
         {
-            Stop();
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: udp server transport address is not valid\n" );
+            return false;
+        }
+
+        sockaddr_storage bindAddress;
+        const int bindAddressBytes = GetSocketAddress( m_address, bindAddress );
+
+        m_socket = socket( bindAddress.ss_family, SOCK_DGRAM, IPPROTO_UDP );
+        if ( m_socket < 0 )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to create udp socket\n" );
+            m_socket = -1;
+            return false;
+        }
+
+        if ( bindAddress.ss_family == AF_INET6 )
+        {
+            int ipv6Only = 1;
+            setsockopt( m_socket, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6Only, sizeof( ipv6Only ) );
+        }
+
+        // a tick can send and receive a burst of packets between reads, so ask for bigger socket buffers. best effort
+
+        int bufferSize = 4 * 1024 * 1024;
+        setsockopt( m_socket, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof( bufferSize ) );
+        setsockopt( m_socket, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof( bufferSize ) );
+
+        if ( bind( m_socket, (sockaddr*) &bindAddress, bindAddressBytes ) < 0 )
+        {
+            yojimbo_printf( YOJIMBO_LOG_LEVEL_ERROR, "error: failed to bind udp socket\n" );
+            close( m_socket );
+            m_socket = -1;
+            return false;
+        }
+
+        sockaddr_storage boundAddress;
+        socklen_t boundAddressBytes = sizeof( boundAddress );
+        if ( getsockname( m_socket, (sockaddr*) &boundAddress, &boundAddressBytes ) == 0 )
+        {
+            if ( boundAddress.ss_family == AF_INET6 )
+                m_boundAddress.SetPort( ntohs( ( (sockaddr_in6*) &boundAddress )->sin6_port ) );
+            else
+                m_boundAddress.SetPort( ntohs( ( (sockaddr_in*) &boundAddress )->sin_port ) );
+        }
+
+        m_connectDisconnectFunction = function;
+        m_connectDisconnectContext = context;
+        m_time = time;
+        m_maxClients = maxClients;
+        m_numConnectedClients = 0;
+
+        m_slots = (Slot*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( Slot ) * maxClients );
+        m_slotAddress = (sockaddr_storage*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( sockaddr_storage ) * maxClients );
+        for ( int i = 0; i < maxClients; ++i )
+        {
+            m_slots[i].packets = YOJIMBO_NEW( *m_allocator, Queue<Packet>, *m_allocator, m_packetQueueSize );
+            FreeSlot( i );
+        }
+
+        m_messages = (mmsghdr*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( mmsghdr ) * m_batchSize );
+        m_iovecs = (iovec*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( iovec ) * m_batchSize );
+        m_messageAddress = (sockaddr_storage*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( sockaddr_storage ) * m_batchSize );
+        m_receiveBuffers = (uint8_t**) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint8_t* ) * m_batchSize );
+        memset( m_receiveBuffers, 0, sizeof( uint8_t* ) * m_batchSize );
+
+        return true;
+    }
+
+    void UdpServerTransport::Stop()
+    {
+        if ( m_socket == -1 )
             return;
+        DisconnectAllClients();
+        for ( int i = 0; i < m_maxClients; ++i )
+        {
+            FreeSlot( i );
+            YOJIMBO_DELETE( *m_allocator, Queue<Packet>, m_slots[i].packets );
+        }
+        for ( int i = 0; i < m_batchSize; ++i )
+        {
+            YOJIMBO_FREE( *m_allocator, m_receiveBuffers[i] );
+        }
+        YOJIMBO_FREE( *m_allocator, m_receiveBuffers );
+        YOJIMBO_FREE( *m_allocator, m_messageAddress );
+        YOJIMBO_FREE( *m_allocator, m_iovecs );
+        YOJIMBO_FREE( *m_allocator, m_messages );
+        YOJIMBO_FREE( *m_allocator, m_slotAddress );
+        YOJIMBO_FREE( *m_allocator, m_slots );
+        close( m_socket );
+        m_socket = -1;
+        m_boundAddress = m_address;
+        m_maxClients = 0;
+    }
+
+    void UdpServerTransport::Update( double time )
+    {
+        yojimbo_assert( m_socket != -1 );
+        m_time = time;
+        for ( int i = 0; i < m_maxClients; ++i )
+        {
+            if ( m_slots[i].state == SLOT_CONNECTING )
+            {
+                m_slots[i].state = SLOT_CONNECTED;
+                m_numConnectedClients++;
+                m_connectDisconnectFunction( m_connectDisconnectContext, i, 1 );
+            }
+            else if ( m_slots[i].state == SLOT_CONNECTED && m_slots[i].lastPacketReceiveTime + m_timeout < time )
+            {
+                DisconnectClient( i );
+            }
         }
-        
-        netcode_server_start( m_server, maxClients );
+    }
 
-        m_boundAddress.SetPort( netcode_server_get_port( m_server ) );
+    void UdpServerTransport::DisconnectClient( int clientIndex )
+    {
+        yojimbo_assert( m_socket != -1 );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        if ( m_slots[clientIndex].state != SLOT_CONNECTED )
+            return;
+        m_numConnectedClients--;
+        m_connectDisconnectFunction( m_connectDisconnectContext, clientIndex, 0 );
+        FreeSlot( clientIndex );
     }
 
-    void Server::Stop()
+    void UdpServerTransport::DisconnectAllClients()
     {
-        if ( m_server )
+        yojimbo_assert( m_socket != -1 );
+        for ( int i = 0; i < m_maxClients; ++i )
         {
-            m_boundAddress = m_address;
-            netcode_server_stop( m_server );
-            netcode_server_destroy( m_server );
-            m_server = NULL;
+            DisconnectClient( i );
         }
-        BaseServer::Stop();
     }
 
-    void Server::DisconnectClient( int clientIndex )
+    bool UdpServerTransport::IsClientConnected( int clientIndex ) const
     {
-        yojimbo_assert( m_server );
-        netcode_server_disconnect_client( m_server, clientIndex );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+        return m_slots[clientIndex].state == SLOT_CONNECTED;
     }
 
-    void Server::DisconnectAllClients()
+    uint64_t UdpServerTransport::GetClientId( int clientIndex ) const
     {
-        yojimbo_assert( m_server );
-        netcode_server_disconnect_all_clients( m_server );
+        return IsClientConnected( clientIndex ) ? m_slots[clientIndex].clientId : 0;
     }
 
-    void Server::SendPackets()
+    void UdpServerTransport::SendPackets( const int * clientIndex, uint8_t * const * packetData, const int * packetBytes, int numPackets )
     {
-        if ( m_server )
+        yojimbo_assert( m_socket != -1 );
+        int i = 0;
+        while ( i < numPackets )
         {
-            const int maxClients = GetMaxClients();
-            for ( int i = 0; i < maxClients; ++i )
+            int numMessages = 0;
+            for ( ; i < numPackets && numMessages < m_batchSize; ++i )
             {
-                if ( IsClientConnected( i ) )
-                {
-                    uint8_t * packetData = GetPacketBuffer();
-                    int packetBytes;
-                    uint16_t packetSequence = reliable_endpoint_next_packet_sequence( GetClientEndpoint(i) );
-                    if ( GetClientConnection(i).GeneratePacket( GetContext(), packetSequence, packetData, m_config.maxPacketSize, packetBytes ) )
-                    {
-                        reliable_endpoint_send_packet( GetClientEndpoint(i), packetData, packetBytes );
-                    }
-                }
+                yojimbo_assert( clientIndex[i] >= 0 );
+                yojimbo_assert( clientIndex[i] < m_maxClients );
+                const Slot & slot = m_slots[clientIndex[i]];
+                if ( slot.state != SLOT_CONNECTED )
+                    continue;
+                m_iovecs[numMessages].iov_base = packetData[i];
+                m_iovecs[numMessages].iov_len = packetBytes[i];
+                memset( &m_messages[numMessages], 0, sizeof( mmsghdr ) );
+                m_messages[numMessages].msg_hdr.msg_name = &m_slotAddress[clientIndex[i]];
+                m_messages[numMessages].msg_hdr.msg_namelen = slot.addressBytes;
+                m_messages[numMessages].msg_hdr.msg_iov = &m_iovecs[numMessages];
+                m_messages[numMessages].msg_hdr.msg_iovlen = 1;
+                numMessages++;
             }
-        }
-    }
 
-    void Server::ReceivePackets()
-    {
-        if ( m_server )
-        {
-            const int maxClients = GetMaxClients();
-            for ( int clientIndex = 0; clientIndex < maxClients; ++clientIndex )
+            // sendmmsg stops at the first packet that fails. skip it and send the rest, unless the socket buffer is full
+
+            int numSent = 0;
+            while ( numSent < numMessages )
             {
-                while ( true )
+                const int result = sendmmsg( m_socket, m_messages + numSent, numMessages - numSent, MSG_DONTWAIT );
+                if ( result > 0 )
                 {
-                    int packetBytes;
-                    uint64_t packetSequence;
-                    uint8_t * packetData = netcode_server_receive_packet( m_server, clientIndex, &packetBytes, &packetSequence );
-                    if ( !packetData )
-                        break;
-                    reliable_endpoint_receive_packet( GetClientEndpoint( clientIndex ), packetData, packetBytes );
-                    netcode_server_free_packet( m_server, packetData );
+                    numSent += result;
+                    continue;
                 }
+                if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                    break;
+                numSent++;
             }
         }
     }
 
-    void Server::AdvanceTime( double time )
+    int UdpServerTransport::ReceivePackets( int clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets )
     {
-        if ( m_server )
-        {
-            netcode_server_update( m_server, time );
-        }
-        BaseServer::AdvanceTime( time );
-        NetworkSimulator * networkSimulator = GetNetworkSimulator();
-        if ( networkSimulator && networkSimulator->IsActive() )
+        yojimbo_assert( m_socket != -1 );
+        yojimbo_assert( clientIndex >= 0 );
+        yojimbo_assert( clientIndex < m_maxClients );
+
+        // packets read for other client slots wait in their queues
+
+        int * clientCapacity = (int*) alloca( sizeof( int ) * m_maxClients );
+        int * packetClientIndex = (int*) alloca( sizeof( int ) * maxPackets );
+        memset( clientCapacity, 0, sizeof( int ) * m_maxClients );
+        clientCapacity[clientIndex] = maxPackets;
+        return ReceiveAllPackets( clientCapacity, packetClientIndex, packetData, packetBytes, maxPackets );
+    }
+
+    int UdpServerTransport::ReceiveAllPackets( int * clientCapacity, int * clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets )
+    {
+        yojimbo_assert( m_socket != -1 );
+
+        int numPackets = 0;
+
+        // packets read earlier for client slots that could not take them go first
+
+        for ( int i = 0; i < m_maxClients && numPackets < maxPackets; ++i )
         {
-            uint8_t ** packetData = (uint8_t**) alloca( sizeof( uint8_t*) * m_config.maxSimulatorPackets );
-            int * packetBytes = (int*) alloca( sizeof(int) * m_config.maxSimulatorPackets );
-            int * to = (int*) alloca( sizeof(int) * m_config.maxSimulatorPackets );
-            int numPackets = networkSimulator->ReceivePackets( m_config.maxSimulatorPackets, packetData, packetBytes, to );
-            for ( int i = 0; i < numPackets; ++i )
+            Queue<Packet> & queue = *m_slots[i].packets;
+            while ( m_slots[i].state == SLOT_CONNECTED && clientCapacity[i] > 0 && numPackets < maxPackets && !queue.IsEmpty() )
             {
-                netcode_server_send_packet( m_server, to[i], (uint8_t*) packetData[i], packetBytes[i] );
-                YOJIMBO_FREE( networkSimulator->GetAllocator(), packetData[i] );
+                Packet packet = queue.Pop();
+                clientIndex[numPackets] = i;
+                packetData[numPackets] = packet.data;
+                packetBytes[numPackets] = packet.bytes;
+                clientCapacity[i]--;
+                numPackets++;
             }
         }
-    }
 
-    bool Server::IsClientConnected( int clientIndex ) const
-    {
-        return netcode_server_client_connected( m_server, clientIndex ) != 0;
-    }
+        // then read the socket. packets for slots that can't take them are queued on the slot
 
-    uint64_t Server::GetClientId( int clientIndex ) const
-    {
-        return netcode_server_client_id( m_server, clientIndex );
-    }
+        while ( numPackets < maxPackets )
+        {
+            const int maxMessages = yojimbo_min( maxPackets - numPackets, m_batchSize );
 
-    int Server::GetNumConnectedClients() const
-    {
-        return netcode_server_num_connected_clients( m_server );
-    }
+            const int numMessages = ReadSocket( maxMessages );
 
-    void Server::ConnectLoopbackClient( int clientIndex, uint64_t clientId, const uint8_t * userData )
-    {
-        netcode_server_connect_loopback_client( m_server, clientIndex, clientId, userData );
-    }
+            for ( int i = 0; i < numMessages; ++i )
+            {
+                if ( m_messages[i].msg_hdr.msg_flags & MSG_TRUNC )
+                    continue;
 
-    void Server::DisconnectLoopbackClient( int clientIndex )
-    {
-        netcode_server_disconnect_loopback_client( m_server, clientIndex );
-    }
+                const int slotIndex = FindClientSlot( i );
+                if ( slotIndex < 0 )
+                    continue;
 
-    bool Server::IsLoopbackClient( int clientIndex ) const
-    {
-        return netcode_server_client_loopback( m_server, clientIndex ) != 0;
-    }
+                Slot & slot = m_slots[slotIndex];
+                slot.lastPacketReceiveTime = m_time;
 
-    void Server::ProcessLoopbackPacket( int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
-    {
-        netcode_server_process_loopback_packet( m_server, clientIndex, packetData, packetBytes, packetSequence );
+                Packet packet;
+                packet.data = m_receiveBuffers[i];
+                packet.bytes = int( m_messages[i].msg_len );
+
+                if ( slot.state == SLOT_CONNECTED && clientCapacity[slotIndex] > 0 )
+                {
+                    clientIndex[numPackets] = slotIndex;
+                    packetData[numPackets] = packet.data;
+                    packetBytes[numPackets] = packet.bytes;
+                    clientCapacity[slotIndex]--;
+                    numPackets++;
+                }
+                else if ( !slot.packets->IsFull() )
+                {
+                    slot.packets->Push( packet );
+                }
+                else
+                {
+                    continue;
+                }
+
+                m_receiveBuffers[i] = NULL;
+            }
+
+            if ( numMessages < maxMessages )
+                break;
+        }
+
+        return numPackets;
     }
 
-    void Server::TransmitPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    void UdpServerTransport::FreePackets( uint8_t ** packetData, int numPackets )
     {
-        (void) packetSequence;
-        NetworkSimulator * networkSimulator = GetNetworkSimulator();
-        if ( networkSimulator && networkSimulator->IsActive() )
-        {
-            networkSimulator->SendPacket( clientIndex, packetData, packetBytes );
-        }
-        else
+        for ( int i = 0; i < numPackets; ++i )
         {
-            netcode_server_send_packet( m_server, clientIndex, packetData, packetBytes );
+            YOJIMBO_FREE( *m_allocator, packetData[i] );
         }
     }
 
-    int Server::ProcessPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes )
+    int UdpServerTransport::ReadSocket( int maxPackets )
     {
-        return (int) GetClientConnection(clientIndex).ProcessPacket( GetContext(), packetSequence, packetData, packetBytes );
+        yojimbo_assert( maxPackets <= m_batchSize );
+
+        // buffers handed out with packets since the last read are replaced here
+
+        for ( int i = 0; i < maxPackets; ++i )
+        {
+            if ( !m_receiveBuffers[i] )
+            {
+                m_receiveBuffers[i] = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, MaxUdpPacketBytes );
+                if ( !m_receiveBuffers[i] )
+                {
+                    maxPackets = i;
+                    break;
+                }
+            }
+            m_iovecs[i].iov_base = m_receiveBuffers[i];
+            m_iovecs[i].iov_len = MaxUdpPacketBytes;
+            memset( &m_messages[i], 0, sizeof( mmsghdr ) );
+            m_messages[i].msg_hdr.msg_name = &m_messageAddress[i];
+            m_messages[i].msg_hdr.msg_namelen = sizeof( sockaddr_storage );
+            m_messages[i].msg_hdr.msg_iov = &m_iovecs[i];
+            m_messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        if ( maxPackets == 0 )
+            return 0;
+
+        const int result = recvmmsg( m_socket, m_messages, maxPackets, MSG_DONTWAIT, NULL );
+
+        return result > 0 ? result : 0;
     }
 
-    void Server::ConnectDisconnectCallbackFunction( int clientIndex, int connected )
+    int UdpServerTransport::FindClientSlot( int messageIndex )
     {
-        if ( connected == 0 )
+        const sockaddr_storage & address = m_messageAddress[messageIndex];
+        const int addressBytes = int( m_messages[messageIndex].msg_hdr.msg_namelen );
+
+        int freeSlot = -1;
+
+        for ( int i = 0; i < m_maxClients; ++i )
         {
-            GetAdapter().OnServerClientDisconnected( clientIndex );
-            reliable_endpoint_reset( GetClientEndpoint( clientIndex ) );
-            GetClientConnection( clientIndex ).Reset();
-            NetworkSimulator * networkSimulator = GetNetworkSimulator();
-            if ( networkSimulator && networkSimulator->IsActive() )
+            if ( m_slots[i].state == SLOT_FREE )
             {
-                networkSimulator->DiscardClientPackets( clientIndex );
+                if ( freeSlot < 0 )
+                    freeSlot = i;
+                continue;
             }
+            if ( m_slots[i].addressBytes == addressBytes && memcmp( &m_slotAddress[i], &address, addressBytes ) == 0 )
+                return i;
         }
-        else
+
+        // a packet from a new address takes a free slot. the server sees the client connect on the next update
+
+        if ( freeSlot >= 0 )
         {
-            GetAdapter().OnServerClientConnected( clientIndex );
+            m_slots[freeSlot].state = SLOT_CONNECTING;
+            m_slots[freeSlot].clientId = murmur_hash_64( &address, addressBytes, 0 );
+            m_slots[freeSlot].addressBytes = addressBytes;
+            memcpy( &m_slotAddress[freeSlot], &address, addressBytes );
         }
-    }
 
-    void Server::SendLoopbackPacketCallbackFunction( int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
-    {
-        GetAdapter().ServerSendLoopbackPacket( clientIndex, packetData, packetBytes, packetSequence );
+        return freeSlot;
     }
 
-    void Server::StaticConnectDisconnectCallbackFunction( void * context, int clientIndex, int connected )
+    void UdpServerTransport::FreeSlot( int clientIndex )
     {
-        Server * server = (Server*) context;
-        server->ConnectDisconnectCallbackFunction( clientIndex, connected );
+        Slot & slot = m_slots[clientIndex];
+        slot.state = SLOT_FREE;
+        slot.clientId = 0;
+        slot.addressBytes = 0;
+        slot.lastPacketReceiveTime = 0.0;
+        while ( !slot.packets->IsEmpty() )
+        {
+            Packet packet = slot.packets->Pop();
+            YOJIMBO_FREE( *m_allocator, packet.data );
+        }
     }
 
-    void Server::StaticSendLoopbackPacketCallbackFunction( void * context, int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence )
-    {
-        Server * server = (Server*) context;
-        server->SendLoopbackPacketCallbackFunction( clientIndex, packetData, packetBytes, packetSequence );
-    }
+#endif // #if defined(__linux__)
 }
 
 // ---------------------------------------------------------------------------------
@@ -4174,3 +8575,351 @@ namespace yojimbo
 }
 
 // ---------------------------------------------------------------------------------
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else // #if defined(_WIN32)
+#include <pthread.h>
+#endif // #if defined(_WIN32)
+
+namespace yojimbo
+{
+    struct WorkerThreadData
+    {
+        struct WorkerPoolInternal * internal;
+        int workerIndex;
+    };
+
+    struct WorkerPoolInternal
+    {
+        int numWorkers;
+        int numBusyWorkers;
+        uint64_t generation;
+        bool quit;
+        WorkerPool::WorkFunction function;
+        void * context;
+        WorkerThreadData * threadData;
+#if defined(_WIN32)
+        HANDLE * threads;
+        CRITICAL_SECTION mutex;
+        CONDITION_VARIABLE workReady;
+        CONDITION_VARIABLE workDone;
+#else // #if defined(_WIN32)
+        pthread_t * threads;
+        pthread_mutex_t mutex;
+        pthread_cond_t workReady;
+        pthread_cond_t workDone;
+#endif // #if defined(_WIN32)
+    };
+
+#if defined(_WIN32)
+
+    static void worker_mutex_create( CRITICAL_SECTION * mutex ) { InitializeCriticalSection( mutex ); }
+    static void worker_mutex_destroy( CRITICAL_SECTION * mutex ) { DeleteCriticalSection( mutex ); }
+    static void worker_mutex_lock( CRITICAL_SECTION * mutex ) { EnterCriticalSection( mutex ); }
+    static void worker_mutex_unlock( CRITICAL_SECTION * mutex ) { LeaveCriticalSection( mutex ); }
+    static void worker_cond_create( CONDITION_VARIABLE * cond ) { InitializeConditionVariable( cond ); }
+    static void worker_cond_destroy( CONDITION_VARIABLE * cond ) { (void) cond; }
+    static void worker_cond_wait( CONDITION_VARIABLE * cond, CRITICAL_SECTION * mutex ) { SleepConditionVariableCS( cond, mutex, INFINITE ); }
+    static void worker_cond_broadcast( CONDITION_VARIABLE * cond ) { WakeAllConditionVariable( cond ); }
+
+#else // #if defined(_WIN32)
+
+    static void worker_mutex_create( pthread_mutex_t * mutex ) { pthread_mutex_init( mutex, NULL ); }
+    static void worker_mutex_destroy( pthread_mutex_t * mutex ) { pthread_mutex_destroy( mutex ); }
+    static void worker_mutex_lock( pthread_mutex_t * mutex ) { pthread_mutex_lock( mutex ); }
+    static void worker_mutex_unlock( pthread_mutex_t * mutex ) { pthread_mutex_unlock( mutex ); }
+    static void worker_cond_create( pthread_cond_t * cond ) { pthread_cond_init( cond, NULL ); }
+    static void worker_cond_destroy( pthread_cond_t * cond ) { pthread_cond_destroy( cond ); }
+    static void worker_cond_wait( pthread_cond_t * cond, pthread_mutex_t * mutex ) { pthread_cond_wait( cond, mutex ); }
+    static void worker_cond_broadcast( pthread_cond_t * cond ) { pthread_cond_broadcast( cond ); }
+
+#endif // #if defined(_WIN32)
+
+    static void worker_thread_loop( WorkerThreadData * data )
+    {
+        WorkerPoolInternal * internal = data->internal;
+        uint64_t generation = 0;
+        worker_mutex_lock( &internal->mutex );
+        while ( true )
+        {
+            while ( internal->generation == generation && !internal->quit )
+                worker_cond_wait( &internal->workReady, &internal->mutex );
+            if ( internal->quit )
+                break;
+            generation = internal->generation;
+            WorkerPool::WorkFunction function = internal->function;
+            void * context = internal->context;
+            worker_mutex_unlock( &internal->mutex );
+            function( context, data->workerIndex, internal->numWorkers );
+            worker_mutex_lock( &internal->mutex );
+            if ( --internal->numBusyWorkers == 0 )
+                worker_cond_broadcast( &internal->workDone );
+        }
+        worker_mutex_unlock( &internal->mutex );
+    }
+
+#if defined(_WIN32)
+    static DWORD WINAPI worker_thread_function( LPVOID data )
+    {
+        worker_thread_loop( (WorkerThreadData*) data );
+        return 0;
+    }
+#else // #if defined(_WIN32)
+    static void * worker_thread_function( void * data )
+    {
+        worker_thread_loop( (WorkerThreadData*) data );
+        return NULL;
+    }
+#endif // #if defined(_WIN32)
+
+    WorkerPool::WorkerPool( Allocator & allocator, int numWorkers )
+    {
+        yojimbo_assert( numWorkers >= 1 );
+        m_allocator = &allocator;
+        m_numWorkers = numWorkers;
+        m_internal = YOJIMBO_NEW( allocator, WorkerPoolInternal );
+        m_internal->numWorkers = numWorkers;
+        m_internal->numBusyWorkers = 0;
+        m_internal->generation = 0;
+        m_internal->quit = false;
+        m_internal->function = NULL;
+        m_internal->context = NULL;
+        worker_mutex_create( &m_internal->mutex );
+        worker_cond_create( &m_internal->workReady );
+        worker_cond_create( &m_internal->workDone );
+        const int numThreads = numWorkers - 1;
+        m_internal->threadData = (WorkerThreadData*) YOJIMBO_ALLOCATE( allocator, sizeof( WorkerThreadData ) * ( numThreads + 1 ) );
+#if defined(_WIN32)
+        m_internal->threads = (HANDLE*) YOJIMBO_ALLOCATE( allocator, sizeof( HANDLE ) * ( numThreads + 1 ) );
+#else // #if defined(_WIN32)
+        m_internal->threads = (pthread_t*) YOJIMBO_ALLOCATE( allocator, sizeof( pthread_t ) * ( numThreads + 1 ) );
+#endif // #if defined(_WIN32)
+        for ( int i = 0; i < numThreads; ++i )
+        {
+            m_internal->threadData[i].internal = m_internal;
+            m_internal->threadData[i].workerIndex = i + 1;
+#if defined(_WIN32)
+            m_internal->threads[i] = CreateThread( NULL, 0, worker_thread_function, &m_internal->threadData[i], 0, NULL );
+            yojimbo_assert( m_internal->threads[i] );
+#else // #if defined(_WIN32)
+            const int result = pthread_create( &m_internal->threads[i], NULL, worker_thread_function, &m_internal->threadData[i] );
+            yojimbo_assert( result == 0 );
+            (void) result;
+#endif // #if defined(_WIN32)
+        }
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        worker_mutex_lock( &m_internal->mutex );
+        m_internal->quit = true;
+        worker_cond_broadcast( &m_internal->workReady );
+        worker_mutex_unlock( &m_internal->mutex );
+        const int numThreads = m_numWorkers - 1;
+        for ( int i = 0; i < numThreads; ++i )
+        {
+#if defined(_WIN32)
+            WaitForSingleObject( m_internal->threads[i], INFINITE );
+            CloseHandle( m_internal->threads[i] );
+#else // #if defined(_WIN32)
+            pthread_join( m_internal->threads[i], NULL );
+#endif // #if defined(_WIN32)
+        }
+        worker_cond_destroy( &m_internal->workDone );
+        worker_cond_destroy( &m_internal->workReady );
+        worker_mutex_destroy( &m_internal->mutex );
+        YOJIMBO_FREE( *m_allocator, m_internal->threads );
+        YOJIMBO_FREE( *m_allocator, m_internal->threadData );
+        YOJIMBO_DELETE( *m_allocator, WorkerPoolInternal, m_internal );
+        m_allocator = NULL;
+    }
+
+    void WorkerPool::Run( WorkFunction function, void * context )
+    {
+        yojimbo_assert( function );
+        if ( m_numWorkers > 1 )
+        {
+            worker_mutex_lock( &m_internal->mutex );
+            m_internal->function = function;
+            m_internal->context = context;
+            m_internal->numBusyWorkers = m_numWorkers - 1;
+            m_internal->generation++;
+            worker_cond_broadcast( &m_internal->workReady );
+            worker_mutex_unlock( &m_internal->mutex );
+        }
+        function( context, 0, m_numWorkers );
+        if ( m_numWorkers > 1 )
+        {
+            worker_mutex_lock( &m_internal->mutex );
+            while ( m_internal->numBusyWorkers > 0 )
+                worker_cond_wait( &m_internal->workDone, &m_internal->mutex );
+            worker_mutex_unlock( &m_internal->mutex );
+        }
+    }
+
+    Mutex::Mutex()
+    {
+#if defined(_WIN32)
+        yojimbo_assert( sizeof( CRITICAL_SECTION ) <= sizeof( m_storage ) );
+        worker_mutex_create( (CRITICAL_SECTION*) m_storage );
+#else // #if defined(_WIN32)
+        yojimbo_assert( sizeof( pthread_mutex_t ) <= sizeof( m_storage ) );
+        worker_mutex_create( (pthread_mutex_t*) m_storage );
+#endif // #if defined(_WIN32)
+    }
+
+    Mutex::~Mutex()
+    {
+#if defined(_WIN32)
+        worker_mutex_destroy( (CRITICAL_SECTION*) m_storage );
+#else // #if defined(_WIN32)
+        worker_mutex_destroy( (pthread_mutex_t*) m_storage );
+#endif // #if defined(_WIN32)
+    }
+
+    void Mutex::Lock()
+    {
+#if defined(_WIN32)
+        worker_mutex_lock( (CRITICAL_SECTION*) m_storage );
+#else // #if defined(_WIN32)
+        worker_mutex_lock( (pthread_mutex_t*) m_storage );
+#endif // #if defined(_WIN32)
+    }
+
+    void Mutex::Unlock()
+    {
+#if defined(_WIN32)
+        worker_mutex_unlock( (CRITICAL_SECTION*) m_storage );
+#else // #if defined(_WIN32)
+        worker_mutex_unlock( (pthread_mutex_t*) m_storage );
+#endif // #if defined(_WIN32)
+    }
+
+    void * LockedAllocator::Allocate( size_t size, const char * file, int line )
+    {
+        m_mutex.Lock();
+        void * p = m_allocator->Allocate( size, file, line );
+        if ( !p )
+            SetErrorLevel( ALLOCATOR_ERROR_OUT_OF_MEMORY );
+        m_mutex.Unlock();
+        return p;
+    }
+
+    void LockedAllocator::Free( void * p, const char * file, int line )
+    {
+        m_mutex.Lock();
+        m_allocator->Free( p, file, line );
+        m_mutex.Unlock();
+    }
+
+#if defined(_WIN32)
+    static __declspec(thread) const NetworkThread * current_network_thread = NULL;
+#else // #if defined(_WIN32)
+    static __thread const NetworkThread * current_network_thread = NULL;
+#endif // #if defined(_WIN32)
+
+    struct NetworkThreadEntry
+    {
+#if defined(_WIN32)
+        static DWORD WINAPI Run( LPVOID data )
+        {
+            NetworkThread::ThreadLoop( (NetworkThread*) data );
+            return 0;
+        }
+#else // #if defined(_WIN32)
+        static void * Run( void * data )
+        {
+            NetworkThread::ThreadLoop( (NetworkThread*) data );
+            return NULL;
+        }
+#endif // #if defined(_WIN32)
+    };
+
+    NetworkThread::NetworkThread()
+    {
+        m_function = NULL;
+        m_context = NULL;
+        m_startTime = 0.0;
+        m_tickRate = 0;
+        m_running = false;
+        m_quit = 0;
+        memset( m_thread, 0, sizeof( m_thread ) );
+    }
+
+    NetworkThread::~NetworkThread()
+    {
+        // IMPORTANT: Please stop the network thread before destroying it!
+        yojimbo_assert( !m_running );
+    }
+
+    void NetworkThread::Start( TickFunction function, void * context, double time, int tickRate )
+    {
+        yojimbo_assert( !m_running );
+        yojimbo_assert( function );
+        yojimbo_assert( tickRate > 0 );
+        m_function = function;
+        m_context = context;
+        m_startTime = time;
+        m_tickRate = tickRate;
+        m_quit = 0;
+        m_running = true;
+        // yojimbo_time sets up its time base on first call, so make sure that happens here and not on two threads at once
+        yojimbo_time();
+#if defined(_WIN32)
+        yojimbo_assert( sizeof( HANDLE ) <= sizeof( m_thread ) );
+        HANDLE thread = CreateThread( NULL, 0, NetworkThreadEntry::Run, this, 0, NULL );
+        yojimbo_assert( thread );
+        memcpy( m_thread, &thread, sizeof( thread ) );
+#else // #if defined(_WIN32)
+        yojimbo_assert( sizeof( pthread_t ) <= sizeof( m_thread ) );
+        const int result = pthread_create( (pthread_t*) m_thread, NULL, NetworkThreadEntry::Run, this );
+        yojimbo_assert( result == 0 );
+        (void) result;
+#endif // #if defined(_WIN32)
+    }
+
+    void NetworkThread::Stop()
+    {
+        yojimbo_assert( m_running );
+        yojimbo_assert( !IsCurrentThread() );
+        yojimbo_atomic_store( &m_quit, 1 );
+#if defined(_WIN32)
+        HANDLE thread;
+        memcpy( &thread, m_thread, sizeof( thread ) );
+        WaitForSingleObject( thread, INFINITE );
+        CloseHandle( thread );
+#else // #if defined(_WIN32)
+        pthread_join( *(pthread_t*) m_thread, NULL );
+#endif // #if defined(_WIN32)
+        memset( m_thread, 0, sizeof( m_thread ) );
+        m_running = false;
+    }
+
+    bool NetworkThread::IsCurrentThread() const
+    {
+        return current_network_thread == this;
+    }
+
+    void NetworkThread::ThreadLoop( NetworkThread * thread )
+    {
+        current_network_thread = thread;
+        const double tickTime = 1.0 / thread->m_tickRate;
+        const double startTime = yojimbo_time();
+        uint64_t tick = 0;
+        while ( !yojimbo_atomic_load( &thread->m_quit ) )
+        {
+            const double elapsed = yojimbo_time() - startTime;
+            thread->m_function( thread->m_context, thread->m_startTime + elapsed );
+            tick++;
+            // keep to a fixed schedule. if ticks fall more than one tick behind, skip ahead instead of running them back to back
+            const double wait = tick * tickTime - ( yojimbo_time() - startTime );
+            if ( wait > 0.0 )
+                yojimbo_sleep( wait );
+            else if ( wait < -tickTime )
+                tick = uint64_t( ( yojimbo_time() - startTime ) / tickTime );
+        }
+        current_network_thread = NULL;
+    }
+}
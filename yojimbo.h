@@ -154,27 +154,36 @@
 struct netcode_server_t;
 struct netcode_client_t;
 struct reliable_endpoint_t;
+struct mmsghdr;
+struct iovec;
+struct sockaddr_storage;
 
 /// The library namespace.
 
 namespace yojimbo
 {
-    const int MaxClients = 64;                                      ///< The maximum number of clients supported by this library. You can increase this if you want, but this library is designed around patterns that work best for [2,64] player games. If your game has less than 64 clients, reducing this will save memory.
+    const int MaxClients = 64;                                      ///< Default number of client slots for servers. Server::Start accepts any number of slots up to NETCODE_MAX_CLIENTS, and BaseServer::Start has no upper limit, since the slot tables are sized at start. Each slot costs ClientServerConfig::serverPerClientMemory bytes.
+    const int MaxQueuedClientPackets = 64;                          ///< Received packets each client slot can queue in a server tick with worker threads. Sent packets are queued until the end of BaseServer::SendClientPackets, with room for ClientServerConfig::maxPacketFragments per client slot.
+    const int MaxTransmitPackets = 256;                             ///< Most packets the server passes to BaseServer::TransmitPackets in one call when it flushes the packets queued in a tick.
+    const int MaxReceivePackets = 256;                              ///< Most packets the server reads from ServerTransport::ReceiveAllPackets in one call.
+    const int MaxUdpPacketBytes = 1500;                             ///< Largest datagram UdpServerTransport receives. Larger datagrams are dropped.
+    const int MaxUnackedReceivedPackets = 16;                       ///< With ConnectionConfig::keepAliveInterval set, a packet goes out at least once every this many packets received, so they all get acked. reliable.io acks the last 33 packets received, so half that still covers one lost ack packet.
     const int MaxChannels = 64;                                     ///< The maximum number of message channels supported by this library. If you need less than 64 channels per-packet, reducing this will save memory.
     const int KeyBytes = 32;                                        ///< Size of encryption key for dedicated client/server in bytes. Must be equal to key size for libsodium encryption primitive. Do not change.
     const int ConnectTokenBytes = 2048;                             ///< Size of the encrypted connect token data return from the matchmaker. Must equal size of NETCODE_CONNECT_TOKEN_BYTE (2048).
     const uint32_t SerializeCheckValue = 0x12345678;                ///< The value written to the stream for serialize checks. See WriteStream::SerializeCheck and ReadStream::SerializeCheck.
-    const int ConservativeMessageHeaderBits = 32;                   ///< Conservative number of bits per-message header.
-    const int ConservativeFragmentHeaderBits = 64;                  ///< Conservative number of bits per-fragment header.
-    const int ConservativeChannelHeaderBits = 32;                   ///< Conservative number of bits per-channel header.
-    const int ConservativePacketHeaderBits = 16;                    ///< Conservative number of bits per-packet header.
+    const int MaxStreamedBlockFragments = 0x7FFFFFFF;               ///< The maximum number of fragments in a streamed block. See BlockMessage::AttachBlockSource.
+    const int MaxParityPayloadBytes = 65535;                        ///< The largest channel entry an unreliable channel with ChannelConfig::packetParityGroupSize set can write to a packet (bytes).
+    const int MaxPacketChannelEntries = 64;                         ///< The maximum number of channel entries in a connection packet. A channel sending a block tops up leftover packet space with extra entries, one per additional fragment. See Connection::GeneratePacket.
 
     /// Determines the reliability and ordering guarantees for a channel.
 
     enum ChannelType
     {
         CHANNEL_TYPE_RELIABLE_ORDERED,                              ///< Messages are received reliably and in the same order they were sent. 
-        CHANNEL_TYPE_UNRELIABLE_UNORDERED                           ///< Messages are sent unreliably. Messages may arrive out of order, or not at all.
+        CHANNEL_TYPE_UNRELIABLE_UNORDERED,                          ///< Messages are sent unreliably. Messages may arrive out of order, or not at all.
+        CHANNEL_TYPE_RELIABLE_UNORDERED,                            ///< Messages are received reliably, but are delivered as soon as they arrive, which may be out of order.
+        CHANNEL_TYPE_UNRELIABLE_SEQUENCED                           ///< Messages are sent unreliably. Messages older than the most recent message received are discarded.
     };
 
     /** 
@@ -182,7 +191,7 @@ namespace yojimbo
      
         Channels let you specify different reliability and ordering guarantees for messages sent across a connection.
      
-        They may be configured as one of two types: reliable-ordered or unreliable-unordered.
+        They may be configured as one of four types: reliable-ordered, unreliable-unordered, reliable-unordered or unreliable-sequenced.
      
         Reliable ordered channels guarantee that messages (see Message) are received reliably and in the same order they were sent. 
         This channel type is designed for control messages and RPCs sent between the client and server.
@@ -190,6 +199,14 @@ namespace yojimbo
         Unreliable unordered channels are like UDP. There is no guarantee that messages will arrive, and messages may arrive out of order.
         This channel type is designed for data that is time critical and should not be resent if dropped, like snapshots of world state sent rapidly 
         from server to client, or cosmetic events such as effects and sounds.
+
+        Reliable unordered channels guarantee that messages are received, but deliver each message as soon as it arrives instead of waiting for the messages sent before it.
+        A dropped packet only delays the messages it carried, so this channel type is designed for independent reliable events where head-of-line blocking would hurt latency.
+        Blocks sent over a reliable-unordered channel are split into fragments like the reliable-ordered channel, and the block message is delivered once all fragments arrive.
+
+        Unreliable sequenced channels are like unreliable-unordered channels, except each message is tagged with a per-channel sequence number and any message 
+        older than the most recent message received is discarded. This channel type is designed for state updates where only the newest value matters.
+        Set ChannelConfig::latestOnly to keep only the newest message in the receive queue.
         
         Both channel types support blocks of data attached to messages (see BlockMessage), but their treatment of blocks is quite different.
         
@@ -202,41 +219,68 @@ namespace yojimbo
         should be used on top of the generated packet to split it up into into smaller packets that can be sent across typical Internet MTU (<1500 bytes). 
         Because of this, you need to make sure that the maximum block size for an unreliable-unordered channel fits within the maximum packet size.
         
+        When several channels have messages to send, channels with higher priority are serviced first. Channels with the same priority take turns getting 
+        first pick of each packet, using deficit round robin so that over time each channel gets a share of bandwidth proportional to its weight.
+
         Channels are typically configured as part of a ConnectionConfig, which is included inside the ClientServerConfig that is passed into the Client and Server constructors.
      */
 
     struct ChannelConfig
     {
-        ChannelType type;                                           ///< Channel type: reliable-ordered or unreliable-unordered.
+        ChannelType type;                                           ///< Channel type: reliable-ordered, unreliable-unordered, reliable-unordered or unreliable-sequenced.
         bool disableBlocks;                                         ///< Disables blocks being sent across this channel.
+        bool latestOnly;                                            ///< Receive queue holds only the most recent message. Older messages still in the queue are released when a newer one arrives. Unreliable-sequenced channel only.
+        bool aggregateMessages;                                     ///< Pack each run of same-type messages in a packet under a single message type and count, instead of writing the message type for every message. Saves bandwidth when sending many small messages of the same type.
+        int priority;                                               ///< Channels with higher priority get first pick of the space in each packet. Channels with the same priority share the packet according to their weight.
+        int weight;                                                 ///< Relative share of packet bandwidth versus other channels with the same priority. Must be at least 1. See Connection::GeneratePacket.
         int sentPacketBufferSize;                                   ///< Number of packet entries in the sent packet sequence buffer. Please consider your packet send rate and make sure you have at least a few seconds worth of entries in this buffer.
         int messageSendQueueSize;                                   ///< Number of messages in the send queue for this channel.
         int messageReceiveQueueSize;                                ///< Number of messages in the receive queue for this channel.
         int maxMessagesPerPacket;                                   ///< Maximum number of messages to include in each packet. Will write up to this many messages, provided the messages fit into the channel packet budget and the number of bytes remaining in the packet.
+        int sentPacketMessageIdBufferSize;                          ///< Size of the ring buffer holding the ids of the messages included in each sent packet (entries). Each run of consecutive message ids in a packet takes two entries. If a packet's ids are overwritten before it is acked, its messages are resent instead. Must divide 65536 evenly and be at least 2 * maxMessagesPerPacket. Reliable channels only.
         int packetBudget;                                           ///< Maximum amount of message data to write to the packet for this channel (bytes). Specifying -1 means the channel can use up to the rest of the bytes remaining in the packet.
         int maxBlockSize;                                           ///< The size of the largest block that can be sent across this channel (bytes).
-        int blockFragmentSize;                                      ///< Blocks are split up into fragments of this size (bytes). Reliable-ordered channel only.
-        float messageResendTime;                                    ///< Minimum delay between message resends (seconds). Avoids sending the same message too frequently. Reliable-ordered channel only.
-        float blockFragmentResendTime;                              ///< Minimum delay between block fragment resends (seconds). Avoids sending the same fragment too frequently. Reliable-ordered channel only.
+        int blockFragmentSize;                                      ///< Blocks are split up into fragments of this size (bytes). Reliable channels only.
+        float messageResendTime;                                    ///< Minimum delay between message resends (seconds). Avoids sending the same message too frequently. Reliable channels only.
+        float blockFragmentResendTime;                              ///< Minimum delay between block fragment resends (seconds). Avoids sending the same fragment too frequently. Reliable channels only.
+        int blockParityGroupSize;                                   ///< Send an XOR parity fragment after every group of this many block fragments, so the receiver can rebuild one lost fragment per group without waiting for a resend. Costs 1/blockParityGroupSize extra bandwidth on blocks. Zero disables parity fragments. Reliable channels only.
+        int packetParityGroupSize;                                  ///< Send an XOR parity entry after every group of this many packets carrying messages for this channel, so the receiver can rebuild the messages of one lost packet per group. Rebuilt messages arrive once the parity entry does, instead of never. Costs about 1/packetParityGroupSize extra bandwidth on the channel. Packets that arrive after they were rebuilt are dropped, as are packets arriving more than 8 groups late. On unreliable-sequenced channels a rebuilt message is still dropped if a newer one was received first. Zero disables parity. Unreliable channels only.
 
         ChannelConfig() : type ( CHANNEL_TYPE_RELIABLE_ORDERED )
         {
             disableBlocks = false;
+            latestOnly = false;
+            aggregateMessages = false;
+            priority = 0;
+            weight = 1;
             sentPacketBufferSize = 1024;
             messageSendQueueSize = 1024;
             messageReceiveQueueSize = 1024;
             maxMessagesPerPacket = 256;
+            sentPacketMessageIdBufferSize = 4096;
             packetBudget = -1;
             maxBlockSize = 256 * 1024;
             blockFragmentSize = 1024;
             messageResendTime = 0.1f;
             blockFragmentResendTime = 0.25f;
+            blockParityGroupSize = 0;
+            packetParityGroupSize = 0;
         }
 
         int GetMaxFragmentsPerBlock() const
         {
             return maxBlockSize / blockFragmentSize;
         }
+
+        int GetNumParityFragments( int numFragments ) const
+        {
+            return ( blockParityGroupSize > 0 && numFragments > 1 ) ? ( numFragments + blockParityGroupSize - 1 ) / blockParityGroupSize : 0;
+        }
+
+        int GetMaxParityFragmentsPerBlock() const
+        {
+            return GetNumParityFragments( GetMaxFragmentsPerBlock() );
+        }
     };
 
     /** 
@@ -249,12 +293,24 @@ namespace yojimbo
     {
         int numChannels;                                        ///< Number of message channels in [1,MaxChannels]. Each message channel must have a corresponding configuration below.
         int maxPacketSize;                                      ///< The maximum size of packets generated to transmit messages between client and server (bytes).
+        int bandwidthLimit;                                     ///< Send rate limit per connection in kilobits per second. Zero means no limit. Enforced by a token bucket holding enough for one packet of maxPacketSize bytes: packets are skipped while the bucket is empty and never larger than what is in it. Each packet is charged its data plus packetOverhead for every datagram it goes out as.
+        int packetOverhead;                                     ///< Bytes each datagram costs on the wire on top of packet data, charged against bandwidthLimit. A packet above fragmentPacketsAbove is charged once per fragment. The default covers the reliable.io header, netcode.io prefix, sequence and MAC, and the UDP and IPv4 headers.
+        int fragmentPacketsAbove;                               ///< Packets above this size (bytes) are split apart into fragments and reassembled on the other side.
+        int packetFragmentSize;                                 ///< Size of each packet fragment (bytes).
+        float keepAliveInterval;                                ///< If greater than zero, packets with no message data are skipped unless acks are due or nothing has been sent for this long (seconds). Acks are due ackDelay after a packet with message data arrives, or once MaxUnackedReceivedPackets packets have arrived since the last packet sent. Zero sends a packet every time, even if it only carries acks. netcode.io sends its own keep-alives 10 times a second on a connection that has nothing else to send, so over netcode.io an idle client never drops below 10 packets per second each way, and an interval near 0.1 seconds sends yojimbo keep-alives on top of netcode.io's. Use a longer interval, eg. one second, and let netcode.io keep the connection alive.
+        float ackDelay;                                         ///< How long acks for received message data wait for a packet with data to ride on, before a packet is sent just for them (seconds). Only used if keepAliveInterval is greater than zero.
         ChannelConfig channel[MaxChannels];                     ///< Per-channel configuration. See ChannelConfig for details.
 
         ConnectionConfig()
         {
             numChannels = 1;
             maxPacketSize = 8 * 1024;
+            bandwidthLimit = 0;
+            packetOverhead = 60;
+            fragmentPacketsAbove = 1024;
+            packetFragmentSize = 1024;
+            keepAliveInterval = 0.0f;
+            ackDelay = 0.0f;
         }
     };
 
@@ -270,11 +326,14 @@ namespace yojimbo
         int timeout;                                            ///< Timeout value in seconds. Set to negative value to disable timeouts (for debugging only).
         int clientMemory;                                       ///< Memory allocated inside Client for packets, messages and stream allocations (bytes)
         int serverGlobalMemory;                                 ///< Memory allocated inside Server for global connection request and challenge response packets (bytes)
-        int serverPerClientMemory;                              ///< Memory allocated inside Server for packets, messages and stream allocations per-client (bytes)
+        int serverPerClientMemory;                              ///< Memory allocated inside Server for packets, messages, stream allocations and the reliable.io endpoint per-client (bytes). Allocated for every client slot at Server::Start, so this dominates server memory when running with many slots.
+        int serverBlockMemory;                                  ///< Memory allocated inside Server for block receive buffers shared by all clients (bytes). Each client receiving a block holds maxBlockSize bytes from it until the block completes. If zero, block receive buffers come out of each client's serverPerClientMemory instead.
+        int serverBroadcastMemory;                              ///< Memory allocated inside Server for messages created with Server::CreateBroadcastMessage (bytes). A broadcast message is held until every client it was sent to is done with it. Zero by default, so servers that don't broadcast don't pay for it. If zero, Server::CreateBroadcastMessage returns NULL.
+        int serverWorkerThreads;                                ///< Number of threads that split per-client work in the server tick, including the thread calling the server. Zero or one runs everything on the calling thread. Socket I/O always stays on the calling thread. Each client slot is only ever touched by one thread at a time, so adapter allocators, message serialization and the serialize context must be safe to use from several threads for different clients.
+        bool networkThread;                                     ///< If true, clients and servers send, receive and ack packets on a background thread at networkTickRate, so message latency does not depend on how often the game thread updates. SendPackets and ReceivePackets become no-ops on the game thread and AdvanceTime only picks up disconnects. Messages are passed between threads through lock-free queues. Adapter callbacks run on the network thread. Loopback is not supported in this mode.
+        int networkTickRate;                                    ///< Ticks per second of the network thread when networkThread is true.
         bool networkSimulator;                                  ///< If true then a network simulator is created for simulating latency, jitter, packet loss and duplicates.
         int maxSimulatorPackets;                                ///< Maximum number of packets that can be stored in the network simulator. Additional packets are dropped.
-        int fragmentPacketsAbove;                               ///< Packets above this size (bytes) are split apart into fragments and reassembled on the other side.
-        int packetFragmentSize;                                 ///< Size of each packet fragment (bytes).
         int maxPacketFragments;                                 ///< Maximum number of fragments a packet can be split up into.
         int packetReassemblyBufferSize;                         ///< Number of packet entries in the fragmentation reassembly buffer.
         int ackedPacketsBufferSize;                             ///< Number of packet entries in the acked packet buffer. Consider your packet send rate and aim to have at least a few seconds worth of entries.
@@ -286,11 +345,14 @@ namespace yojimbo
             timeout = YOJIMBO_DEFAULT_TIMEOUT;
             clientMemory = 10 * 1024 * 1024;
             serverGlobalMemory = 10 * 1024 * 1024;
-            serverPerClientMemory = 10 * 1024 * 1024;
+            serverPerClientMemory = 2 * 1024 * 1024;
+            serverBlockMemory = 0;
+            serverBroadcastMemory = 0;
+            serverWorkerThreads = 0;
+            networkThread = false;
+            networkTickRate = 60;
             networkSimulator = true;
             maxSimulatorPackets = 4 * 1024;
-            fragmentPacketsAbove = 1024;
-            packetFragmentSize = 1024;
             maxPacketFragments = (int) ceil( maxPacketSize / packetFragmentSize );
             packetReassemblyBufferSize = 64;
             ackedPacketsBufferSize = 256;
@@ -397,6 +459,57 @@ void yojimbo_sleep( double time );
 
 double yojimbo_time();
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif // #if defined(_MSC_VER)
+
+/**
+    Read an int that another thread writes with yojimbo_atomic_store.
+    Everything the other thread wrote before the store is visible once the stored value is seen.
+    @param p Pointer to the value.
+    @returns The value.
+ */
+
+inline int yojimbo_atomic_load( const volatile int * p )
+{
+#if defined(_MSC_VER)
+    return _InterlockedCompareExchange( (volatile long*) p, 0, 0 );
+#else // #if defined(_MSC_VER)
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+#endif // #if defined(_MSC_VER)
+}
+
+/**
+    Write an int that another thread reads with yojimbo_atomic_load.
+    @param p Pointer to the value.
+    @param value The value to write.
+ */
+
+inline void yojimbo_atomic_store( volatile int * p, int value )
+{
+#if defined(_MSC_VER)
+    _InterlockedExchange( (volatile long*) p, value );
+#else // #if defined(_MSC_VER)
+    __atomic_store_n( p, value, __ATOMIC_RELEASE );
+#endif // #if defined(_MSC_VER)
+}
+
+/**
+    Add to an int that several threads update.
+    @param p Pointer to the value.
+    @param value The value to add. Pass a negative value to subtract.
+    @returns The new value.
+ */
+
+inline int yojimbo_atomic_add( volatile int * p, int value )
+{
+#if defined(_MSC_VER)
+    return _InterlockedExchangeAdd( (volatile long*) p, value ) + value;
+#else // #if defined(_MSC_VER)
+    return __atomic_add_fetch( p, value, __ATOMIC_ACQ_REL );
+#endif // #if defined(_MSC_VER)
+}
+
 #define YOJIMBO_LOG_LEVEL_NONE      0
 #define YOJIMBO_LOG_LEVEL_ERROR     1
 #define YOJIMBO_LOG_LEVEL_INFO      2
@@ -877,6 +990,30 @@ namespace yojimbo
 #endif // #ifdef __GNUC__
     }
 
+    /**
+        Calculates the number of trailing zero bits in an unsigned 64 bit integer.
+        This is the index of the lowest bit set to 1. Use it to walk the bits set in a mask without testing every bit.
+        @param x The input integer value. Must not be zero.
+        @returns The number of trailing zero bits in [0,63].
+     */
+
+    inline int trailing_zeros( uint64_t x )
+    {
+        yojimbo_assert( x != 0 );
+#ifdef __GNUC__
+        return __builtin_ctzll( x );
+#else // #ifdef __GNUC__
+        int result = 0;
+        if ( ( x & 0xFFFFFFFF ) == 0 ) { x >>= 32; result += 32; }
+        if ( ( x & 0xFFFF ) == 0 )     { x >>= 16; result += 16; }
+        if ( ( x & 0xFF ) == 0 )       { x >>= 8;  result += 8;  }
+        if ( ( x & 0xF ) == 0 )        { x >>= 4;  result += 4;  }
+        if ( ( x & 0x3 ) == 0 )        { x >>= 2;  result += 2;  }
+        if ( ( x & 0x1 ) == 0 )        {           result += 1;  }
+        return result;
+#endif // #ifdef __GNUC__
+    }
+
     /**
         Reverse the order of bytes in a 64 bit integer.
         @param value The input value.
@@ -1173,6 +1310,122 @@ namespace yojimbo
             return ( m_data[data_index] >> bit_index ) & 1;
         }
 
+        /**
+            Find the first bit set to 1 at or after an index.
+            Scans a 64 bit word at a time, so runs of zero bits are skipped quickly.
+            @param index The index of the bit to start searching from, in [0,size].
+            @returns The index of the first bit set at or after index, or -1 if there is none.
+         */
+
+        int FindNextSetBit( int index ) const
+        {
+            yojimbo_assert( index >= 0 );
+            yojimbo_assert( index <= m_size );
+            if ( index >= m_size )
+                return -1;
+            const int num_words = m_bytes / 8;
+            int data_index = index >> 6;
+            uint64_t word = m_data[data_index] & ( ~uint64_t(0) << ( index & ( (1<<6) - 1 ) ) );
+            while ( true )
+            {
+                if ( word )
+                {
+                    const int result = ( data_index << 6 ) + trailing_zeros( word );
+                    return ( result < m_size ) ? result : -1;
+                }
+                if ( ++data_index == num_words )
+                    return -1;
+                word = m_data[data_index];
+            }
+        }
+
+        /**
+            Find the first bit set to 0 at or after an index.
+            Scans a 64 bit word at a time, so runs of bits set to 1 are skipped quickly.
+            @param index The index of the bit to start searching from, in [0,size].
+            @returns The index of the first bit cleared at or after index, or -1 if there is none.
+         */
+
+        int FindNextClearBit( int index ) const
+        {
+            yojimbo_assert( index >= 0 );
+            yojimbo_assert( index <= m_size );
+            if ( index >= m_size )
+                return -1;
+            const int num_words = m_bytes / 8;
+            int data_index = index >> 6;
+            uint64_t word = ~m_data[data_index] & ( ~uint64_t(0) << ( index & ( (1<<6) - 1 ) ) );
+            while ( true )
+            {
+                if ( word )
+                {
+                    const int result = ( data_index << 6 ) + trailing_zeros( word );
+                    return ( result < m_size ) ? result : -1;
+                }
+                if ( ++data_index == num_words )
+                    return -1;
+                word = ~m_data[data_index];
+            }
+        }
+
+        /**
+            Count the number of bits set to 1.
+            @returns The number of bits set in the bit array.
+         */
+
+        int CountSetBits() const
+        {
+            const int num_words = m_bytes / 8;
+            int result = 0;
+            for ( int i = 0; i < num_words; ++i )
+                result += popcount( uint32_t( m_data[i] ) ) + popcount( uint32_t( m_data[i] >> 32 ) );
+            return result;
+        }
+
+        /**
+            Set a range of bits to 1.
+            @param begin The index of the first bit to set.
+            @param end One past the index of the last bit to set.
+         */
+
+        void SetBitRange( int begin, int end )
+        {
+            yojimbo_assert( begin >= 0 );
+            yojimbo_assert( begin <= end );
+            yojimbo_assert( end <= m_size );
+            while ( begin < end )
+            {
+                const int data_index = begin >> 6;
+                const int bit_index = begin & ( (1<<6) - 1 );
+                const int num_bits = yojimbo_min( 64 - bit_index, end - begin );
+                const uint64_t mask = ( num_bits == 64 ) ? ~uint64_t(0) : ( ( uint64_t(1) << num_bits ) - 1 ) << bit_index;
+                m_data[data_index] |= mask;
+                begin += num_bits;
+            }
+        }
+
+        /**
+            Clear a range of bits to 0.
+            @param begin The index of the first bit to clear.
+            @param end One past the index of the last bit to clear.
+         */
+
+        void ClearBitRange( int begin, int end )
+        {
+            yojimbo_assert( begin >= 0 );
+            yojimbo_assert( begin <= end );
+            yojimbo_assert( end <= m_size );
+            while ( begin < end )
+            {
+                const int data_index = begin >> 6;
+                const int bit_index = begin & ( (1<<6) - 1 );
+                const int num_bits = yojimbo_min( 64 - bit_index, end - begin );
+                const uint64_t mask = ( num_bits == 64 ) ? ~uint64_t(0) : ( ( uint64_t(1) << num_bits ) - 1 ) << bit_index;
+                m_data[data_index] &= ~mask;
+                begin += num_bits;
+            }
+        }
+
         /**
             Gets the size of the bit array, in number of bits.
             @returns The number of bits.
@@ -1355,6 +1608,111 @@ namespace yojimbo
         int m_numEntries;                               ///< The number of entries currently stored in the queue.
     };
 
+    /**
+        A fixed size FIFO queue for passing values from one thread to another without locks.
+        Exactly one thread may push (the producer) and exactly one other thread may pop (the consumer).
+     */
+
+    template <typename T> class SPSCQueue
+    {
+    public:
+
+        /**
+            SPSC queue constructor.
+            @param allocator The allocator to use.
+            @param size The maximum number of entries in the queue. Rounded up to a power of two.
+         */
+
+        SPSCQueue( Allocator & allocator, int size )
+        {
+            yojimbo_assert( size > 0 );
+            m_allocator = &allocator;
+            m_size = 1;
+            while ( m_size < size )
+                m_size *= 2;
+            m_entries = (T*) YOJIMBO_ALLOCATE( allocator, sizeof(T) * m_size );
+            memset( m_entries, 0, sizeof(T) * m_size );
+            m_head = 0;
+            m_tail = 0;
+        }
+
+        /**
+            SPSC queue destructor.
+         */
+
+        ~SPSCQueue()
+        {
+            yojimbo_assert( m_allocator );
+            YOJIMBO_FREE( *m_allocator, m_entries );
+            m_allocator = NULL;
+        }
+
+        /**
+            Push a value onto the queue. Producer thread only.
+            @param value The value to push.
+            @returns True if the value was pushed, false if the queue is full.
+         */
+
+        bool Push( const T & value )
+        {
+            const uint32_t tail = uint32_t( m_tail );
+            if ( tail - uint32_t( yojimbo_atomic_load( &m_head ) ) == uint32_t( m_size ) )
+                return false;
+            m_entries[tail & ( m_size - 1 )] = value;
+            yojimbo_atomic_store( &m_tail, int( tail + 1 ) );
+            return true;
+        }
+
+        /**
+            Pop a value off the queue. Consumer thread only.
+            @param value Set to the value popped off the queue.
+            @returns True if a value was popped, false if the queue is empty.
+         */
+
+        bool Pop( T & value )
+        {
+            const uint32_t head = uint32_t( m_head );
+            if ( head == uint32_t( yojimbo_atomic_load( &m_tail ) ) )
+                return false;
+            value = m_entries[head & ( m_size - 1 )];
+            yojimbo_atomic_store( &m_head, int( head + 1 ) );
+            return true;
+        }
+
+        /**
+            Get the number of values that can be pushed right now. Producer thread only.
+            The consumer may pop at any time, so the real number can only be higher.
+            @returns The number of free entries.
+         */
+
+        int GetNumFreeEntries() const
+        {
+            return m_size - int( uint32_t( m_tail ) - uint32_t( yojimbo_atomic_load( &m_head ) ) );
+        }
+
+        /**
+            Get the size of the queue.
+            @returns The maximum number of entries in the queue.
+         */
+
+        int GetSize() const
+        {
+            return m_size;
+        }
+
+    private:
+
+        Allocator * m_allocator;                    ///< The allocator passed in to the constructor.
+        T * m_entries;                              ///< Array of entries. Indexed by head and tail modulo the size.
+        int m_size;                                 ///< The size of the entry array. Always a power of two.
+        volatile int m_head;                        ///< Number of values popped. Written by the consumer only.
+        uint8_t m_padding[64];                      ///< Keeps head and tail on separate cache lines.
+        volatile int m_tail;                        ///< Number of values pushed. Written by the producer only.
+
+        SPSCQueue( const SPSCQueue<T> & other );
+        SPSCQueue<T> & operator = ( const SPSCQueue<T> & other );
+    };
+
     /**
         Data structure that stores data indexed by sequence number.
         Entries may or may not exist. If they don't exist the sequence value for the entry at that index is set to 0xFFFFFFFF. 
@@ -2486,6 +2844,18 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Add bits measured by another measure stream.
+            Measurements don't depend on where they start in the stream, so something measured once can be added again without serializing it.
+            @param bits The number of bits to add.
+         */
+
+        void AddBits( int bits )
+        {
+            yojimbo_assert( bits >= 0 );
+            m_bitsWritten += bits;
+        }
+
         /**
             Get number of bits written so far.
             @returns Number of bits written.
@@ -3503,8 +3873,9 @@ namespace yojimbo
 
         /** 
             Set the message id.
-            When messages are sent over a reliable-ordered channel, the message id starts at 0 and increases with each message sent over that channel.
+            When messages are sent over a reliable channel, the message id starts at 0 and increases with each message sent over that channel.
             When messages are sent over an unreliable-unordered channel, the message id is set to the sequence number of the packet it was delivered in.
+            When messages are sent over an unreliable-sequenced channel, the message id is the per-channel sequence number the message was sent with.
             @param id The message id.
          */
 
@@ -3618,11 +3989,60 @@ namespace yojimbo
         const Message & operator = ( const Message & other );
 
         int m_refCount;                             ///< Number of references on this message object. Starts at 1. Message is destroyed when it reaches 0.
-        uint32_t m_id : 16;                         ///< The message id. For messages sent over reliable-ordered channels, this starts at 0 and increases with each message sent. For unreliable-unordered channels this is set to the sequence number of the packet the message was included in.
+        uint32_t m_id : 16;                         ///< The message id. For messages sent over reliable channels, this starts at 0 and increases with each message sent. For unreliable-unordered channels this is set to the sequence number of the packet the message was included in.
         uint32_t m_type : 15;                       ///< The message type. Corresponds to the type integer used when the message was created though the message factory.
         uint32_t m_blockMessage : 1;                ///< 1 if this is a block message. 0 otherwise. If 1 then you can cast the Message* to BlockMessage*. Lightweight RTTI.
     };
 
+    /**
+        Supplies the data for a streamed block.
+        Attach a block source to a block message instead of a block to send more data than ChannelConfig::maxBlockSize, without holding all of it in memory.
+        @see BlockMessage::AttachBlockSource
+     */
+
+    class BlockSource
+    {
+    public:
+
+        virtual ~BlockSource() {}
+
+        /**
+            Read part of the block.
+            Called each time a fragment is sent, so the same range may be read more than once if a fragment is resent. Reads stay within a window of ChannelConfig::GetMaxFragmentsPerBlock fragments of the oldest unacked fragment.
+            @param offset The offset of the data to read, in bytes from the start of the block.
+            @param data The buffer to read into [out].
+            @param bytes The number of bytes to read.
+            @returns True if the data was read. Returning false sets CHANNEL_ERROR_BLOCK_STREAM_FAILED on the channel.
+         */
+
+        virtual bool ReadBlockData( int offset, uint8_t * data, int bytes ) = 0;
+    };
+
+    /**
+        Receives the data for streamed blocks.
+        Set a block sink on a channel to receive streamed blocks sent over it. Fragments are written straight to the sink as they arrive, so the channel never holds more than one fragment of a streamed block in memory.
+        @see Connection::SetBlockSink
+     */
+
+    class BlockSink
+    {
+    public:
+
+        virtual ~BlockSink() {}
+
+        /**
+            Write part of a streamed block.
+            Each part of the block is written exactly once, but not necessarily in order. The block message is delivered once the whole block has been written.
+            @param messageId The id of the block message the data belongs to.
+            @param offset The offset of the data, in bytes from the start of the block.
+            @param data The data to write.
+            @param bytes The number of bytes to write.
+            @returns True if the data was written. Returning false sets CHANNEL_ERROR_BLOCK_STREAM_FAILED on the channel.
+         */
+
+        virtual bool WriteBlockData( uint16_t messageId, int offset, const uint8_t * data, int bytes ) = 0;
+    };
+
     /**
         A message which can have a block of data attached to it.
         @see ChannelConfig
@@ -3638,7 +4058,7 @@ namespace yojimbo
             @see MessageFactory::CreateMessage
          */
 
-        explicit BlockMessage() : Message( 1 ), m_allocator(NULL), m_blockData(NULL), m_blockSize(0) {}
+        explicit BlockMessage() : Message( 1 ), m_allocator(NULL), m_blockData(NULL), m_blockSource(NULL), m_blockSize(0) {}
 
         /**
             Attach a block to this message.
@@ -3652,11 +4072,31 @@ namespace yojimbo
             yojimbo_assert( blockData );
             yojimbo_assert( blockSize > 0 );
             yojimbo_assert( !m_blockData );
+            yojimbo_assert( !m_blockSource );
             m_allocator = &allocator;
             m_blockData = blockData;
             m_blockSize = blockSize;
         }
 
+        /**
+            Attach a streamed block to this message.
+            The block is read from the block source one fragment at a time as it is sent, so it may be larger than ChannelConfig::maxBlockSize. Only reliable channels can send streamed blocks, and the receiving channel must have a BlockSink set.
+            The block source is not owned by the message and must stay valid until the message is released.
+            Block messages delivered from a streamed block have the block size set but no block data or source, because the data was written to the block sink instead.
+            @param blockSource The block source. NULL only for block messages delivered from a streamed block.
+            @param blockSize The size of the block (bytes).
+            @see Connection::SetBlockSink
+         */
+
+        void AttachBlockSource( BlockSource * blockSource, int blockSize )
+        {
+            yojimbo_assert( blockSize > 0 );
+            yojimbo_assert( !m_blockData );
+            yojimbo_assert( !m_blockSource );
+            m_blockSource = blockSource;
+            m_blockSize = blockSize;
+        }
+
         /** 
             Detach the block from this message.
             By doing this you are responsible for copying the block pointer and allocator and making sure the block is freed.
@@ -3669,6 +4109,7 @@ namespace yojimbo
         {
             m_allocator = NULL;
             m_blockData = NULL;
+            m_blockSource = NULL;
             m_blockSize = 0;
         }
 
@@ -3712,6 +4153,26 @@ namespace yojimbo
             return m_blockSize;
         }
 
+        /**
+            Get the block source of a streamed block.
+            @returns The block source. NULL if no streamed block is attached to this message.
+         */
+
+        BlockSource * GetBlockSource()
+        {
+            return m_blockSource;
+        }
+
+        /**
+            Is the block attached to this message streamed?
+            @returns True if the block is read from a block source when sent, or was written to a block sink when received.
+         */
+
+        bool IsStreamedBlock() const
+        {
+            return m_blockSize > 0 && !m_blockData;
+        }
+
         /**
             Templated serialize function for the block message. Doesn't do anything. The block data is serialized elsewhere.
             You can override the serialize methods on a block message to implement your own serialize function. It's just like a regular message with a block attached to it.
@@ -3745,9 +4206,72 @@ namespace yojimbo
 
         Allocator * m_allocator;                    ///< Allocator for the block attached to the message. NULL if no block is attached.
         uint8_t * m_blockData;                      ///< The block data. NULL if no block is attached.
+        BlockSource * m_blockSource;                ///< The block source for a streamed block. NULL if no streamed block is attached.
         int m_blockSize;                            ///< The block size (bytes). 0 if no block is attached.
     };
 
+    /**
+        A message shared by several connections, eg. a message broadcast to many clients.
+        The message is created and measured once. Each connection sends its own SharedMessageReference to it, so message ids stay per-connection.
+        References are released by whichever thread works on each connection. The owner of the shared message frees it once numReferences reaches zero.
+        @see BaseServer::BroadcastMessage
+     */
+
+    struct SharedMessage
+    {
+        Message * message;                          ///< The shared message. Never sent directly.
+        int measuredBits;                           ///< Bits the shared message takes to serialize, measured once when it is shared.
+        volatile int numReferences;                 ///< Number of SharedMessageReference objects alive. Updated with yojimbo_atomic_add.
+        SharedMessage * next;                       ///< Next shared message in the owner's list.
+    };
+
+    /**
+        A per-connection message that writes a shared message.
+        Created with MessageFactory::CreateSharedMessageReference, so it is allocated and released like any other message from that factory.
+        Has the type of the shared message and serializes exactly like it, so the receiver sees an ordinary message. Only supports writing and measuring.
+     */
+
+    class SharedMessageReference : public Message
+    {
+    public:
+
+        /**
+            Add a reference to a shared message.
+            @param sharedMessage The shared message. It must not be a block message.
+         */
+
+        explicit SharedMessageReference( SharedMessage & sharedMessage ) : m_sharedMessage( &sharedMessage )
+        {
+            yojimbo_assert( sharedMessage.message );
+            yojimbo_assert( !sharedMessage.message->IsBlockMessage() );
+            yojimbo_atomic_add( &sharedMessage.numReferences, 1 );
+        }
+
+        /**
+            Release the reference to the shared message.
+            The shared message itself is freed by its owner, which may be on another thread.
+         */
+
+        ~SharedMessageReference()
+        {
+            yojimbo_atomic_add( &m_sharedMessage->numReferences, -1 );
+        }
+
+        bool SerializeInternal( ReadStream & stream ) { (void) stream; yojimbo_assert( false ); return false; }
+
+        bool SerializeInternal( WriteStream & stream ) { return m_sharedMessage->message->SerializeInternal( stream ); }
+
+        bool SerializeInternal( MeasureStream & stream ) { stream.AddBits( m_sharedMessage->measuredBits ); return true; }
+
+    private:
+
+        SharedMessageReference( const SharedMessageReference & other );
+
+        const SharedMessageReference & operator = ( const SharedMessageReference & other );
+
+        SharedMessage * m_sharedMessage;            ///< The shared message written in place of this one.
+    };
+
     /**
         Message factory error level.
      */
@@ -3842,6 +4366,30 @@ namespace yojimbo
             return message;
         }
 
+        /**
+            Create a message that sends a shared message over one connection.
+            The message has the type of the shared message and is released with MessageFactory::ReleaseMessage like any other message from this factory.
+            @param sharedMessage The shared message. Its numReferences is increased until the returned message is destroyed.
+            @returns The message, or NULL if the message could not be allocated. If the message allocation fails, the message factory error level is set to MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE.
+         */
+
+        Message * CreateSharedMessageReference( SharedMessage & sharedMessage )
+        {
+            yojimbo_assert( sharedMessage.message );
+            yojimbo_assert( sharedMessage.message->GetType() < m_numTypes );
+            Message * message = YOJIMBO_NEW( *m_allocator, SharedMessageReference, sharedMessage );
+            if ( !message )
+            {
+                m_errorLevel = MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE;
+                return NULL;
+            }
+            SetMessageType( message, sharedMessage.message->GetType() );
+            #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+            allocated_messages[message] = 1;
+            #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+            return message;
+        }
+
         /**
             Add a reference to a message.
             @param message The message to add a reference to.
@@ -4014,28 +4562,46 @@ namespace yojimbo
         uint32_t initialized : 1;
         uint32_t blockMessage : 1;
         uint32_t messageFailedToSerialize : 1;
+        uint32_t packetParity : 1;
 
         struct MessageData
         {
             int numMessages;
             Message ** messages;
+            int numSkippedIds;
+            uint16_t * skippedIds;
+            uint8_t * payloadData;
+            int payloadBytes;
         };
 
         struct BlockData
         {
             BlockMessage * message;
             uint8_t * fragmentData;
-            uint64_t messageId : 16;
-            uint64_t fragmentId : 16;
-            uint64_t fragmentSize : 16;
-            uint64_t numFragments : 16;
+            int fragmentId;
+            int numFragments;
+            uint16_t messageId;
+            uint16_t fragmentSize;
+            bool streamed;
             int messageType;
+            int lastFragmentSize;
+        };
+
+        struct ParityData
+        {
+            int numPackets;
+            uint16_t * packetSequence;
+            int * packetBytes;
+            uint8_t * parityData;
+            int parityBytes;
+            void * context;
         };
 
         union
         {
             MessageData message;
             BlockData block;
+            ParityData parity;
         };
 
         void Initialize();
@@ -4064,7 +4630,23 @@ namespace yojimbo
     };
 
     /**
-        Channel error level.
+        Channel send queue status.
+        Lets producers see how backed up a channel is, so they can throttle or reduce the detail of what they send before the send queue overflows.
+        @see Channel::GetStatus
+     */
+
+    struct ChannelStatus
+    {
+        int numMessagesQueued;                                  ///< Number of messages in the send queue. For reliable channels this includes messages that have been sent but not acked yet.
+        int sendQueueSize;                                      ///< Number of messages the send queue can hold. See ChannelConfig::messageSendQueueSize.
+        int numBytesQueued;                                     ///< Measured size of the messages in the send queue, including attached blocks (bytes). Reliable channels only.
+        float oldestUnackedAge;                                 ///< Time since the oldest unacked message was queued (seconds). Zero if there are no unacked messages. Reliable channels only.
+        float ackedMessagesPerSecond;                           ///< Smoothed number of messages acked per-second. Reliable channels only.
+        float estimatedDrainTime;                               ///< Estimated time to ack every message in the send queue at the current ack rate (seconds). Negative if there are queued messages but no recent acks. Reliable channels only.
+    };
+
+    /**
+        Channel error level.
         If the channel gets into an error state, it sets an error state on the corresponding connection. See yojimbo::CONNECTION_ERROR_CHANNEL.
         This way if any channel on a client/server connection gets into a bad state, that client is automatically kicked from the server.
         @see Client
@@ -4080,6 +4662,7 @@ namespace yojimbo
         CHANNEL_ERROR_BLOCKS_DISABLED,                          ///< The channel received a packet containing data for blocks, but this channel is configured to disable blocks. See ChannelConfig::disableBlocks.
         CHANNEL_ERROR_FAILED_TO_SERIALIZE,                      ///< Serialize read failed for a message sent to this channel. Check your message serialize functions, one of them is returning false on serialize read. This can also be caused by a desync in message read and write.
         CHANNEL_ERROR_OUT_OF_MEMORY,                            ///< The channel tried to allocate some memory but couldn't.
+        CHANNEL_ERROR_BLOCK_STREAM_FAILED,                      ///< A streamed block could not be read from its BlockSource or written to the BlockSink, or a streamed block was received on a channel with no block sink set.
     };
 
     /// Helper function to convert a channel error to a user friendly string.
@@ -4094,6 +4677,7 @@ namespace yojimbo
             case CHANNEL_ERROR_OUT_OF_MEMORY:           return "out of memory";
             case CHANNEL_ERROR_BLOCKS_DISABLED:         return "blocks disabled";
             case CHANNEL_ERROR_FAILED_TO_SERIALIZE:     return "failed to serialize";
+            case CHANNEL_ERROR_BLOCK_STREAM_FAILED:     return "block stream failed";
             default:
                 yojimbo_assert( false );
                 return "(unknown)";
@@ -4130,12 +4714,40 @@ namespace yojimbo
 
         virtual bool CanSendMessage() const = 0;
 
+        /**
+            Returns true if a batch of messages can be sent over this channel.
+            @param numMessages The number of messages in the batch.
+         */
+
+        virtual bool CanSendMessages( int numMessages ) const = 0;
+
+        /**
+            Does this channel have messages waiting to be sent?
+            Used by the connection to decide which channels are competing for space in the next packet. See Connection::GeneratePacket.
+            @returns True if there is at least one message in the send queue.
+         */
+
+        virtual bool HasMessagesToSend() const = 0;
+
         /**
             Queue a message to be sent across this channel.
             @param message The message to be sent.
+            @param context The serialization context.
+            @param timeToLive Time in seconds after which the message is no longer worth delivering. Zero means the message never expires. Only reliable channels support this.
+            @param priority Messages with higher priority are included in packets first. Only reliable channels support this.
+         */
+
+        virtual void SendMessage( Message * message, void *context, double timeToLive, int priority ) = 0;
+
+        /**
+            Queue a batch of messages to be sent across this channel.
+            Equivalent to calling SendMessage for each message in turn, but the batch goes through the channel in one call.
+            @param messages Array of messages to be sent. Ownership of every message passes to the channel, even if the channel is in an error state.
+            @param numMessages The number of messages in the array.
+            @param context The serialization context.
          */
 
-        virtual void SendMessage( Message * message, void *context) = 0;
+        virtual void SendMessages( Message ** messages, int numMessages, void *context ) = 0;
 
         /** 
             Pops the next message off the receive queue if one is available.
@@ -4144,6 +4756,15 @@ namespace yojimbo
 
         virtual Message * ReceiveMessage() = 0;
 
+        /**
+            Pops up to maxMessages messages off the receive queue.
+            @param messages Array of message pointers to be filled [out]. The caller owns the messages returned and is responsible for releasing each of them.
+            @param maxMessages The size of the message array.
+            @returns The number of messages received.
+         */
+
+        virtual int ReceiveMessages( Message ** messages, int maxMessages ) = 0;
+
         /**
             Advance channel time.
             Called by Connection::AdvanceTime for each channel configured on the connection.
@@ -4163,6 +4784,18 @@ namespace yojimbo
 
         virtual int GetPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits) = 0;
 
+        /**
+            Get more channel packet data to top up space left over in a packet.
+            Called after every channel has had a chance to add its packet data, for as long as space is left and the channel keeps adding data. Each call adds another channel entry to the packet.
+            @param packetData The channel packet data to be filled [out]
+            @param packetSequence The sequence number of the packet being generated.
+            @param availableBits The maximum number of bits of packet data the channel is allowed to write.
+            @returns The number of bits of packet data written by the channel, or 0 if the channel has nothing more to add.
+            @see Connection::GeneratePacket
+         */
+
+        virtual int GetTopUpPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits ) = 0;
+
         /**
             Process packet data included in a connection packet.
             @param packetData The channel packet data to process.
@@ -4176,13 +4809,20 @@ namespace yojimbo
         /**
             Process a connection packet ack.
             Depending on the channel type: 
-                1. Acks messages and block fragments so they stop being included in outgoing connection packets (reliable-ordered channel), 
+                1. Acks messages and block fragments so they stop being included in outgoing connection packets (reliable-ordered and reliable-unordered channels), 
                 2. Does nothing at all (unreliable-unordered).
             @param sequence The sequence number of the connection packet that was acked.
          */
 
         virtual void ProcessAck( uint16_t sequence ) = 0;
 
+        /**
+            Get the status of the channel send queue.
+            @param status The channel status to be filled [out].
+         */
+
+        virtual void GetStatus( ChannelStatus & status ) const = 0;
+
     public:
 
         /**
@@ -4214,6 +4854,23 @@ namespace yojimbo
 
         void ResetCounters();
 
+        /**
+            Set the block sink that streamed blocks received on this channel are written to.
+            Only reliable channels can receive streamed blocks.
+            @param blockSink The block sink. NULL to stop receiving streamed blocks. The channel does not own the block sink.
+            @see BlockMessage::AttachBlockSource
+         */
+
+        void SetBlockSink( BlockSink * blockSink );
+
+        /**
+            Set the allocator that buffers for blocks received on this channel are allocated from.
+            Block receive buffers are only allocated while a block is being received, so a single allocator can be shared by many channels as a pool. Defaults to the channel allocator.
+            @param allocator The block allocator. Must outlive the channel.
+         */
+
+        void SetBlockAllocator( Allocator & allocator );
+
     protected:
 
         /**
@@ -4227,10 +4884,12 @@ namespace yojimbo
 
         const ChannelConfig m_config;                                                   ///< Channel configuration data.
         Allocator * m_allocator;                                                        ///< Allocator for allocations matching life cycle of this channel.
+        Allocator * m_blockAllocator;                                                   ///< Allocator for block receive buffers. See SetBlockAllocator.
         int m_channelIndex;                                                             ///< The channel index in [0,numChannels-1].
         double m_time;                                                                  ///< The current time.
         ChannelErrorLevel m_errorLevel;                                                 ///< The channel error level.
         MessageFactory * m_messageFactory;                                              ///< Message factory for creating and destroying messages.
+        BlockSink * m_blockSink;                                                        ///< Streamed blocks received on this channel are written here. NULL if not set.
         uint64_t m_counters[CHANNEL_COUNTER_NUM_COUNTERS];                              ///< Counters for unit testing, stats etc.
     };
 
@@ -4267,18 +4926,38 @@ namespace yojimbo
 
         bool CanSendMessage() const;
 
-        void SendMessage( Message * message, void *context );
+        bool CanSendMessages( int numMessages ) const;
+
+        /**
+            Queue a message to be sent across this channel.
+            A message with a time to live is retired if it has not been acked by the time it expires. The message is released and a skip marker is sent in its place, so the receiver can move past that message id without breaking ordering.
+            Block messages never expire and ignore priority.
+            @param message The message to be sent.
+            @param context The serialization context.
+            @param timeToLive Time in seconds after which the message is retired if it has not been acked. Zero means the message never expires.
+            @param priority Messages with higher priority are picked first from the send window when not all messages fit in the packet.
+         */
+
+        void SendMessage( Message * message, void *context, double timeToLive, int priority );
+
+        void SendMessages( Message ** messages, int numMessages, void *context );
 
         Message * ReceiveMessage();
 
+        int ReceiveMessages( Message ** messages, int maxMessages );
+
         void AdvanceTime( double time );
 
         int GetPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
 
+        int GetTopUpPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
+
         void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
 
         void ProcessAck( uint16_t ack );
 
+        void GetStatus( ChannelStatus & status ) const;
+
         /**
             Are there any unacked messages in the send queue?
             Messages are acked individually and remain in the send queue until acked.
@@ -4300,6 +4979,19 @@ namespace yojimbo
 
         int GetMessagesToSend( uint16_t * messageIds, int & numMessageIds, int remainingPacketBits, void *context );
 
+        /**
+            Get messages to include in a packet, highest priority first.
+            Used instead of the in-order walk in GetMessagesToSend while any message in the send queue has non-zero priority.
+            Considers every message in the send window that is due to be sent. Skip markers are picked first, then messages in order of decreasing priority, and in message id order within the same priority.
+            @param messageIds Array of message ids to be filled [out]. The ids are written in message id order.
+            @param numMessageIds The number of message ids written to the array.
+            @param availableBits Number of bits available for messages in the packet.
+            @returns The number of bits required to serialize the message ids and messages.
+            @see GetMessagesToSend
+         */
+
+        int GetPriorityMessagesToSend( uint16_t * messageIds, int & numMessageIds, int availableBits );
+
         /**
             Fill channel packet data with messages.
             This is the payload function to fill packet data while sending regular messages (without blocks attached).
@@ -4315,6 +5007,7 @@ namespace yojimbo
         /**
             Add a packet entry for the set of messages included in a packet.
             This lets us look up the set of messages that were included in that packet later on when it is acked, so we can ack those messages individually.
+            The message ids are appended to the sent packet message id ring buffer as runs of consecutive ids.
             @param messageIds The set of message ids that were included in the packet.
             @param numMessageIds The number of message ids in the array.
             @param sequence The sequence number of the connection packet the messages were included in.
@@ -4325,16 +5018,27 @@ namespace yojimbo
         /**
             Process messages included in a packet.
             Any messages that have not already been received are added to the message receive queue. Messages that are added to the receive queue have a reference added. See Message::AddRef.
+            Also called with the block message once all fragments of a block have been received.
             @param numMessages The number of messages to process.
             @param messages Array of pointers to messages.
          */
 
-        void ProcessPacketMessages( int numMessages, Message ** messages );
+        virtual void ProcessPacketMessages( int numMessages, Message ** messages );
+
+        /**
+            Process skip markers included in a packet.
+            Each skipped message id is added to the receive queue with a NULL message, so the receiver moves past it without delivering anything.
+            @param numSkippedIds The number of skipped message ids.
+            @param skippedIds Array of skipped message ids.
+         */
+
+        virtual void ProcessPacketSkippedIds( int numSkippedIds, const uint16_t * skippedIds );
 
         /**
             Track the oldest unacked message id in the send queue.
             Because messages are acked individually, the send queue is not a true queue and may have holes. 
             Because of this it is necessary to periodically walk forward from the previous oldest unacked message id, to find the current oldest unacked message id. 
+            The walk scans the send queue occupancy bitmap a word at a time, so holes left by acked messages are skipped 64 at a time.
             This lets us know our starting point for considering messages to include in the next packet we send.
             @see GetMessagesToSend
          */
@@ -4346,7 +5050,7 @@ namespace yojimbo
             Block messages are treated differently to regular messages. 
             Regular messages are small so we try to fit as many into the packet we can. See ReliableChannelData::GetMessagesToSend.
             Blocks attached to block messages are usually larger than the maximum packet size or channel budget, so they are split up fragments. 
-            While in the mode of sending a block message, each channel packet data generated has exactly one fragment from the current block in it. Fragments keep getting included in packets until all fragments of that block are acked.
+            While in the mode of sending a block message, each channel packet data generated has exactly one fragment from the current block in it. Space left over in the packet is topped up with more fragments, each in a channel packet data of its own. Fragments keep getting included in packets until all fragments of that block are acked.
             @returns True if currently sending a block message over the network, false otherwise.
             @see BlockMessage
             @see GetFragmentToSend
@@ -4356,16 +5060,36 @@ namespace yojimbo
 
         /**
             Get the next block fragment to send.
-            The next block fragment is selected by scanning left to right over the set of fragments in the block, skipping over any fragments that have already been acked or have been sent within ChannelConfig::fragmentResendTime.
+            Fragments due to be resent go first, oldest send first, followed by fragments that have not been sent yet in fragment id order. Fragments that have been acked or were sent within ChannelConfig::blockFragmentResendTime are never selected.
+            Streamed blocks are sent through a window of ChannelConfig::GetMaxFragmentsPerBlock fragments starting at the oldest unacked fragment, and fragment data is read from the block source as it is sent.
             @param messageId The id of the message that the block is attached to [out].
-            @param fragmentId The id of the fragment to send [out].
+            @param fragmentId The id of the fragment to send [out]. Parity fragments have ids starting at numFragments. See ChannelConfig::blockParityGroupSize.
             @param fragmentBytes The size of the fragment in bytes.
-            @param numFragments The total number of fragments in this block.
+            @param numFragments The total number of fragments in this block, not including parity fragments.
             @param messageType The type of message the block is attached to. See MessageFactory.
+            @param availableBits The maximum number of bits the fragment may take up. If the next fragment to send doesn't fit, no fragment is selected.
             @returns Pointer to the fragment data.
          */
 
-        uint8_t * GetFragmentToSend( uint16_t & messageId, uint16_t & fragmentId, int & fragmentBytes, int & numFragments, int & messageType );
+        uint8_t * GetFragmentToSend( uint16_t & messageId, int & fragmentId, int & fragmentBytes, int & numFragments, int & messageType, int availableBits );
+
+        /**
+            Get the number of bits a fragment of the block being sent takes up in a packet.
+            Follows SerializeBlockFragment field by field. Only the alignment before the fragment data is a worst case.
+            @param fragmentId The fragment id.
+            @param fragmentBytes The size of the fragment data in bytes.
+            @returns The number of bits required to serialize the fragment, including the block message if it goes with this fragment.
+         */
+
+        int GetFragmentBits( int fragmentId, int fragmentBytes ) const;
+
+        /**
+            Get the id of the nth fragment of the block being sent, in first send order.
+            @param sendIndex The send index in [0,numFragments+numParityFragments-1].
+            @returns The fragment id. Parity fragments have ids starting at numFragments.
+         */
+
+        int GetBlockFragmentIdToSend( int sendIndex ) const;
 
         /**
             Fill the packet data with block and fragment data.
@@ -4377,12 +5101,12 @@ namespace yojimbo
             @param fragmentSize The size of the fragment data (bytes).
             @param numFragments The number of fragments in the block.
             @param messageType The type of message the block is attached to.
-            @returns An estimate of the number of bits required to serialize the block message and fragment data (upper bound).
+            @returns The number of bits required to serialize the block message and fragment data. See GetFragmentBits.
          */
 
         int GetFragmentPacketData( ChannelPacketData & packetData, 
                                    uint16_t messageId, 
-                                   uint16_t fragmentId, 
+                                   int fragmentId, 
                                    uint8_t * fragmentData, 
                                    int fragmentSize, 
                                    int numFragments, 
@@ -4396,28 +5120,72 @@ namespace yojimbo
             @param sequence The sequence number of the packet the fragment was included in.
          */
 
-        void AddFragmentPacketEntry( uint16_t messageId, uint16_t fragmentId, uint16_t sequence );
+        void AddFragmentPacketEntry( uint16_t messageId, int fragmentId, uint16_t sequence );
+
+        /**
+            Add another fragment to the packet entry of a packet being topped up with fragments.
+            Fragment ids after the first are appended to the sent packet message id ring buffer, as the low and high 16 bits of each id.
+            @param fragmentId The fragment id.
+            @param sequence The sequence number of the packet the fragment was included in.
+         */
+
+        void AddFragmentToPacketEntry( int fragmentId, uint16_t sequence );
+
+        /**
+            Allocate the sent packet message id ring buffer on first use.
+            @returns True if the ring buffer is allocated. Sets CHANNEL_ERROR_OUT_OF_MEMORY and returns false otherwise.
+         */
+
+        bool AllocateSentPacketMessageIds();
+
+        /**
+            Ack a fragment of the block being sent. Completes the block send once all fragments are acked.
+            @param fragmentId The id of the fragment that was acked.
+         */
+
+        void AckBlockFragment( int fragmentId );
 
         /**
             Process a packet fragment.
             The fragment is added to the set of received fragments for the block. When all packet fragments are received, that block is reconstructed, attached to the block message and added to the message receive queue.
+            Fragments of a streamed block are written to the block sink instead, and the block message is added to the message receive queue once all of them have been written.
             @param messageType The type of the message this block fragment is attached to. This is used to make sure this message type actually allows blocks to be attached to it.
             @param messageId The id of the message the block fragment belongs to.
             @param numFragments The number of fragments in the block.
+            @param streamed True if the fragment belongs to a streamed block. See BlockMessage::AttachBlockSource.
             @param fragmentId The id of the fragment in [0,numFragments-1].
             @param fragmentData The fragment data.
             @param fragmentBytes The size of the fragment data in bytes.
-            @param blockMessage Pointer to the block message. Passed this in only with the first fragment (0), pass NULL for all other fragments.
+            @param lastFragmentBytes The size of the last fragment in the block. Sent with the last parity fragment only, so the block size is known even if the last fragment is rebuilt from parity.
+            @param blockMessage Pointer to the block message. Passed in only with the first fragment (0) and the first parity fragment, pass NULL for all other fragments.
          */
 
         void ProcessPacketFragment( int messageType, 
                                     uint16_t messageId, 
                                     int numFragments, 
-                                    uint16_t fragmentId, 
+                                    bool streamed, 
+                                    int fragmentId, 
                                     const uint8_t * fragmentData, 
                                     int fragmentBytes, 
+                                    int lastFragmentBytes, 
                                     BlockMessage * blockMessage );
 
+        /**
+            Rebuild a lost block fragment from parity.
+            Fragment ids [numFragments,numFragments+numParityFragments-1] are parity fragments. Parity fragment n is the XOR of block fragments [n*blockParityGroupSize,(n+1)*blockParityGroupSize-1], so once all but one fragment of a group and its parity fragment are received, the missing fragment is the XOR of the others.
+            @param fragmentId The id of a fragment just received. Any fragment of the group, including its parity fragment.
+         */
+
+        void RecoverBlockFragment( int fragmentId );
+
+        /**
+            Ack a parity group once enough of it has been acked.
+            The receiver rebuilds a group from any blockParityGroupSize of its fragments plus parity, so the sender stops sending the rest of the group at that point instead of waiting for acks that will never come.
+            @param fragmentId The id of the fragment just acked.
+         */
+
+        void AckParityGroup( int fragmentId );
+
     protected:
 
         /**
@@ -4427,8 +5195,11 @@ namespace yojimbo
 
         struct MessageSendQueueEntry
         {
-            Message * message;                                                          ///< Pointer to the message. When inserted in the send queue the message has one reference. It is released when the message is acked and removed from the send queue.
+            Message * message;                                                          ///< Pointer to the message. When inserted in the send queue the message has one reference. It is released when the message is acked and removed from the send queue. NULL if the message expired and this entry is a skip marker.
             double timeLastSent;                                                        ///< The time the message was last sent. Used to implement ChannelConfig::messageResendTime.
+            double timeQueued;                                                          ///< The time the message was added to the send queue.
+            double expireTime;                                                          ///< The time the message expires, or negative if it never expires.
+            int priority;                                                               ///< The message priority. Higher priority messages are sent first.
             uint32_t measuredBits : 31;                                                 ///< The number of bits the message takes up in a bit stream.
             uint32_t block : 1;                                                         ///< 1 if this is a block message. Block messages are treated differently to regular messages when sent over a reliable-ordered channel.
         };
@@ -4439,7 +5210,7 @@ namespace yojimbo
 
         struct MessageReceiveQueueEntry
         {
-            Message * message;                                                          ///< The message pointer. Has at a reference count of at least 1 while in the receive queue. Ownership of the message is passed back to the caller when the message is dequeued.
+            Message * message;                                                          ///< The message pointer. Has at a reference count of at least 1 while in the receive queue. Ownership of the message is passed back to the caller when the message is dequeued. NULL if the sender skipped this message id.
         };
 
         /**
@@ -4449,62 +5220,80 @@ namespace yojimbo
         struct SentPacketEntry
         {
             double timeSent;                                                            ///< The time the packet was sent. Used to estimate round trip time.
-            uint16_t * messageIds;                                                      ///< Pointer to an array of message ids. Dynamically allocated because the user can configure the maximum number of messages in a packet per-channel with ChannelConfig::maxMessagesPerPacket.
-            uint32_t numMessageIds : 16;                                                ///< The number of message ids in in the array.
+            uint32_t messageIdRunStart;                                                 ///< Position of the first message id run for this packet in the sent packet message id ring buffer. See ChannelConfig::sentPacketMessageIdBufferSize.
+            uint32_t numMessageIdRuns : 16;                                             ///< The number of runs of consecutive message ids included in the packet.
             uint32_t acked : 1;                                                         ///< 1 if this packet has been acked.
+            uint32_t numBlockFragments : 15;                                            ///< The number of block fragments in the packet. Fragments after the first are stored in the sent packet message id ring buffer starting at messageIdRunStart.
             uint64_t block : 1;                                                         ///< 1 if this packet contains a fragment of a block message.
             uint64_t blockMessageId : 16;                                               ///< The block message id. Valid only if "block" is 1.
-            uint64_t blockFragmentId : 16;                                              ///< The block fragment id. Valid only if "block" is 1.
+            uint64_t blockFragmentId : 32;                                              ///< The id of the first block fragment in the packet. Valid only if "block" is 1.
         };
 
         /**
             Internal state for a block being sent across the reliable ordered channel.
-            Stores the block data and tracks which fragments have been acked. The block send completes when all fragments have been acked.
+            Tracks which fragments have been acked. The block send completes when all fragments have been acked.
+            Fragments of a streamed block are tracked in a window of windowSize fragments starting at fragmentBase, with fragment n stored in slot n % windowSize. Other blocks always fit in the window, so fragmentBase stays at zero.
             IMPORTANT: Although there can be multiple block messages in the message send and receive queues, only one data block can be in flights over the wire at a time.
          */
 
         struct SendBlockData
         {
-            SendBlockData( Allocator & allocator, int maxBlockSize, int maxFragmentsPerBlock )
+            SendBlockData( Allocator & allocator, int maxFragmentsPerBlock )
             {
                 m_allocator = &allocator;
+                windowSize = maxFragmentsPerBlock;
                 ackedFragment = YOJIMBO_NEW( allocator, BitArray, allocator, maxFragmentsPerBlock );
                 fragmentSendTime = (double*) YOJIMBO_ALLOCATE( allocator, sizeof( double) * maxFragmentsPerBlock );
-                blockData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, maxBlockSize );
+                resendQueue = YOJIMBO_NEW( allocator, Queue<int>, allocator, maxFragmentsPerBlock * 2 );
                 yojimbo_assert( ackedFragment );
                 yojimbo_assert( fragmentSendTime );
-                yojimbo_assert( blockData );
+                yojimbo_assert( resendQueue );
                 Reset();
             }
 
             ~SendBlockData()
             {
                 YOJIMBO_DELETE( *m_allocator, BitArray, ackedFragment );
-                YOJIMBO_FREE( *m_allocator, blockData );
+                YOJIMBO_DELETE( *m_allocator, Queue<int>, resendQueue );
                 YOJIMBO_FREE( *m_allocator, fragmentSendTime );
             }
 
             void Reset()
             {
                 active = false;
+                streamed = false;
                 numFragments = 0;
                 numAckedFragments = 0;
+                numParityFragments = 0;
+                nextFragmentId = 0;
+                fragmentBase = 0;
                 blockMessageId = 0;
                 blockSize = 0;
+                resendQueue->Clear();
+            }
+
+            bool IsFragmentAcked( int fragmentId ) const
+            {
+                return fragmentId < fragmentBase || ackedFragment->GetBit( fragmentId % windowSize );
             }
 
             bool active;                                                                ///< True if we are currently sending a block.
+            bool streamed;                                                              ///< True if the block is read from a block source. See BlockMessage::AttachBlockSource.
             int blockSize;                                                              ///< The size of the block (bytes).
             int numFragments;                                                           ///< Number of fragments in the block being sent.
-            int numAckedFragments;                                                      ///< Number of acked fragments in the block being sent.
+            int numAckedFragments;                                                      ///< Number of acked fragments in the block being sent. Includes fragments the receiver can rebuild from parity.
+            int numParityFragments;                                                     ///< Number of parity fragments sent with the block. See ChannelConfig::blockParityGroupSize.
+            int nextFragmentId;                                                         ///< Send index of the first fragment that has not been sent yet. Fragments are first sent in order, with each parity fragment following its group.
+            int fragmentBase;                                                           ///< All fragments before this one have been acked. Only advances for streamed blocks.
+            int windowSize;                                                             ///< Number of fragments tracked at once.
             uint16_t blockMessageId;                                                    ///< The message id the block is attached to.
-            BitArray * ackedFragment;                                                   ///< Has fragment n been received?
-            double * fragmentSendTime;                                                  ///< Last time fragment was sent.
-            uint8_t * blockData;                                                        ///< The block data.
+            BitArray * ackedFragment;                                                   ///< Has fragment n been acked? Indexed by n % windowSize.
+            double * fragmentSendTime;                                                  ///< Last time fragment n was sent. Indexed by n % windowSize.
+            Queue<int> * resendQueue;                                                   ///< Ids of sent fragments in the order they were last sent. Every fragment has the same resend time, so the front of the queue is always the next fragment due to be resent. Acked fragments are skipped when they reach the front. Sized for two windows, since acked fragments of a streamed block can linger behind the front.
 
         private:
 
-            Allocator * m_allocator;                                                    ///< Allocator used to create the block data.
+            Allocator * m_allocator;                                                    ///< Allocator used to create the fragment tracking data.
         
             SendBlockData( const SendBlockData & other );
             
@@ -4514,65 +5303,136 @@ namespace yojimbo
         /**
             Internal state for a block being received across the reliable ordered channel.
             Stores the fragments received over the network for the block, and completes once all fragments have been received.
+            The buffers the fragments are stored in are only allocated while a block is being received, from the channel block allocator. See Channel::SetBlockAllocator.
+            Fragments of a streamed block are written to the block sink instead of stored, and tracked in a window of windowSize fragments starting at fragmentBase, with fragment n stored in slot n % windowSize.
             IMPORTANT: Although there can be multiple block messages in the message send and receive queues, only one data block can be in flights over the wire at a time.
          */
 
         struct ReceiveBlockData
         {
-            ReceiveBlockData( Allocator & allocator, int maxBlockSize, int maxFragmentsPerBlock )
+            ReceiveBlockData( Allocator & allocator, int maxBlockSize, int maxFragmentsPerBlock, int maxParityFragmentsPerBlock, int blockFragmentSize )
             {
                 m_allocator = &allocator;
-                receivedFragment = YOJIMBO_NEW( allocator, BitArray, allocator, maxFragmentsPerBlock );
-                blockData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, maxBlockSize );
-                yojimbo_assert( receivedFragment && blockData );
+                m_dataAllocator = NULL;
+                m_maxBlockSize = maxBlockSize;
+                m_maxParityBytes = maxParityFragmentsPerBlock * blockFragmentSize;
+                windowSize = maxFragmentsPerBlock + maxParityFragmentsPerBlock;
+                receivedFragment = YOJIMBO_NEW( allocator, BitArray, allocator, windowSize );
+                yojimbo_assert( receivedFragment );
+                blockData = NULL;
+                parityData = NULL;
                 blockMessage = NULL;
                 Reset();
             }
 
             ~ReceiveBlockData()
             {
+                FreeBuffers();
                 YOJIMBO_DELETE( *m_allocator, BitArray, receivedFragment );
-                YOJIMBO_FREE( *m_allocator, blockData );
+            }
+
+            bool AllocateBuffers( Allocator & allocator )
+            {
+                yojimbo_assert( !m_dataAllocator );
+                blockData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, m_maxBlockSize );
+                parityData = ( m_maxParityBytes > 0 ) ? (uint8_t*) YOJIMBO_ALLOCATE( allocator, m_maxParityBytes ) : NULL;
+                m_dataAllocator = &allocator;
+                if ( !blockData || ( m_maxParityBytes > 0 && !parityData ) )
+                {
+                    FreeBuffers();
+                    return false;
+                }
+                return true;
+            }
+
+            void FreeBuffers()
+            {
+                if ( m_dataAllocator )
+                {
+                    YOJIMBO_FREE( *m_dataAllocator, blockData );
+                    YOJIMBO_FREE( *m_dataAllocator, parityData );
+                    m_dataAllocator = NULL;
+                }
             }
 
             void Reset()
             {
+                FreeBuffers();
                 active = false;
+                streamed = false;
                 numFragments = 0;
                 numReceivedFragments = 0;
+                fragmentBase = 0;
                 messageId = 0;
                 messageType = 0;
                 blockSize = 0;
             }
 
             bool active;                                                                ///< True if we are currently receiving a block.
+            bool streamed;                                                              ///< True if the block is written to the block sink as it is received.
             int numFragments;                                                           ///< The number of fragments in this block
-            int numReceivedFragments;                                                   ///< The number of fragments received.
+            int numReceivedFragments;                                                   ///< The number of fragments received or rebuilt from parity. Does not include parity fragments.
+            int fragmentBase;                                                           ///< All fragments before this one have been received. Only advances for streamed blocks.
+            int windowSize;                                                             ///< Number of fragments tracked at once.
             uint16_t messageId;                                                         ///< The message id corresponding to the block.
             int messageType;                                                            ///< Message type of the block being received.
             uint32_t blockSize;                                                         ///< Block size in bytes.
-            BitArray * receivedFragment;                                                ///< Has fragment n been received?
-            uint8_t * blockData;                                                        ///< Block data for receive.
-            BlockMessage * blockMessage;                                                ///< Block message (sent with fragment 0).
+            BitArray * receivedFragment;                                                ///< Has fragment n been received? Parity fragments follow the block fragments. Indexed by n % windowSize.
+            uint8_t * blockData;                                                        ///< Block data for receive. Allocated when a block starts and freed when it completes. NULL while idle, and while receiving a streamed block.
+            uint8_t * parityData;                                                       ///< Parity fragments received for the block. Allocated with the block data. NULL if parity fragments are disabled.
+            BlockMessage * blockMessage;                                                ///< Block message (sent with fragment 0 and the first parity fragment).
 
         private:
 
             Allocator * m_allocator;                                                    ///< Allocator used to free the data on shutdown.
+            Allocator * m_dataAllocator;                                                ///< Allocator the block and parity data were allocated with. NULL if they are not allocated.
+            int m_maxBlockSize;                                                         ///< Size of the block data buffer (bytes).
+            int m_maxParityBytes;                                                       ///< Size of the parity data buffer (bytes).
 
             ReceiveBlockData( const ReceiveBlockData & other );
             
             ReceiveBlockData & operator = ( const ReceiveBlockData & other );
         };
 
-    private:
+        /**
+            Retire a message in the send queue if it has expired.
+            The message is released and the entry becomes a skip marker. Skip markers stay in the send queue and are resent until acked, just like messages.
+            @param entry The send queue entry to check.
+         */
+
+        void RetireExpiredMessage( MessageSendQueueEntry * entry );
+
+        /**
+            Add a message to the send queue.
+            Shared by SendMessage and SendMessages, so a batch of messages is measured with a single measure stream.
+            @param message The message to add. Released if it can't be added, in which case the channel error level is set.
+            @param measureStream The measure stream used to measure the size of the message.
+            @param timeToLive Time in seconds after which the message is retired if it has not been acked. Zero means the message never expires.
+            @param priority The message priority.
+            @returns True if the message was added to the send queue.
+         */
+
+        bool QueueMessage( Message * message, MeasureStream & measureStream, double timeToLive, int priority );
+
+    protected:
 
         uint16_t m_sendMessageId;                                                       ///< Id of the next message to be added to the send queue.
-        uint16_t m_receiveMessageId;                                                    ///< Id of the next message to be added to the receive queue.
+        uint16_t m_receiveMessageId;                                                    ///< Id of the next message to be dequeued from the receive queue. For the reliable-unordered channel, the oldest message id not yet received.
         uint16_t m_oldestUnackedMessageId;                                              ///< Id of the oldest unacked message in the send queue.
+        int m_numPriorityMessages;                                                      ///< Number of messages in the send queue with non-zero priority. While zero, messages are picked in id order.
+        int m_numQueuedMessages;                                                        ///< Number of messages and skip markers in the send queue.
+        uint64_t m_numQueuedBits;                                                       ///< Measured size of the messages in the send queue, including attached blocks (bits).
+        int m_minQueuedMessageBits;                                                     ///< Lower bound on the measured size of any message in the send queue (bits). Zero once a message expires into a skip marker. Lets GetMessagesToSend stop as soon as nothing else can fit.
+        uint64_t m_numMessagesAcked;                                                    ///< Number of messages and skip markers removed from the send queue because they were acked.
+        uint64_t m_ackRateSampleMessagesAcked;                                          ///< Value of m_numMessagesAcked at the start of the current ack rate sample.
+        double m_ackRateSampleTime;                                                     ///< Time the current ack rate sample started.
+        float m_ackedMessagesPerSecond;                                                 ///< Smoothed number of messages acked per-second.
         SequenceBuffer<SentPacketEntry> * m_sentPackets;                                ///< Stores information per sent connection packet about messages and block data included in each packet. Used to walk from connection packet level acks to message and data block fragment level acks.
         SequenceBuffer<MessageSendQueueEntry> * m_messageSendQueue;                     ///< Message send queue.
+        BitArray * m_sendQueueOccupancy;                                                ///< Bit n is set while slot n of the message send queue holds an unacked message or skip marker.
         SequenceBuffer<MessageReceiveQueueEntry> * m_messageReceiveQueue;               ///< Message receive queue.
-        uint16_t * m_sentPacketMessageIds;                                              ///< Array of n message ids per sent connection packet. Allows the maximum number of messages per-packet to be allocated dynamically.
+        uint16_t * m_sentPacketMessageIds;                                              ///< Ring buffer of message id runs for sent connection packets. Each run is the first message id followed by the number of consecutive ids. Packets append their runs in send order. Allocated when the first message is sent.
+        uint32_t m_sentPacketMessageIdHead;                                             ///< Position the next message id run is written to in the ring buffer. Wraps at 2^32, so positions are compared by difference.
         SendBlockData * m_sendBlock;                                                    ///< Data about the block being currently sent.
         ReceiveBlockData * m_receiveBlock;                                              ///< Data about the block being currently received.
 
@@ -4583,6 +5443,74 @@ namespace yojimbo
         ReliableOrderedChannel & operator = ( const ReliableOrderedChannel & other );
     };
 
+    /**
+        Messages sent across this channel are guaranteed to arrive, but are delivered in the order they are received rather than the order they were sent.
+        This channel type is best used for reliable events that don't depend on each other, where waiting for a dropped packet to be resent would needlessly delay messages that already arrived.
+        Shares the send queue, packet level acks and resend logic with the reliable-ordered channel. Only the receive side differs: messages are delivered as soon as they arrive, and duplicates are discarded by message id.
+        Blocks are split up into fragments and only one block may be in flight at a time, same as the reliable-ordered channel.
+     */
+
+    class ReliableUnorderedChannel : public ReliableOrderedChannel
+    {
+    public:
+
+        /** 
+            Reliable unordered channel constructor.
+            @param allocator The allocator to use.
+            @param messageFactory Message factory for creating and destroying messages.
+            @param config The configuration for this channel.
+            @param channelIndex The channel index in [0,numChannels-1].
+         */
+
+        ReliableUnorderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, double time );
+
+        /**
+            Reliable unordered channel destructor.
+            Any messages still in the send, receive or delivery queues will be released.
+         */
+
+        ~ReliableUnorderedChannel();
+
+        void Reset();
+
+        Message * ReceiveMessage();
+
+        int ReceiveMessages( Message ** messages, int maxMessages );
+
+        /**
+            Process messages included in a packet.
+            Messages that have not already been received are added to the delivery queue immediately. The message receive queue only tracks which message ids have been received, so duplicates can be discarded.
+            @param numMessages The number of messages to process.
+            @param messages Array of pointers to messages.
+         */
+
+        void ProcessPacketMessages( int numMessages, Message ** messages );
+
+        void ProcessPacketSkippedIds( int numSkippedIds, const uint16_t * skippedIds );
+
+    protected:
+
+        /**
+            Advance the receive window past all message ids received contiguously.
+         */
+
+        void AdvanceReceiveWindow();
+
+        /**
+            Release any messages in the delivery queue.
+         */
+
+        void ClearDeliveryQueue();
+
+        Queue<Message*> * m_messageDeliveryQueue;                                       ///< Messages received and ready to be dequeued, in the order they arrived.
+
+    private:
+
+        ReliableUnorderedChannel( const ReliableUnorderedChannel & other );
+
+        ReliableUnorderedChannel & operator = ( const ReliableUnorderedChannel & other );
+    };
+
     /**
         Messages sent across this channel are not guaranteed to arrive, and may be received in a different order than they were sent.
         This channel type is best used for time critical data like snapshots and object state.
@@ -4613,22 +5541,100 @@ namespace yojimbo
 
         bool CanSendMessage() const;
 
-        void SendMessage( Message * message, void *context );
+        bool CanSendMessages( int numMessages ) const;
+
+        bool HasMessagesToSend() const;
+
+        void SendMessage( Message * message, void *context, double timeToLive, int priority );
+
+        void SendMessages( Message ** messages, int numMessages, void *context );
 
         Message * ReceiveMessage();
 
+        int ReceiveMessages( Message ** messages, int maxMessages );
+
         void AdvanceTime( double time );
 
         int GetPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
 
+        int GetTopUpPacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
+
         void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
 
         void ProcessAck( uint16_t ack );
 
+        void GetStatus( ChannelStatus & status ) const;
+
     protected:
 
+        /**
+            Fill a channel entry with messages from the send queue.
+            With ChannelConfig::packetParityGroupSize set, the messages are written out as payload bytes, which are added to the current parity group.
+            @returns The number of bits the entry takes, or zero if no messages were added.
+         */
+
+        int GetMessagePacketData( void *context, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
+
+        /**
+            Fill a channel entry with the parity of the current group, and start the next group.
+            @returns The number of bits the entry takes, or zero if it doesn't fit in availableBits. A group whose parity doesn't fit is dropped.
+         */
+
+        int GetParityPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
+
+        /**
+            Add the payload of a sent channel entry to the current parity group.
+            @returns True if the payload was added. False if the parity buffer could not be allocated, in which case parity is skipped for this group.
+         */
+
+        bool AddParityPacket( uint16_t packetSequence, const uint8_t * payloadData, int payloadBytes );
+
+        /**
+            Clear the parity of the current group and start a new one.
+         */
+
+        void ResetParityGroup();
+
+        /**
+            Keep the payload of a received channel entry for rebuilding lost packets, or rebuild a lost packet from a parity entry.
+            Only used with ChannelConfig::packetParityGroupSize set.
+            @returns True if the entry carries messages to receive. False for parity entries, and for packets that were already received or rebuilt.
+         */
+
+        bool ProcessParityPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
+
+        /**
+            Rebuild the messages of a lost packet from a parity entry and receive them.
+            The missing payload is the XOR of the parity with the payloads of the rest of the group, so nothing happens unless exactly one packet of the group is missing.
+         */
+
+        void RecoverParityPacket( const ChannelPacketData::ParityData & parity );
+
+        /**
+            The payload of a packet received on a channel with ChannelConfig::packetParityGroupSize set.
+         */
+
+        struct ParityReceiveEntry
+        {
+            uint16_t packetSequence;                            ///< The packet sequence the payload was received in, or rebuilt for.
+            bool valid;                                         ///< True if this entry holds a payload.
+            int bytes;                                          ///< The size of the payload (bytes).
+            int capacity;                                       ///< The size of the data buffer (bytes). Grows to the largest payload received.
+            uint8_t * data;                                     ///< The payload data.
+        };
+
         Queue<Message*> * m_messageSendQueue;                   ///< Message send queue.
         Queue<Message*> * m_messageReceiveQueue;                ///< Message receive queue.
+        uint8_t * m_parityData;                                 ///< XOR of the payloads in the current parity group. NULL until the first payload is sent.
+        int m_parityCapacity;                                   ///< Size of the parity buffer (bytes). Grows to the largest payload sent.
+        int m_parityBytes;                                      ///< Size of the parity of the current group (bytes). The largest payload in the group.
+        int m_numParityPackets;                                 ///< Number of packets in the current parity group.
+        uint16_t * m_parityPacketSequence;                      ///< Packet sequence of each packet in the current parity group. NULL if parity is disabled.
+        int * m_parityPacketBytes;                              ///< Payload size of each packet in the current parity group (bytes). NULL if parity is disabled.
+        int m_parityTopUpSequence;                              ///< Sequence of the packet a parity entry was just added to. Messages for that packet go in a top up entry after it. -1 if none.
+        int m_parityTopUpBits;                                  ///< Bits taken by that parity entry. Counts against ChannelConfig::packetBudget for the top up entry.
+        int m_numParityReceiveEntries;                          ///< Number of received payloads kept. Enough to cover several parity groups when the channel doesn't send in every packet.
+        ParityReceiveEntry * m_parityReceiveEntries;            ///< Received payloads, indexed by packet sequence % m_numParityReceiveEntries. NULL if parity is disabled.
 
     private:
 
@@ -4637,6 +5643,47 @@ namespace yojimbo
         UnreliableUnorderedChannel & operator = ( const UnreliableUnorderedChannel & other );
     };
 
+    /**
+        Messages sent across this channel are not guaranteed to arrive, but are never received out of order. Any message older than the most recent message received is discarded.
+        This channel type is best used for state updates where only the newest value matters, so stale data doesn't pile up in the receive queue under jitter.
+        Each message is tagged with a per-channel sequence number, which is available on the receiver via Message::GetId.
+     */
+
+    class UnreliableSequencedChannel : public UnreliableUnorderedChannel
+    {
+    public:
+
+        /** 
+            Unreliable sequenced channel constructor.
+            @param allocator The allocator to use.
+            @param messageFactory Message factory for creating and destroying messages.
+            @param config The configuration for this channel.
+            @param channelIndex The channel index in [0,numChannels-1].
+         */
+
+        UnreliableSequencedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelIndex, double time );
+
+        void Reset();
+
+        void SendMessage( Message * message, void *context, double timeToLive, int priority );
+
+        void SendMessages( Message ** messages, int numMessages, void *context );
+
+        void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
+
+    protected:
+
+        uint16_t m_sendMessageId;                               ///< Sequence number assigned to the next message sent.
+        uint16_t m_receiveMessageId;                            ///< Sequence number of the most recent message received. Valid only if m_receivedMessage is true.
+        bool m_receivedMessage;                                 ///< True once at least one message has been received.
+
+    private:
+
+        UnreliableSequencedChannel( const UnreliableSequencedChannel & other );
+
+        UnreliableSequencedChannel & operator = ( const UnreliableSequencedChannel & other );
+    };
+
     /// Connection error level.
 
     enum ConnectionErrorLevel
@@ -4664,10 +5711,42 @@ namespace yojimbo
 
         bool CanSendMessage( int channelIndex ) const;
 
+        bool CanSendMessages( int channelIndex, int numMessages ) const;
+
+        void GetChannelStatus( int channelIndex, ChannelStatus & status ) const;
+
+        /**
+            Set the block sink that streamed blocks received on a channel are written to. See Channel::SetBlockSink.
+         */
+
+        void SetBlockSink( int channelIndex, BlockSink * blockSink );
+
+        /**
+            Set the allocator that block receive buffers are allocated from, on all channels. See Channel::SetBlockAllocator.
+         */
+
+        void SetBlockAllocator( Allocator & allocator );
+
         void SendMessage( int channelIndex, Message * message, void *context = 0);
 
+        /**
+            Send a message with a time to live and priority.
+            Only reliable channels support these. Unreliable channels send the message as usual.
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param message The message to send.
+            @param timeToLive Time in seconds after which the message is retired if it has not been acked. Zero means the message never expires.
+            @param priority Messages with higher priority are sent first.
+            @param context The serialization context.
+         */
+
+        void SendMessage( int channelIndex, Message * message, double timeToLive, int priority, void *context = 0 );
+
+        void SendMessages( int channelIndex, Message ** messages, int numMessages, void *context = 0 );
+
         Message * ReceiveMessage( int channelIndex );
 
+        int ReceiveMessages( int channelIndex, Message ** messages, int maxMessages );
+
         void ReleaseMessage( Message * message );
 
         bool GeneratePacket( void * context, uint16_t packetSequence, uint8_t * packetData, int maxPacketBytes, int & packetBytes );
@@ -4680,13 +5759,163 @@ namespace yojimbo
 
         ConnectionErrorLevel GetErrorLevel() { return m_errorLevel; }
 
-    private:
+        /**
+            Change the send rate limit. Overrides ConnectionConfig::bandwidthLimit until the connection is reset.
+            @param kbps The limit in kilobits per second. Zero means no limit.
+         */
 
-        Allocator * m_allocator;                                ///< Allocator passed in to the connection constructor.
-        MessageFactory * m_messageFactory;                      ///< Message factory for creating and destroying messages.
+        void SetBandwidthLimit( int kbps );
+
+        int GetBandwidthLimit() const { return m_bandwidthLimit; }
+
+    protected:
+
+        /**
+            Work out the order in which channels get to add data to the next packet.
+            Channels are sorted by priority, then by deficit so the channel that is furthest behind its fair share goes first. Ties are broken round robin.
+            @param channelOrder Array of channel indices to be filled [out]. Must have at least numChannels entries.
+         */
+
+        void GetChannelSchedule( int * channelOrder ) const;
+
+        /**
+            Update the per-channel deficit after generating a packet.
+            Each channel with messages to send is credited its weighted share of the bits used by its priority level, and debited the bits it actually used.
+            Channels with nothing to send have their deficit reset to zero.
+            @param channelOrder The order channels were serviced in. See GetChannelSchedule.
+            @param channelActive Array of flags, true if the channel had messages to send when the packet was generated.
+            @param channelBits Array of packet data bits written by each channel.
+            @param maxPacketBits The maximum packet size in bits. Deficits are clamped to this range.
+         */
+
+        void UpdateChannelDeficits( const int * channelOrder, const bool * channelActive, const int * channelBits, int maxPacketBits );
+
+    private:
+
+        /**
+            Get the bytes a packet costs against the bandwidth limit.
+            @param packetBytes The size of the packet data (bytes).
+            @returns The packet size plus ConnectionConfig::packetOverhead for the packet, or for each fragment if it is above ConnectionConfig::fragmentPacketsAbove.
+         */
+
+        int GetBandwidthCost( int packetBytes ) const;
+
+        /**
+            Records which channels included data in a sent packet.
+         */
+
+        struct SentPacketEntry
+        {
+            uint64_t channelMask;                               ///< Bit n is set if reliable channel n included data in the packet.
+        };
+
+        Allocator * m_allocator;                                ///< Allocator passed in to the connection constructor.
+        MessageFactory * m_messageFactory;                      ///< Message factory for creating and destroying messages.
         ConnectionConfig m_connectionConfig;                    ///< Connection configuration.
         Channel * m_channel[MaxChannels];                       ///< Array of connection channels. Array size corresponds to m_connectionConfig.numChannels
         ConnectionErrorLevel m_errorLevel;                      ///< The connection error level.
+        int m_channelDeficit[MaxChannels];                      ///< Deficit round robin credit per-channel (bits). Positive means the channel has had less than its share of bandwidth.
+        int m_scheduleOffset;                                   ///< Rotates which channel wins ties in the channel schedule, so equal channels take turns going first.
+        uint64_t m_reliableChannelMask;                         ///< Bit n is set if channel n is reliable. Only reliable channels do anything with acks.
+        SequenceBuffer<SentPacketEntry> * m_sentPackets;        ///< Channel mask per sent packet, so each ack is only passed to the channels that included data in that packet.
+        int m_bandwidthLimit;                                   ///< Send rate limit in kilobits per second. Zero means no limit.
+        double m_bandwidthTokens;                               ///< Bytes in the token bucket. Refilled by AdvanceTime, spent by GeneratePacket.
+        double m_time;                                          ///< The current time. See AdvanceTime.
+        double m_lastPacketSendTime;                            ///< Time the last packet was generated. Empty packets go out as keep-alives when this gets older than ConnectionConfig::keepAliveInterval.
+        double m_ackPendingTime;                                ///< Time the oldest received packet with message data came in, since the last packet was generated. Negative if no acks are due.
+        int m_numUnackedReceivedPackets;                        ///< Packets received since the last packet was generated. An empty packet goes out to ack them once this reaches MaxUnackedReceivedPackets.
+    };
+
+    /**
+        Lock-free message queues between the game thread and the network thread for one connection.
+        Used by clients and servers when ClientServerConfig::networkThread is set. The game thread pushes messages to send and pops received messages.
+        Each network tick, Update moves queued messages into the connection and received messages out of it, so neither thread waits on the other.
+     */
+
+    class MessageQueues
+    {
+    public:
+
+        /**
+            @param allocator The allocator used for the queues.
+            @param connectionConfig The connection config. Queues are sized to match each channel's send and receive queue.
+         */
+
+        MessageQueues( Allocator & allocator, const ConnectionConfig & connectionConfig );
+
+        ~MessageQueues();
+
+        /**
+            Check if messages can be queued for send. Game thread only.
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param numMessages The number of messages to be sent.
+            @returns True if there is room in the send queue for all messages.
+         */
+
+        bool CanSendMessages( int channelIndex, int numMessages ) const;
+
+        /**
+            Queue a message to be sent. Game thread only.
+            @param channelIndex The channel index in [0,numChannels-1].
+            @param message The message to send. Ownership passes to the queue.
+            @param timeToLive Passed to Connection::SendMessage.
+            @param priority Passed to Connection::SendMessage.
+            @returns True if the message was queued, false if the send queue is full. The caller still owns the message on failure.
+         */
+
+        bool SendMessage( int channelIndex, Message * message, double timeToLive = 0.0, int priority = 0 );
+
+        /**
+            Pop a received message. Game thread only.
+            @param channelIndex The channel index in [0,numChannels-1].
+            @returns The message received, or NULL if there are none. The caller owns the message.
+         */
+
+        Message * ReceiveMessage( int channelIndex );
+
+        /**
+            Move queued messages into the connection as it has room for them, and received messages out of it as the receive queues have room for them. Network thread only.
+            @param connection The connection these queues belong to.
+            @param context The serialization context passed to Connection::SendMessage.
+         */
+
+        void Update( Connection & connection, void * context );
+
+        /**
+            Release all messages waiting to be sent. Network thread only.
+            @param messageFactory The message factory the messages were created with.
+         */
+
+        void ReleaseSendQueue( MessageFactory & messageFactory );
+
+        /**
+            Release all received messages not yet popped by the game thread. Game thread only.
+            @param messageFactory The message factory the messages were created with.
+         */
+
+        void ReleaseReceiveQueue( MessageFactory & messageFactory );
+
+    private:
+
+        MessageQueues( const MessageQueues & other );
+
+        MessageQueues & operator = ( const MessageQueues & other );
+
+        /**
+            A message waiting to be passed to Connection::SendMessage.
+         */
+
+        struct QueuedMessage
+        {
+            Message * message;                                  ///< The message. Owned by the queue.
+            double timeToLive;                                  ///< Time to live passed to Connection::SendMessage.
+            int priority;                                       ///< Priority passed to Connection::SendMessage.
+        };
+
+        Allocator * m_allocator;                                ///< Allocator passed in to the constructor.
+        int m_numChannels;                                      ///< Number of channels.
+        SPSCQueue<QueuedMessage> * m_sendQueue[MaxChannels];    ///< Per-channel messages from the game thread waiting to be sent.
+        SPSCQueue<Message*> * m_receiveQueue[MaxChannels];      ///< Per-channel received messages waiting for the game thread.
     };
 
     /**
@@ -4852,6 +6081,174 @@ namespace yojimbo
         PacketEntry * m_packetEntries;                  ///< Pointer to dynamically allocated packet entries. This is where buffered packets are stored.
     };
 
+    /**
+        A fixed set of threads that run one job at a time.
+        The thread calling WorkerPool::Run takes part as worker 0, so a pool of one worker runs jobs inline.
+        Used by BaseServer to split per-client work across threads when ClientServerConfig::serverWorkerThreads is greater than one.
+     */
+
+    class WorkerPool
+    {
+    public:
+
+        /**
+            The job run by every worker. Workers split the work between themselves using workerIndex and numWorkers.
+         */
+
+        typedef void (*WorkFunction)( void * context, int workerIndex, int numWorkers );
+
+        /**
+            Create the worker pool and start its threads.
+            @param allocator The allocator used for the pool's internal state.
+            @param numWorkers The number of workers, including the calling thread. Must be at least 1.
+         */
+
+        WorkerPool( Allocator & allocator, int numWorkers );
+
+        /**
+            Stop and join the worker threads.
+         */
+
+        ~WorkerPool();
+
+        /**
+            Run a job on all workers and wait for every worker to finish it.
+            @param function The job to run. Called once per worker with that worker's index.
+            @param context Passed through to the job.
+         */
+
+        void Run( WorkFunction function, void * context );
+
+        int GetNumWorkers() const { return m_numWorkers; }
+
+    private:
+
+        WorkerPool( const WorkerPool & other );
+
+        WorkerPool & operator = ( const WorkerPool & other );
+
+        Allocator * m_allocator;                                ///< Allocator passed in to the constructor.
+        int m_numWorkers;                                       ///< Number of workers, including the calling thread.
+        struct WorkerPoolInternal * m_internal;                 ///< Platform specific threads and synchronization primitives.
+    };
+
+    /**
+        A mutex. Not recursive.
+     */
+
+    class Mutex
+    {
+    public:
+
+        Mutex();
+
+        ~Mutex();
+
+        void Lock();
+
+        void Unlock();
+
+    private:
+
+        Mutex( const Mutex & other );
+
+        Mutex & operator = ( const Mutex & other );
+
+        uint64_t m_storage[8];                                  ///< Platform mutex. Fixed storage so the platform headers stay out of yojimbo.h.
+    };
+
+    /**
+        Wraps another allocator so it can be called from several threads.
+        Every allocation and free takes a mutex. Used by BaseServer for allocators shared between client slots, like the server block allocator, when client slots are worked on from more than one thread.
+     */
+
+    class LockedAllocator : public Allocator
+    {
+    public:
+
+        /**
+            @param allocator The allocator to wrap. Must outlive this allocator.
+         */
+
+        LockedAllocator( Allocator & allocator ) : m_allocator( &allocator ) {}
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        void Free( void * p, const char * file, int line );
+
+    private:
+
+        Allocator * m_allocator;                                ///< The wrapped allocator.
+        Mutex m_mutex;                                          ///< Held while calling the wrapped allocator.
+    };
+
+    /**
+        A background thread that ticks a client or server at a fixed rate.
+        Used when ClientServerConfig::networkThread is set, so packets are sent, received and acked at the tick rate no matter how often the game thread updates.
+     */
+
+    class NetworkThread
+    {
+    public:
+
+        /**
+            The function called each tick on the network thread.
+         */
+
+        typedef void (*TickFunction)( void * context, double time );
+
+        NetworkThread();
+
+        /**
+            The thread must be stopped before it is destroyed.
+         */
+
+        ~NetworkThread();
+
+        /**
+            Start the thread.
+            @param function Called tickRate times per second on the network thread until Stop is called.
+            @param context Passed through to the tick function.
+            @param time The time passed to the first tick. Later ticks add the real time elapsed since then.
+            @param tickRate Ticks per second.
+         */
+
+        void Start( TickFunction function, void * context, double time, int tickRate );
+
+        /**
+            Stop the thread and wait for it to exit. Any tick in progress finishes first.
+         */
+
+        void Stop();
+
+        bool IsRunning() const { return m_running; }
+
+        /**
+            Check if the calling thread is this network thread.
+            @returns True if called from inside the tick function.
+         */
+
+        bool IsCurrentThread() const;
+
+    private:
+
+        NetworkThread( const NetworkThread & other );
+
+        NetworkThread & operator = ( const NetworkThread & other );
+
+        static void ThreadLoop( NetworkThread * thread );
+
+        friend struct NetworkThreadEntry;
+
+        TickFunction m_function;                                ///< The tick function.
+        void * m_context;                                       ///< Passed to the tick function.
+        double m_startTime;                                     ///< Time passed to the first tick.
+        int m_tickRate;                                         ///< Ticks per second.
+        bool m_running;                                         ///< True between Start and Stop. Only changed by the thread that calls Start and Stop.
+        volatile int m_quit;                                    ///< Set by Stop to ask the thread to exit.
+        uint64_t m_thread[2];                                   ///< Platform thread handle.
+    };
+
     /** 
         Specifies the message factory and callbacks for clients and servers.
         An instance of this class is passed into the client and server constructors. 
@@ -4985,7 +6382,7 @@ namespace yojimbo
         /**
             Start the server and allocate client slots.
             Each client that connects to this server occupies one of the client slots allocated by this function.
-            @param maxClients The number of client slots to allocate. Must be in range [1,MaxClients]
+            @param maxClients The number of client slots to allocate. Must be at least 1. The dedicated Server is further limited to NETCODE_MAX_CLIENTS slots by netcode.io.
             @see Server::Stop
          */
 
@@ -5138,6 +6535,68 @@ namespace yojimbo
 
         virtual void SendMessage( int clientIndex, int channelIndex, Message * message ) = 0;
 
+        /**
+            Can we send a batch of messages to a particular client on a channel?
+            @param clientIndex The index of the client to send messages to.
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param numMessages The number of messages in the batch.
+            @returns True if all messages in the batch can be sent over the channel, false otherwise.
+         */
+
+        virtual bool CanSendMessages( int clientIndex, int channelIndex, int numMessages ) const = 0;
+
+        /**
+            Get the send queue status of a channel to a particular client.
+            Use this to throttle or reduce the detail of what you send to a client before the channel send queue fills up.
+            @param clientIndex The index of the client.
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param status The channel status to be filled [out].
+         */
+
+        virtual void GetChannelStatus( int clientIndex, int channelIndex, ChannelStatus & status ) const = 0;
+
+        /**
+            Set the block sink that streamed blocks received from a particular client on a channel are written to.
+            The server must be started. The block sink stays set for the client slot until the server is stopped.
+            @param clientIndex The index of the client.
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param blockSink The block sink. NULL to stop receiving streamed blocks.
+            @see BlockMessage::AttachBlockSource
+         */
+
+        virtual void SetBlockSink( int clientIndex, int channelIndex, BlockSink * blockSink ) = 0;
+
+        /**
+            Send a batch of messages to a client over a channel.
+            Cheaper than calling SendMessage for each message when sending many messages per-tick.
+            @param clientIndex The index of the client to send messages to.
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param messages Array of messages to send.
+            @param numMessages The number of messages in the array.
+         */
+
+        virtual void SendMessages( int clientIndex, int channelIndex, Message ** messages, int numMessages ) = 0;
+
+        /**
+            Create a message to broadcast to several clients.
+            The message is allocated from ClientServerConfig::serverBroadcastMemory instead of a client heap. Pass it to BroadcastMessage.
+            @param type The type of the message to create. Block messages can't be broadcast.
+            @returns The message, or NULL if it could not be allocated or ClientServerConfig::serverBroadcastMemory is zero.
+         */
+
+        virtual Message * CreateBroadcastMessage( int type ) = 0;
+
+        /**
+            Send the same message to several clients over a channel.
+            The message is measured once and shared by reference between the client connections, instead of being created and measured once per client.
+            Takes ownership of the message, same as SendMessage. Each client gets the message as if it was sent with SendMessage, including being disconnected if its channel send queue is full.
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param message The message to send. Must be created with CreateBroadcastMessage. If ClientServerConfig::serverBroadcastMemory is zero an error is logged, nothing is sent and the message stays with the caller.
+            @param clientMask Bit i % 64 of clientMask[i/64] selects client slot i. Pass NULL to send to every connected client. Slots that aren't connected are skipped.
+         */
+
+        virtual void BroadcastMessage( int channelIndex, Message * message, const uint64_t * clientMask ) = 0;
+
         /**
             Receive a message from a client over a channel.
             @param clientIndex The index of the client to receive messages from.
@@ -5147,6 +6606,17 @@ namespace yojimbo
 
         virtual Message * ReceiveMessage( int clientIndex, int channelIndex ) = 0;
 
+        /**
+            Receive a batch of messages from a client over a channel.
+            @param clientIndex The index of the client to receive messages from.
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param messages Array of message pointers to be filled [out]. Make sure to release each message by calling Server::ReleaseMessage.
+            @param maxMessages The size of the message array.
+            @returns The number of messages received.
+         */
+
+        virtual int ReceiveMessages( int clientIndex, int channelIndex, Message ** messages, int maxMessages ) = 0;
+
         /**
             Release a message.
             Call this for messages received by Server::ReceiveMessage.
@@ -5165,6 +6635,15 @@ namespace yojimbo
 
         virtual void GetNetworkInfo( int clientIndex, NetworkInfo & info ) const = 0;
 
+        /**
+            Limit the rate packets are sent to a client, eg. to stop flooding a client on a mobile connection.
+            Overrides ClientServerConfig::bandwidthLimit for this client until it disconnects. Drive this from GetNetworkInfo to back off when packet loss or RTT goes up.
+            @param clientIndex The index of the client.
+            @param kbps The limit in kilobits per second. Zero means no limit.
+         */
+
+        virtual void SetClientBandwidthLimit( int clientIndex, int kbps ) = 0;
+
         /**
             Connect a loopback client.
             This allows you to have local clients connected to a server, for example for integrated server or singleplayer.
@@ -5249,12 +6728,34 @@ namespace yojimbo
 
         void SendMessage( int clientIndex, int channelIndex, Message * message );
 
+        /**
+            Send a message to a client with a time to live and priority. See Connection::SendMessage.
+         */
+
+        void SendMessage( int clientIndex, int channelIndex, Message * message, double timeToLive, int priority );
+
+        bool CanSendMessages( int clientIndex, int channelIndex, int numMessages ) const;
+
+        void GetChannelStatus( int clientIndex, int channelIndex, ChannelStatus & status ) const;
+
+        void SetBlockSink( int clientIndex, int channelIndex, BlockSink * blockSink );
+
+        void SendMessages( int clientIndex, int channelIndex, Message ** messages, int numMessages );
+
+        Message * CreateBroadcastMessage( int type );
+
+        void BroadcastMessage( int channelIndex, Message * message, const uint64_t * clientMask );
+
         Message * ReceiveMessage( int clientIndex, int channelIndex );
 
+        int ReceiveMessages( int clientIndex, int channelIndex, Message ** messages, int maxMessages );
+
         void ReleaseMessage( int clientIndex, Message * message );
 
         void GetNetworkInfo( int clientIndex, NetworkInfo & info ) const;
 
+        void SetClientBandwidthLimit( int clientIndex, int kbps );
+
     protected:
 
         uint8_t * GetPacketBuffer() { return m_packetBuffer; }
@@ -5273,38 +6774,689 @@ namespace yojimbo
 
         Connection & GetClientConnection( int clientIndex );
 
-        virtual void TransmitPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes ) = 0;
+        /**
+            Generate and send a packet to each connected client.
+            Derived servers call this from SendPackets. Packets for all clients are generated first, in parallel with worker threads, and queued. The queue is then flushed through TransmitPackets on the calling thread.
+         */
 
-        virtual int ProcessPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes ) = 0;
+        void SendClientPackets();
 
-        static void StaticTransmitPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes );
-        
-        static int StaticProcessPacketFunction( void * context,int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes );
+        /**
+            Check if a client slot can take another received packet this tick.
+            Always true without worker threads. With worker threads, received packets are queued until ProcessReceivedClientPackets, and each slot queues at most MaxQueuedClientPackets. Leave any further packets with the socket layer until the next tick.
+            @param clientIndex The index of the client slot.
+            @returns True if ReceiveClientPacket can be called for this client slot.
+         */
 
-        static void * StaticAllocateFunction( void * context, uint64_t bytes );
-        
-        static void StaticFreeFunction( void * context, void * pointer );
+        bool CanReceiveClientPacket( int clientIndex ) const;
 
-    private:
+        /**
+            Get how many packets can be passed to ReceiveClientPacket for a client slot right now.
+            Use this to size a batch of packets read from the transport. Without worker threads packets are processed immediately, so this is always MaxQueuedClientPackets.
+            @param clientIndex The index of the client slot.
+            @returns The number of packets the client slot can take, between 0 and MaxQueuedClientPackets.
+         */
 
-        ClientServerConfig m_config;                                ///< Base client/server config.
-        Allocator * m_allocator;                                    ///< Allocator passed in to constructor.
-        Adapter * m_adapter;                                        ///< The adapter specifies the allocator to use, and the message factory class.
-        void * m_context;                                           ///< Optional serialization context.
-        int m_maxClients;                                           ///< Maximum number of clients supported.
-        bool m_running;                                             ///< True if server is currently running, eg. after "Start" is called, before "Stop".
-        double m_time;                                              ///< Current server time in seconds.
-        uint8_t * m_globalMemory;                                   ///< The block of memory backing the global allocator. Allocated with m_allocator.
-        uint8_t * m_clientMemory[MaxClients];                       ///< The block of memory backing the per-client allocators. Allocated with m_allocator.
+        int GetClientReceiveCapacity( int clientIndex ) const;
+
+        /**
+            Pass a packet received from a client to its reliable endpoint.
+            Processed immediately without worker threads. With worker threads, the packet is copied and processed by ProcessReceivedClientPackets, so the caller can free it straight away.
+            @param clientIndex The index of the client slot the packet came from.
+            @param packetData The packet data.
+            @param packetBytes The size of the packet in bytes.
+         */
+
+        void ReceiveClientPacket( int clientIndex, uint8_t * packetData, int packetBytes );
+
+        /**
+            Process packets queued by ReceiveClientPacket across the worker threads.
+            Derived servers call this at the end of ReceivePackets. Does nothing without worker threads.
+         */
+
+        void ProcessReceivedClientPackets();
+
+        /**
+            Mark a client slot as connected.
+            Derived servers call this when a client connects. Per-tick loops only visit connected slots, so a slot that is never added is never updated or sent packets.
+            @param clientIndex The index of the client slot. Must not already be connected.
+         */
+
+        void AddActiveClient( int clientIndex );
+
+        /**
+            Mark a client slot as disconnected.
+            Safe to call from inside BaseServer::AdvanceTime, which disconnects clients whose connection is in an error state.
+            @param clientIndex The index of the client slot. Must be connected.
+         */
+
+        void RemoveActiveClient( int clientIndex );
+
+        int GetNumActiveClients() const { return m_numActiveClients; }
+
+        int GetActiveClient( int i ) const { yojimbo_assert( i >= 0 ); yojimbo_assert( i < m_numActiveClients ); return m_activeClients[i]; }
+
+        /**
+            Reset a client slot's reliable endpoint and connection once the client has disconnected.
+            Call this after RemoveActiveClient. With the network thread, this is the point where messages the game thread queued for the old client are released.
+            @param clientIndex The index of the client slot.
+         */
+
+        void ResetClient( int clientIndex );
+
+        /**
+            Start the network thread, if ClientServerConfig::networkThread is set.
+            Derived servers call this at the end of Start, once they are ready to send and receive packets. From then on the network thread calls ReceivePackets, AdvanceTime and SendPackets at ClientServerConfig::networkTickRate.
+         */
+
+        void StartNetworkThread();
+
+        /**
+            Stop the network thread. Derived servers call this first thing in Stop. Does nothing if the network thread is not running.
+         */
+
+        void StopNetworkThread();
+
+        /**
+            Check if a call from outside should be left to the network thread.
+            @returns True if the network thread is running and the caller is not the network thread. In that case SendPackets, ReceivePackets and AdvanceTime should only call BaseServer::AdvanceTime, which syncs with the network thread.
+         */
+
+        bool DeferToNetworkThread() const { return m_networkThread.IsRunning() && !m_networkThread.IsCurrentThread(); }
+
+        /**
+            Ask the network thread to disconnect a client at the start of its next tick.
+            @param clientIndex The index of the client slot.
+         */
+
+        void RequestDisconnectClient( int clientIndex );
+
+        /**
+            Ask the network thread to disconnect all clients at the start of its next tick.
+         */
+
+        void RequestDisconnectAllClients();
+
+        /**
+            Check if a client is connected, as seen from outside the network thread.
+            A new client in a slot only shows up once everything left over from the previous client in that slot has been released.
+            @param clientIndex The index of the client slot.
+            @returns True if the client is connected.
+         */
+
+        bool IsClientConnectedOutsideNetworkThread( int clientIndex ) const;
+
+        int GetNumConnectedClientsOutsideNetworkThread() const { return yojimbo_atomic_load( &m_numConnectedClients ); }
+
+        /**
+            Get the id of the client connected to a slot, as seen from outside the network thread.
+            Recorded when the client connects, so the transport is never touched while the network thread updates it.
+            @param clientIndex The index of the client slot.
+            @returns The client id.
+         */
+
+        uint64_t GetClientIdOutsideNetworkThread( int clientIndex ) const;
+
+        virtual void TransmitPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes ) = 0;
+
+        /**
+            Transmit a batch of packets queued by SendClientPackets.
+            Packets are interleaved across clients: the first packet of each client in active client order, then the second, and so on. Batches hold up to MaxTransmitPackets packets.
+            The default implementation calls TransmitPacketFunction for each packet. Override it to hand the whole batch to the transport at once.
+            @param clientIndex Array of client slots to send each packet to.
+            @param packetSequence Array of reliable endpoint sequences, one per packet.
+            @param packetData Array of packets. Only valid during the call.
+            @param packetBytes Array of packet sizes in bytes.
+            @param numPackets The number of packets in the batch.
+         */
+
+        virtual void TransmitPackets( const int * clientIndex, const uint16_t * packetSequence, uint8_t * const * packetData, const int * packetBytes, int numPackets );
+
+        virtual int ProcessPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes ) = 0;
+
+        static void StaticTransmitPacketFunction( void * context, int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes );
+        
+        static int StaticProcessPacketFunction( void * context,int index, uint16_t packetSequence, uint8_t * packetData, int packetBytes );
+
+        static void * StaticAllocateFunction( void * context, uint64_t bytes );
+        
+        static void StaticFreeFunction( void * context, void * pointer );
+
+    private:
+
+        /**
+            Packets waiting to be transmitted for one client slot in a tick, or waiting to be processed in a worker thread tick.
+         */
+
+        struct ClientPacketQueue
+        {
+            int numPackets;                                         ///< Number of queued packets.
+            int maxPackets;                                         ///< Number of packets the queue has room for.
+            uint16_t * packetSequence;                              ///< Reliable endpoint sequence per packet. Only used for outgoing packets.
+            int * packetBytes;                                      ///< Size of each packet in bytes.
+            uint8_t ** packetData;                                  ///< Copy of each packet, allocated with the client allocator.
+        };
+
+        /**
+            Allocate a packet queue for each client slot, in one block with m_allocator.
+            @param maxPackets The number of packets each queue has room for.
+            @returns The array of queues, one per client slot. Free it with YOJIMBO_FREE.
+         */
+
+        ClientPacketQueue * CreateClientPacketQueues( int maxPackets );
+
+        bool AdvanceClient( int clientIndex );
+
+        void SendClientPacket( int clientIndex, uint8_t * packetBuffer );
+
+        void QueueTransmitPacket( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes );
+
+        void FlushTransmitPackets();
+
+        void GetWorkerClients( int workerIndex, int numWorkers, int & begin, int & end ) const;
+
+        static void StaticAdvanceClientsWork( void * context, int workerIndex, int numWorkers );
+
+        static void StaticSendClientPacketsWork( void * context, int workerIndex, int numWorkers );
+
+        static void StaticProcessReceivedPacketsWork( void * context, int workerIndex, int numWorkers );
+
+        /**
+            Client slot state shared between the network thread and the thread that owns the server.
+         */
+
+        struct ClientThreadState
+        {
+            volatile int connected;                                 ///< 1 if the client is connected, as seen from outside the network thread.
+            volatile int resetState;                                ///< CLIENT_RESET_NONE, or which thread still has to release messages left over from a disconnected client.
+            volatile int disconnectRequested;                       ///< Set by RequestDisconnectClient. Cleared by the network thread.
+            uint64_t clientId;                                      ///< Id of the client last connected to the slot. Written and read under the slot lock, since the transport can only be asked on the network thread.
+        };
+
+        enum
+        {
+            CLIENT_RESET_NONE = 0,                                  ///< Messages flow normally.
+            CLIENT_RESET_RECEIVE_QUEUE,                             ///< The client disconnected. Received messages are waiting to be released by BaseServer::AdvanceTime outside the network thread.
+            CLIENT_RESET_SEND_QUEUE                                 ///< Received messages are released. Messages queued to send are waiting to be released by the network thread.
+        };
+
+        /**
+            Check if public calls for a client slot go through its message queues.
+            @returns True if ClientServerConfig::networkThread is set and the caller is not the network thread. The network thread itself, eg. in adapter callbacks, works on connections directly.
+         */
+
+        bool UseMessageQueues() const { return m_clientMessageQueues && !m_networkThread.IsCurrentThread(); }
+
+        void LockClient( int clientIndex ) const;
+
+        void UnlockClient( int clientIndex ) const;
+
+        void NetworkThreadTick( double time );
+
+        void SyncNetworkThread();
+
+        static void StaticNetworkThreadTick( void * context, double time );
+
+        /**
+            Free broadcast messages that no client connection refers to anymore.
+            Only called on the thread that owns the server, which is the only thread that uses the broadcast allocator.
+         */
+
+        void FreeSharedMessages();
+
+        ClientServerConfig m_config;                                ///< Base client/server config.
+        Allocator * m_allocator;                                    ///< Allocator passed in to constructor.
+        Adapter * m_adapter;                                        ///< The adapter specifies the allocator to use, and the message factory class.
+        void * m_context;                                           ///< Optional serialization context.
+        int m_maxClients;                                           ///< Maximum number of clients supported.
+        bool m_running;                                             ///< True if server is currently running, eg. after "Start" is called, before "Stop".
+        double m_time;                                              ///< Current server time in seconds.
+        uint8_t * m_globalMemory;                                   ///< The block of memory backing the global allocator. Allocated with m_allocator.
+        uint8_t ** m_clientMemory;                                  ///< The blocks of memory backing the per-client allocators, one per client slot. Allocated with m_allocator.
+        uint8_t * m_blockMemory;                                    ///< The block of memory backing the block allocator. Allocated with m_allocator. NULL if ClientServerConfig::serverBlockMemory is zero.
         Allocator * m_globalAllocator;                              ///< The global allocator. Used for allocations that don't belong to a specific client.
-        Allocator * m_clientAllocator[MaxClients];                  ///< Array of per-client allocator. These are used for allocations related to connected clients.
-        MessageFactory * m_clientMessageFactory[MaxClients];        ///< Array of per-client message factories. This silos message allocations per-client slot.
-        Connection * m_clientConnection[MaxClients];                ///< Array of per-client connection classes. This is how messages are exchanged with clients.
-        reliable_endpoint_t * m_clientEndpoint[MaxClients];         ///< Array of per-client reliable.io endpoints.
+        Allocator ** m_clientAllocator;                             ///< Array of per-client allocators, one per client slot. These are used for allocations related to connected clients.
+        Allocator * m_blockAllocator;                               ///< Block receive buffers for all clients are allocated from this pool. NULL if ClientServerConfig::serverBlockMemory is zero.
+        uint8_t * m_broadcastMemory;                                ///< The block of memory backing the broadcast allocator. Allocated with m_allocator. NULL if ClientServerConfig::serverBroadcastMemory is zero.
+        Allocator * m_broadcastAllocator;                           ///< Broadcast messages and their SharedMessage entries are allocated from this. Only used on the thread that owns the server. NULL if ClientServerConfig::serverBroadcastMemory is zero.
+        MessageFactory * m_broadcastMessageFactory;                 ///< Creates broadcast messages with m_broadcastAllocator. NULL if ClientServerConfig::serverBroadcastMemory is zero.
+        SharedMessage * m_sharedMessages;                           ///< Broadcast messages that may still be referenced by client connections. Freed by FreeSharedMessages.
+        MessageFactory ** m_clientMessageFactory;                   ///< Array of per-client message factories, one per client slot. This silos message allocations per-client slot.
+        Connection ** m_clientConnection;                           ///< Array of per-client connection classes, one per client slot. This is how messages are exchanged with clients.
+        reliable_endpoint_t ** m_clientEndpoint;                    ///< Array of per-client reliable.io endpoints, one per client slot.
+        int * m_activeClients;                                      ///< Dense array of connected client slot indices. Per-tick loops iterate over this instead of every slot.
+        int * m_activeClientIndex;                                  ///< Position of each client slot in m_activeClients, or -1 if the slot is not connected.
+        int m_numActiveClients;                                     ///< Number of entries in m_activeClients.
+        WorkerPool * m_workerPool;                                  ///< Splits per-client work across threads. NULL unless ClientServerConfig::serverWorkerThreads is greater than one.
+        LockedAllocator * m_lockedBlockAllocator;                   ///< Locks m_blockAllocator when client slots are worked on from several threads. NULL unless serverBlockMemory is used with worker threads or the network thread.
+        uint8_t ** m_workerPacketBuffer;                            ///< Packet buffer per worker, so workers can generate packets at the same time.
+        ClientPacketQueue * m_clientSendQueue;                      ///< Packets generated by SendClientPackets, flushed through TransmitPackets once every client has generated its packets. One per client slot.
+        ClientPacketQueue * m_clientReceiveQueue;                   ///< Packets received on the calling thread, processed afterwards by the workers. One per client slot.
+        bool m_queueTransmitPackets;                                ///< True while SendClientPackets generates packets. Outgoing packets are queued instead of sent.
+        NetworkThread m_networkThread;                              ///< Ticks the server in the background when ClientServerConfig::networkThread is set.
+        Mutex ** m_clientLock;                                      ///< Per-client slot lock, held by whichever thread is working on the slot's connection, endpoint or allocator. NULL unless ClientServerConfig::networkThread is set.
+        MessageQueues ** m_clientMessageQueues;                     ///< Per-client slot message queues between the network thread and the thread that owns the server. NULL unless ClientServerConfig::networkThread is set.
+        ClientThreadState * m_clientThreadState;                    ///< Per-client slot state shared with the network thread. NULL unless ClientServerConfig::networkThread is set.
+        volatile int m_disconnectAllRequested;                      ///< Set by RequestDisconnectAllClients. Cleared by the network thread.
+        volatile int m_numConnectedClients;                         ///< Number of connected clients, as seen from outside the network thread.
         NetworkSimulator * m_networkSimulator;                      ///< The network simulator used to simulate packet loss, latency, jitter etc. Optional. 
         uint8_t * m_packetBuffer;                                   ///< Buffer used when writing packets.
     };
 
+    /**
+        The datagram layer under a Server.
+        The server hands it packets to send and asks it for packets received from each client slot. The transport decides who is connected and reports clients connecting and disconnecting.
+        NetcodeServerTransport is the default. Implement this interface to run a server over something else, like MemoryServerTransport.
+        Sends and receives cross this interface in batches that span client slots. NetcodeServerTransport sends and receives one packet per socket call inside netcode.io. UdpServerTransport batches them into sendmmsg and recvmmsg calls on Linux.
+     */
+
+    class ServerTransport
+    {
+    public:
+
+        /**
+            Called by the transport when a client connects (connected is 1) or disconnects (connected is 0).
+         */
+
+        typedef void (*ConnectDisconnectFunction)( void * context, int clientIndex, int connected );
+
+        virtual ~ServerTransport() {}
+
+        /**
+            Start accepting clients.
+            @param allocator Allocator for the transport's memory while it is started. Stays valid until Stop.
+            @param maxClients The number of client slots.
+            @param function Called when a client connects or disconnects. Only called from inside Update, DisconnectClient, DisconnectAllClients and Stop.
+            @param context Passed through to the function.
+            @param time The current time in seconds.
+            @returns True if the transport started. The server stops again if this returns false.
+         */
+
+        virtual bool Start( Allocator & allocator, int maxClients, ConnectDisconnectFunction function, void * context, double time ) = 0;
+
+        /**
+            Disconnect all clients and stop. Does nothing if the transport is not started.
+         */
+
+        virtual void Stop() = 0;
+
+        /**
+            Update the transport. This is where clients connect, time out and so on.
+            @param time The current time in seconds.
+         */
+
+        virtual void Update( double time ) = 0;
+
+        virtual void DisconnectClient( int clientIndex ) = 0;
+
+        virtual void DisconnectAllClients() = 0;
+
+        virtual bool IsClientConnected( int clientIndex ) const = 0;
+
+        virtual uint64_t GetClientId( int clientIndex ) const = 0;
+
+        virtual int GetNumConnectedClients() const = 0;
+
+        /**
+            Send a batch of packets.
+            @param clientIndex Array of client slots to send each packet to.
+            @param packetData Array of packets. The caller keeps ownership.
+            @param packetBytes Array of packet sizes in bytes.
+            @param numPackets The number of packets to send.
+         */
+
+        virtual void SendPackets( const int * clientIndex, uint8_t * const * packetData, const int * packetBytes, int numPackets ) = 0;
+
+        /**
+            Receive a batch of packets from a client.
+            @param clientIndex The client slot to receive packets from.
+            @param packetData Array of packet pointers to fill [out]. Pass them to FreePackets when done.
+            @param packetBytes Array of packet sizes to fill [out].
+            @param maxPackets The size of the arrays.
+            @returns The number of packets received. Less than maxPackets means there are no more packets for this client right now.
+         */
+
+        virtual int ReceivePackets( int clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets ) = 0;
+
+        /**
+            Receive a batch of packets from all client slots. This is what Server::ReceivePackets calls each tick.
+            @param clientCapacity Array with the number of packets each client slot can take, indexed by client slot [in/out]. Decremented for each packet returned. Packets for a slot at zero stay with the transport until a later call.
+            @param clientIndex Array of client slots each packet came from [out].
+            @param packetData Array of packet pointers to fill [out]. Pass them to FreePackets when done.
+            @param packetBytes Array of packet sizes to fill [out].
+            @param maxPackets The size of the arrays.
+            @returns The number of packets received. Less than maxPackets means there are no more packets the client slots can take right now.
+         */
+
+        virtual int ReceiveAllPackets( int * clientCapacity, int * clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets ) = 0;
+
+        /**
+            Free packets returned by ReceivePackets and ReceiveAllPackets.
+         */
+
+        virtual void FreePackets( uint8_t ** packetData, int numPackets ) = 0;
+
+        /**
+            Get the address the transport is bound to.
+         */
+
+        virtual const Address & GetAddress() const = 0;
+
+        /**
+            Connect a loopback client. Optional. Only transports that support loopback override this, and the loopback functions below.
+         */
+
+        virtual void ConnectLoopbackClient( int clientIndex, uint64_t clientId, const uint8_t * userData ) { (void) clientIndex; (void) clientId; (void) userData; yojimbo_assert( false ); }
+
+        virtual void DisconnectLoopbackClient( int clientIndex ) { (void) clientIndex; yojimbo_assert( false ); }
+
+        virtual bool IsLoopbackClient( int clientIndex ) const { (void) clientIndex; return false; }
+
+        virtual void ProcessLoopbackPacket( int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence ) { (void) clientIndex; (void) packetData; (void) packetBytes; (void) packetSequence; yojimbo_assert( false ); }
+    };
+
+    /**
+        Server transport on top of netcode.io. Secure UDP connections using connect tokens.
+     */
+
+    class NetcodeServerTransport : public ServerTransport
+    {
+    public:
+
+        /**
+            @param privateKey The private key used to generate connect tokens.
+            @param address The address the server binds to.
+            @param protocolId Clients can only connect with tokens generated for this protocol id.
+            @param adapter The adapter. Loopback packets are sent through Adapter::ServerSendLoopbackPacket.
+         */
+
+        NetcodeServerTransport( const uint8_t privateKey[], const Address & address, uint64_t protocolId, Adapter & adapter );
+
+        ~NetcodeServerTransport();
+
+        bool Start( Allocator & allocator, int maxClients, ConnectDisconnectFunction function, void * context, double time );
+
+        void Stop();
+
+        void Update( double time );
+
+        void DisconnectClient( int clientIndex );
+
+        void DisconnectAllClients();
+
+        bool IsClientConnected( int clientIndex ) const;
+
+        uint64_t GetClientId( int clientIndex ) const;
+
+        int GetNumConnectedClients() const;
+
+        void SendPackets( const int * clientIndex, uint8_t * const * packetData, const int * packetBytes, int numPackets );
+
+        int ReceivePackets( int clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets );
+
+        int ReceiveAllPackets( int * clientCapacity, int * clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets );
+
+        void FreePackets( uint8_t ** packetData, int numPackets );
+
+        const Address & GetAddress() const { return m_boundAddress; }
+
+        void ConnectLoopbackClient( int clientIndex, uint64_t clientId, const uint8_t * userData );
+
+        void DisconnectLoopbackClient( int clientIndex );
+
+        bool IsLoopbackClient( int clientIndex ) const;
+
+        void ProcessLoopbackPacket( int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence );
+
+    private:
+
+        NetcodeServerTransport( const NetcodeServerTransport & other );
+
+        NetcodeServerTransport & operator = ( const NetcodeServerTransport & other );
+
+        static void StaticConnectDisconnectCallbackFunction( void * context, int clientIndex, int connected );
+
+        static void StaticSendLoopbackPacketCallbackFunction( void * context, int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence );
+
+        static void * StaticAllocateFunction( void * context, uint64_t bytes );
+
+        static void StaticFreeFunction( void * context, void * pointer );
+
+        Adapter * m_adapter;                                ///< Loopback packets are sent through the adapter.
+        netcode_server_t * m_server;                        ///< netcode.io server. NULL unless started.
+        Address m_address;                                  ///< Original address passed to ctor.
+        Address m_boundAddress;                             ///< Address after socket bind, eg. valid port.
+        uint64_t m_protocolId;                              ///< Protocol id passed to netcode.io.
+        uint8_t m_privateKey[KeyBytes];                     ///< Private key passed to netcode.io.
+        int m_maxClients;                                   ///< Number of client slots passed to Start.
+        ConnectDisconnectFunction m_connectDisconnectFunction;  ///< Passed in to Start.
+        void * m_connectDisconnectContext;                  ///< Passed in to Start.
+    };
+
+    /**
+        Server transport that exchanges packets with MemoryClientTransport in the same process, without sockets.
+        Packets are copied between queues, so tests and benchmarks can measure library overhead without socket overhead. Connect tokens are ignored.
+        Not thread safe. The server and all its memory clients must be updated from the same thread.
+     */
+
+    class MemoryServerTransport : public ServerTransport
+    {
+    public:
+
+        /**
+            @param allocator The allocator used for packet copies and client slots.
+            @param address The address reported by GetAddress. Nothing is bound to it.
+            @param packetQueueSize The number of packets buffered in each direction for each client. Packets sent to a full queue are dropped.
+         */
+
+        MemoryServerTransport( Allocator & allocator, const Address & address, int packetQueueSize = 256 );
+
+        ~MemoryServerTransport();
+
+        bool Start( Allocator & allocator, int maxClients, ConnectDisconnectFunction function, void * context, double time );
+
+        void Stop();
+
+        void Update( double time );
+
+        void DisconnectClient( int clientIndex );
+
+        void DisconnectAllClients();
+
+        bool IsClientConnected( int clientIndex ) const;
+
+        uint64_t GetClientId( int clientIndex ) const;
+
+        int GetNumConnectedClients() const { return m_numConnectedClients; }
+
+        void SendPackets( const int * clientIndex, uint8_t * const * packetData, const int * packetBytes, int numPackets );
+
+        int ReceivePackets( int clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets );
+
+        int ReceiveAllPackets( int * clientCapacity, int * clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets );
+
+        void FreePackets( uint8_t ** packetData, int numPackets );
+
+        const Address & GetAddress() const { return m_address; }
+
+    private:
+
+        friend class MemoryClientTransport;
+
+        /**
+            A packet in flight. Allocated with the transport allocator.
+         */
+
+        struct Packet
+        {
+            uint8_t * data;                                 ///< The packet data.
+            int bytes;                                      ///< The packet size in bytes.
+        };
+
+        /**
+            The state of a client slot.
+         */
+
+        enum SlotState
+        {
+            SLOT_FREE,                                      ///< Nobody in the slot.
+            SLOT_CONNECTING,                                ///< A client took the slot. The server sees it connect on the next Update.
+            SLOT_CONNECTED,                                 ///< Connected on both sides.
+            SLOT_DISCONNECTING                              ///< The client left. The server sees it disconnect on the next Update.
+        };
+
+        struct Slot
+        {
+            SlotState state;                                ///< The state of the slot.
+            uint64_t clientId;                              ///< The client id passed in by the client.
+            uint64_t sequence;                              ///< Bumped each time a client takes the slot, so clients can tell they have been disconnected.
+            Queue<Packet> * toServer;                       ///< Packets sent by the client.
+            Queue<Packet> * toClient;                       ///< Packets sent by the server.
+        };
+
+        int ConnectClient( uint64_t clientId, uint64_t & sequence );
+
+        void ClientDisconnected( int clientIndex, uint64_t sequence );
+
+        bool IsClientSlot( int clientIndex, uint64_t sequence, SlotState state ) const;
+
+        void QueuePacket( Queue<Packet> & queue, const uint8_t * packetData, int packetBytes );
+
+        int PopPackets( Queue<Packet> & queue, uint8_t ** packetData, int * packetBytes, int maxPackets );
+
+        void ClearPackets( Queue<Packet> & queue );
+
+        void FreeSlot( int clientIndex );
+
+        MemoryServerTransport( const MemoryServerTransport & other );
+
+        MemoryServerTransport & operator = ( const MemoryServerTransport & other );
+
+        Allocator * m_allocator;                            ///< Allocator passed in to the constructor.
+        Address m_address;                                  ///< Address passed in to the constructor.
+        int m_packetQueueSize;                              ///< Packets buffered in each direction per client.
+        int m_maxClients;                                   ///< Number of client slots. Zero unless started.
+        int m_numConnectedClients;                          ///< Number of slots in the connected state.
+        uint64_t m_sequence;                                ///< Next slot sequence.
+        Slot * m_slots;                                     ///< Client slots. NULL unless started.
+        ConnectDisconnectFunction m_connectDisconnectFunction;  ///< Passed in to Start.
+        void * m_connectDisconnectContext;                  ///< Passed in to Start.
+    };
+
+#if defined(__linux__)
+
+    /**
+        Server transport on plain UDP sockets. Sends and receives go through sendmmsg and recvmmsg, so a server tick moves many packets per system call.
+        Packets are not encrypted and connect tokens are ignored. A client takes a free slot with the first packet it sends from a new address, and is disconnected after a timeout without packets. Use it on trusted networks, or to measure socket overhead without netcode.io.
+        Linux only.
+     */
+
+    class UdpServerTransport : public ServerTransport
+    {
+    public:
+
+        /**
+            @param allocator The allocator used for packets and client slots.
+            @param address The address to bind to. Port zero binds to any free port, see GetAddress.
+            @param batchSize The most packets sent or received per system call. One sends and receives a packet per call, like a transport without batching.
+            @param timeout Disconnect a client after this many seconds without a packet from it.
+            @param packetQueueSize The number of received packets buffered for each client slot that can't take them yet. Further packets are dropped.
+         */
+
+        UdpServerTransport( Allocator & allocator, const Address & address, int batchSize = 64, double timeout = YOJIMBO_DEFAULT_TIMEOUT, int packetQueueSize = 256 );
+
+        ~UdpServerTransport();
+
+        bool Start( Allocator & allocator, int maxClients, ConnectDisconnectFunction function, void * context, double time );
+
+        void Stop();
+
+        void Update( double time );
+
+        void DisconnectClient( int clientIndex );
+
+        void DisconnectAllClients();
+
+        bool IsClientConnected( int clientIndex ) const;
+
+        uint64_t GetClientId( int clientIndex ) const;
+
+        int GetNumConnectedClients() const { return m_numConnectedClients; }
+
+        void SendPackets( const int * clientIndex, uint8_t * const * packetData, const int * packetBytes, int numPackets );
+
+        int ReceivePackets( int clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets );
+
+        int ReceiveAllPackets( int * clientCapacity, int * clientIndex, uint8_t ** packetData, int * packetBytes, int maxPackets );
+
+        void FreePackets( uint8_t ** packetData, int numPackets );
+
+        const Address & GetAddress() const { return m_boundAddress; }
+
+    private:
+
+        /**
+            A received packet waiting for its client slot. Allocated with the transport allocator.
+         */
+
+        struct Packet
+        {
+            uint8_t * data;                                 ///< The packet data.
+            int bytes;                                      ///< The packet size in bytes.
+        };
+
+        /**
+            The state of a client slot.
+         */
+
+        enum SlotState
+        {
+            SLOT_FREE,                                      ///< Nobody in the slot.
+            SLOT_CONNECTING,                                ///< A packet arrived from a new address. The server sees the client connect on the next Update.
+            SLOT_CONNECTED                                  ///< Connected.
+        };
+
+        struct Slot
+        {
+            SlotState state;                                ///< The state of the slot.
+            uint64_t clientId;                              ///< Hash of the client address.
+            int addressBytes;                               ///< Size of the client address (bytes).
+            double lastPacketReceiveTime;                   ///< Time the last packet arrived from the client.
+            Queue<Packet> * packets;                        ///< Received packets the server has not taken yet.
+        };
+
+        int ReadSocket( int maxPackets );
+
+        int FindClientSlot( int messageIndex );
+
+        void FreeSlot( int clientIndex );
+
+        UdpServerTransport( const UdpServerTransport & other );
+
+        UdpServerTransport & operator = ( const UdpServerTransport & other );
+
+        Allocator * m_allocator;                            ///< Allocator passed in to the constructor.
+        Address m_address;                                  ///< Address passed in to the constructor.
+        Address m_boundAddress;                             ///< Address after socket bind, eg. valid port.
+        int m_batchSize;                                    ///< Most packets per sendmmsg or recvmmsg call.
+        double m_timeout;                                   ///< Seconds without a packet before a client is disconnected.
+        int m_packetQueueSize;                              ///< Received packets buffered per client slot.
+        int m_socket;                                       ///< The UDP socket. -1 unless started.
+        double m_time;                                      ///< Time of the last update.
+        int m_maxClients;                                   ///< Number of client slots. Zero unless started.
+        int m_numConnectedClients;                          ///< Number of slots in the connected state.
+        Slot * m_slots;                                     ///< Client slots. NULL unless started.
+        struct sockaddr_storage * m_slotAddress;            ///< Address of the client in each slot. Packets for the slot are sent there.
+        struct mmsghdr * m_messages;                        ///< Message headers for sendmmsg and recvmmsg, batchSize entries.
+        struct iovec * m_iovecs;                            ///< The packet buffer of each message header.
+        struct sockaddr_storage * m_messageAddress;         ///< The address of each message header. Filled in with the sender on receive.
+        uint8_t ** m_receiveBuffers;                        ///< Buffers recvmmsg reads into, MaxUdpPacketBytes each. A buffer handed out with a packet is replaced on the next read.
+        ConnectDisconnectFunction m_connectDisconnectFunction;  ///< Passed in to Start.
+        void * m_connectDisconnectContext;                  ///< Passed in to Start.
+    };
+
+#endif // #if defined(__linux__)
+
     /**
         Dedicated server implementation.
      */
@@ -5313,8 +7465,29 @@ namespace yojimbo
     {
     public:
 
+        /**
+            Create a server on top of netcode.io.
+            @param allocator The allocator for all memory used by the server.
+            @param privateKey The private key used to generate connect tokens.
+            @param address The address the server binds to.
+            @param config The client/server configuration.
+            @param adapter The adapter to the game program.
+            @param time The current time in seconds.
+         */
+
         Server( Allocator & allocator, const uint8_t privateKey[], const Address & address, const ClientServerConfig & config, Adapter & adapter, double time );
 
+        /**
+            Create a server on top of another transport.
+            @param allocator The allocator for all memory used by the server.
+            @param transport The transport to send and receive packets with. Not owned by the server. Must outlive it.
+            @param config The client/server configuration.
+            @param adapter The adapter to the game program.
+            @param time The current time in seconds.
+         */
+
+        Server( Allocator & allocator, ServerTransport & transport, const ClientServerConfig & config, Adapter & adapter, double time );
+
         ~Server();
 
         void Start( int maxClients );
@@ -5345,27 +7518,25 @@ namespace yojimbo
 
         void ProcessLoopbackPacket( int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence );
 
-        const Address & GetAddress() const { return m_boundAddress; }
+        const Address & GetAddress() const { return m_transport->GetAddress(); }
 
     private:
 
         void TransmitPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes );
 
+        void TransmitPackets( const int * clientIndex, const uint16_t * packetSequence, uint8_t * const * packetData, const int * packetBytes, int numPackets );
+
         int ProcessPacketFunction( int clientIndex, uint16_t packetSequence, uint8_t * packetData, int packetBytes );
 
         void ConnectDisconnectCallbackFunction( int clientIndex, int connected );
 
-        void SendLoopbackPacketCallbackFunction( int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence );
-
         static void StaticConnectDisconnectCallbackFunction( void * context, int clientIndex, int connected );
 
-        static void StaticSendLoopbackPacketCallbackFunction( void * context, int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence );
-
         ClientServerConfig m_config;
-        netcode_server_t * m_server;
-        Address m_address;                                  // original address passed to ctor
-        Address m_boundAddress;                             // address after socket bind, eg. valid port
-        uint8_t m_privateKey[KeyBytes];
+        Allocator * m_allocator;                            ///< Allocator passed in to the constructor. Used for the transport if the server creates it.
+        ServerTransport * m_transport;                      ///< The transport packets are sent and received with.
+        bool m_ownsTransport;                               ///< True if the server created the transport, and destroys it.
+        bool m_transportStarted;                            ///< True between a successful ServerTransport::Start and ServerTransport::Stop.
     };
 
     /**
@@ -5534,6 +7705,44 @@ namespace yojimbo
 
         virtual void SendMessage( int channelIndex, Message * message ) = 0;
 
+        /**
+            Can we send a batch of messages on a channel?
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param numMessages The number of messages in the batch.
+            @returns True if all messages in the batch can be sent over the channel, false otherwise.
+         */
+
+        virtual bool CanSendMessages( int channelIndex, int numMessages ) const = 0;
+
+        /**
+            Get the send queue status of a channel.
+            Use this to throttle or reduce the detail of what you send before the channel send queue fills up.
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param status The channel status to be filled [out].
+         */
+
+        virtual void GetChannelStatus( int channelIndex, ChannelStatus & status ) const = 0;
+
+        /**
+            Set the block sink that streamed blocks received on a channel are written to.
+            Call this after starting to connect. Each connect starts with no block sink set.
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param blockSink The block sink. NULL to stop receiving streamed blocks.
+            @see BlockMessage::AttachBlockSource
+         */
+
+        virtual void SetBlockSink( int channelIndex, BlockSink * blockSink ) = 0;
+
+        /**
+            Send a batch of messages on a channel.
+            Cheaper than calling SendMessage for each message when sending many messages per-tick.
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param messages Array of messages to send.
+            @param numMessages The number of messages in the array.
+         */
+
+        virtual void SendMessages( int channelIndex, Message ** messages, int numMessages ) = 0;
+
         /**
             Receive a message from a channel.
             @param channelIndex The channel index in range [0,numChannels-1].
@@ -5542,6 +7751,16 @@ namespace yojimbo
 
         virtual Message * ReceiveMessage( int channelIndex ) = 0;
 
+        /**
+            Receive a batch of messages from a channel.
+            @param channelIndex The channel index in range [0,numChannels-1].
+            @param messages Array of message pointers to be filled [out]. Make sure to release each message by calling Client::ReleaseMessage.
+            @param maxMessages The size of the message array.
+            @returns The number of messages received.
+         */
+
+        virtual int ReceiveMessages( int channelIndex, Message ** messages, int maxMessages ) = 0;
+
         /**
             Release a message.
             Call this for messages received by Client::ReceiveMessage.
@@ -5618,15 +7837,15 @@ namespace yojimbo
 
         void AdvanceTime( double time );
 
-        bool IsConnecting() const { return m_clientState == CLIENT_STATE_CONNECTING; }
+        bool IsConnecting() const { return GetClientState() == CLIENT_STATE_CONNECTING; }
 
-        bool IsConnected() const { return m_clientState == CLIENT_STATE_CONNECTED; }
+        bool IsConnected() const { return GetClientState() == CLIENT_STATE_CONNECTED; }
 
-        bool IsDisconnected() const { return m_clientState <= CLIENT_STATE_DISCONNECTED; }
+        bool IsDisconnected() const { return GetClientState() <= CLIENT_STATE_DISCONNECTED; }
 
-        bool ConnectionFailed() const { return m_clientState == CLIENT_STATE_ERROR; }
+        bool ConnectionFailed() const { return GetClientState() == CLIENT_STATE_ERROR; }
 
-        ClientState GetClientState() const { return m_clientState; }
+        ClientState GetClientState() const { return (ClientState) yojimbo_atomic_load( &m_clientState ); }
 
         int GetClientIndex() const { return m_clientIndex; }
 
@@ -5652,8 +7871,24 @@ namespace yojimbo
 
         void SendMessage( int channelIndex, Message * message );
 
+        /**
+            Send a message to the server with a time to live and priority. See Connection::SendMessage.
+         */
+
+        void SendMessage( int channelIndex, Message * message, double timeToLive, int priority );
+
+        bool CanSendMessages( int channelIndex, int numMessages ) const;
+
+        void GetChannelStatus( int channelIndex, ChannelStatus & status ) const;
+
+        void SetBlockSink( int channelIndex, BlockSink * blockSink );
+
+        void SendMessages( int channelIndex, Message ** messages, int numMessages );
+
         Message * ReceiveMessage( int channelIndex );
 
+        int ReceiveMessages( int channelIndex, Message ** messages, int maxMessages );
+
         void ReleaseMessage( Message * message );
 
         void GetNetworkInfo( NetworkInfo & info ) const;
@@ -5682,6 +7917,33 @@ namespace yojimbo
 
         Connection & GetConnection() { yojimbo_assert( m_connection ); return *m_connection; }
 
+        /**
+            Start the network thread, if ClientServerConfig::networkThread is set.
+            Derived clients call this once they start connecting. From then on the network thread calls ReceivePackets, AdvanceTime and SendPackets at ClientServerConfig::networkTickRate, until the client disconnects.
+         */
+
+        void StartNetworkThread();
+
+        /**
+            Stop the network thread. Called by BaseClient::Disconnect. Does nothing if the network thread is not running.
+         */
+
+        void StopNetworkThread();
+
+        /**
+            Check if a call from outside should be left to the network thread.
+            @returns True if the network thread is running and the caller is not the network thread. In that case SendPackets, ReceivePackets and AdvanceTime should only call BaseClient::AdvanceTime, which picks up disconnects flagged by the network thread.
+         */
+
+        bool DeferToNetworkThread() const { return m_networkThread.IsRunning() && !m_networkThread.IsCurrentThread(); }
+
+        /**
+            Check if the calling thread is the network thread.
+            On the network thread, a disconnect should only be flagged with SetClientState. The client is torn down by the next call to AdvanceTime outside the network thread.
+         */
+
+        bool IsNetworkThread() const { return m_networkThread.IsCurrentThread(); }
+
         virtual void TransmitPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes ) = 0;
 
         virtual int ProcessPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes ) = 0;
@@ -5696,6 +7958,17 @@ namespace yojimbo
 
     private:
 
+        /**
+            Check if public calls go through the message queues.
+            @returns True if ClientServerConfig::networkThread is set and the caller is not the network thread.
+         */
+
+        bool UseMessageQueues() const { return m_messageQueues && !m_networkThread.IsCurrentThread(); }
+
+        void NetworkThreadTick( double time );
+
+        static void StaticNetworkThreadTick( void * context, double time );
+
         ClientServerConfig m_config;                                        ///< The client/server configuration.
         Allocator * m_allocator;                                            ///< The allocator passed to the client on creation.
         Adapter * m_adapter;                                                ///< The adapter specifies the allocator to use, and the message factory class.
@@ -5706,10 +7979,14 @@ namespace yojimbo
         MessageFactory * m_messageFactory;                                  ///< The client message factory. Created and destroyed on each connection attempt.
         Connection * m_connection;                                          ///< The client connection for exchanging messages with the server.
         NetworkSimulator * m_networkSimulator;                              ///< The network simulator used to simulate packet loss, latency, jitter etc. Optional. 
-        ClientState m_clientState;                                          ///< The current client state. See ClientInterface::GetClientState
+        volatile int m_clientState;                                         ///< The current client state. See ClientInterface::GetClientState. Written by the network thread when ClientServerConfig::networkThread is set.
         int m_clientIndex;                                                  ///< The client slot index on the server [0,maxClients-1]. -1 if not connected.
         double m_time;                                                      ///< The current client time. See ClientInterface::AdvanceTime
         uint8_t * m_packetBuffer;                                           ///< Buffer used to read and write packets.
+        NetworkThread m_networkThread;                                      ///< Ticks the client in the background when ClientServerConfig::networkThread is set.
+        mutable Mutex m_lock;                                               ///< Held by the network thread for each tick, and outside it while touching the connection, message factory or client allocator.
+        MessageQueues * m_messageQueues;                                    ///< Message queues between the network thread and the thread that owns the client. NULL unless ClientServerConfig::networkThread is set.
+        volatile int m_disconnectRequested;                                 ///< Set outside the network thread when a send queue overflows. The network thread then disconnects the client.
 
     private:
 
@@ -5718,6 +7995,206 @@ namespace yojimbo
         const BaseClient & operator = ( const BaseClient & other );
     };
 
+    /**
+        The datagram layer under a Client.
+        The client hands it packets to send to the server and asks it for packets received from the server. The transport owns the connection state.
+        NetcodeClientTransport is the default. Implement this interface to run a client over something else, like MemoryClientTransport.
+     */
+
+    class ClientTransport
+    {
+    public:
+
+        virtual ~ClientTransport() {}
+
+        /**
+            Start connecting to a server.
+            @param allocator Allocator for the transport's memory while connected. Stays valid until Disconnect.
+            @param clientId The globally unique client id.
+            @param connectToken The connect token. Transports that don't need one ignore it.
+            @param time The current time in seconds.
+            @returns True if the transport started connecting. GetState reports how it goes from there.
+         */
+
+        virtual bool Connect( Allocator & allocator, uint64_t clientId, uint8_t * connectToken, double time ) = 0;
+
+        /**
+            Disconnect and free everything allocated since Connect. Does nothing if not connected.
+         */
+
+        virtual void Disconnect() = 0;
+
+        /**
+            Update the transport. This is where the connection is made, times out and so on.
+            @param time The current time in seconds.
+         */
+
+        virtual void Update( double time ) = 0;
+
+        /**
+            Get the connection state. The client disconnects when this goes to CLIENT_STATE_DISCONNECTED or CLIENT_STATE_ERROR.
+         */
+
+        virtual ClientState GetState() const = 0;
+
+        virtual int GetClientIndex() const = 0;
+
+        /**
+            Send a batch of packets to the server.
+            @param packetData Array of packets. The caller keeps ownership.
+            @param packetBytes Array of packet sizes in bytes.
+            @param numPackets The number of packets to send.
+         */
+
+        virtual void SendPackets( uint8_t * const * packetData, const int * packetBytes, int numPackets ) = 0;
+
+        /**
+            Receive a batch of packets from the server.
+            @param packetData Array of packet pointers to fill [out]. Pass them to FreePackets when done.
+            @param packetBytes Array of packet sizes to fill [out].
+            @param maxPackets The size of the arrays.
+            @returns The number of packets received. Less than maxPackets means there are no more packets right now.
+         */
+
+        virtual int ReceivePackets( uint8_t ** packetData, int * packetBytes, int maxPackets ) = 0;
+
+        /**
+            Free packets returned by ReceivePackets.
+         */
+
+        virtual void FreePackets( uint8_t ** packetData, int numPackets ) = 0;
+
+        /**
+            Get the address the transport is bound to.
+         */
+
+        virtual const Address & GetAddress() const = 0;
+
+        /**
+            Connect as a loopback client. Optional. Only transports that support loopback override this, and the loopback functions below.
+         */
+
+        virtual bool ConnectLoopback( Allocator & allocator, int clientIndex, int maxClients, double time ) { (void) allocator; (void) clientIndex; (void) maxClients; (void) time; yojimbo_assert( false ); return false; }
+
+        virtual bool IsLoopback() const { return false; }
+
+        virtual void DisconnectLoopback() { yojimbo_assert( false ); }
+
+        virtual void ProcessLoopbackPacket( const uint8_t * packetData, int packetBytes, uint64_t packetSequence ) { (void) packetData; (void) packetBytes; (void) packetSequence; yojimbo_assert( false ); }
+    };
+
+    /**
+        Client transport on top of netcode.io. Secure UDP connection using a connect token.
+     */
+
+    class NetcodeClientTransport : public ClientTransport
+    {
+    public:
+
+        /**
+            @param address The address the client binds to.
+            @param adapter The adapter. Loopback packets are sent through Adapter::ClientSendLoopbackPacket.
+         */
+
+        NetcodeClientTransport( const Address & address, Adapter & adapter );
+
+        ~NetcodeClientTransport();
+
+        bool Connect( Allocator & allocator, uint64_t clientId, uint8_t * connectToken, double time );
+
+        void Disconnect();
+
+        void Update( double time );
+
+        ClientState GetState() const;
+
+        int GetClientIndex() const;
+
+        void SendPackets( uint8_t * const * packetData, const int * packetBytes, int numPackets );
+
+        int ReceivePackets( uint8_t ** packetData, int * packetBytes, int maxPackets );
+
+        void FreePackets( uint8_t ** packetData, int numPackets );
+
+        const Address & GetAddress() const { return m_boundAddress; }
+
+        bool ConnectLoopback( Allocator & allocator, int clientIndex, int maxClients, double time );
+
+        bool IsLoopback() const;
+
+        void DisconnectLoopback();
+
+        void ProcessLoopbackPacket( const uint8_t * packetData, int packetBytes, uint64_t packetSequence );
+
+    private:
+
+        NetcodeClientTransport( const NetcodeClientTransport & other );
+
+        NetcodeClientTransport & operator = ( const NetcodeClientTransport & other );
+
+        bool CreateClient( Allocator & allocator, double time );
+
+        void DestroyClient();
+
+        static void StaticSendLoopbackPacketCallbackFunction( void * context, int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence );
+
+        static void * StaticAllocateFunction( void * context, uint64_t bytes );
+
+        static void StaticFreeFunction( void * context, void * pointer );
+
+        Adapter * m_adapter;                            ///< Loopback packets are sent through the adapter.
+        netcode_client_t * m_client;                    ///< netcode.io client. NULL unless connected.
+        Address m_address;                              ///< Original address passed to ctor.
+        Address m_boundAddress;                         ///< Address after socket bind, eg. with valid port
+    };
+
+    /**
+        Client transport that connects to a MemoryServerTransport in the same process.
+        Not thread safe. Must be updated from the same thread as the server transport.
+     */
+
+    class MemoryClientTransport : public ClientTransport
+    {
+    public:
+
+        /**
+            @param server The server transport to connect to. Must outlive this transport.
+         */
+
+        explicit MemoryClientTransport( MemoryServerTransport & server );
+
+        ~MemoryClientTransport();
+
+        bool Connect( Allocator & allocator, uint64_t clientId, uint8_t * connectToken, double time );
+
+        void Disconnect();
+
+        void Update( double time ) { (void) time; }
+
+        ClientState GetState() const;
+
+        int GetClientIndex() const { return m_clientIndex; }
+
+        void SendPackets( uint8_t * const * packetData, const int * packetBytes, int numPackets );
+
+        int ReceivePackets( uint8_t ** packetData, int * packetBytes, int maxPackets );
+
+        void FreePackets( uint8_t ** packetData, int numPackets );
+
+        const Address & GetAddress() const { return m_address; }
+
+    private:
+
+        MemoryClientTransport( const MemoryClientTransport & other );
+
+        MemoryClientTransport & operator = ( const MemoryClientTransport & other );
+
+        MemoryServerTransport * m_server;               ///< The server transport passed in to the constructor.
+        Address m_address;                              ///< Always an invalid address. Nothing is bound.
+        int m_clientIndex;                              ///< The server slot taken on connect. -1 if not connected.
+        uint64_t m_sequence;                            ///< The sequence of the server slot taken on connect.
+    };
+
     /**
         Implementation of client for dedicated servers.
      */
@@ -5736,6 +8213,16 @@ namespace yojimbo
 
         explicit Client( Allocator & allocator, const Address & address, const ClientServerConfig & config, Adapter & adapter, double time );
 
+        /**
+            Create a client on top of another transport.
+            @param allocator The allocator for all memory used by the client.
+            @param transport The transport to send and receive packets with. Not owned by the client. Must outlive it.
+            @param config The client/server configuration.
+            @param time The current time in seconds. See ClientInterface::AdvanceTime
+         */
+
+        Client( Allocator & allocator, ClientTransport & transport, const ClientServerConfig & config, Adapter & adapter, double time );
+
         ~Client();
 
         void InsecureConnect( const uint8_t privateKey[], uint64_t clientId, const Address & address );
@@ -5764,7 +8251,7 @@ namespace yojimbo
 
         void ProcessLoopbackPacket( const uint8_t * packetData, int packetBytes, uint64_t packetSequence );
 
-        const Address & GetAddress() const { return m_boundAddress; }
+        const Address & GetAddress() const { return m_transport->GetAddress(); }
 
     private:
 
@@ -5774,26 +8261,17 @@ namespace yojimbo
                                            const Address serverAddresses[], 
                                            int numServerAddresses );
 
-        void CreateClient( const Address & address );
-
-        void DestroyClient();
-
-        void StateChangeCallbackFunction( int previous, int current );
-
-        static void StaticStateChangeCallbackFunction( void * context, int previous, int current );
+        void DisconnectTransport();
 
         void TransmitPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes );
 
         int ProcessPacketFunction( uint16_t packetSequence, uint8_t * packetData, int packetBytes );
 
-        void SendLoopbackPacketCallbackFunction( int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence );
-
-        static void StaticSendLoopbackPacketCallbackFunction( void * context, int clientIndex, const uint8_t * packetData, int packetBytes, uint64_t packetSequence );
-
         ClientServerConfig m_config;                    ///< Client/server configuration.
-        netcode_client_t * m_client;                    ///< netcode.io client data.
-        Address m_address;                              ///< Original address passed to ctor.
-        Address m_boundAddress;                         ///< Address after socket bind, eg. with valid port
+        Allocator * m_allocator;                        ///< Allocator passed in to the constructor. Used for the transport if the client creates it.
+        ClientTransport * m_transport;                  ///< The transport packets are sent and received with.
+        bool m_ownsTransport;                           ///< True if the client created the transport and must destroy it.
+        bool m_transportConnected;                      ///< True between a successful connect on the transport and the next disconnect.
         uint64_t m_clientId;                            ///< The globally unique client id (set on each call to connect)
     };
 